@@ -0,0 +1,548 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark suite of FlatUI.
+// Covers the glyph cache, FontManager::GetBuffer(), each specialized layout
+// loop and full GUI frames.
+//
+// Usage: flatui_benchmarks [--filter <substring>] [--font <file>]
+//                          [--arabic_font <file>]
+//
+// Each result is printed as a line of JSON, e.g.
+//   {"name": "get_buffer/latin/warm", "ops": 1200, "ns_per_op": 812.4}
+// so that the output can be compared across runs with a script. Log output of
+// FlatUI and FPLBase goes to stderr or the system log, not to stdout.
+//
+// The frame benchmarks need a GL context, so the suite opens a small window.
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "flatui/flatui.h"
+#include "flatui/internal/glyph_cache.h"
+#include "fplbase/input.h"
+#include "fplbase/renderer.h"
+#include "fplbase/utilities.h"
+
+using flatui::FontBuffer;
+using flatui::FontBufferParameters;
+using flatui::FontManager;
+using flatui::GlyphCache;
+using flatui::GlyphCacheEntry;
+using flatui::GlyphKey;
+using mathfu::vec2;
+using mathfu::vec2i;
+
+namespace {
+
+// Default font shipped in assets/ that covers Latin and CJK.
+const char *kDefaultFont = "fonts/NotoSansCJKjp-Bold.otf";
+
+// # of iterations of each case. The fastest iteration is reported.
+const int32_t kNumIterations = 10;
+
+// Size of the window used for frame benchmarks.
+const vec2i kWindowSize(800, 600);
+
+// Glyph cache parameters similar to FontManager's default.
+const int32_t kCacheSize = 1024;
+const int32_t kCacheMaxPages = 4;
+
+// # of distinct code points and lookups of the Zipf glyph cache workload.
+const int32_t kNumZipfGlyphs = 8000;
+const int32_t kNumZipfLookups = 200000;
+
+// # of lookups between glyph cache cycle updates, similar to a frame.
+const int32_t kLookupsPerCycle = 2000;
+
+// Strings laid out in the GetBuffer() cases.
+const char *kLatinStrings[] = {"The quick brown fox jumps over the lazy dog.",
+                               "Settings",
+                               "Cancel",
+                               "Download complete",
+                               "Pack my box with five dozen liquor jugs.",
+                               "0123456789 !?%&()[]"};
+const char *kCjkStrings[] = {
+    // "吾輩は猫である。"
+    "\xe5\x90\xbe\xe8\xbc\xa9\xe3\x81\xaf\xe7\x8c\xab\xe3\x81\xa7"
+    "\xe3\x81\x82\xe3\x82\x8b\xe3\x80\x82",
+    // "設定"
+    "\xe8\xa8\xad\xe5\xae\x9a",
+    // "キャンセル"
+    "\xe3\x82\xad\xe3\x83\xa3\xe3\x83\xb3\xe3\x82\xbb\xe3\x83\xab",
+    // "ダウンロード完了"
+    "\xe3\x83\x80\xe3\x82\xa6\xe3\x83\xb3\xe3\x83\xad\xe3\x83\xbc"
+    "\xe3\x83\x89\xe5\xae\x8c\xe4\xba\x86",
+    // "日本語の文章"
+    "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae\xe6\x96\x87"
+    "\xe7\xab\xa0",
+    // "中文测试"
+    "\xe4\xb8\xad\xe6\x96\x87\xe6\xb5\x8b\xe8\xaf\x95"};
+const char *kArabicStrings[] = {
+    // "مرحبا بالعالم"
+    "\xd9\x85\xd8\xb1\xd8\xad\xd8\xa8\xd8\xa7 \xd8\xa8\xd8\xa7\xd9\x84"
+    "\xd8\xb9\xd8\xa7\xd9\x84\xd9\x85",
+    // "السلام عليكم"
+    "\xd8\xa7\xd9\x84\xd8\xb3\xd9\x84\xd8\xa7\xd9\x85 \xd8\xb9\xd9\x84"
+    "\xd9\x8a\xd9\x83\xd9\x85",
+    // "إعدادات"
+    "\xd8\xa5\xd8\xb9\xd8\xaf\xd8\xa7\xd8\xaf\xd8\xa7\xd8\xaa",
+    // "إلغاء"
+    "\xd8\xa5\xd9\x84\xd8\xba\xd8\xa7\xd8\xa1",
+    // "اكتمل التنزيل"
+    "\xd8\xa7\xd9\x83\xd8\xaa\xd9\x85\xd9\x84 \xd8\xa7\xd9\x84\xd8\xaa"
+    "\xd9\x86\xd8\xb2\xd9\x8a\xd9\x84"};
+
+// A paragraph laid out with line breaks.
+const char *kParagraph =
+    "FlatUI is an immediate mode C++ GUI library for games and graphical "
+    "applications. Its aim is to provide a simple and efficient way to write "
+    "GUIs, with minimal setup and no clutter. Layout is computed in a first "
+    "pass over the GUI definition, and rendering and event handling happen "
+    "in a second pass, so that the application doesn't need to keep any "
+    "widget objects around between frames.";
+
+// Font sizes used in the GetBuffer() cases.
+const float kFontSizes[] = {16.0f, 24.0f, 32.0f};
+
+// Options given on the command line.
+struct Options {
+  Options() : filter(""), font(kDefaultFont), arabic_font(nullptr) {}
+  const char *filter;
+  const char *font;
+  const char *arabic_font;
+};
+
+Options g_options;
+
+// Returns true if the benchmark is selected with --filter.
+bool Selected(const char *name) {
+  return strstr(name, g_options.filter) != nullptr;
+}
+
+// Print a result as a line of JSON.
+void Report(const char *name, const int32_t ops, const double ns_per_op) {
+  printf("{\"name\": \"%s\", \"ops\": %d, \"ns_per_op\": %.1f}\n", name, ops,
+         ns_per_op);
+  fflush(stdout);
+}
+
+// Measure a function and return the fastest iteration in ns/op.
+// setup is invoked before every iteration and isn't measured.
+template <typename S, typename F>
+double Measure(const int32_t ops, S setup, F func) {
+  double best = 0.0;
+  for (int32_t i = 0; i < kNumIterations; ++i) {
+    setup();
+    auto start = std::chrono::high_resolution_clock::now();
+    func();
+    auto end = std::chrono::high_resolution_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    if (i == 0 || ns < best) best = ns;
+  }
+  return best / ops;
+}
+
+template <typename F>
+double Measure(const int32_t ops, F func) {
+  return Measure(ops, []() {}, func);
+}
+
+// Volatile sink to keep results from being optimized out.
+volatile uintptr_t g_sink;
+
+// GlyphCache::Find()/Set() with Zipf distributed code points and sizes, as in
+// a text heavy UI where a few glyphs dominate.
+void BenchmarkGlyphCache() {
+  const char *kName = "glyph_cache/zipf_find_set";
+  if (!Selected(kName)) return;
+
+  const uint32_t kGlyphSizes[] = {16, 24, 32, 48};
+  std::vector<double> weights;
+  for (int32_t i = 0; i < kNumZipfGlyphs; ++i) {
+    weights.push_back(1.0 / (i + 1));
+  }
+  std::mt19937 rng(1);
+  std::discrete_distribution<int32_t> zipf(weights.begin(), weights.end());
+  std::discrete_distribution<int32_t> sizes({8, 4, 2, 1});
+  std::vector<GlyphKey> keys;
+  std::vector<vec2i> glyph_sizes;
+  for (int32_t i = 0; i < kNumZipfLookups; ++i) {
+    auto glyph_size = kGlyphSizes[sizes(rng)];
+    keys.push_back(GlyphKey(0x1234abcd, 0x20 + zipf(rng), glyph_size));
+    glyph_sizes.push_back(vec2i(glyph_size * 3 / 4, glyph_size));
+  }
+  std::vector<uint8_t> image(64 * 64, 0x80);
+
+  std::unique_ptr<GlyphCache<uint8_t>> cache;
+  auto ns = Measure(
+      kNumZipfLookups,
+      [&]() {
+        cache.reset(new GlyphCache<uint8_t>(vec2i(kCacheSize, kCacheSize),
+                                            kCacheMaxPages));
+      },
+      [&]() {
+        uintptr_t sum = 0;
+        for (int32_t i = 0; i < kNumZipfLookups; ++i) {
+          auto entry = cache->Find(keys[i]);
+          if (entry == nullptr) {
+            GlyphCacheEntry new_entry;
+            new_entry.set_code_point(keys[i].get_code_point());
+            new_entry.set_size(glyph_sizes[i]);
+            entry = cache->Set(image.data(), keys[i], new_entry);
+          }
+          sum += reinterpret_cast<uintptr_t>(entry);
+          if (i % kLookupsPerCycle == 0) cache->Update();
+        }
+        g_sink = sum;
+      });
+  Report(kName, kNumZipfLookups, ns);
+}
+
+// Set of strings of a script laid out in the GetBuffer() cases.
+struct Script {
+  const char *name;
+  const char *locale;
+  const char *const *strings;
+  int32_t num_strings;
+  const char *font;
+};
+
+// Open a FontManager with the font and the locale of a script.
+void OpenFont(const Script &script, FontManager *fontman) {
+  auto result = fontman->Open(script.font);
+  assert(result);
+  (void)result;
+  fontman->SelectFont(script.font);
+  fontman->SetLocale(script.locale);
+}
+
+// Lay out all strings of a script in all sizes.
+void GetBuffers(const Script &script, FontManager *fontman) {
+  auto font_id = fontman->GetCurrentFace()->font_id_;
+  uintptr_t sum = 0;
+  for (size_t size = 0; size < sizeof(kFontSizes) / sizeof(kFontSizes[0]);
+       ++size) {
+    for (int32_t i = 0; i < script.num_strings; ++i) {
+      auto text = script.strings[i];
+      FontBufferParameters parameters(font_id, flatui::HashId(text),
+                                      kFontSizes[size], mathfu::kZeros2i,
+                                      false);
+      sum += reinterpret_cast<uintptr_t>(
+          fontman->GetBuffer(text, strlen(text), parameters));
+    }
+  }
+  g_sink = sum;
+}
+
+// GetBuffer() with all caches cold (a new FontManager per iteration), and
+// warm (all buffers cached).
+void BenchmarkGetBuffer(const Script &script) {
+  auto ops = script.num_strings *
+             static_cast<int32_t>(sizeof(kFontSizes) / sizeof(kFontSizes[0]));
+  std::string cold = std::string("get_buffer/") + script.name + "/cold";
+  if (Selected(cold.c_str())) {
+    std::unique_ptr<FontManager> fontman;
+    auto ns = Measure(
+        ops,
+        [&]() {
+          fontman.reset(new FontManager());
+          OpenFont(script, fontman.get());
+          fontman->StartLayoutPass();
+        },
+        [&]() { GetBuffers(script, fontman.get()); });
+    Report(cold.c_str(), ops, ns);
+  }
+
+  std::string warm = std::string("get_buffer/") + script.name + "/warm";
+  if (Selected(warm.c_str())) {
+    FontManager fontman;
+    OpenFont(script, &fontman);
+    fontman.StartLayoutPass();
+    GetBuffers(script, &fontman);
+    auto ns = Measure(ops, [&]() {
+      fontman.StartLayoutPass();
+      GetBuffers(script, &fontman);
+    });
+    Report(warm.c_str(), ops, ns);
+  }
+}
+
+// Multi line layout of a paragraph. Glyphs are cached, but the buffer is laid
+// out again with a different width in each call.
+void BenchmarkWrapping() {
+  const char *kName = "get_buffer/latin/wrap";
+  if (!Selected(kName)) return;
+  const int32_t kNumWidths = 64;
+
+  FontManager fontman;
+  auto result = fontman.Open(g_options.font);
+  assert(result);
+  (void)result;
+  auto font_id = fontman.GetCurrentFace()->font_id_;
+  auto text_id = flatui::HashId(kParagraph);
+  auto length = strlen(kParagraph);
+  int32_t iteration = 0;
+  auto ns = Measure(
+      kNumWidths,
+      [&]() {
+        // Drop buffers of the previous iteration so that they are laid out
+        // again.
+        fontman.FlushLayout();
+        fontman.StartLayoutPass();
+        iteration++;
+      },
+      [&]() {
+        uintptr_t sum = 0;
+        for (int32_t i = 0; i < kNumWidths; ++i) {
+          FontBufferParameters parameters(font_id, text_id, 24.0f,
+                                          vec2i(200 + i * 8, 0), false);
+          sum += reinterpret_cast<uintptr_t>(
+              fontman.GetBuffer(kParagraph, length, parameters));
+        }
+        g_sink = sum + iteration;
+      });
+  Report(kName, kNumWidths, ns);
+}
+
+// Multi line layout of a long article with each text layout strategy. The
+// shaping cache is disabled, so that every layout shapes the text again.
+void BenchmarkArticle() {
+  const int32_t kNumParagraphs = 20;
+  const struct {
+    const char *name;
+    flatui::TextLayoutStrategy strategy;
+  } kStrategies[] = {
+      {"get_buffer/latin/article_words", flatui::TextLayoutStrategyWord},
+      {"get_buffer/latin/article_paragraphs",
+       flatui::TextLayoutStrategyParagraph}};
+
+  std::string article;
+  for (int32_t i = 0; i < kNumParagraphs; ++i) {
+    article += kParagraph;
+    article += "\n";
+  }
+  for (size_t i = 0; i < sizeof(kStrategies) / sizeof(kStrategies[0]); ++i) {
+    auto name = kStrategies[i].name;
+    if (!Selected(name)) continue;
+
+    FontManager fontman;
+    auto result = fontman.Open(g_options.font);
+    assert(result);
+    (void)result;
+    fontman.SetShapingCacheSize(0);
+    fontman.SetLayoutStrategy(kStrategies[i].strategy);
+    FontBufferParameters parameters(fontman.GetCurrentFace()->font_id_,
+                                    flatui::HashId(article.c_str()), 24.0f,
+                                    vec2i(400, 0), false);
+    auto ns = Measure(
+        1,
+        [&]() {
+          fontman.FlushLayout();
+          fontman.StartLayoutPass();
+        },
+        [&]() {
+          g_sink = reinterpret_cast<uintptr_t>(
+              fontman.GetBuffer(article.c_str(), article.length(), parameters));
+        });
+    Report(name, 1, ns);
+  }
+}
+
+// Layout of cached glyphs with each specialized variant of the layout loop.
+// The buffers are laid out again in every iteration.
+void BenchmarkLayoutVariants() {
+  const float kFontSize = 24.0f;
+  const int32_t kNumLayouts = 64;
+  const struct {
+    const char *name;
+    flatui::TextLayoutDirection direction;
+    const char *text;
+    vec2i size;
+    bool caret_info;
+  } kVariants[] = {
+      {"layout/ltr/single_line", flatui::TextLayoutDirectionLTR,
+       kLatinStrings[0], vec2i(0, 24), false},
+      {"layout/rtl/single_line", flatui::TextLayoutDirectionRTL,
+       kLatinStrings[0], vec2i(0, 24), false},
+      {"layout/ltr/multi_line", flatui::TextLayoutDirectionLTR, kParagraph,
+       vec2i(400, 0), false},
+      {"layout/rtl/multi_line", flatui::TextLayoutDirectionRTL, kParagraph,
+       vec2i(400, 0), false},
+      {"layout/ltr/multi_line_caret", flatui::TextLayoutDirectionLTR,
+       kParagraph, vec2i(400, 0), true}};
+
+  for (size_t i = 0; i < sizeof(kVariants) / sizeof(kVariants[0]); ++i) {
+    auto &variant = kVariants[i];
+    if (!Selected(variant.name)) continue;
+
+    FontManager fontman;
+    auto result = fontman.Open(g_options.font);
+    assert(result);
+    (void)result;
+    fontman.SetLayoutDirection(variant.direction);
+    auto font_id = fontman.GetCurrentFace()->font_id_;
+    auto text_id = flatui::HashId(variant.text);
+    auto length = strlen(variant.text);
+    auto layout = [&]() {
+      uintptr_t sum = 0;
+      for (int32_t j = 0; j < kNumLayouts; ++j) {
+        // Vary the text id so that each layout creates a new buffer.
+        FontBufferParameters parameters(
+            font_id, text_id + static_cast<flatui::HashedId>(j), kFontSize,
+            variant.size, variant.caret_info);
+        sum += reinterpret_cast<uintptr_t>(
+            fontman.GetBuffer(variant.text, length, parameters));
+      }
+      g_sink = sum;
+    };
+
+    // Warm up the glyph cache.
+    fontman.StartLayoutPass();
+    layout();
+    auto ns = Measure(kNumLayouts,
+                      [&]() {
+                        fontman.FlushLayout();
+                        fontman.StartLayoutPass();
+                      },
+                      layout);
+    Report(variant.name, kNumLayouts, ns);
+  }
+}
+
+// Labels of a synthetic UI, kept across frames.
+std::vector<std::string> g_labels;
+
+// A synthetic UI with num_elements labels in rows of a scroll group.
+void SyntheticUI(const int32_t num_elements, vec2 *scroll_offset) {
+  const int32_t kElementsPerRow = 5;
+  flatui::StartGroup(flatui::kLayoutVerticalLeft, 4, "root");
+  flatui::PositionGroup(flatui::kAlignCenter, flatui::kAlignTop,
+                        mathfu::kZeros2f);
+  flatui::ColorBackground(mathfu::vec4(0.2f, 0.2f, 0.2f, 1.0f));
+  flatui::StartScroll(vec2(800, 600), scroll_offset);
+  for (int32_t row = 0; row < num_elements / kElementsPerRow; ++row) {
+    flatui::StartGroup(flatui::kLayoutHorizontalTop, 8,
+                       g_labels[row * kElementsPerRow].c_str());
+    for (int32_t i = 0; i < kElementsPerRow; ++i) {
+      flatui::Label(g_labels[row * kElementsPerRow + i].c_str(), 20);
+    }
+    flatui::EndGroup();
+  }
+  flatui::EndScroll();
+  flatui::EndGroup();
+}
+
+// flatui::Run() of a synthetic UI with num_elements labels. Only the CPU time
+// of Run() is measured; the frame isn't presented.
+void BenchmarkRun(fplbase::AssetManager &assetman, FontManager &fontman,
+                  fplbase::InputSystem &input, const int32_t num_elements) {
+  char name[64];
+  snprintf(name, sizeof(name), "run/%d_elements", num_elements);
+  if (!Selected(name)) return;
+  const int32_t kFramesPerIteration = 20;
+
+  g_labels.clear();
+  for (int32_t i = 0; i < num_elements; ++i) {
+    g_labels.push_back("Item " + std::to_string(i));
+  }
+  vec2 scroll_offset = mathfu::kZeros2f;
+  auto frame = [&]() {
+    flatui::Run(assetman, fontman, input,
+                [&]() { SyntheticUI(num_elements, &scroll_offset); });
+  };
+
+  // Warm up the caches.
+  frame();
+  auto ns = Measure(kFramesPerIteration, [&]() {
+    for (int32_t i = 0; i < kFramesPerIteration; ++i) frame();
+  });
+  Report(name, kFramesPerIteration, ns);
+}
+
+bool ParseOptions(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 < argc && !strcmp(argv[i], "--filter")) {
+      g_options.filter = argv[++i];
+    } else if (i + 1 < argc && !strcmp(argv[i], "--font")) {
+      g_options.font = argv[++i];
+    } else if (i + 1 < argc && !strcmp(argv[i], "--arabic_font")) {
+      g_options.arabic_font = argv[++i];
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--filter <substring>] [--font <file>] "
+              "[--arabic_font <file>]\n",
+              argv[0]);
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+extern "C" int FPL_main(int argc, char **argv) {
+  if (!ParseOptions(argc, argv)) return 1;
+
+  // Set the local directory to the assets, so that fonts and shaders are
+  // found.
+  bool result = fplbase::ChangeToUpstreamDir(argv[0], "benchmarks/assets");
+  assert(result);
+  (void)result;
+
+  fplbase::Renderer renderer;
+  fplbase::InputSystem input;
+  fplbase::AssetManager assetman(renderer);
+  renderer.Initialize(kWindowSize, "FlatUI benchmarks");
+  input.Initialize();
+
+  BenchmarkGlyphCache();
+
+  // The default font has no Arabic glyphs. Without --arabic_font, the Arabic
+  // case still runs the RTL layout path but renders missing glyphs.
+  auto arabic_font =
+      g_options.arabic_font != nullptr ? g_options.arabic_font : g_options.font;
+  const Script kScripts[] = {
+      {"latin", "en", kLatinStrings,
+       sizeof(kLatinStrings) / sizeof(kLatinStrings[0]), g_options.font},
+      {"cjk", "ja", kCjkStrings, sizeof(kCjkStrings) / sizeof(kCjkStrings[0]),
+       g_options.font},
+      {"arabic", "ar", kArabicStrings,
+       sizeof(kArabicStrings) / sizeof(kArabicStrings[0]), arabic_font}};
+  for (size_t i = 0; i < sizeof(kScripts) / sizeof(kScripts[0]); ++i) {
+    BenchmarkGetBuffer(kScripts[i]);
+  }
+  BenchmarkWrapping();
+  BenchmarkArticle();
+  BenchmarkLayoutVariants();
+
+  FontManager fontman;
+  fontman.Open(g_options.font);
+  fontman.SetRenderer(renderer);
+  const int32_t kNumElements[] = {10, 100, 1000};
+  for (size_t i = 0; i < sizeof(kNumElements) / sizeof(kNumElements[0]); ++i) {
+    input.AdvanceFrame(&renderer.window_size());
+    BenchmarkRun(assetman, fontman, input, kNumElements[i]);
+  }
+  flatui::ReleaseGuiContext(flatui::GetCurrentGuiContext());
+  return 0;
+}
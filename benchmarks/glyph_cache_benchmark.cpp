@@ -0,0 +1,376 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmark of GlyphCache against the node based implementation it
+// replaced (legacy_glyph_cache.h).
+// Each case runs the same sequence of keys on both implementations and prints
+// nanoseconds per operation.
+// Before timing, the same Set/Find/Flush/eviction sequence is run through both
+// implementations and the results are compared. The benchmark fails if they
+// differ, or if keys out of the range of GlyphKey are not rejected.
+
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "flatui/internal/glyph_cache.h"
+#include "legacy_glyph_cache.h"
+
+namespace {
+
+// Cache parameters similar to FontManager's default.
+const int32_t kCacheSize = 1024;
+const int32_t kCacheMaxPages = 4;
+
+// # of distinct glyphs in the working set. Small enough to fit in the cache
+// so that lookups after the warm up always hit.
+const int32_t kNumGlyphs = 2000;
+
+// # of lookups per iteration in the hit case.
+const int32_t kNumLookups = 200000;
+
+// # of iterations of each case. The fastest iteration is reported.
+const int32_t kNumIterations = 10;
+
+// A glyph in the benchmark workload.
+struct Glyph {
+  uint32_t font_id;
+  uint32_t code_point;
+  uint32_t glyph_size;
+  mathfu::vec2i size;
+};
+
+// Build glyphs with a few fonts and sizes like a label heavy UI.
+std::vector<Glyph> BuildGlyphs(const int32_t count, const uint32_t seed) {
+  const uint32_t kFontIds[] = {0x1234abcd, 0x5678ef01, 0x9abc2345};
+  const uint32_t kGlyphSizes[] = {16, 24, 32, 48};
+  std::mt19937 rng(seed);
+  std::vector<Glyph> glyphs;
+  for (int32_t i = 0; i < count; ++i) {
+    Glyph g;
+    g.font_id = kFontIds[rng() % 3];
+    g.glyph_size = kGlyphSizes[rng() % 4];
+    g.code_point = rng() % 20000;
+    g.size = mathfu::vec2i(g.glyph_size / 2 + rng() % (g.glyph_size / 2),
+                           g.glyph_size - rng() % 4);
+    glyphs.push_back(g);
+  }
+  return glyphs;
+}
+
+template <typename Cache, typename Key, typename Entry>
+void Fill(Cache* cache, const std::vector<Glyph>& glyphs,
+          const std::vector<uint8_t>& image) {
+  for (auto it = glyphs.begin(); it != glyphs.end(); ++it) {
+    Key key(it->font_id, it->code_point, it->glyph_size);
+    if (cache->Find(key) != nullptr) continue;
+    Entry entry;
+    entry.set_code_point(it->code_point);
+    entry.set_size(it->size);
+    cache->Set(image.data(), key, entry);
+  }
+}
+
+// Measure a function and return the fastest time of iterations in ns/op.
+template <typename F>
+double Measure(const int32_t ops, F func) {
+  double best = 0.0;
+  for (int32_t i = 0; i < kNumIterations; ++i) {
+    auto start = std::chrono::high_resolution_clock::now();
+    func();
+    auto end = std::chrono::high_resolution_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    if (i == 0 || ns < best) best = ns;
+  }
+  return best / ops;
+}
+
+// Volatile sink to keep lookups from being optimized out.
+volatile uintptr_t g_sink;
+
+// Find() of cached glyphs.
+template <typename Cache, typename Key, typename Entry>
+double BenchmarkFindHit(const std::vector<Glyph>& glyphs,
+                        const std::vector<uint32_t>& sequence,
+                        const std::vector<uint8_t>& image) {
+  Cache cache(mathfu::vec2i(kCacheSize, kCacheSize), kCacheMaxPages);
+  Fill<Cache, Key, Entry>(&cache, glyphs, image);
+  std::vector<Key> keys;
+  for (auto it = sequence.begin(); it != sequence.end(); ++it) {
+    auto& g = glyphs[*it];
+    keys.push_back(Key(g.font_id, g.code_point, g.glyph_size));
+  }
+  return Measure(static_cast<int32_t>(keys.size()), [&]() {
+    uintptr_t sum = 0;
+    for (auto it = keys.begin(); it != keys.end(); ++it) {
+      sum += reinterpret_cast<uintptr_t>(cache.Find(*it));
+    }
+    g_sink = sum;
+  });
+}
+
+// Find() of glyphs that are not in the cache.
+template <typename Cache, typename Key, typename Entry>
+double BenchmarkFindMiss(const std::vector<Glyph>& glyphs,
+                         const std::vector<Glyph>& missing,
+                         const std::vector<uint8_t>& image) {
+  Cache cache(mathfu::vec2i(kCacheSize, kCacheSize), kCacheMaxPages);
+  Fill<Cache, Key, Entry>(&cache, glyphs, image);
+  std::vector<Key> keys;
+  for (auto it = missing.begin(); it != missing.end(); ++it) {
+    keys.push_back(Key(it->font_id, it->code_point + 20000, it->glyph_size));
+  }
+  return Measure(static_cast<int32_t>(keys.size()), [&]() {
+    uintptr_t sum = 0;
+    for (auto it = keys.begin(); it != keys.end(); ++it) {
+      sum += reinterpret_cast<uintptr_t>(cache.Find(*it));
+    }
+    g_sink = sum;
+  });
+}
+
+// Set() of all glyphs to an empty cache followed by Flush().
+template <typename Cache, typename Key, typename Entry>
+double BenchmarkSetFlush(const std::vector<Glyph>& glyphs,
+                         const std::vector<uint8_t>& image) {
+  Cache cache(mathfu::vec2i(kCacheSize, kCacheSize), kCacheMaxPages);
+  return Measure(static_cast<int32_t>(glyphs.size()), [&]() {
+    Fill<Cache, Key, Entry>(&cache, glyphs, image);
+    cache.Flush();
+  });
+}
+
+// Set() of a working set larger than the cache, with a cycle update every
+// 100 glyphs so that rows and pages are evicted.
+template <typename Cache, typename Key, typename Entry>
+double BenchmarkEviction(const std::vector<Glyph>& glyphs,
+                         const std::vector<uint8_t>& image) {
+  Cache cache(mathfu::vec2i(kCacheSize / 4, kCacheSize / 4), kCacheMaxPages);
+  return Measure(static_cast<int32_t>(glyphs.size()), [&]() {
+    int32_t count = 0;
+    for (auto it = glyphs.begin(); it != glyphs.end(); ++it) {
+      Key key(it->font_id, it->code_point, it->glyph_size);
+      if (cache.Find(key) == nullptr) {
+        Entry entry;
+        entry.set_code_point(it->code_point);
+        entry.set_size(it->size);
+        cache.Set(image.data(), key, entry);
+      }
+      if (++count % 100 == 0) cache.Update();
+    }
+  });
+}
+
+// Compare results of the two implementations for one operation.
+// Both should agree on whether the glyph is cached, and on where it is.
+template <typename LegacyEntry, typename Entry>
+bool CompareEntries(const char* op, const int32_t index,
+                    const LegacyEntry* legacy, const Entry* current) {
+  if ((legacy == nullptr) != (current == nullptr)) {
+    printf("Mismatch: %s #%d legacy: %s current: %s\n", op, index,
+           legacy ? "hit" : "miss", current ? "hit" : "miss");
+    return false;
+  }
+  if (legacy == nullptr) return true;
+  auto legacy_uv = legacy->get_uv();
+  auto uv = current->get_uv();
+  if (legacy->get_code_point() != current->get_code_point() ||
+      legacy->get_size().x() != current->get_size().x() ||
+      legacy->get_size().y() != current->get_size().y() ||
+      legacy->get_page() != current->get_page() ||
+      legacy_uv.x() != uv.x() || legacy_uv.y() != uv.y() ||
+      legacy_uv.z() != uv.z() || legacy_uv.w() != uv.w()) {
+    printf("Mismatch: %s #%d code point: %u/%u page: %d/%d\n", op, index,
+           legacy->get_code_point(), current->get_code_point(),
+           legacy->get_page(), current->get_page());
+    return false;
+  }
+  return true;
+}
+
+// Run the same Set/Find/Flush/eviction sequence through both implementations
+// and compare every result.
+template <typename LegacyCache, typename LegacyKey, typename LegacyEntry,
+          typename Cache, typename Key, typename Entry>
+bool CheckEquivalence(const std::vector<Glyph>& glyphs,
+                      const std::vector<Glyph>& large_set,
+                      const std::vector<uint8_t>& image) {
+  LegacyCache legacy(mathfu::vec2i(kCacheSize, kCacheSize), kCacheMaxPages);
+  Cache cache(mathfu::vec2i(kCacheSize, kCacheSize), kCacheMaxPages);
+  bool ok = true;
+  // Find each glyph and Set it on a miss, then Find all of them again.
+  // After Flush() everything should miss.
+  const char* kOps[] = {"Set", "Find", "Find after Flush"};
+  for (int32_t pass = 0; pass < 3 && ok; ++pass) {
+    if (pass == 2) {
+      legacy.Flush();
+      cache.Flush();
+    }
+    for (size_t i = 0; i < glyphs.size() && ok; ++i) {
+      auto& g = glyphs[i];
+      LegacyKey legacy_key(g.font_id, g.code_point, g.glyph_size);
+      Key key(g.font_id, g.code_point, g.glyph_size);
+      auto legacy_entry = legacy.Find(legacy_key);
+      auto entry = cache.Find(key);
+      ok = CompareEntries(kOps[pass], static_cast<int32_t>(i), legacy_entry,
+                          entry);
+      if (ok && pass == 0 && entry == nullptr) {
+        LegacyEntry new_legacy_entry;
+        new_legacy_entry.set_code_point(g.code_point);
+        new_legacy_entry.set_size(g.size);
+        Entry new_entry;
+        new_entry.set_code_point(g.code_point);
+        new_entry.set_size(g.size);
+        ok = CompareEntries(
+            kOps[pass], static_cast<int32_t>(i),
+            legacy.Set(image.data(), legacy_key, new_legacy_entry),
+            cache.Set(image.data(), key, new_entry));
+      }
+    }
+  }
+
+  // Working set larger than the cache, with a cycle update every 100 glyphs
+  // so that rows and pages are evicted.
+  LegacyCache small_legacy(mathfu::vec2i(kCacheSize / 4, kCacheSize / 4),
+                           kCacheMaxPages);
+  Cache small_cache(mathfu::vec2i(kCacheSize / 4, kCacheSize / 4),
+                    kCacheMaxPages);
+  for (size_t i = 0; i < large_set.size() && ok; ++i) {
+    auto& g = large_set[i];
+    LegacyKey legacy_key(g.font_id, g.code_point, g.glyph_size);
+    Key key(g.font_id, g.code_point, g.glyph_size);
+    auto legacy_entry = small_legacy.Find(legacy_key);
+    auto entry = small_cache.Find(key);
+    ok = CompareEntries("Find with eviction", static_cast<int32_t>(i),
+                        legacy_entry, entry);
+    if (ok && entry == nullptr) {
+      LegacyEntry new_legacy_entry;
+      new_legacy_entry.set_code_point(g.code_point);
+      new_legacy_entry.set_size(g.size);
+      Entry new_entry;
+      new_entry.set_code_point(g.code_point);
+      new_entry.set_size(g.size);
+      ok = CompareEntries(
+          "Set with eviction", static_cast<int32_t>(i),
+          small_legacy.Set(image.data(), legacy_key, new_legacy_entry),
+          small_cache.Set(image.data(), key, new_entry));
+    }
+    if ((i + 1) % 100 == 0) {
+      small_legacy.Update();
+      small_cache.Update();
+    }
+  }
+  return ok;
+}
+
+// Keys whose code point or glyph size don't fit GlyphKey should be invalid,
+// never alias a valid key, and miss in the cache.
+bool CheckInvalidKeys(const std::vector<uint8_t>& image) {
+  using flatui::GlyphCache;
+  using flatui::GlyphCacheEntry;
+  using flatui::GlyphKey;
+  const uint32_t kMaxGlyphSize = 1U << flatui::kGlyphKeyGlyphSizeBits;
+  const uint32_t kMaxCodePoint = 1U << flatui::kGlyphKeyCodePointBits;
+  GlyphCache<uint8_t> cache(mathfu::vec2i(kCacheSize, kCacheSize),
+                            kCacheMaxPages);
+  GlyphCacheEntry entry;
+  entry.set_code_point(65);
+  entry.set_size(mathfu::vec2i(16, 24));
+  GlyphKey valid_key(0x1234abcd, 65, 32);
+  if (!valid_key.is_valid() ||
+      cache.Set(image.data(), valid_key, entry) == nullptr) {
+    printf("A valid GlyphKey is rejected.\n");
+    return false;
+  }
+  const GlyphKey kInvalidKeys[] = {
+      GlyphKey(0x1234abcd, 65, 32 + kMaxGlyphSize),
+      GlyphKey(0x1234abcd, 65 + kMaxCodePoint, 32),
+      GlyphKey(0x1234abcd, flatui::kGlyphKeyCodePointInvalid, 32),
+  };
+  for (size_t i = 0; i < sizeof(kInvalidKeys) / sizeof(kInvalidKeys[0]);
+       ++i) {
+    auto& key = kInvalidKeys[i];
+    if (key.is_valid() || key == valid_key || cache.Find(key) != nullptr ||
+        cache.Set(image.data(), key, entry) != nullptr) {
+      printf("Out of range GlyphKey #%d is not rejected.\n",
+             static_cast<int32_t>(i));
+      return false;
+    }
+  }
+  return true;
+}
+
+void Report(const char* name, const double legacy, const double current) {
+  printf("%-24s legacy: %8.1f ns/op  current: %8.1f ns/op  speedup: %.2fx\n",
+         name, legacy, current, legacy / current);
+}
+
+}  // namespace
+
+int main(int /*argc*/, char** /*argv*/) {
+  using flatui::GlyphCache;
+  using flatui::GlyphCacheEntry;
+  using flatui::GlyphKey;
+  typedef flatui::legacy::GlyphCache<uint8_t> LegacyCache;
+  typedef flatui::legacy::GlyphCacheEntry LegacyEntry;
+  typedef flatui::legacy::GlyphKey LegacyKey;
+
+  auto glyphs = BuildGlyphs(kNumGlyphs, 1);
+  auto missing = BuildGlyphs(kNumGlyphs, 2);
+  auto large_set = BuildGlyphs(kNumGlyphs * 5, 3);
+  std::vector<uint8_t> image(64 * 64, 0x80);
+
+  // Skewed lookup sequence. Lower indices are looked up more often.
+  std::mt19937 rng(4);
+  std::vector<uint32_t> sequence;
+  for (int32_t i = 0; i < kNumLookups; ++i) {
+    auto r = static_cast<double>(rng()) / rng.max();
+    sequence.push_back(static_cast<uint32_t>(r * r * (kNumGlyphs - 1)));
+  }
+
+  if (!CheckEquivalence<LegacyCache, LegacyKey, LegacyEntry,
+                        GlyphCache<uint8_t>, GlyphKey, GlyphCacheEntry>(
+          glyphs, large_set, image)) {
+    printf("GlyphCache doesn't match the legacy implementation.\n");
+    return 1;
+  }
+  if (!CheckInvalidKeys(image)) {
+    return 1;
+  }
+
+  Report("Find (hit)",
+         BenchmarkFindHit<LegacyCache, LegacyKey, LegacyEntry>(glyphs,
+                                                               sequence, image),
+         BenchmarkFindHit<GlyphCache<uint8_t>, GlyphKey, GlyphCacheEntry>(
+             glyphs, sequence, image));
+  Report("Find (miss)",
+         BenchmarkFindMiss<LegacyCache, LegacyKey, LegacyEntry>(glyphs, missing,
+                                                                image),
+         BenchmarkFindMiss<GlyphCache<uint8_t>, GlyphKey, GlyphCacheEntry>(
+             glyphs, missing, image));
+  Report("Set + Flush",
+         BenchmarkSetFlush<LegacyCache, LegacyKey, LegacyEntry>(glyphs, image),
+         BenchmarkSetFlush<GlyphCache<uint8_t>, GlyphKey, GlyphCacheEntry>(
+             glyphs, image));
+  Report("Set with eviction",
+         BenchmarkEviction<LegacyCache, LegacyKey, LegacyEntry>(large_set,
+                                                                image),
+         BenchmarkEviction<GlyphCache<uint8_t>, GlyphKey, GlyphCacheEntry>(
+             large_set, image));
+  return 0;
+}
@@ -16,6 +16,7 @@
 #define FPL_FLATUI_H
 
 #include <functional>
+#include <memory>
 #include <string>
 
 #if defined(_MSC_VER)
@@ -24,6 +25,7 @@ typedef SSIZE_T ssize_t;
 #endif
 
 #include "font_manager.h"
+#include "flatui/internal/trace.h"
 #include "flatui/version.h"
 #include "fplbase/asset_manager.h"
 #include "fplbase/input.h"
@@ -36,23 +38,234 @@ namespace flatui {
 //
 /// @{
 
+/// @class GuiContext
+///
+/// @brief The state of a GUI kept across frames, such as the input focus, the
+/// pointer capture, the text being edited, the retained layout and storage
+/// reused by frames.
+///
+/// Each context runs its own GUI, such as a GUI of a window, a split-screen
+/// player or a VR panel. Contexts can be run with `Run()` on different threads
+/// at the same time, as long as each thread uses its own FontManager,
+/// InputSystem and AssetManager with a GL context current on the thread.
+/// FontManagers share a FreeType library, so create them and open fonts
+/// before running contexts in parallel.
+///
+/// A thread uses a default context shared by the threads until it sets its own
+/// context. A context that is destroyed while current in the thread destroying
+/// it is replaced with the default context. Functions called outside of
+/// `Run()`, such as `SetRetainedLayout()` and `GetFrameStats()`, apply to the
+/// current context of the calling thread.
+class GuiContext {
+ public:
+  GuiContext();
+  ~GuiContext();
+
+ private:
+  friend class InternalState;
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+
+  // Disable copy constructor.
+  GuiContext(const GuiContext &);
+  GuiContext &operator=(const GuiContext &);
+};
+
+/// @brief Set the current GUI context of the calling thread.
+///
+/// @note Call this outside of `Run()`.
+///
+/// @param[in] context A GuiContext to use in the calling thread, or `nullptr`
+/// to use the default context.
+void SetCurrentGuiContext(GuiContext *context);
+
+/// @return Returns the current GUI context of the calling thread.
+GuiContext &GetCurrentGuiContext();
+
+/// @brief Release the GL resources held by a GUI context, such as the image
+/// atlas and render-to-texture layers.
+///
+/// The resources are released when the context is destroyed, which needs a
+/// current GL context. Call this before the GL context is destroyed instead,
+/// in particular for the default context, which is destroyed only at program
+/// exit. The resources are created again if the context is run again.
+///
+/// @note Call this on the thread rendering the GUI, outside of `Run()`.
+///
+/// @param[in] context The GuiContext to release, e.g.
+/// `GetCurrentGuiContext()`.
+void ReleaseGuiContext(GuiContext &context);
+
 /// @brief The core function that drives the GUI.
 ///
+/// Same as `Run()` with the current GUI context, except that it runs the
+/// given context. The context is current for the calling thread only while
+/// `Run()` is running, and the previous context is restored when it returns.
+/// Use `SetCurrentGuiContext()` to apply functions such as `GetFrameStats()`
+/// to the context outside of `Run()`.
+///
+/// @param[in,out] context The GuiContext that keeps the state of the GUI.
+/// @param[in,out] assetman The AssetManager you want to use textures from.
+/// @param[in] fontman The FontManager to be used by the GUI.
+/// @param[in] input The InputSystem to be used by the GUI.
+/// @param[in] gui_definition A function that defines all GUI elements using the
+/// GUI element construction functions.
+void Run(GuiContext &context, fplbase::AssetManager &assetman,
+         FontManager &fontman, fplbase::InputSystem &input,
+         const std::function<void()> &gui_definition);
+
+/// @brief The core function that drives the GUI with the current GUI context
+/// of the calling thread.
+///
 /// While FlatUI i sbeing initialized, it will implicitly load the shaders used
-/// in the API below via AssetManager (`shaders/color.glslv`,
-/// `shaders/color.glslf`, `shaders/font.glslv`, `shaders/font.glslf`,
-/// `shaders/textured.glslv`, and `shaders/textured.glslf`).
+/// in the API below via AssetManager (`shaders/font_batch.glslv`,
+/// `shaders/font_batch.glslf`, `shaders/font_batch_sdf.glslv`,
+/// `shaders/font_batch_sdf.glslf`, `shaders/quad_batch.glslv`,
+/// `shaders/quad_batch.glslf`, `shaders/textured.glslv`, and
+/// `shaders/textured.glslf`).
 ///
 /// @param[in,out] assetman The AssetManager you want to use textures from.
 /// @param[in] fontman The FontManager to be used by the GUI.
 /// @param[in] input The InputSystem to be used by the GUI.
 /// @param[in] gui_definition A function that defines all GUI elements using the
 /// GUI element construction functions. (It will be run twice, once for the
-/// layout, and once for rendering & events.)
+/// layout, and once for rendering & events. In the retained layout mode, it
+/// may be run only once for rendering & events. See `SetRetainedLayout()`.)
 void Run(fplbase::AssetManager &assetman, FontManager &fontman,
          fplbase::InputSystem &input,
          const std::function<void()> &gui_definition);
 
+/// @brief Enable or disable the retained layout mode of `Run()`.
+///
+/// In the retained layout mode, `Run()` keeps the layout of a frame and skips
+/// the layout pass in following frames, so that `gui_definition` is run only
+/// once for rendering & events. The layout is validated with a signature of
+/// element IDs, element sizes and group parameters computed in the render
+/// pass.
+///
+/// The layout pass runs again in the frame after:
+/// * An element returned an event other than `kEventHover`.
+/// * An edit box had the input focus.
+/// * `InvalidateLayout()` was called.
+/// * The signature computed while rendering didn't match the retained layout.
+///   The frame is still rendered with the retained layout in this case, so
+///   that an element added in the frame shows up one frame later.
+///
+/// A label whose text changed without an input, such as a counter or a timer,
+/// is rendered in place when its size didn't change. When its size changed,
+/// the frame is run again with the layout pass, unless the frame has already
+/// rendered a custom element, a layer or a batch of quads or glyphs, or
+/// returned an event before the label. In that case the label is rendered with
+/// the retained layout and the layout pass runs in the next frame.
+///
+/// The mode is disabled by default.
+///
+/// @param[in] enable A bool determining if the retained layout mode should be
+/// enabled.
+void SetRetainedLayout(bool enable);
+
+/// @brief Enable or disable packing small images into a runtime atlas.
+///
+/// Images, backgrounds and nine-patches are batched, so that consecutive
+/// quads with the same texture are rendered in a draw call. Solid color quads
+/// share a texture with the atlas. When packing is enabled, textures up to
+/// 256x256 pixels are copied into the atlas on their first use, so that a
+/// panel of widgets with different images renders in one or two draw calls.
+///
+/// Textures are identified by their texture ids and sizes. Call
+/// `InvalidateImage()` when a packed texture is updated or released. When the
+/// atlas is full, images that don't fit are rendered with their own textures,
+/// and the atlas is cleared after a while so that images used afterwards are
+/// packed again.
+///
+/// Packing is disabled by default.
+///
+/// @note Call this on the thread rendering the GUI, outside of `Run()`.
+///
+/// @param[in] enable A bool determining if images should be packed.
+void SetImageAtlas(bool enable);
+
+/// @brief Let the image atlas copy a texture again on its next use.
+///
+/// Call this when the contents of a texture used by the GUI are updated, or
+/// before the texture is released, so that the atlas doesn't render an
+/// outdated copy of the image.
+///
+/// @note Call this on the thread rendering the GUI, outside of `Run()`.
+///
+/// @param[in] texture The texture that has been updated or will be released.
+void InvalidateImage(const fplbase::Texture &texture);
+
+/// @brief Let `Run()` run the layout pass in the next frame in the retained
+/// layout mode.
+///
+/// Call this when the application changes a state that affects the layout
+/// without an user input, such as an element shown by a timer, to avoid
+/// rendering a frame with the outdated layout.
+void InvalidateLayout();
+
+/// @brief Returns the number of heap allocations the last `Run()` made for
+/// its per-frame storage.
+///
+/// `Run()` keeps elements, the group stack and batched labels in an arena
+/// that persists across frames, so that a steady-state frame returns 0. The
+/// count is non-zero only when a frame needs more storage than any previous
+/// frame. Debug builds assert if a frame with the same layout as the previous
+/// frame allocates.
+///
+/// @return Returns the number of allocations as an `int32_t`.
+int32_t GetFrameAllocationCount();
+
+/// @struct FrameStats
+///
+/// @brief Statistics of the last `Run()`, available in release builds.
+struct FrameStats {
+  FrameStats()
+      : layout_pass_time(0.0),
+        render_pass_time(0.0),
+        retained_layout(false),
+        num_elements(0),
+        num_groups(0),
+        num_draw_calls(0),
+        edit_input_time(0.0) {}
+
+  /// @brief Seconds spent in `gui_definition` in the layout pass. 0 when the
+  /// layout pass is skipped in the retained layout mode.
+  double layout_pass_time;
+
+  /// @brief Seconds spent in the render pass, including rendering batched
+  /// labels at the end of the pass.
+  double render_pass_time;
+
+  /// @brief `true` if the frame reused the retained layout.
+  bool retained_layout;
+
+  /// @brief The number of elements, including groups, in the render pass.
+  int32_t num_elements;
+
+  /// @brief The number of groups in the render pass.
+  int32_t num_groups;
+
+  /// @brief The number of draw calls issued by the GUI, excluding the ones
+  /// issued in `CustomElement()` renderers.
+  int32_t num_draw_calls;
+
+  /// @brief Seconds spent handling text input events of edit boxes.
+  double edit_input_time;
+
+  /// @brief FontManager operations in the frame, such as `GetBuffer()` hits
+  /// and misses, shaping calls, glyph rasterizations, uploaded atlas bytes
+  /// and glyph cache flushes.
+  FontStats font_stats;
+};
+
+/// @brief Returns statistics of the last `Run()`.
+///
+/// Use `SetTraceFunctions()` to trace the passes of `Run()` in a profiler.
+///
+/// @return Returns a FrameStats that stays valid until the next `Run()`.
+const FrameStats &GetFrameStats();
+
 /// @enum Event
 ///
 /// @brief Event types are returned by most interactive elements. These are
@@ -316,6 +529,16 @@ void SetTextColor(const mathfu::vec4 &color);
 /// that should be set.
 void SetTextFont(const char *font_name);
 
+/// @brief Set the Label's font with fallback fonts.
+///
+/// Characters the first font doesn't have are rendered with the first font
+/// in the rest of the list that has them.
+///
+/// @param[in] font_names An array of C-strings corresponding to the names of
+/// the fonts, which need to have been opened by FontManager::Open().
+/// @param[in] count The number of fonts in `font_names`.
+void SetTextFont(const char *font_names[], int32_t count);
+
 /// @brief Set a locale used for the text rendering.
 ///
 /// @param[in] locale A C-string corresponding to the of the
@@ -325,6 +548,12 @@ void SetTextFont(const char *font_name);
 /// renderings.
 void SetTextLocale(const char *locale);
 
+/// @brief Set a locale resolved with FontManager::GetLocaleInfo().
+///
+/// @param[in] locale A LocaleInfo retrieved from the FontManager used by the
+/// GUI. Switching locales by a LocaleInfo is cheaper than by a locale string.
+void SetTextLocale(const LocaleInfo &locale);
+
 /// @brief Override a text layout direction set by SetTextLocale() API.
 ///
 /// @param[in] direction TextLayoutDirection specifying text layout direction.
@@ -363,6 +592,39 @@ void StartGroup(Layout layout, float spacing = 0,
 /// however, be nested to create more complex layouts.
 void EndGroup();
 
+/// @brief Create a group of elements rendered through a cached layer.
+///
+/// Same as `StartGroup()`, except that the contents of the group are rendered
+/// into an offscreen texture, which is composited as a single quad. Following
+/// frames reuse the texture as long as the elements in the group and their
+/// sizes don't change, so that a static panel costs a single draw call.
+///
+/// The contents are rendered again when:
+/// * An element or a group parameter in the group changed.
+/// * An element in the group returned an event, including `kEventHover`. The
+///   contents are rendered again in the next frame.
+/// * `InvalidateLayer()` has been called with the ID of the group.
+///
+/// Call `InvalidateLayer()` when something else changes the looks of the group,
+/// such as a text color, texture contents or a `CustomElement()` renderer.
+///
+/// @note `StartLayer()` and `EndLayer()` calls must be matched. Layers can't be
+/// nested, and can't contain scrolling groups.
+///
+/// @param[in] layout The Layout to be used by the group.
+/// @param[in] spacing A float corresponding to the intra-element spacing for
+/// the group.
+/// @param[in] id A C-string in UTF-8 format to uniquely identify this layer.
+void StartLayer(Layout layout, float spacing, const char *id);
+
+/// @brief Clean up the layer started by `StartLayer()`.
+void EndLayer();
+
+/// @brief Let the next frame render the contents of a layer again.
+///
+/// @param[in] id A C-string in UTF-8 format identifying the layer.
+void InvalidateLayer(const char *id);
+
 /// @brief Sets the margin for the current group.
 ///
 /// @note This function is specific to a group, and should be called after
@@ -537,6 +799,32 @@ void StartScroll(const mathfu::vec2 &size, mathfu::vec2 *offset);
 /// @note Call `EndScroll()` right before `EndGroup()`.
 void EndScroll();
 
+/// @brief Make the current group into a scrolling list of `item_count` items
+/// that only lays out the items intersecting the window of "size".
+///
+/// Unlike `StartScroll()`, `item_renderer` is only invoked for the visible
+/// items (and a few items around them), so the cost of a frame doesn't grow
+/// with the length of the list. The scrolling range is computed from
+/// `item_count` and `item_height`.
+///
+/// @param[in] size A vec2 corresponding to the size of the window that the
+/// items should be displayed in.
+/// @param[in] item_count The number of items in the list.
+/// @param[in] item_height The size of an item along the direction of the
+/// group. Items larger than the value are laid out as is, but the scrolling
+/// range and the visible range are estimated with the value.
+/// @param[out] offset A vec2 that captures the value of the current scroll
+/// location.
+/// @param[in] item_renderer The function that is invoked with an index of an
+/// item to create the elements of the item. The function needs to create the
+/// same elements in the layout pass and the render pass.
+///
+/// @note Call `ScrollList()` right after `StartGroup()` with a horizontal or
+/// vertical layout, and call `EndGroup()` right after it.
+void ScrollList(const mathfu::vec2 &size, int32_t item_count,
+                float item_height, mathfu::vec2 *offset,
+                const std::function<void(int32_t index)> &item_renderer);
+
 /// @brief Make the current group into a slider group that can handle basic
 /// slider behavior. The group will capture/release the pointer as necessary.
 ///
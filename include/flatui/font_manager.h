@@ -15,7 +15,11 @@
 #ifndef FONT_MANAGER_H
 #define FONT_MANAGER_H
 
+#include <algorithm>
+#include <mutex>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
 
 /// @cond FLATUI_INTERNAL
 // Use libunibreak for a line breaking
@@ -25,8 +29,12 @@
 #endif  // !defined(FLATUI_USE_LIBUNIBREAK)
 
 #include "fplbase/renderer.h"
+#include "flatui/internal/coverage_set.h"
+#include "flatui/internal/font_data.h"
+#include "flatui/internal/font_vertex_buffer.h"
 #include "flatui/internal/glyph_cache.h"
 #include "flatui/internal/flatui_util.h"
+#include "flatui/internal/lru_cache.h"
 
 // Forward decls for FreeType & Harfbuzz
 typedef struct FT_LibraryRec_ *FT_Library;
@@ -46,11 +54,20 @@ namespace flatui {
 /// @cond FLATUI_INTERNAL
 // Forward decl.
 class FontTexture;
+class FontImage;
 class FontBuffer;
 class FontMetrics;
 class WordEnumerator;
 class FaceData;
+class GlyphRasterizer;
+class AtlasUploader;
+class ShapingCache;
+struct ShapedRun;
+struct ParagraphRun;
+class DistanceFieldGenerator;
 struct ScriptInfo;
+struct LayoutContext;
+class LayoutWorker;
 /// @endcond
 
 /// @var kFreeTypeUnit
@@ -72,6 +89,110 @@ const int32_t kGlyphCacheWidth = 1024;
 /// @brief The default size of the glyph cache height.
 const int32_t kGlyphCacheHeight = 1024;
 
+/// @var kGlyphCacheMaxPages
+///
+/// @brief The default max number of pages in the glyph cache.
+///
+/// Each page has the size of the glyph cache and is backed by its own atlas
+/// texture. Pages are allocated lazily when the existing pages are full.
+const int32_t kGlyphCacheMaxPages = 4;
+
+/// @var kFontBufferCacheSize
+///
+/// @brief The default max number of bytes used by cached FontBuffers.
+const size_t kFontBufferCacheSize = 4 * 1024 * 1024;
+
+/// @var kFontTextureCacheSize
+///
+/// @brief The default max number of bytes used by cached FontTextures.
+const size_t kFontTextureCacheSize = 16 * 1024 * 1024;
+
+/// @struct FontCacheUsage
+///
+/// @brief Memory usage and eviction statistics of a FontManager cache.
+struct FontCacheUsage {
+  /// @brief Total size of cached entries in bytes.
+  size_t size;
+
+  /// @brief The byte budget of the cache.
+  size_t max_size;
+
+  /// @brief The number of cached entries.
+  size_t num_entries;
+
+  /// @brief The number of entries evicted since the cache was created.
+  uint32_t num_evictions;
+};
+
+/// @struct FontStats
+///
+/// @brief Counters of FontManager operations since the last
+/// `FontManager::ResetStats()` call.
+struct FontStats {
+  FontStats()
+      : num_buffer_hits(0),
+        num_buffer_misses(0),
+        num_measurements(0),
+        num_shaping_calls(0),
+        num_glyph_rasterizations(0),
+        uploaded_atlas_bytes(0),
+        compacted_atlas_bytes(0),
+        num_flushes(0) {}
+
+  /// @brief The number of FontBuffer lookups found in the FontBuffer cache.
+  int32_t num_buffer_hits;
+
+  /// @brief The number of FontBuffers created because they were not cached.
+  int32_t num_buffer_misses;
+
+  /// @brief The number of FontBuffers created by `MeasureText()` without
+  /// glyphs.
+  int32_t num_measurements;
+
+  /// @brief The number of texts shaped with HarfBuzz, excluding results
+  /// reused from the shaping cache.
+  int32_t num_shaping_calls;
+
+  /// @brief The number of glyphs rasterized, including glyphs rasterized by
+  /// worker threads.
+  int32_t num_glyph_rasterizations;
+
+  /// @brief The number of bytes uploaded to atlas textures.
+  size_t uploaded_atlas_bytes;
+
+  /// @brief The number of bytes of glyph images moved by
+  /// `FontManager::CompactGlyphCache()`.
+  size_t compacted_atlas_bytes;
+
+  /// @brief The number of glyph cache flushes, which start a subpass in a
+  /// rendering pass.
+  int32_t num_flushes;
+};
+
+/// @var kShapingCacheSize
+///
+/// @brief The default max number of bytes used by the shaping cache.
+///
+/// The shaping cache keeps HarfBuzz outputs of words, so that a text laid out
+/// again with a different wrap width or label size isn't shaped again.
+const size_t kShapingCacheSize = 256 * 1024;
+
+/// @var kGlyphSDFReferenceSize
+///
+/// @brief The glyph size used to rasterize glyphs in the SDF mode.
+///
+/// In the SDF mode, each glyph is rasterized once at the size and rendered at
+/// any size by scaling the distance field.
+const int32_t kGlyphSDFReferenceSize = 32;
+
+/// @var kGlyphSDFPadding
+///
+/// @brief The padding added to each side of a glyph in the SDF mode.
+///
+/// The value is also the max distance in pixels (at the reference size)
+/// encoded in the distance field.
+const int32_t kGlyphSDFPadding = 4;
+
 /// @var kLineHeightDefault
 ///
 /// @brief Default value for a line height factor.
@@ -101,6 +222,39 @@ enum TextLayoutDirection {
   TextLayoutDirectionTTB = 2,
 };
 
+/// @enum GlyphRasterizeMode
+///
+/// @brief Specify how `GetBuffer()` handles glyphs that are not in the glyph
+/// cache while the asynchronous glyph rasterization is enabled.
+/// Default value is GlyphRasterizeModeBlock.
+///
+/// GlyphRasterizeModeBlock waits until all missing glyphs are rasterized by
+/// worker threads and returns a complete FontBuffer.
+/// GlyphRasterizeModeNextFrame returns a FontBuffer immediately. Glyphs that
+/// are not rasterized yet are not rendered and the buffer reports it's not
+/// ready. The buffer is updated in a following frame once the glyphs are
+/// available.
+enum GlyphRasterizeMode {
+  GlyphRasterizeModeBlock = 0,
+  GlyphRasterizeModeNextFrame = 1,
+};
+
+/// @enum TextLayoutStrategy
+///
+/// @brief Specify how multi line texts are shaped.
+/// Default value is TextLayoutStrategyWord.
+///
+/// TextLayoutStrategyWord shapes each word separately.
+/// TextLayoutStrategyParagraph shapes each paragraph once, and breaks lines
+/// with the advances of the shaped glyphs, keeping kerning across words.
+/// A word whose boundary falls inside a glyph cluster, such as a ligature
+/// over a line break opportunity, is shaped separately.
+///
+enum TextLayoutStrategy {
+  TextLayoutStrategyWord = 0,
+  TextLayoutStrategyParagraph = 1,
+};
+
 /// @class FontBufferParameters
 ///
 /// @brief This class that includes font buffer parameters. It is used as a key
@@ -166,6 +320,9 @@ class FontBufferParameters {
   /// @return Returns a hash value of the text.
   HashedId get_text_id() const { return text_id_; }
 
+  /// @return Returns a hashed value of the font name.
+  HashedId get_font_id() const { return font_id_; }
+
   /// @return Returns the size value.
   const mathfu::vec2i &get_size() const { return size_; }
 
@@ -183,6 +340,59 @@ class FontBufferParameters {
   bool caret_info_;
 };
 
+/// @struct FontBufferRequest
+///
+/// @brief A text and its FontBufferParameters laid out with
+/// `FontManager::GetBuffers()`.
+struct FontBufferRequest {
+  /// @brief The default constructor for an empty FontBufferRequest.
+  FontBufferRequest() : text(nullptr), length(0) {}
+
+  /// @brief Constructor to create a FontBufferRequest with a given text.
+  ///
+  /// @param[in] text A C-string in UTF-8 format with the text for the
+  /// FontBuffer. The string needs to be kept alive during the call.
+  /// @param[in] length The length of the text string.
+  /// @param[in] parameters The FontBufferParameters of the FontBuffer.
+  FontBufferRequest(const char *text, const size_t length,
+                    const FontBufferParameters &parameters)
+      : text(text), length(length), parameters(parameters) {}
+
+  /// @var text
+  /// @brief The text of the FontBuffer.
+  const char *text;
+
+  /// @var length
+  /// @brief The length of the text string.
+  size_t length;
+
+  /// @var parameters
+  /// @brief The parameters of the FontBuffer.
+  FontBufferParameters parameters;
+};
+
+/// @struct LocaleInfo
+///
+/// @brief This struct holds the text layout settings resolved from a locale.
+///
+/// Callers can keep a LocaleInfo retrieved with FontManager::GetLocaleInfo()
+/// and switch locales with FontManager::SetLocale(const LocaleInfo &).
+struct LocaleInfo {
+  /// @var language
+  /// @brief Language used for line breaking.
+  const char *language;
+
+  /// @var script_info
+  /// @brief Script information of the locale, or nullptr if the locale is not
+  /// in the script table. Current script and layout direction are kept when
+  /// such a locale is set.
+  const ScriptInfo *script_info;
+
+  /// @var script
+  /// @brief HarfBuzz script tag of `script_info`.
+  uint32_t script;
+};
+
 /// @class FontManager
 ///
 /// @brief FontManager manages font rendering with OpenGL utilizing freetype
@@ -206,6 +416,17 @@ class FontManager {
   /// @param[in] cache_size The size of the cache, in pixels.
   FontManager(const mathfu::vec2i &cache_size);
 
+  /// @brief Constructor for FontManager with a given cache size and a max
+  /// number of cache pages.
+  ///
+  /// @note The given size is rounded up to nearest power of 2 internally to be
+  /// used as an OpenGL texture sizes.
+  ///
+  /// @param[in] cache_size The size of the cache page, in pixels.
+  /// @param[in] max_pages The max number of cache pages. Each page is backed
+  /// by an atlas texture with the size of `cache_size`.
+  FontManager(const mathfu::vec2i &cache_size, const int32_t max_pages);
+
   /// @brief The destructor for FontManager.
   ~FontManager();
 
@@ -242,12 +463,29 @@ class FontManager {
   /// returns false.
   bool SelectFont(const char *font_name);
 
+  /// @brief Select the current font face with a fallback chain.
+  ///
+  /// The first font is used as the current font face. Characters the face
+  /// doesn't have glyphs for are laid out with the first font in the rest of
+  /// the list that has them, in the list order.
+  ///
+  /// @note The font faces need to have been opened by `Open()`.
+  ///
+  /// @param[in] font_names An array of C-strings in UTF-8 format representing
+  /// the names of the fonts.
+  /// @param[in] count The number of fonts in `font_names`.
+  ///
+  /// @return Returns `true` if the fonts were selected successfully. Otherwise
+  /// it returns false.
+  bool SelectFont(const char *font_names[], int32_t count);
+
   /// @brief Retrieve a texture with the given text.
   ///
-  /// @note This API doesn't use the glyph cache, instead it writes the string
-  /// image directly to the returned texture. The user can use this API when a
-  /// font texture is used for a long time, such as a string image used in game
-  /// HUD.
+  /// @note The string image is composed from glyph bitmaps in the glyph cache
+  /// and written to the returned texture, which isn't affected by later
+  /// updates of the glyph cache. The user can use this API when a font texture
+  /// is used for a long time, such as a string image used in game HUD. Use
+  /// `GetImage()` for many single line labels.
   ///
   /// @param[in] text A C-string in UTF-8 format with the text for the texture.
   /// @param[in] length The length of the text string.
@@ -257,6 +495,27 @@ class FontManager {
   FontTexture *GetTexture(const char *text, const uint32_t length,
                           const float ysize);
 
+  /// @brief Retrieve an image of a single line text packed into a texture
+  /// shared with other text images.
+  ///
+  /// Same as `GetTexture()`, except that images are sub-allocated from shared
+  /// textures instead of creating a texture per text, so that many labels
+  /// don't create as many texture objects or pad their images to powers of
+  /// two.
+  ///
+  /// Images that haven't been retrieved since the last `StartLayoutPass()` may
+  /// be evicted to make room for other images. Retrieve the image again in
+  /// each frame rather than keeping its texture and UV.
+  ///
+  /// @param[in] text A C-string in UTF-8 format with the text for the image.
+  /// @param[in] length The length of the text string.
+  /// @param[in] ysize The height of the image.
+  ///
+  /// @return Returns a pointer to the FontImage, or `nullptr` if the image
+  /// doesn't fit in a shared texture.
+  const FontImage *GetImage(const char *text, const uint32_t length,
+                            const float ysize);
+
   /// @brief Retrieve a vertex buffer for a font rendering using glyph cache.
   ///
   /// @param[in] text A C-string in UTF-8 format with the text for the
@@ -266,11 +525,132 @@ class FontManager {
   /// for the FontBuffer.
   ///
   /// @return Returns `nullptr` if the string does not fit in the glyph cache.
+  /// The glyph cache allocates a new page or recycles a page that is not used
+  /// in the current rendering cycle before it reaches the state.
   ///  When this happens, caller may flush the glyph cache with
   /// `FlushAndUpdate()` call and re-try the `GetBuffer()` call.
   FontBuffer *GetBuffer(const char *text, const size_t length,
                         const FontBufferParameters &parameters);
 
+  /// @brief Retrieve a vertex buffer for a font rendering using glyph cache
+  /// with a specified glyph rasterization mode.
+  ///
+  /// @param[in] text A C-string in UTF-8 format with the text for the
+  /// FontBuffer.
+  /// @param[in] length The length of the text string.
+  /// @param[in] parameters The FontBufferParameters specifying the parameters
+  /// for the FontBuffer.
+  /// @param[in] mode Specify if the call waits for glyphs rasterized by worker
+  /// threads. The mode is ignored unless `EnableAsyncRasterization()` is
+  /// called.
+  ///
+  /// @return Returns `nullptr` if the string does not fit in the glyph cache.
+  /// With GlyphRasterizeModeNextFrame, check `FontBuffer::get_ready_state()`
+  /// to see if all glyphs in the buffer are available.
+  FontBuffer *GetBuffer(const char *text, const size_t length,
+                        const FontBufferParameters &parameters,
+                        const GlyphRasterizeMode mode);
+
+  /// @brief Measure a text without building its glyphs.
+  ///
+  /// The text is shaped and broken into lines to compute its size, but no
+  /// glyph is rasterized into the glyph cache and no vertex is built. Use
+  /// this in the layout pass for texts that may not be rendered, such as
+  /// labels scrolled out of view. A following `GetBuffer()` call with the same
+  /// parameters builds the glyphs when the text is rendered.
+  ///
+  /// A FontBuffer already cached with the parameters is returned as is.
+  ///
+  /// @note The metrics of a measured buffer are the ones of the face, without
+  /// the leading of glyphs extending beyond the ascender or the descender.
+  /// Texts with caret info are built with `GetBuffer()`, since carets need
+  /// glyph metrics.
+  ///
+  /// @param[in] text A C-string in UTF-8 format with the text to measure.
+  /// @param[in] length The length of the text string.
+  /// @param[in] parameters The FontBufferParameters specifying the parameters
+  /// for the FontBuffer.
+  ///
+  /// @return Returns a FontBuffer with the size of the text. Check
+  /// `FontBuffer::get_measured_state()` to see if the buffer has glyphs.
+  const FontBuffer *MeasureText(const char *text, const size_t length,
+                                const FontBufferParameters &parameters);
+
+  /// @brief Retrieve vertex buffers of multiple texts, laying them out in
+  /// parallel.
+  ///
+  /// Texts are shaped and their missing glyphs are rasterized on
+  /// `num_threads` threads including the calling thread. Each thread has own
+  /// FreeType and HarfBuzz instances, and only accesses to the glyph cache
+  /// and the FontBuffer cache are serialized. The call blocks until all
+  /// buffers are ready, and the result is the same as calling `GetBuffer()`
+  /// for each request.
+  ///
+  /// @note Don't call other FontManager APIs during the call. The current
+  /// font and the layout settings are used for all requests.
+  ///
+  /// @param[in] requests Texts and their parameters to lay out.
+  /// @param[in] num_threads The number of threads to lay out texts. With 1,
+  /// texts are laid out in the calling thread.
+  /// @param[out] buffers FontBuffers of the requests in the same order. An
+  /// element is `nullptr` when the text doesn't fit in the glyph cache.
+  void GetBuffers(const std::vector<FontBufferRequest> &requests,
+                  const int32_t num_threads,
+                  std::vector<FontBuffer *> *buffers);
+
+  /// @brief Enable asynchronous glyph rasterization using worker threads.
+  ///
+  /// Each worker thread has own FreeType face instances, and rasterized glyphs
+  /// are stored to the glyph cache in `StartLayoutPass()` (or in `GetBuffer()`
+  /// with GlyphRasterizeModeBlock).
+  ///
+  /// @param[in] num_threads The number of worker threads.
+  ///
+  /// @return Returns `true` if worker threads are started.
+  bool EnableAsyncRasterization(const int32_t num_threads);
+
+  /// @brief Stop worker threads started by `EnableAsyncRasterization()`.
+  /// Glyphs are rasterized synchronously after the call.
+  void DisableAsyncRasterization();
+
+  /// @brief Save the glyph cache contents and cached FontBuffers to a file.
+  ///
+  /// The saved file can be loaded with `LoadCache()` in a later run to skip
+  /// rasterizing glyphs and shaping strings again.
+  ///
+  /// @param[in] file_name A C-string in UTF-8 format of the file name.
+  ///
+  /// @return Returns `true` if the file is saved successfully.
+  bool SaveCache(const char *file_name);
+
+  /// @brief Load the glyph cache contents and FontBuffers saved with
+  /// `SaveCache()`.
+  ///
+  /// @note Open all fonts used in the saved cache before the call. The cache
+  /// is rejected if any of the fonts is not opened or the font file has been
+  /// changed, or the glyph cache size differs.
+  /// FontBuffers are restored only when the current locale, script, layout
+  /// direction, line height and layout strategy settings match with the saved
+  /// ones.
+  ///
+  /// @param[in] file_name A C-string in UTF-8 format of the file name.
+  ///
+  /// @return Returns `true` if the cache is loaded successfully.
+  bool LoadCache(const char *file_name);
+
+  /// @brief Load the glyph cache contents and FontBuffers saved with
+  /// `SaveCache()` from a memory.
+  ///
+  /// @note The format only consists of POD records so that the caller can
+  /// memory map the saved file and pass it to the API. The data is not
+  /// referenced after the call.
+  ///
+  /// @param[in] data A pointer to the saved cache data.
+  /// @param[in] size The size of the data in bytes.
+  ///
+  /// @return Returns `true` if the cache is loaded successfully.
+  bool LoadCache(const void *data, const size_t size);
+
   /// @brief Set the renderer to be used to create texture instances.
   ///
   /// @param[in] renderer The Renderer to set for creating textures.
@@ -305,15 +685,100 @@ class FontManager {
   /// @brief Flush the existing FontBuffer in the cache.
   ///
   /// Call this API when FontBuffers are not used anymore.
-  void FlushLayout() { map_buffers_.clear(); }
+  void FlushLayout() { map_buffers_.Clear(); }
+
+  /// @brief Set the max number of bytes used by cached FontBuffers.
+  ///
+  /// When the cache exceeds the budget, least recently used FontBuffers are
+  /// evicted. FontBuffers retrieved since the last `StartLayoutPass()` are
+  /// never evicted, so that a pointer returned by `GetBuffer()` stays valid
+  /// until the next `StartLayoutPass()`. The default is
+  /// `kFontBufferCacheSize`.
+  ///
+  /// @param[in] size The max number of bytes.
+  void SetBufferCacheSize(const size_t size) {
+    map_buffers_.set_max_size(size);
+  }
+
+  /// @brief Set the max number of bytes used by cached FontTextures.
+  ///
+  /// The size of a FontTexture is the size of its texture image. Eviction
+  /// follows the same rule as `SetBufferCacheSize()`. The default is
+  /// `kFontTextureCacheSize`.
+  ///
+  /// @param[in] size The max number of bytes.
+  void SetTextureCacheSize(const size_t size) {
+    map_textures_.set_max_size(size);
+  }
+
+  /// @return Returns the memory usage of the FontBuffer cache.
+  FontCacheUsage GetBufferCacheUsage() const {
+    return GetCacheUsage(map_buffers_);
+  }
+
+  /// @return Returns the memory usage of the FontTexture cache.
+  FontCacheUsage GetTextureCacheUsage() const {
+    return GetCacheUsage(map_textures_);
+  }
+
+  /// @brief Compact the glyph cache in a frame with spare time.
+  ///
+  /// Glyph cache rows are allocated by glyph heights. As rows are evicted and
+  /// split, the cache can run out of rows for a glyph while many pixels are
+  /// free, which flushes the whole cache. The API moves glyphs out of sparsely
+  /// used rows into other rows with the same height, and merges empty
+  /// neighboring rows to make room for glyphs of any height.
+  /// Glyphs used in the current rendering cycle are not moved. FontBuffers
+  /// with moved glyphs update their UVs when they are used next time.
+  ///
+  /// @note Call this outside of the layout pass and the render pass, such as
+  /// after `flatui::Run()`.
+  ///
+  /// @param[in] max_bytes The max number of bytes of glyph images moved in
+  /// the call.
+  ///
+  /// @return Returns the number of bytes moved.
+  size_t CompactGlyphCache(const size_t max_bytes);
+
+  /// @return Returns the fragmentation of the free space in the glyph cache,
+  /// from 0 when the free space is contiguous, to 1 when it's split into
+  /// many small regions. Use `CompactGlyphCache()` to reduce it.
+  float GetGlyphCacheFragmentation() const {
+    return glyph_cache_->get_fragmentation();
+  }
+
+  /// @return Returns counters of operations since the last `ResetStats()`.
+  const FontStats &GetStats() const { return stats_; }
+
+  /// @brief Reset counters returned by `GetStats()`.
+  ///
+  /// FlatUI resets the counters at the beginning of each `Run()`.
+  void ResetStats() { stats_ = FontStats(); }
 
   /// @brief Indicates a start of new render pass.
   ///
   /// Call the API each time the user starts a render pass.
   void StartRenderPass() { UpdatePass(false); }
 
-  /// @return Returns font atlas texture.
-  fplbase::Texture *GetAtlasTexture() { return atlas_texture_.get(); }
+  /// @brief Retrieve a font atlas texture of a glyph cache page.
+  ///
+  /// @param[in] page The index of the glyph cache page. Use
+  /// `FontBuffer::get_glyph_page()` to retrieve a page used in a FontBuffer.
+  ///
+  /// @return Returns font atlas texture of the page. Returns `nullptr` if the
+  /// page hasn't been allocated yet.
+  fplbase::Texture *GetAtlasTexture(const int32_t page = 0) {
+    if (page < 0 || page >= static_cast<int32_t>(atlas_textures_.size())) {
+      return nullptr;
+    }
+    return atlas_textures_[page].get();
+  }
+
+  /// @cond FLATUI_INTERNAL
+  // Index buffer of quad indices shared by FontBuffers rendered from their
+  // vertex buffers. Use it on the thread owning the GL context.
+  QuadIndexBuffer *GetQuadIndexBuffer() { return &quad_index_buffer_; }
+  /// @endcond
 
   /// @brief The user can supply a size selector function to adjust glyph sizes
   /// when storing a glyph cache entry. By doing that, multiple strings with
@@ -336,8 +801,24 @@ class FontManager {
   /// following text renderings based on the locale.
   void SetLocale(const char *locale);
 
-  /// @return Returns the current language setting as a std::string.
-  const char *GetLanguage() { return language_.c_str(); }
+  /// @brief Set a locale resolved by GetLocaleInfo().
+  ///
+  /// @param[in] locale A LocaleInfo returned by GetLocaleInfo().
+  ///
+  /// @note Switching locales with the LocaleInfo doesn't look up locale tables
+  /// or allocate memory.
+  void SetLocale(const LocaleInfo &locale);
+
+  /// @brief Resolve language, script and layout direction of a locale.
+  ///
+  /// @param[in] locale A C-string of the locale (e.g. 'en-US').
+  ///
+  /// @return Returns a LocaleInfo of the locale that stays valid while the
+  /// FontManager is alive. Returns nullptr if `locale` is nullptr.
+  const LocaleInfo *GetLocaleInfo(const char *locale);
+
+  /// @return Returns the current language setting as a C-string.
+  const char *GetLanguage() { return language_; }
 
   /// @brief Set a script used for a script layout.
   ///
@@ -368,6 +849,21 @@ class FontManager {
   /// @return Returns the current layout direciton.
   TextLayoutDirection GetLayoutDirection() { return layout_direction_; }
 
+  /// @brief Set how multi line texts are shaped.
+  ///
+  /// @param[in] strategy Text layout strategy. The default is
+  /// TextLayoutStrategyWord.
+  void SetLayoutStrategy(const TextLayoutStrategy strategy) {
+    // Flush layout cache if we switch a strategy.
+    if (strategy != layout_strategy_) {
+      FlushLayout();
+    }
+    layout_strategy_ = strategy;
+  }
+
+  /// @return Returns the current layout strategy.
+  TextLayoutStrategy GetLayoutStrategy() const { return layout_strategy_; }
+
   /// @brief Set a line height for a multi-line text.
   ///
   /// @param[in] line_height A float representing the line height for a
@@ -377,6 +873,36 @@ class FontManager {
   /// @return Returns the current font face.
   FaceData *GetCurrentFace() { return current_face_; }
 
+  /// @return Returns a hashed ID of the current font face and its fallback
+  /// fonts. Use the ID as the font ID of FontBufferParameters, so that
+  /// buffers laid out with different fallback chains are cached separately.
+  HashedId GetCurrentFontId() const { return current_font_id_; }
+
+  /// @brief Enable or disable the signed distance field (SDF) glyph mode.
+  ///
+  /// In the SDF mode, glyphs are rasterized once at `kGlyphSDFReferenceSize`
+  /// into distance fields, so that one glyph cache entry is shared by all
+  /// sizes of the glyph. The atlas needs to be rendered with a SDF shader
+  /// (e.g. `shaders/font_batch_sdf` used by FlatUI's labels).
+  ///
+  /// @note Changing the mode flushes the glyph cache and cached FontBuffers.
+  /// The size selector is not used in the SDF mode.
+  ///
+  /// @param[in] sdf Set `true` to enable the SDF mode.
+  void SetSDFMode(const bool sdf);
+
+  /// @return Returns `true` if the SDF glyph mode is enabled.
+  bool GetSDFMode() const { return sdf_; }
+
+  /// @brief Set the max number of bytes used by the shaping cache.
+  ///
+  /// Shaped words are reused across FontBuffers of the same face, glyph size,
+  /// script and layout direction. Least recently used words are evicted when
+  /// the cache exceeds the size. The default is `kShapingCacheSize`.
+  ///
+  /// @param[in] size The max number of bytes.
+  void SetShapingCacheSize(const size_t size);
+
  private:
   // Pass indicating rendering pass.
   static const int32_t kRenderPass = -1;
@@ -389,34 +915,96 @@ class FontManager {
   // to use the class.
   static void Terminate();
 
-  // Expand a texture image buffer when the font metrics is changed.
-  // Returns true if the image buffer was reallocated.
-  static bool ExpandBuffer(const int32_t width, const int32_t height,
-                           const FontMetrics &original_metrics,
-                           const FontMetrics &new_metrics,
-                           std::unique_ptr<uint8_t[]> *image);
-
-  // Layout text and update harfbuzz_buf_.
+  // Compose a luminance image of a single line text with the current face
+  // from glyph bitmaps in the glyph cache. Glyphs are rasterized on their own
+  // in the SDF mode, or when the glyph cache is full.
+  // The image size is rounded up to powers of two if power_of_two is true.
+  // Returns false if a glyph can't be loaded.
+  bool ComposeTextImage(const char *text, const uint32_t length,
+                        const int32_t ysize, const bool power_of_two,
+                        std::vector<uint8_t> *image, mathfu::vec2i *size,
+                        FontMetrics *metrics);
+
+  // Set up a layout context with FontManager's own instances for the calling
+  // thread.
+  void GetMainContext(LayoutContext *context);
+
+  // Layout texts of requests in worker threads and store FontBuffers to the
+  // FontBuffer cache.
+  void LayoutBuffersInParallel(const std::vector<FontBufferRequest> &requests,
+                               const int32_t num_threads);
+
+  // Layout text and update the HarfBuzz buffer of the context.
   // Returns the width of the text layout in pixels.
-  uint32_t LayoutText(const char *text, const size_t length);
+  uint32_t LayoutText(LayoutContext *context, const char *text,
+                      const size_t length);
+
+  // Retrieve usage statistics of a cache.
+  template <typename T>
+  static FontCacheUsage GetCacheUsage(const T &cache) {
+    FontCacheUsage usage;
+    usage.size = cache.get_size();
+    usage.max_size = cache.get_max_size();
+    usage.num_entries = cache.get_num_entries();
+    usage.num_evictions = cache.get_num_evictions();
+    return usage;
+  }
+
+  // Returns # of bytes used by a FontBuffer.
+  static size_t GetBufferSize(const FontBuffer &buffer);
+
+  // Look up the shaping cache for the text, or layout the text and store the
+  // result to the cache. ysize is the pixel size set to the current face.
+  const ShapedRun *ShapeText(LayoutContext *context, const char *text,
+                             const size_t length, const int32_t ysize);
+
+  // Shape the text splitting it into runs of the current face and fallback
+  // faces with glyphs of the characters. faces is set to faces of glyphs in
+  // the returned run, or nullptr if all glyphs use the context's face.
+  const ShapedRun *ShapeTextWithFallback(
+      LayoutContext *context, const char *text, const size_t length,
+      const int32_t ysize, const std::vector<const FaceData *> **faces);
+
+  // Shape the current word of a multi line text, setting faces like
+  // ShapeTextWithFallback(). With TextLayoutStrategyParagraph, the paragraph
+  // of the word is shaped on its first word, and the word is sliced from it.
+  // The returned run is valid until the next shaping.
+  const ShapedRun *ShapeWord(LayoutContext *context, const char *text,
+                             const size_t length,
+                             const WordEnumerator &word_enum,
+                             const int32_t ysize,
+                             const std::vector<const FaceData *> **faces);
+
+  // Shape a paragraph of a text into the paragraph run of the context.
+  void ShapeParagraph(LayoutContext *context, const char *text,
+                      const size_t start, const size_t end,
+                      const int32_t ysize);
+
+  // Switch the face of the main thread context and set its pixel size.
+  void SetContextFace(LayoutContext *context, const FaceData *face,
+                      const int32_t ysize);
+
+  // Update current_font_id_ with the current face and fallback faces.
+  void UpdateCurrentFontId();
 
   // Calculate internal/external leading value and expand a buffer if
   // necessary.
+  // top and height are the top and the height of a glyph image.
   // Returns true if the size of metrics has been changed.
-  bool UpdateMetrics(const FT_GlyphSlot glyph,
+  bool UpdateMetrics(const int32_t top, const int32_t height,
                      const FontMetrics &current_metrics,
                      FontMetrics *new_metrics);
 
   // Retrieve cached entry from the glyph cache.
   // If an entry is not found in the glyph cache, the API tries to create new
-  // cache entry and returns it if succeeded.
-  // Returns nullptr if,
+  // cache entry with the face of the context and copies it if succeeded.
+  // Returns false if,
   // - The font doesn't have the requested glyph.
   // - The glyph doesn't fit into the cache (even after trying to evict some
   // glyphs in cache based on LRU rule).
   // (e.g. Requested glyph size too large or the cache is highly fragmented.)
-  const GlyphCacheEntry *GetCachedEntry(const uint32_t code_point,
-                                        const int32_t y_size);
+  bool GetCachedEntry(LayoutContext *context, const uint32_t code_point,
+                      const int32_t y_size, GlyphCacheEntry *entry);
 
   // Update font manager, check glyph cache if the texture atlas needs to be
   // updated.
@@ -426,9 +1014,25 @@ class FontManager {
   // flushed during a rendering pass.
   void UpdatePass(const bool start_subpass);
 
-  // Update UV value in the FontBuffer.
+  // Create textures for pages of a cache that don't have a texture yet.
+  // It's used for both glyph cache atlas textures and text image textures.
+  void CreatePageTextures(
+      GlyphCache<uint8_t> *cache,
+      std::vector<std::unique_ptr<fplbase::Texture>> *textures);
+
+  // Create textures for newly allocated pages of a cache and upload dirty
+  // regions of the other pages, then clear the dirty state of the cache.
+  void UploadPages(GlyphCache<uint8_t> *cache,
+                   std::vector<std::unique_ptr<fplbase::Texture>> *textures);
+
+  // Update UV value and glyph cache pages in the FontBuffer.
   // Returns nullptr if one of UV values couldn't be updated.
-  FontBuffer *UpdateUV(const int32_t ysize, FontBuffer *buffer);
+  FontBuffer *UpdateUV(LayoutContext *context, const int32_t ysize,
+                       FontBuffer *buffer);
+
+  // Returns true if glyphs of the buffer have been moved in the glyph cache
+  // since its UVs were updated.
+  bool HasMovedGlyphs(const FontBuffer &buffer) const;
 
   // Convert requested glyph size using SizeSelector if it's set.
   int32_t ConvertSize(const int32_t size);
@@ -440,19 +1044,65 @@ class FontManager {
                            int32_t index);
 
   // Create FontBuffer with requested parameters.
+  // If async is true, glyphs missing in the glyph cache are requested to
+  // worker threads and the buffer is marked as not ready.
+  // If measure is true, the text is only shaped and broken into lines to set
+  // the size of the buffer, and any cached buffer is returned as is.
+  // When the context has a mutex, the buffer is laid out in a layout worker
+  // and only stored to the FontBuffer cache. UV of a cached buffer is updated
+  // by the following GetBuffer() call in the calling thread.
+  // The function may return nullptr if the glyph cache is full.
+  FontBuffer *CreateBuffer(LayoutContext *context, const char *text,
+                           const uint32_t length,
+                           const FontBufferParameters &parameters,
+                           const bool async, const bool measure);
+
+  // Lay out glyphs of a text into a new FontBuffer, and set its size, metrics
+  // and ready state. CreateBuffer() picks a variant specialized for the layout
+  // direction, single/multi line layout and caret info once per call, so that
+  // the glyph loop doesn't branch on them.
+  // converted_ysize is the glyph size in the glyph cache.
+  // Returns false if the glyph cache is full.
+  template <bool kRightToLeft, bool kMultiLine, bool kCaretInfo>
+  bool LayoutBuffer(LayoutContext *context, const char *text,
+                    const uint32_t length,
+                    const FontBufferParameters &parameters,
+                    const int32_t converted_ysize, const bool async,
+                    const bool measure, FontBuffer *buffer);
+
+  // Create a multi line FontBuffer with caret info from FontBuffers of each
+  // paragraph in the text. Paragraph buffers are cached in the FontBuffer
+  // cache, so that editing a paragraph only lays out the paragraph again.
   // The function may return nullptr if the glyph cache is full.
-  FontBuffer *CreateBuffer(const char *text, const uint32_t length,
-                           const FontBufferParameters &parameters);
+  FontBuffer *CreateBufferByParagraphs(LayoutContext *context, const char *text,
+                                       const uint32_t length,
+                                       const FontBufferParameters &parameters,
+                                       const bool async);
+
+  // Request a glyph to be rasterized in worker threads.
+  void RequestGlyph(const FaceData *face, const uint32_t code_point,
+                    const int32_t ysize);
+
+  // Store glyphs rasterized by worker threads to the glyph cache.
+  void UpdateRasterizedGlyphs();
 
-  // Update language related settings.
-  void SetLanguageSettings();
+  // Returns true if asynchronous rasterization is enabled.
+  bool IsAsyncRasterizationEnabled() const;
 
-  // Look up a supported locale.
+  // Update language related settings of the context's HarfBuzz buffer.
+  void SetLanguageSettings(LayoutContext *context);
+
+  // Pack up to the first 8 bytes of a locale string into an integer tag.
+  // Tags of locale strings are ordered as the strings.
+  static uint64_t PackLocaleTag(const char *locale, size_t length);
+
+  // Look up a supported locale with a packed tag in a hash table.
   // Returns nullptr if the API doesn't find the specified locale.
-  const ScriptInfo *FindLocale(const char *locale);
+  static const ScriptInfo *FindLocale(uint64_t tag);
 
-  // Check if speficied language is supported in the font manager engine.
-  bool IsLanguageSupported(const char *language);
+  // Look up a language supported in the font manager engine with a packed
+  // tag. Returns nullptr if the language is not supported.
+  static const char *FindLanguage(uint64_t tag);
 
   // Renderer instance.
   fplbase::Renderer *renderer_;
@@ -466,23 +1116,36 @@ class FontManager {
   // Pointer for current face.
   FaceData *current_face_;
 
+  // Fallback faces of the current face in the order of the look up, and the
+  // hashed ID of the chain.
+  std::vector<FaceData *> fallback_faces_;
+  HashedId current_font_id_;
+
+  // Scratch run of a text shaped with fallback faces and faces of its glyphs.
+  std::unique_ptr<ShapedRun> fallback_run_;
+  std::vector<const FaceData *> fallback_run_faces_;
+
+  // Paragraph being laid out in the main thread.
+  std::unique_ptr<ParagraphRun> paragraph_run_;
+
   // Texture cache for a rendered string image.
   // Using the FontBufferParameters as keys.
   // The map is used for GetTexture() API.
-  std::unordered_map<FontBufferParameters, std::unique_ptr<FontTexture>,
-                     FontBufferParameters> map_textures_;
+  LruCache<FontBufferParameters, FontTexture, FontBufferParameters>
+      map_textures_;
 
   // Cache for a texture atlas + vertex array rendering.
   // Using the FontBufferParameters as keys.
   // The map is used for GetBuffer() API.
-  std::unordered_map<FontBufferParameters, std::unique_ptr<FontBuffer>,
-                     FontBufferParameters> map_buffers_;
+  LruCache<FontBufferParameters, FontBuffer, FontBufferParameters>
+      map_buffers_;
 
   // Singleton instance of Freetype library.
   static FT_Library *ft_;
 
-  // Harfbuzz buffer
-  static hb_buffer_t *harfbuzz_buf_;
+  // Harfbuzz buffer of the instance, so that FontManagers can lay out texts
+  // on different threads.
+  hb_buffer_t *harfbuzz_buf_;
 
   // Unique pointer to a glyph cache.
   std::unique_ptr<GlyphCache<uint8_t>> glyph_cache_;
@@ -490,8 +1153,17 @@ class FontManager {
   // Current atlas texture's contents revision.
   uint32_t current_atlas_revision_;
 
-  // Unique pointer to a font atlas texture.
-  std::unique_ptr<fplbase::Texture> atlas_texture_;
+  // Font atlas textures. Each texture corresponds to a glyph cache page.
+  std::vector<std::unique_ptr<fplbase::Texture>> atlas_textures_;
+
+  // Text images of GetImage() packed into shared textures, created on the
+  // first GetImage() call. The FontImage cache keeps their metrics.
+  std::unique_ptr<GlyphCache<uint8_t>> image_cache_;
+  std::vector<std::unique_ptr<fplbase::Texture>> image_textures_;
+  LruCache<FontBufferParameters, FontImage, FontBufferParameters> map_images_;
+
+  // Uploader of dirty regions of glyph cache pages to atlas textures.
+  std::unique_ptr<AtlasUploader> atlas_uploader_;
 
   // Current pass counter.
   // Current implementation only supports up to 2 passes in a rendering cycle.
@@ -503,17 +1175,53 @@ class FontManager {
   // Language of input strings.
   // Used to determine line breaking depending on a language.
   uint32_t script_;
-  std::string language_;
-  std::string locale_;
+  const char *language_;
   TextLayoutDirection layout_direction_;
+  TextLayoutStrategy layout_strategy_;
   static const ScriptInfo script_table_[];
   static const char *language_table_[];
 
+  // Locales resolved by GetLocaleInfo() with their packed tags, and the
+  // current locale.
+  std::unordered_map<uint64_t, LocaleInfo> locales_;
+  const LocaleInfo *locale_;
+
   // Line height for a multi line text.
   float line_height_;
 
   // Line break info buffer used in libunibreak.
   std::vector<char> wordbreak_info_;
+
+  // Cache of HarfBuzz outputs reused across FontBuffers.
+  std::unique_ptr<ShapingCache> shaping_cache_;
+
+  // Worker threads pool for an asynchronous glyph rasterization.
+  std::unique_ptr<GlyphRasterizer> rasterizer_;
+
+  // Keys of glyphs that worker threads failed to rasterize. They're laid out
+  // without quads, so that FontBuffers using them become ready.
+  std::unordered_set<GlyphKey, GlyphKey> failed_glyphs_;
+
+  // Index buffer shared by vertex buffers of FontBuffers in the GL context of
+  // the FontManager.
+  QuadIndexBuffer quad_index_buffer_;
+
+  // Flag indicating if glyphs are rasterized as signed distance fields.
+  bool sdf_;
+
+  // Distance field generator and its output buffer used in the SDF mode.
+  std::unique_ptr<DistanceFieldGenerator> sdf_generator_;
+  std::vector<uint8_t> sdf_image_;
+
+  // Per thread layout states used in GetBuffers(), created on demand.
+  std::vector<std::unique_ptr<LayoutWorker>> layout_workers_;
+
+  // Mutex guarding the glyph cache and the FontBuffer cache in GetBuffers().
+  // Also guards stats_ while texts are laid out in parallel.
+  std::mutex layout_mutex_;
+
+  // Counters of operations since the last ResetStats() call.
+  FontStats stats_;
 };
 
 /// @class FontMetrics
@@ -663,29 +1371,87 @@ class FontTexture : public fplbase::Texture {
   FontMetrics metrics_;
 };
 
+/// @class FontImage
+///
+/// @brief An image of a single line text in a texture shared with other text
+/// images. It's retrieved with `FontManager::GetImage()`.
+class FontImage {
+ public:
+  /// @brief The default constructor for a FontImage.
+  FontImage() : texture_(nullptr), uv_(mathfu::kZeros4f), size_(0, 0) {}
+
+  /// @return Returns the texture that contains the image.
+  fplbase::Texture *get_texture() const { return texture_; }
+
+  /// @return Returns the UV rect (u0, v0, u1, v1) of the image in the
+  /// texture.
+  const mathfu::vec4 &get_uv() const { return uv_; }
+
+  /// @return Returns the size of the image in pixels.
+  const mathfu::vec2i &get_size() const { return size_; }
+
+  /// @return Returns a const reference to the FontMetrics that specifies
+  /// the metrics parameters for the image.
+  const FontMetrics &get_metrics() const { return metrics_; }
+
+ private:
+  friend class FontManager;
+
+  fplbase::Texture *texture_;
+  mathfu::vec4 uv_;
+  mathfu::vec2i size_;
+  FontMetrics metrics_;
+};
+
+/// @var kFontVertexUVScale
+///
+/// @brief Scale of UV values stored in FontVertex as unorm16.
+const float kFontVertexUVScale = 65535.0f;
+
 /// @struct FontVertex
 ///
 /// @brief This struct holds all the font vertex data.
+///
+/// A vertex is 12 bytes: a 2D position in pixels and an atlas UV stored as
+/// unsigned normalized 16 bit values. Glyphs are always rendered on the z = 0
+/// plane.
 struct FontVertex {
   /// @brief The constructor for a FontVertex.
   ///
   /// @param[in] x A float representing the `x` position of the vertex.
   /// @param[in] y A float representing the `y` position of the vertex.
-  /// @param[in] z A float representing the `z` position of the vertex.
   /// @param[in] u A float representing the `u` value in the UV mapping.
   /// @param[in] v A float representing the `v` value in the UV mapping.
-  FontVertex(const float x, const float y, const float z, const float u,
-             const float v) {
+  FontVertex(const float x, const float y, const float u, const float v) {
     position_.data[0] = x;
     position_.data[1] = y;
-    position_.data[2] = z;
-    uv_.data[0] = u;
-    uv_.data[1] = v;
+    set_uv(mathfu::vec2(u, v));
+  }
+
+  /// @return Returns the position of the vertex.
+  mathfu::vec2 position() const { return mathfu::vec2(position_); }
+
+  /// @return Returns the UV value of the vertex in [0, 1].
+  mathfu::vec2 uv() const {
+    return mathfu::vec2(uv_[0], uv_[1]) * (1.0f / kFontVertexUVScale);
+  }
+
+  /// @brief Set the UV value of the vertex.
+  ///
+  /// @param[in] uv The UV value. It's clamped to [0, 1].
+  void set_uv(const mathfu::vec2 &uv) {
+    uv_[0] = PackUV(uv.x());
+    uv_[1] = PackUV(uv.y());
   }
 
   /// @cond FONT_MANAGER_INTERNAL
-  mathfu::vec3_packed position_;
-  mathfu::vec2_packed uv_;
+  static uint16_t PackUV(const float value) {
+    auto clamped = value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+    return static_cast<uint16_t>(clamped * kFontVertexUVScale + 0.5f);
+  }
+
+  mathfu::vec2_packed position_;
+  uint16_t uv_[2];
   /// @endcond
 };
 
@@ -704,8 +1470,19 @@ class FontBuffer {
   /// @brief The number of vertices per code point.
   static const int32_t kVerticesPerCodePoint = 4;
 
+  /// @var kMaxGlyphsPerDraw
+  ///
+  /// @brief The number of glyphs covered by `GetQuadIndices()`, which is the
+  /// max # of glyphs addressable with 16 bit indices.
+  static const int32_t kMaxGlyphsPerDraw = 0x10000 / kVerticesPerCodePoint;
+
   /// @brief The default constructor for a FontBuffer.
-  FontBuffer() : revision_(0) {}
+  FontBuffer()
+      : revision_(0),
+        move_revision_(0),
+        uv_version_(0),
+        ready_state_(true),
+        measured_state_(false) {}
 
   /// @brief The constructor for FontBuffer with a given buffer size.
   ///
@@ -719,8 +1496,13 @@ class FontBuffer {
   ///
   /// Since it has a strong relationship to rendering positions, we store the
   /// caret position information in the FontBuffer.
-  FontBuffer(uint32_t size, bool caret_info) : revision_(0) {
-    indices_.reserve(size * kIndiciesPerCodePoint);
+  FontBuffer(uint32_t size, bool caret_info)
+      : revision_(0),
+        move_revision_(0),
+        uv_version_(0),
+        ready_state_(true),
+        measured_state_(false) {
+    glyph_pages_.reserve(size);
     vertices_.reserve(size * kVerticesPerCodePoint);
     code_points_.reserve(size);
     if (caret_info) {
@@ -741,11 +1523,45 @@ class FontBuffer {
   /// @param[in] metrics The FontMetrics to set for the font texture.
   void set_metrics(const FontMetrics &metrics) { metrics_ = metrics; }
 
-  /// @return Returns the indices array as a std::vector<uint16_t>.
-  std::vector<uint16_t> *get_indices() { return &indices_; }
-
+  /// @brief Retrieve the index array shared by all FontBuffers.
+  ///
+  /// Glyphs are stored as quads of `kVerticesPerCodePoint` vertices, so that
+  /// every buffer uses the same index pattern. Glyph `i` of a vertices array
+  /// is rendered with indices `[i * kIndiciesPerCodePoint,
+  /// (i + 1) * kIndiciesPerCodePoint)` of the array.
+  ///
+  /// @note The array covers `kMaxGlyphsPerDraw` glyphs. Longer vertices
+  /// arrays need to be rendered in chunks of `kMaxGlyphsPerDraw` glyphs.
+  ///
   /// @return Returns the indices array as a const std::vector<uint16_t>.
-  const std::vector<uint16_t> *get_indices() const { return &indices_; }
+  static const std::vector<uint16_t> &GetQuadIndices();
+
+  /// @brief Retrieve a glyph cache page used by a glyph.
+  ///
+  /// @note Each glyph needs to be rendered with an atlas texture of its page.
+  ///
+  /// @param[in] index The index of the glyph entry.
+  ///
+  /// @return Returns the index of the glyph cache page.
+  int32_t get_glyph_page(const int32_t index) const {
+    return glyph_pages_[index];
+  }
+
+  /// @return Returns the glyph cache pages of all glyph entries as a const
+  /// std::vector<int32_t>.
+  const std::vector<int32_t> &get_glyph_pages() const { return glyph_pages_; }
+
+  /// @brief Retrieve a vertex buffer object holding the vertices.
+  ///
+  /// The vertex buffer is created on the first call, and the vertices are
+  /// uploaded again only when their UVs have been updated, so that a cached
+  /// buffer is rendered without copying its vertices every frame.
+  ///
+  /// @note Call this on the thread owning the GL context. The FontBuffer
+  /// needs to be released on the thread once the vertex buffer is created.
+  ///
+  /// @return Returns the vertex buffer of the FontBuffer.
+  FontVertexBuffer *GetVertexBuffer() const;
 
   /// @return Returns the vertices array as a std::vector<FontVertex>.
   std::vector<FontVertex> *get_vertices() { return &vertices_; }
@@ -787,6 +1603,21 @@ class FontBuffer {
   /// font_manager try to re-construct the buffer.
   void set_revision(const uint32_t revision) { revision_ = revision; }
 
+  /// @return Returns the glyph cache move revision the UVs of the buffer are
+  /// up to date with.
+  ///
+  /// @note Compacting the glyph cache moves glyphs without evicting them. The
+  /// UVs are updated when a page used by the buffer has moved glyphs since
+  /// the move revision.
+  uint32_t get_move_revision() const { return move_revision_; }
+
+  /// @brief Sets the glyph cache move revision.
+  ///
+  /// @param[in] move_revision The uint32_t containing the new move revision.
+  void set_move_revision(const uint32_t move_revision) {
+    move_revision_ = move_revision;
+  }
+
   /// @return Returns the pass counter as an int32_t.
   ///
   /// @note In the render pass, this value is used if the user of the class
@@ -799,6 +1630,32 @@ class FontBuffer {
   /// needs to call `StartRenderPass()` to upload the atlas texture.
   void set_pass(const int32_t pass) { pass_ = pass; }
 
+  /// @return Returns `true` if all glyphs in the buffer are rasterized and
+  /// stored in the glyph cache.
+  ///
+  /// @note A buffer retrieved with GlyphRasterizeModeNextFrame may not be
+  /// ready while worker threads rasterize the glyphs. Glyphs that are not
+  /// ready are not rendered.
+  bool get_ready_state() const { return ready_state_; }
+
+  /// @brief Set the ready state of the buffer.
+  ///
+  /// @param[in] ready_state Set `false` if some glyphs in the buffer are
+  /// being rasterized.
+  void set_ready_state(const bool ready_state) { ready_state_ = ready_state; }
+
+  /// @return Returns `true` if the buffer has only been measured by
+  /// `FontManager::MeasureText()`. A measured buffer has the size and the
+  /// metrics of the text, but no glyphs.
+  bool get_measured_state() const { return measured_state_; }
+
+  /// @brief Set the measured state of the buffer.
+  ///
+  /// @param[in] measured_state Set `true` if the buffer has no glyphs.
+  void set_measured_state(const bool measured_state) {
+    measured_state_ = measured_state;
+  }
+
   /// @brief Adds 4 vertices to be used for a glyph rendering to the
   /// vertex array.
   ///
@@ -829,6 +1686,47 @@ class FontBuffer {
   /// components of the vector.
   void UpdateUV(const int32_t index, const mathfu::vec4 &uv);
 
+  /// @brief Add glyph cache page information of a new glyph entry.
+  ///
+  /// @param[in] page The glyph cache page that stores the glyph image.
+  void AddPage(const int32_t page) { glyph_pages_.push_back(page); }
+
+  /// @brief Reserve the glyph buffers for a number of glyphs.
+  ///
+  /// The buffers grow geometrically, so that reserving a few glyphs at a time
+  /// doesn't reallocate the buffers each time.
+  ///
+  /// @param[in] size The number of glyphs the buffers need to hold.
+  void Reserve(const size_t size) {
+    if (code_points_.capacity() >= size) return;
+    auto capacity = std::max(size, code_points_.capacity() * 2);
+    glyph_pages_.reserve(capacity);
+    vertices_.reserve(capacity * kVerticesPerCodePoint);
+    code_points_.reserve(capacity);
+  }
+
+  /// @brief Update glyph cache page information of a glyph entry.
+  ///
+  /// @param[in] index The index of the glyph entry that should be updated.
+  /// @param[in] page The glyph cache page that stores the glyph image.
+  ///
+  /// @return Returns `true` if the page has been changed.
+  bool UpdatePage(const int32_t index, const int32_t page) {
+    if (glyph_pages_[index] == page) return false;
+    glyph_pages_[index] = page;
+    return true;
+  }
+
+  /// @brief Append glyphs and caret positions of another FontBuffer.
+  ///
+  /// @param[in] buffer The FontBuffer to append.
+  /// @param[in] offset The position of `buffer` in this buffer.
+  /// @param[in] last_caret Set to `false` to skip the last caret position of
+  /// `buffer`, which overlaps the first caret position of a following
+  /// buffer.
+  void Append(const FontBuffer &buffer, const mathfu::vec2 &offset,
+              const bool last_caret);
+
   /// @brief Verifies that the sizes of the arrays used in the buffer are
   /// correct.
   ///
@@ -837,7 +1735,7 @@ class FontBuffer {
   /// @return Returns `true`.
   bool Verify() {
     assert(vertices_.size() == code_points_.size() * kVerticesPerCodePoint);
-    assert(indices_.size() == code_points_.size() * kIndiciesPerCodePoint);
+    assert(glyph_pages_.size() == code_points_.size());
     return true;
   }
 
@@ -863,16 +1761,29 @@ class FontBuffer {
   /// If the caret positions array has 0 elements, it will return `false`.
   bool HasCaretPositions() const { return caret_positions_.capacity() != 0; }
 
+  /// @return Returns a const reference to indices of the first caret position
+  /// of each line in the caret positions buffer, in ascending order.
+  const std::vector<int32_t> &GetLineStarts() const { return line_starts_; }
+
+  /// @brief Retrieve a line of a caret position with a binary search.
+  ///
+  /// @param[in] index The index of the caret position.
+  ///
+  /// @return Returns the line index of the caret position. Returns 0 if the
+  /// buffer does not contain caret information.
+  int32_t GetCaretLine(size_t index) const;
+
  private:
   // Font metrics information.
   FontMetrics metrics_;
 
-  // Arrays for font indices, vertices and code points.
+  // Arrays for font vertices and code points.
   // They are hold as a separate vector because OpenGL draw call needs them to
-  // be a separate array.
+  // be a separate array. Indices are shared by all buffers (GetQuadIndices()).
 
-  // Indices of the font buffer.
-  std::vector<uint16_t> indices_;
+  // Glyph cache page of each glyph entry. Glyphs in a buffer may be stored in
+  // different pages, and are moved to other pages when the cache is flushed.
+  std::vector<int32_t> glyph_pages_;
 
   // Vertices data of the font buffer.
   std::vector<FontVertex> vertices_;
@@ -886,6 +1797,15 @@ class FontBuffer {
   // can include multiple caret positions.
   std::vector<mathfu::vec2i> caret_positions_;
 
+  // Indices of the first caret position of each line in caret_positions_.
+  // A caret with a new y position starts a new line.
+  std::vector<int32_t> line_starts_;
+
+  // Faces of glyphs laid out with fallback fonts, as pairs of the first glyph
+  // index of a run and the face. nullptr stands for the face the buffer is
+  // laid out with, which is also used before the first run.
+  std::vector<std::pair<int32_t, const FaceData *>> face_runs_;
+
   // Size of the string in pixels.
   mathfu::vec2i size_;
 
@@ -894,8 +1814,27 @@ class FontBuffer {
   // entries by checking the revision.
   uint32_t revision_;
 
+  // Glyph cache move revision the UVs are up to date with.
+  uint32_t move_revision_;
+
+  // Incremented each time UVs are updated, so that the vertex buffer is
+  // uploaded again only when the vertices changed.
+  uint32_t uv_version_;
+
   // Pass id. Each pass should have it's own texture atlas contents.
   int32_t pass_;
+
+  // Flag indicating if all glyphs in the buffer are available.
+  bool ready_state_;
+
+  // Flag indicating if the buffer only has the size and the metrics.
+  bool measured_state_;
+
+  // GPU copy of the vertices, created on the first GetVertexBuffer() call.
+  mutable std::unique_ptr<FontVertexBuffer> vertex_buffer_;
+
+  // FontManager serializes, restores and measures the buffer contents.
+  friend class FontManager;
 };
 
 /// @class FaceData
@@ -907,7 +1846,11 @@ class FontBuffer {
 class FaceData {
  public:
   /// @brief The default constructor for FaceData.
-  FaceData() : face_(nullptr), harfbuzz_font_(nullptr), font_id_(kNullHash) {}
+  FaceData()
+      : face_(nullptr),
+        harfbuzz_font_(nullptr),
+        font_id_(kNullHash),
+        font_hash_(kNullHash) {}
 
   /// @brief The destructor for FaceData.
   ///
@@ -931,12 +1874,25 @@ class FaceData {
   ///
   /// @brief Opened font file data.
   ///
-  /// The file needs to be kept open until FreeType finishes using the file.
-  std::string font_data_;
+  /// The file is memory mapped when possible, and shared by faces opened with
+  /// the same file name in all FontManager instances. The data needs to be
+  /// kept alive until FreeType finishes using the file.
+  std::shared_ptr<FontData> font_data_;
 
   /// @var font_id_
   /// @brief Hashed value of the font face.
   HashedId font_id_;
+
+  /// @var font_hash_
+  /// @brief Hashed value of the font file contents.
+  ///
+  /// The value is used to validate persistent caches created with the font.
+  HashedId font_hash_;
+
+  /// @var coverage_
+  /// @brief Code points the font face has glyphs for, built from the cmap
+  /// when the font is opened. Used to pick fallback fonts.
+  CoverageSet coverage_;
 };
 
 /// @struct ScriptInfo
@@ -0,0 +1,93 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ATLAS_UPLOADER_H
+#define ATLAS_UPLOADER_H
+
+#include <vector>
+
+#include "fplbase/renderer.h"
+#include "mathfu/constants.h"
+
+/// @cond FLATUI_INTERNAL
+namespace flatui {
+
+// AtlasUploader uploads dirty rects of a glyph cache page to its atlas
+// texture.
+// Each rect is uploaded with its own width instead of full rows of the page.
+// Because OpenGL ES 2 can't upload a sub-rect of a wider image, rows of the
+// rects are packed into a staging buffer first.
+// When built with FLATUI_PIXEL_BUFFER_UPLOAD, the staging buffer is a pair of
+// pixel buffer objects used alternately, so that glTexSubImage2D() returns
+// without waiting for the GPU to read the previous upload.
+class AtlasUploader {
+ public:
+  AtlasUploader();
+  ~AtlasUploader();
+
+  // Upload dirty rects of a luminance image to a texture.
+  // texture: texture of the same size as the image.
+  // image: contents of the whole page.
+  // image_size: size of the image.
+  // rects: disjoint rects (x0, y0, x1, y1) to upload.
+  void Upload(fplbase::Texture *texture, const uint8_t *image,
+              const mathfu::vec2i &image_size,
+              const std::vector<mathfu::vec4i> &rects);
+
+  // Getter of # of bytes uploaded by the last Upload() call.
+  size_t get_uploaded_bytes() const { return uploaded_bytes_; }
+
+ private:
+  // Expand the rect horizontally to 4 pixels boundaries, so that packed rows
+  // have the same stride regardless of GL_UNPACK_ALIGNMENT.
+  static mathfu::vec4i AlignRect(const mathfu::vec4i &rect,
+                                 const mathfu::vec2i &image_size);
+
+  // Copy rows of the rects to the destination buffer.
+  static void PackRects(const uint8_t *image, const mathfu::vec2i &image_size,
+                        const std::vector<mathfu::vec4i> &rects,
+                        uint8_t *dest);
+
+  // Upload packed rects. data is a pointer to the packed rows, or an offset
+  // in the bound pixel buffer object.
+  static void UploadPackedRects(const std::vector<mathfu::vec4i> &rects,
+                                const uint8_t *data);
+
+#ifdef FLATUI_PIXEL_BUFFER_UPLOAD
+  // Upload rects through a pixel buffer object.
+  // Returns false if the buffer couldn't be mapped.
+  bool UploadWithPixelBuffer(const uint8_t *image,
+                             const mathfu::vec2i &image_size, size_t size);
+
+  // Pixel buffer objects used alternately.
+  static const int32_t kNumPixelBuffers = 2;
+  uint32_t pixel_buffers_[kNumPixelBuffers];
+  int32_t current_pixel_buffer_;
+#endif
+
+  // Aligned rects of the current upload.
+  std::vector<mathfu::vec4i> aligned_rects_;
+
+  // Staging buffer of packed rows. The buffer keeps its capacity across
+  // uploads.
+  std::vector<uint8_t> staging_;
+
+  // # of bytes uploaded by the last Upload() call.
+  size_t uploaded_bytes_;
+};
+
+}  // namespace flatui
+/// @endcond
+
+#endif  // ATLAS_UPLOADER_H
@@ -0,0 +1,83 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COVERAGE_SET_H
+#define COVERAGE_SET_H
+
+#include <cstdint>
+#include <vector>
+
+/// @cond FLATUI_INTERNAL
+namespace flatui {
+
+// CoverageSet is a sparse bitmap of code points a font face has glyphs for.
+// Code points are grouped into blocks of 256, and only blocks with at least
+// one code point have a bitmap, so that a CJK font with tens of thousands of
+// glyphs takes a few KB and a look up is two array accesses.
+class CoverageSet {
+ public:
+  CoverageSet() {}
+  ~CoverageSet() {}
+
+  // Add a code point to the set.
+  void Add(uint32_t code_point) {
+    auto block = code_point >> kBlockShift;
+    if (block >= blocks_.size()) {
+      blocks_.resize(block + 1, kEmptyBlock);
+    }
+    if (blocks_[block] == kEmptyBlock) {
+      blocks_[block] = static_cast<int32_t>(bits_.size());
+      bits_.resize(bits_.size() + kWordsPerBlock, 0);
+    }
+    bits_[blocks_[block] + ((code_point & kBlockMask) >> 6)] |=
+        1ULL << (code_point & 63);
+  }
+
+  // Returns true if the code point is in the set.
+  bool Contains(uint32_t code_point) const {
+    auto block = code_point >> kBlockShift;
+    if (block >= blocks_.size() || blocks_[block] == kEmptyBlock) {
+      return false;
+    }
+    return (bits_[blocks_[block] + ((code_point & kBlockMask) >> 6)] >>
+            (code_point & 63)) & 1;
+  }
+
+  // Returns true if the set has no code points.
+  bool IsEmpty() const { return bits_.empty(); }
+
+  // Remove all code points.
+  void Clear() {
+    blocks_.clear();
+    bits_.clear();
+  }
+
+ private:
+  static const uint32_t kBlockShift = 8;
+  static const uint32_t kBlockMask = (1 << kBlockShift) - 1;
+  static const int32_t kWordsPerBlock = (1 << kBlockShift) / 64;
+  static const int32_t kEmptyBlock = -1;
+
+  // Offsets of blocks in bits_, or kEmptyBlock for blocks without code
+  // points.
+  std::vector<int32_t> blocks_;
+
+  // Bitmaps of blocks with code points.
+  std::vector<uint64_t> bits_;
+};
+
+}  // namespace flatui
+/// @endcond
+
+#endif  // COVERAGE_SET_H
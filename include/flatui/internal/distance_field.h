@@ -0,0 +1,75 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DISTANCE_FIELD_H
+#define DISTANCE_FIELD_H
+
+#include <cstdint>
+#include <vector>
+
+/// @cond FLATUI_INTERNAL
+namespace flatui {
+
+// Threshold of the glyph edge in the generated distance field.
+// A texel value of (kDistanceFieldEdge * 255) is on the glyph outline, values
+// above it are inside of the glyph.
+const float kDistanceFieldEdge = 0.75f;
+
+// Generates a signed distance field image from a 8 bit coverage bitmap
+// rasterized by FreeType.
+// The generator uses the linear-time Euclidean distance transform by
+// Felzenszwalb & Huttenlocher for inside and outside of the glyph, with
+// sub-pixel offsets derived from anti-aliased coverage values.
+// The instance keeps working buffers to avoid allocations for each glyph, so
+// that an instance must not be shared between threads.
+class DistanceFieldGenerator {
+ public:
+  DistanceFieldGenerator() {}
+  ~DistanceFieldGenerator() {}
+
+  // Generate a distance field.
+  // bitmap: coverage bitmap of the glyph.
+  // width, height: size of the bitmap.
+  // pitch: # of bytes in a row of the bitmap.
+  // padding: # of pixels added to each side of the glyph. It's also used as
+  // a max distance encoded in the output.
+  // output: a buffer to store the generated image with the size of
+  // (width + padding * 2) x (height + padding * 2).
+  void Generate(const uint8_t *bitmap, const int32_t width,
+                const int32_t height, const int32_t pitch,
+                const int32_t padding, std::vector<uint8_t> *output);
+
+ private:
+  // Perform 2D distance transform on the grid.
+  void Transform2D(std::vector<float> *grid, const int32_t width,
+                   const int32_t height);
+
+  // Perform 1D distance transform on the working buffers.
+  void Transform1D(const int32_t length);
+
+  // Squared distances to outside and inside of the glyph.
+  std::vector<float> grid_outer_;
+  std::vector<float> grid_inner_;
+
+  // Working buffers for 1D transform.
+  std::vector<float> f_;
+  std::vector<float> d_;
+  std::vector<int32_t> v_;
+  std::vector<float> z_;
+};
+
+}  // namespace flatui
+/// @endcond
+
+#endif  // DISTANCE_FIELD_H
@@ -50,6 +50,25 @@ inline HashedId HashId(const char *id) {
   return hash;
 }
 
+/// @brief Hash a part of a string into a `HashId`.
+///
+/// The hash of a string is the same as `HashId(const char *)` of the
+/// C-string with the same contents.
+///
+/// @param[in] text A pointer to the string. It doesn't need to be
+/// null-terminated.
+/// @param[in] length The length of the string in bytes.
+///
+/// @return Returns the HashId corresponding to the string.
+inline HashedId HashId(const char *text, size_t length) {
+  HashedId hash = 0x84222325;
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ static_cast<uint8_t>(text[i])) * 0x000001b3;
+  }
+  assert(hash != kNullHash);
+  return hash;
+}
+
 /// @brief Hash a pointer to an object, of which there is guaranteed to be only
 /// one (e.g. a texture).
 ///
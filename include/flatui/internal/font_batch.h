@@ -0,0 +1,123 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FONT_BATCH_H
+#define FONT_BATCH_H
+
+#include <vector>
+
+#include "flatui/font_manager.h"
+#include "fplbase/renderer.h"
+
+/// @cond FLATUI_INTERNAL
+namespace flatui {
+
+// A clipping rect coordinate used for labels without clipping.
+// The value is kept small enough to be interpolated in mediump precision.
+const float kFontBatchNoClipping = 32767.0f;
+
+// FontBatch accumulates glyphs of multiple labels into a vertex buffer per
+// atlas page, so that they are rendered with a draw call per page using the
+// quad indices shared by all FontBuffers.
+// A label position, a color, a clipping rect and a SDF smoothing width are
+// baked into each vertex, so that labels with different parameters can be
+// merged in a batch.
+// Long labels are not copied into the batch. They are rendered right away
+// from GPU-resident vertices of their FontBuffers.
+// The owner needs to flush the batch before changing a render state that
+// affects the batch, such as a scissor rect or other draw calls that need to
+// be rendered on top of the labels.
+class FontBatch {
+ public:
+  FontBatch() : shader_(nullptr), num_labels_(0), num_draw_calls_(0) {}
+  ~FontBatch() {}
+
+  // Append glyphs of a FontBuffer to the batch.
+  // renderer, fontman: used to flush the batch when the batch is full or the
+  // shader needs to be switched.
+  // shader: shader to render the batch.
+  // offset: position of the label on the screen.
+  // clipping: a clipping rect (x0, y0, x1, y1) on the screen.
+  // color: text color.
+  // smoothing: smoothing width of the SDF glyph edge.
+  void Add(fplbase::Renderer &renderer, FontManager &fontman,
+           fplbase::Shader *shader, const FontBuffer &buffer,
+           const mathfu::vec2 &offset, const mathfu::vec4 &clipping,
+           const mathfu::vec4 &color, float smoothing);
+
+  // Render all glyphs in the batch and clear the batch.
+  void Flush(fplbase::Renderer &renderer, FontManager &fontman);
+
+  // Discard all glyphs in the batch without rendering them.
+  void Clear();
+
+  // Returns true if a rect (x0, y0, x1, y1) on the screen overlaps a label in
+  // the batch.
+  bool Overlaps(const mathfu::vec4 &rect) const;
+
+  // Returns true if Add() renders the buffer right away instead of adding it
+  // to the batch.
+  static bool RendersDirectly(const FontBuffer &buffer);
+
+  // Returns true if the batch has no glyphs.
+  bool IsEmpty() const { return num_labels_ == 0; }
+
+  // Getter of # of labels merged in the batch since the last flush.
+  int32_t get_num_labels() const { return num_labels_; }
+
+  // Getter of # of draw calls issued since the last ResetDrawCallCount().
+  int32_t get_num_draw_calls() const { return num_draw_calls_; }
+  void ResetDrawCallCount() { num_draw_calls_ = 0; }
+
+ private:
+  // Render a label from the vertex buffer object of the FontBuffer, with
+  // the same parameters as Add().
+  void RenderDirect(fplbase::Renderer &renderer, FontManager &fontman,
+                    fplbase::Shader *shader, const FontBuffer &buffer,
+                    const mathfu::vec2 &offset, const mathfu::vec4 &clipping,
+                    const mathfu::vec4 &color, float smoothing);
+
+  // Vertex of the batch. The layout needs to match kFontBatchFormat.
+  struct FontBatchVertex {
+    mathfu::vec3_packed position_;
+    mathfu::vec2_packed uv_;
+    // Smoothing width of the SDF glyph edge in x. y is unused.
+    mathfu::vec2_packed smoothing_;
+    // Clipping rect on the screen.
+    mathfu::vec4_packed clipping_;
+    uint8_t color_[4];
+  };
+
+  // Shader used to render the current batch.
+  fplbase::Shader *shader_;
+
+  // Vertices of glyphs in the batch per atlas page.
+  // Each page is rendered with a draw call, so that glyphs in different pages
+  // may be drawn out of the order they are added.
+  std::vector<std::vector<FontBatchVertex>> vertices_;
+
+  // Clipped rects (x0, y0, x1, y1) of labels in the batch on the screen.
+  std::vector<mathfu::vec4> rects_;
+
+  // # of labels merged in the batch.
+  int32_t num_labels_;
+
+  // # of draw calls issued by Flush().
+  int32_t num_draw_calls_;
+};
+
+}  // namespace flatui
+/// @endcond
+
+#endif  // FONT_BATCH_H
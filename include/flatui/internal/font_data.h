@@ -0,0 +1,80 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FONT_DATA_H
+#define FONT_DATA_H
+
+#include <memory>
+#include <string>
+
+/// @cond FLATUI_INTERNAL
+#if defined(__ANDROID__)
+struct AAsset;
+#endif
+
+namespace flatui {
+
+// FontData holds the contents of a font file.
+// The file is memory mapped when possible, so that pages of the file are
+// loaded on demand and can be dropped by the OS instead of staying in the
+// heap. On Android, the file is mapped from the APK with the asset manager.
+// When the file can't be mapped (e.g. a compressed asset), it's loaded to
+// the heap.
+// FontData opened with the same file name are shared by all FontManager
+// instances, and the file is unmapped when the last reference is released.
+class FontData {
+ public:
+  ~FontData();
+
+  // Open a font file or return the shared instance of the file.
+  // Returns nullptr if the file can't be opened.
+  static std::shared_ptr<FontData> Open(const char *file_name);
+
+  // Getters of the file contents.
+  const unsigned char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+  // Returns true if the contents are memory mapped.
+  bool is_mapped() const { return data_ != nullptr && heap_data_.empty(); }
+
+ private:
+  FontData();
+
+  // Map the file. Returns false if the file can't be mapped.
+  bool Map(const char *file_name);
+
+  // Release the mapping.
+  void Unmap();
+
+  // Contents of the file, either mapped or pointing to heap_data_.
+  const unsigned char *data_;
+  size_t size_;
+
+  // Contents of the file loaded to the heap when it can't be mapped.
+  std::string heap_data_;
+
+#if defined(__ANDROID__)
+  // Asset of the mapped file.
+  AAsset *asset_;
+#endif
+
+  // Disable copy constructor.
+  FontData(const FontData &);
+  FontData &operator=(const FontData &);
+};
+
+}  // namespace flatui
+/// @endcond
+
+#endif  // FONT_DATA_H
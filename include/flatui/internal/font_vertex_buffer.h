@@ -0,0 +1,94 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FONT_VERTEX_BUFFER_H
+#define FONT_VERTEX_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+
+/// @cond FLATUI_INTERNAL
+namespace flatui {
+
+struct FontVertex;
+
+// QuadIndexBuffer keeps FontBuffer::GetQuadIndices() in an index buffer
+// object. Each FontManager owns one for the FontBuffers it renders, so that
+// the index buffer belongs to the GL context of the FontManager's thread.
+// The object must be used and destroyed on the thread owning the GL context.
+class QuadIndexBuffer {
+ public:
+  QuadIndexBuffer();
+  ~QuadIndexBuffer();
+
+  // Bind the index buffer, uploading the indices on the first call.
+  void Bind();
+
+ private:
+  // Index buffer object.
+  uint32_t index_buffer_;
+
+  // Disable copy constructor.
+  QuadIndexBuffer(const QuadIndexBuffer &);
+  QuadIndexBuffer &operator=(const QuadIndexBuffer &);
+};
+
+// FontVertexBuffer keeps vertices of a FontBuffer in a vertex buffer object,
+// so that a label is rendered without copying its vertices every frame.
+// The vertices are uploaded once, and again only when the FontBuffer's UVs
+// are updated.
+// Indices come from a QuadIndexBuffer shared by vertex buffers rendered in the
+// same GL context.
+// The object must be used and destroyed on the thread owning the GL context.
+class FontVertexBuffer {
+ public:
+  FontVertexBuffer();
+  ~FontVertexBuffer();
+
+  // Upload vertices unless they're already uploaded with the UV version of the
+  // FontBuffer.
+  // Returns # of bytes uploaded.
+  size_t Update(const FontVertex *vertices, size_t num_vertices,
+                uint32_t uv_version);
+
+  // Bind the vertex buffer and the shared index buffer, and enable the
+  // position and UV attribute arrays. Other attributes used by a shader need
+  // to be set as constant vertex attributes by the caller.
+  void Bind(QuadIndexBuffer *index_buffer) const;
+
+  // Disable the attribute arrays and unbind the buffers.
+  static void Unbind();
+
+  // Render glyphs [first_glyph, first_glyph + num_glyphs) with the bound
+  // shader and texture. Glyphs beyond the range of 16 bit indices are
+  // rendered in chunks.
+  // Returns # of draw calls issued.
+  int32_t Render(int32_t first_glyph, int32_t num_glyphs) const;
+
+ private:
+  // Set the attribute pointers to vertices starting at a given vertex.
+  static void SetAttributes(size_t first_vertex);
+
+  // Vertex buffer object.
+  uint32_t vertex_buffer_;
+
+  // # of vertices and the UV version of the last upload.
+  size_t num_vertices_;
+  uint32_t uv_version_;
+};
+
+}  // namespace flatui
+/// @endcond
+
+#endif  // FONT_VERTEX_BUFFER_H
@@ -15,9 +15,9 @@
 #ifndef GLYPH_CACH_H
 #define GLYPH_CACH_H
 
-#include <list>
-#include <map>
-#include <unordered_map>
+#include <algorithm>
+#include <memory>
+#include <vector>
 
 #include "flatui_util.h"
 #include "fplbase/utilities.h"
@@ -40,14 +40,23 @@ namespace flatui {
 // caching perfomance estimating same size of glphys tends to be stored in a
 // cache at same time. (e.g. Caching a string in a same size.)
 //
-// When looking up a cached entry, the API looks up unordered_map which is O(1)
-// operation.
+// When looking up a cached entry, the API looks up an open addressing hash
+// table keyed by a packed 64 bit GlyphKey, which is O(1) operation.
+// Entries and rows are kept in index based pools and rows are linked with an
+// intrusive LRU list, so that lookups and insertions neither allocate memory
+// nor chase list nodes.
 // If there is no cached entry for given code point, the caller needs to invoke
 // Set() API to fill in a cache.
 // Set() operation takes
 // O(log N (N=# of rows)) when there is a room in the cache for the request,
 // + O(N (N=# of rows)) to look up and evict least recently used row with
 // sufficient height.
+//
+// The cache can be backed by multiple pages of the same size (each page
+// corresponds to one atlas texture). When no row fits a new entry, the cache
+// allocates a new page instead of failing, up to the max # of pages given at
+// the construction time. Once all pages are allocated, a least recently used
+// page that is not used in the current cycle is flushed and recycled.
 
 // Enable tracking stats in Debug build.
 #ifdef _DEBUG
@@ -68,51 +77,111 @@ const int32_t kGlyphCacheHeightRound = 4;
 const int32_t kGlyphCachePaddingX = 1;
 const int32_t kGlyphCachePaddingY = 1;
 
+// A sentinel value of a page index that indicates no page is found.
+const int32_t kGlyphCachePageInvalid = -1;
+
+// A sentinel value of entry and row indices that indicates no element.
+const int32_t kGlyphCacheIndexInvalid = -1;
+
+// # of bits of a code point and a glyph size packed in GlyphKey.
+// A code point is a glyph index in a font file, which fits in 16 bits for
+// OpenType fonts.
+const int32_t kGlyphKeyCodePointBits = 21;
+const int32_t kGlyphKeyGlyphSizeBits = 11;
+
+// Code point of an invalid GlyphKey, reserved for parameters that don't fit
+// the packed key. The cache never stores invalid keys.
+const uint32_t kGlyphKeyCodePointInvalid = (1U << kGlyphKeyCodePointBits) - 1;
+
 // TODO: Provide proper int specialization in mathfu.
 static inline int32_t RoundUpToPowerOf2(int32_t x) {
   return static_cast<int32_t>(mathfu::RoundUpToPowerOf2(static_cast<float>(x)));
 }
 
 // Class that includes glyph parameters.
+// Parameters are packed in a 64 bit integer as
+// [font id:32][code point:21][glyph size:11] so that keys are compared and
+// hashed as a single integer.
 class GlyphKey {
  public:
   // Constructors.
-  GlyphKey() : font_id_(kNullHash), code_point_(0), glyph_size_(0) {}
+  GlyphKey() : key_(Pack(kNullHash, 0, 0)) {}
   GlyphKey(const HashedId font_id, uint32_t code_point, uint32_t glyph_size) {
-    font_id_ = font_id;
-    code_point_ = code_point;
-    glyph_size_ = glyph_size;
+    if (code_point >= kGlyphKeyCodePointInvalid ||
+        glyph_size >= (1U << kGlyphKeyGlyphSizeBits)) {
+      // Truncated parameters would alias another glyph. Make the key invalid
+      // so that the cache treats it as a miss.
+      code_point = kGlyphKeyCodePointInvalid;
+      glyph_size = 0;
+    }
+    key_ = Pack(font_id, code_point, glyph_size);
   }
 
-  // Compare operator.
-  bool operator==(const GlyphKey& other) const {
-    return (code_point_ == other.code_point_ && font_id_ == other.font_id_ &&
-            glyph_size_ == other.glyph_size_);
+  // Returns false if the parameters given to the constructor are out of the
+  // range of the packed key.
+  bool is_valid() const {
+    return get_code_point() != kGlyphKeyCodePointInvalid;
   }
 
+  // Compare operator.
+  bool operator==(const GlyphKey& other) const { return key_ == other.key_; }
+
   // Hash function.
   size_t operator()(const GlyphKey& key) const {
-    // Note that font_id_ is an already hashed value.
-    return ((std::hash<uint32_t>()(key.code_point_) ^ (key.font_id_ << 1)) >>
-            1) ^
-           (std::hash<uint32_t>()(key.glyph_size_) << 1);
+    return static_cast<size_t>(key.get_hash());
+  }
+
+  // Getters of glyph parameters.
+  HashedId get_font_id() const { return static_cast<HashedId>(key_ >> 32); }
+  uint32_t get_code_point() const {
+    return static_cast<uint32_t>(key_ >> kGlyphKeyGlyphSizeBits) &
+           ((1U << kGlyphKeyCodePointBits) - 1);
+  }
+  uint32_t get_glyph_size() const {
+    return static_cast<uint32_t>(key_) & ((1U << kGlyphKeyGlyphSizeBits) - 1);
+  }
+
+  // Getter of the packed key.
+  uint64_t get_packed_key() const { return key_; }
+
+  // Getter of a hash value of the key.
+  // Bits of the key are mixed with the finalizer of MurmurHash3 so that lower
+  // bits of the hash can be used as an index of a power of 2 sized table.
+  uint64_t get_hash() const { return Hash(key_); }
+
+  // Hash a packed key.
+  static uint64_t Hash(const uint64_t packed_key) {
+    uint64_t h = packed_key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb3f99a3b07fdULL;
+    h ^= h >> 33;
+    return h;
   }
 
  private:
-  HashedId font_id_;
-  uint32_t code_point_;
-  uint32_t glyph_size_;
+  static uint64_t Pack(const HashedId font_id, uint32_t code_point,
+                       uint32_t glyph_size) {
+    return (static_cast<uint64_t>(font_id) << 32) |
+           (static_cast<uint64_t>(code_point &
+                                  ((1U << kGlyphKeyCodePointBits) - 1))
+            << kGlyphKeyGlyphSizeBits) |
+           (glyph_size & ((1U << kGlyphKeyGlyphSizeBits) - 1));
+  }
+
+  uint64_t key_;
 };
 
 // Cache entry for a glyph.
 class GlyphCacheEntry {
  public:
-  // Typedef for cache entry map's iterator.
-  typedef std::unordered_map<GlyphKey, std::unique_ptr<GlyphCacheEntry>,
-                             GlyphKey>::iterator iterator;
-  typedef std::list<GlyphCacheRow>::iterator iterator_row;
-
-  GlyphCacheEntry() : code_point_(0), size_(0, 0), offset_(0, 0) {}
+  GlyphCacheEntry()
+      : code_point_(0),
+        size_(0, 0),
+        offset_(0, 0),
+        page_(0),
+        row_(kGlyphCacheIndexInvalid) {}
 
   // Setter/Getter of code point.
   // Code point is an entry in a font file, not a direct transform of Unicode.
@@ -131,6 +200,10 @@ class GlyphCacheEntry {
   mathfu::vec4 get_uv() const { return uv_; }
   void set_uv(const mathfu::vec4& uv) { uv_ = uv; }
 
+  // Setter/Getter of the page index in the cache that stores the glyph image.
+  int32_t get_page() const { return page_; }
+  void set_page(const int32_t page) { page_ = page; }
+
  private:
   // Friend class, GlyphCache needs an access to internal variables of the
   // class.
@@ -149,11 +222,15 @@ class GlyphCacheEntry {
   // Glyph image's UV in the texture atlas.
   mathfu::vec4 uv_;
 
-  // Iterator to the row entry.
-  GlyphCacheEntry::iterator_row it_row;
+  // Index of the atlas page that stores the glyph image.
+  int32_t page_;
 
-  // Iterator to the row LRU entry.
-  std::list<GlyphCacheEntry::iterator_row>::iterator it_lru_row_;
+  // Key of the entry. Used to remove the entry from the look-up table when
+  // the row is flushed.
+  GlyphKey key_;
+
+  // Index of the row that stores the entry.
+  int32_t row_;
 };
 
 // Single row in a cache. A row correspond to a horizontal slice of a texture.
@@ -166,12 +243,24 @@ class GlyphCacheEntry {
 // GlyphCacheRow is an internal class for GlyphCache.
 class GlyphCacheRow {
  public:
-  GlyphCacheRow() { Initialize(0, mathfu::vec2i(0, 0)); }
+  GlyphCacheRow()
+      : page_(kGlyphCachePageInvalid),
+        lru_prev_(kGlyphCacheIndexInvalid),
+        lru_next_(kGlyphCacheIndexInvalid),
+        height_order_(0) {
+    Initialize(0, mathfu::vec2i(0, 0));
+  }
   // Constructor with an arguments.
   // y_pos : vertical position of the row in the buffer.
   // witdh : width of the row. Typically same value of the buffer width.
   // height : height of the row.
-  GlyphCacheRow(const int32_t y_pos, const mathfu::vec2i& size) {
+  // page : index of the page in the cache that the row belongs to.
+  GlyphCacheRow(const int32_t y_pos, const mathfu::vec2i& size,
+                const int32_t page)
+      : page_(page),
+        lru_prev_(kGlyphCacheIndexInvalid),
+        lru_next_(kGlyphCacheIndexInvalid),
+        height_order_(0) {
     Initialize(y_pos, size);
   }
   ~GlyphCacheRow() {}
@@ -190,15 +279,14 @@ class GlyphCacheRow {
     return !(size.x() > remaining_width_ || size.y() > size_.y());
   }
 
-  // Reserve an area in the row.
-  int32_t Reserve(const GlyphCacheEntry::iterator it,
-                  const mathfu::vec2i& size) {
+  // Reserve an area in the row for the entry with the given index.
+  int32_t Reserve(const int32_t entry, const mathfu::vec2i& size) {
     assert(DoesFit(size));
 
     // Update row info.
     int32_t pos = size_.x() - remaining_width_;
     remaining_width_ -= size.x();
-    cached_entries_.push_back(it);
+    cached_entries_.push_back(entry);
     return pos;
   }
 
@@ -216,36 +304,25 @@ class GlyphCacheRow {
   int32_t get_y_pos() const { return y_pos_; }
   void set_y_pos(const int32_t y_pos) { y_pos_ = y_pos; }
 
+  // Setter/Getter of the page index the row belongs to.
+  // A row released to the free list has kGlyphCachePageInvalid.
+  int32_t get_page() const { return page_; }
+  void set_page(const int32_t page) { page_ = page; }
+
   // Getter of cached glyphs.
   size_t get_num_glyphs() const { return cached_entries_.size(); }
 
-  // Setter/Getter of iterator to row LRU.
-  const std::list<GlyphCacheEntry::iterator_row>::iterator get_it_lru_row()
-      const {
-    return it_lru_row_;
-  }
-  void set_it_lru_row(
-      const std::list<GlyphCacheEntry::iterator_row>::iterator it_lru_row) {
-    it_lru_row_ = it_lru_row;
-  }
-
-  // Setter/Getter of iterator to row height map.
-  std::multimap<int32_t, GlyphCacheEntry::iterator_row>::iterator
-  get_it_row_height_map() const {
-    return it_row_height_map_;
-  }
-  void set_it_row_height_map(
-      const std::multimap<int32_t, GlyphCacheEntry::iterator_row>::iterator
-          it_row_height_map) {
-    it_row_height_map_ = it_row_height_map;
-  }
-
-  // Getter of cached glyph entries.
-  std::vector<GlyphCacheEntry::iterator>& get_cached_entries() {
+  // Getter of indices of cached glyph entries.
+  std::vector<int32_t>& get_cached_entries() { return cached_entries_; }
+  const std::vector<int32_t>& get_cached_entries() const {
     return cached_entries_;
   }
 
  private:
+  // Friend class, GlyphCache maintains the LRU links of rows.
+  template <typename T>
+  friend class GlyphCache;
+
   // Last used counter value of the entry. The value is used to determine
   // if the entry can be evicted from the cache.
   uint32_t last_used_counter_;
@@ -260,16 +337,58 @@ class GlyphCacheRow {
   // Vertical position of the row in the entire cache buffer.
   uint32_t y_pos_;
 
-  // Iterator to the row LRU list.
-  std::list<GlyphCacheEntry::iterator_row>::iterator it_lru_row_;
+  // Index of the page that the row belongs to.
+  int32_t page_;
 
-  // Iterator to the row height map.
-  std::multimap<int32_t, GlyphCacheEntry::iterator_row>::iterator
-      it_row_height_map_;
+  // Indices of previous (less recently used) and next (more recently used)
+  // rows in the row LRU list.
+  int32_t lru_prev_;
+  int32_t lru_next_;
+
+  // Insertion order of the row in the sorted row heights.
+  uint32_t height_order_;
 
   // Tracking cached entries in the row.
-  // When flushing the row, entries in the map is removed using the vector.
-  std::vector<GlyphCacheEntry::iterator> cached_entries_;
+  // When flushing the row, entries in the table are removed using the vector.
+  std::vector<int32_t> cached_entries_;
+};
+
+// Version of the serialized glyph cache format.
+// Increment the version when any of serialized structures below is changed.
+const uint32_t kGlyphCacheSerializedVersion = 1;
+
+// Serialized image of the glyph cache.
+// The image consists of a header, rows, entries and page buffers in the order.
+// All records are POD with 4 bytes aligned fields so that the image can be
+// used directly from a memory mapped file.
+struct GlyphCacheSerializedHeader {
+  uint32_t version;
+  uint32_t bytes_per_pixel;
+  int32_t width;
+  int32_t height;
+  int32_t num_pages;
+  int32_t num_rows;
+  int32_t num_entries;
+  uint32_t reserved;
+};
+
+// Serialized row. Entries of the row follow the previous row's entries in the
+// entry array in the order they are reserved.
+struct GlyphCacheSerializedRow {
+  int32_t page;
+  int32_t y_pos;
+  int32_t height;
+  int32_t num_entries;
+};
+
+// Serialized glyph cache entry.
+struct GlyphCacheSerializedEntry {
+  uint32_t font_id;
+  uint32_t code_point;
+  uint32_t glyph_size;
+  int32_t size[2];
+  int32_t offset[2];
+  float uv[4];
 };
 
 template <typename T>
@@ -278,22 +397,25 @@ class GlyphCache {
   // Constructor with parameters.
   // width: width of the glyph cache texture. Rounded up to power of 2.
   // height: height of the glyph cache texture. Rounded up to power of 2.
-  GlyphCache(const mathfu::vec2i& size)
-      : counter_(0), revision_(0), dirty_(false) {
+  // max_pages: max # of pages the cache can allocate. Pages are allocated
+  // lazily when existing pages are full.
+  GlyphCache(const mathfu::vec2i& size, const int32_t max_pages = 1)
+      : counter_(0),
+        lru_head_(kGlyphCacheIndexInvalid),
+        lru_tail_(kGlyphCacheIndexInvalid),
+        row_height_order_(0),
+        num_entries_(0),
+        revision_(0),
+        move_revision_(0),
+        max_pages_(std::max(max_pages, 1)) {
     // Round up cache sizes to power of 2.
     size_.x() = RoundUpToPowerOf2(size.x());
     size_.y() = RoundUpToPowerOf2(size.y());
 
-    // Allocate the glyph cache buffer.
-    // A buffer format can be 8/32 bpp (32 bpp is mostly used for Emoji).
-    buffer_.reset(new T[size_.x() * size_.y()]);
+    table_.resize(kInitialTableSize);
 
-    // Clearing allocated buffer.
-    const int32_t kCacheClearValue = 0x0;
-    memset(buffer_.get(), kCacheClearValue, size_.x() * size_.y() * sizeof(T));
-
-    // Create first (empty) row entry.
-    InsertNewRow(0, size_, list_row_.end());
+    // Allocate the first page.
+    AllocatePage();
 
 #ifdef GLYPH_CACHE_STATS
     ResetStats();
@@ -309,21 +431,23 @@ class GlyphCache {
     // Update debug variable.
     stats_lookup_++;
 #endif
-    auto it = map_entries_.find(key);
-    if (it != map_entries_.end()) {
+    if (!key.is_valid()) return nullptr;
+    auto index = LookUp(key);
+    if (index != kGlyphCacheIndexInvalid) {
       // Found an entry!
+      auto& entry = GetEntry(index);
 
       // Mark the row as being used in current cycle.
-      it->second->it_row->set_last_used_counter(counter_);
+      rows_[entry.row_].set_last_used_counter(counter_);
 
       // Update row LRU entry. The row is now most recently used.
-      lru_row_.splice(lru_row_.end(), lru_row_, it->second->it_lru_row_);
+      TouchRow(entry.row_);
 
 #ifdef GLYPH_CACHE_STATS
       // Update debug variable.
       stats_hit_++;
 #endif
-      return it->second.get();
+      return &entry;
     }
 
     // Didn't find a cached entry. A caller may call Store() function to store
@@ -354,6 +478,10 @@ class GlyphCache {
 #endif
       return p;
     }
+    if (!key.is_valid()) {
+      // The glyph can't be identified in the cache.
+      return nullptr;
+    }
 
     // Adjust requested height & width.
     // Height is rounded up to multiple of kGlyphCacheHeightRound.
@@ -363,58 +491,55 @@ class GlyphCache {
                            (kGlyphCacheHeightRound - 1)) &
                           ~(kGlyphCacheHeightRound - 1));
 
-    // Look up the row map to retrieve a row iterator to start with.
-    auto it = map_row_.lower_bound(req_height);
-    while (it != map_row_.end()) {
-      if (it->second->DoesFit(mathfu::vec2i(req_width, req_height))) {
+    // Look up the row heights to retrieve a row to start with.
+    auto it =
+        std::lower_bound(row_heights_.begin(), row_heights_.end(),
+                         RowHeight(req_height, 0, kGlyphCacheIndexInvalid));
+    while (it != row_heights_.end()) {
+      if (rows_[it->row_].DoesFit(mathfu::vec2i(req_width, req_height))) {
         break;
       }
       it++;
     }
 
     GlyphCacheEntry* ret;
-    if (it != map_row_.end()) {
+    if (it != row_heights_.end()) {
       // Found sufficient space in the buffer.
-      auto it_row = it->second;
+      auto row_index = it->row_;
 
-      if (it_row->get_num_glyphs() == 0) {
+      if (rows_[row_index].get_num_glyphs() == 0) {
         // Putting first entry to the row.
         // In this case, we create new empty row to track rest of free space.
-        auto original_height = it_row->get_size().y();
-        auto original_y_pos = it_row->get_y_pos();
+        auto original_height = rows_[row_index].get_size().y();
+        auto original_y_pos = rows_[row_index].get_y_pos();
 
         if (original_height - req_height >= kGlyphCacheHeightRound) {
           // Create new row for free space.
-          it_row->set_size(mathfu::vec2i(size_.x(), req_height));
-
-          // Update row height map key as well.
-          map_row_.erase(it_row->get_it_row_height_map());
-          auto it_map =
-              map_row_.insert(std::pair<int32_t, GlyphCacheEntry::iterator_row>(
-                  req_height, it_row));
-          it_row->set_it_row_height_map(it_map);
-
-          InsertNewRow(original_y_pos + req_height,
-                       mathfu::vec2i(size_.x(), original_height - req_height),
-                       list_row_.end());
+          // Note that it invalidates references to rows_.
+          SetRowHeight(row_index, req_height);
+          AllocateRow(original_y_pos + req_height,
+                      mathfu::vec2i(size_.x(), original_height - req_height),
+                      rows_[row_index].get_page());
         }
       }
 
-      // Create new entry in the look-up map.
-      auto pair = map_entries_.insert(
-          std::pair<GlyphKey, std::unique_ptr<GlyphCacheEntry>>(
-              key,
-              std::unique_ptr<GlyphCacheEntry>(new GlyphCacheEntry(entry))));
-      auto it_entry = pair.first;
-      ret = it_entry->second.get();
+      // Create new entry in the look-up table.
+      auto entry_index = AllocateEntry();
+      ret = &GetEntry(entry_index);
+      *ret = entry;
+      ret->key_ = key;
+      ret->row_ = row_index;
+      Insert(key, entry_index);
 
       // Reserve a region in the row.
+      auto& row = rows_[row_index];
       auto pos = mathfu::vec2i(
-          it_row->Reserve(it_entry, mathfu::vec2i(req_width, req_height)),
-          it_row->get_y_pos());
+          row.Reserve(entry_index, mathfu::vec2i(req_width, req_height)),
+          row.get_y_pos());
 
       // Store given image into the buffer.
-      CopyImage(pos, image, it_entry->second.get());
+      ret->set_page(row.get_page());
+      CopyImage(pos, image, ret);
 
       // Update UV of the entry.
       mathfu::vec4 uv(
@@ -422,45 +547,55 @@ class GlyphCache {
           mathfu::vec2(pos + entry.get_size()) / mathfu::vec2(size_));
       ret->set_uv(uv);
 
-      // Establish links.
-      ret->it_row = it_row;
-      ret->it_lru_row_ = it_row->get_it_lru_row();
-
       // Update row LRU entry.
-      lru_row_.splice(lru_row_.end(), lru_row_, it_row->get_it_lru_row());
-      it_row->set_last_used_counter(counter_);
+      TouchRow(row_index);
+      row.set_last_used_counter(counter_);
     } else {
       // Couldn't find sufficient row entry nor free space to create new row.
 
+      // Allocate a new page if we still have a room for it. Existing entries
+      // are kept intact in this case.
+      if (AllocatePage()) {
+        return Set(image, key, entry);
+      }
+
       // Try to find a row that is not used in current cycle and has enough
       // height from LRU list.
-      for (auto row_it = lru_row_.begin(); row_it != lru_row_.end(); ++row_it) {
-        auto& row = *row_it;
-        if (row->get_last_used_counter() == counter_) {
+      for (auto i = lru_head_; i != kGlyphCacheIndexInvalid;
+           i = rows_[i].lru_next_) {
+        auto& row = rows_[i];
+        if (row.get_last_used_counter() == counter_) {
           // The row is being used in current rendering cycle.
           // We can not evict the row.
           continue;
         }
-        if (row->get_size().y() >= req_height) {
+        if (row.get_size().y() >= req_height) {
           // Now flush & initialize the row.
-          FlushRow(row);
-          row->Initialize(row->get_y_pos(), row->get_size());
+          FlushRow(i);
+          row.Initialize(row.get_y_pos(), row.get_size());
 
           // Call the function recursively.
           return Set(image, key, entry);
         }
       }
+
+      // No single row can be recycled. Recycle a whole page that is not used
+      // in current cycle.
+      auto page = FindLRUPage();
+      if (page != kGlyphCachePageInvalid) {
+        FlushPage(page);
+        return Set(image, key, entry);
+      }
 #ifdef GLYPH_CACHE_STATS
       stats_set_fail_++;
 #endif
       // TODO: Try to flush multiple rows and merge them to free up space.
-      // TODO: Evaluate re-allocate solution.
       // Now we don't have any space in the cache.
       // It's caller's responsivility to recover from the situation.
       // Possible work arounds are:
       // - Draw glyphs with current glyph cache contents and then flush them,
       // start new caching.
-      // - Just increase cache size.
+      // - Just increase cache size or # of pages.
       return nullptr;
     }
 
@@ -468,22 +603,22 @@ class GlyphCache {
   }
 
   // Flush all cache entries.
+  // Allocated pages are kept and reused.
   bool Flush() {
 #ifdef GLYPH_CACHE_STATS
     ResetStats();
 #endif
-    map_entries_.clear();
-    lru_row_.clear();
-    list_row_.clear();
-    map_row_.clear();
+    Clear();
 
     // Update cache revision.
     revision_ = counter_;
 
-    // Create first (empty) row entry.
-    InsertNewRow(0, size_, list_row_.end());
-
-    dirty_ = false;
+    // Create first (empty) row entry for each page.
+    for (size_t i = 0; i < pages_.size(); ++i) {
+      AllocateRow(0, size_, static_cast<int32_t>(i));
+      pages_[i].dirty_ = false;
+      pages_[i].dirty_rects_.clear();
+    }
 
     return true;
   }
@@ -494,22 +629,152 @@ class GlyphCache {
   // cache entries are full.
   void Update() { counter_++; }
 
+  // Compact the cache incrementally.
+  // Entries in sparsely used rows are moved into denser rows with the same
+  // height. Then rows are slid up into empty rows above them, so that empty
+  // rows are merged into taller rows toward the bottom of pages and can be
+  // used by entries of any height again.
+  // Rows used in the current cycle are kept intact. Moved entries get new UVs.
+  // Entries are not evicted, so the revision is kept. Instead, pages whose
+  // entries moved are marked with a new move revision (see IsPageMoved()).
+  // max_bytes: max # of bytes of entry images moved in the call.
+  // Returns # of bytes moved.
+  size_t Compact(const size_t max_bytes) {
+    move_revision_++;
+
+    // Collect sparse rows, sparsest first.
+    std::vector<std::pair<int32_t, int32_t>> sources;
+    for (size_t i = 0; i < rows_.size(); ++i) {
+      auto index = static_cast<int32_t>(i);
+      if (IsSparseRow(index) &&
+          rows_[i].get_last_used_counter() != counter_) {
+        sources.push_back(std::make_pair(GetUsedWidth(index), index));
+      }
+    }
+    std::sort(sources.begin(), sources.end());
+
+    size_t moved_bytes = 0;
+    std::vector<int32_t> destinations;
+    for (auto it = sources.begin(); it != sources.end(); ++it) {
+      auto source = it->second;
+      // The row may have become denser as a destination of other rows.
+      if (!IsSparseRow(source)) continue;
+
+      auto& entries = rows_[source].get_cached_entries();
+      size_t bytes = 0;
+      for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+        auto size = GetEntry(*entry).get_size();
+        bytes += size.x() * size.y() * sizeof(T);
+      }
+      if (moved_bytes + bytes > max_bytes) break;
+
+      // Move entries only when all of them fit, since the space of a row
+      // can't be reused until the row is empty.
+      if (!FindDestinations(source, &destinations)) continue;
+      for (size_t i = 0; i < entries.size(); ++i) {
+        MoveEntry(entries[i], destinations[i]);
+      }
+      rows_[source].Initialize(rows_[source].get_y_pos(),
+                               rows_[source].get_size());
+      moved_bytes += bytes;
+    }
+
+    // Slide rows up into empty rows and merge neighboring empty rows.
+    // An empty row is carried down until it reaches a row that can't be
+    // moved.
+    auto sorted_rows = GetSortedRows();
+    auto empty_row = kGlyphCacheIndexInvalid;
+    for (size_t i = 0; i < sorted_rows.size(); ++i) {
+      auto index = sorted_rows[i].row_;
+      if (empty_row != kGlyphCacheIndexInvalid &&
+          rows_[empty_row].get_page() != rows_[index].get_page()) {
+        empty_row = kGlyphCacheIndexInvalid;
+      }
+      if (!rows_[index].get_num_glyphs()) {
+        if (empty_row == kGlyphCacheIndexInvalid) {
+          empty_row = index;
+        } else {
+          auto height =
+              rows_[empty_row].get_size().y() + rows_[index].get_size().y();
+          ReleaseRow(index);
+          SetRowHeight(empty_row, height);
+        }
+        continue;
+      }
+      if (empty_row == kGlyphCacheIndexInvalid) continue;
+
+      size_t bytes =
+          GetUsedWidth(index) * rows_[index].get_size().y() * sizeof(T);
+      if (rows_[index].get_last_used_counter() == counter_ ||
+          moved_bytes + bytes > max_bytes) {
+        empty_row = kGlyphCacheIndexInvalid;
+        continue;
+      }
+      auto y_pos = rows_[empty_row].get_y_pos();
+      MoveRow(index, y_pos);
+      rows_[empty_row].set_y_pos(y_pos + rows_[index].get_size().y());
+      moved_bytes += bytes;
+    }
+
+#ifdef GLYPH_CACHE_STATS
+    stats_compaction_bytes_ += moved_bytes;
+#endif
+    return moved_bytes;
+  }
+
+  // Returns the fragmentation of the free space in allocated pages.
+  // The value is 1 - (the largest free block) / (all free pixels), where a
+  // free block is the remaining space of a row with entries, or a run of
+  // neighboring empty rows. 0 means the free space is contiguous, and a value
+  // close to 1 means Set() may fail even though many pixels are free.
+  float get_fragmentation() const {
+    size_t free_pixels = 0;
+    size_t largest_block = 0;
+    size_t empty_block = 0;
+    auto sorted_rows = GetSortedRows();
+    for (size_t i = 0; i < sorted_rows.size(); ++i) {
+      auto& row = rows_[sorted_rows[i].row_];
+      size_t pixels = row.remaining_width_ * row.get_size().y();
+      free_pixels += pixels;
+      if (row.get_num_glyphs()) {
+        largest_block = std::max(largest_block, pixels);
+        empty_block = 0;
+        continue;
+      }
+      if (i > 0 && sorted_rows[i - 1].page_ != sorted_rows[i].page_) {
+        empty_block = 0;
+      }
+      empty_block += pixels;
+      largest_block = std::max(largest_block, empty_block);
+    }
+    if (free_pixels == 0) return 0.0f;
+    return 1.0f -
+           static_cast<float>(largest_block) / static_cast<float>(free_pixels);
+  }
+
   // Debug API to show cache statistics.
   void Status() {
 #ifdef GLYPH_CACHE_STATS
-    LogInfo("Cache size: %dx%d", size_.x(), size_.y());
+    LogInfo("Cache size: %dx%d pages: %d/%d", size_.x(), size_.y(),
+            get_num_pages(), max_pages_);
     LogInfo("Cache hit: %d / %d", stats_hit_, stats_lookup_);
 
     auto total_glyph = 0;
-    for (auto row : list_row_) {
-      LogInfo("Row start:%d height:%d glyphs:%d counter:%d", row.get_y_pos(),
-              row.get_size().y(), row.get_num_glyphs(),
-              row.get_last_used_counter());
+    for (auto it = rows_.begin(); it != rows_.end(); ++it) {
+      auto& row = *it;
+      if (row.get_page() == kGlyphCachePageInvalid) continue;
+      LogInfo("Row page:%d start:%d height:%d glyphs:%d counter:%d",
+              row.get_page(), row.get_y_pos(), row.get_size().y(),
+              row.get_num_glyphs(), row.get_last_used_counter());
       total_glyph += row.get_num_glyphs();
     }
     LogInfo("Cached glyphs: %d", total_glyph);
     LogInfo("Row flush: %d", stats_row_flush_);
+    LogInfo("Page flush: %d", stats_page_flush_);
     LogInfo("Set fail: %d", stats_set_fail_);
+    LogInfo("Compaction: %d bytes",
+            static_cast<int32_t>(stats_compaction_bytes_));
+    LogInfo("Fragmentation: %f", get_fragmentation());
 #endif
   }
 
@@ -517,58 +782,460 @@ class GlyphCache {
   uint32_t get_revision() const { return revision_; }
   void set_revision(const uint32_t revision) { revision_ = revision; }
 
+  // Getter of the move revision, incremented by each Compact() call.
+  uint32_t get_move_revision() const { return move_revision_; }
+
+  // Returns true if entries of the page have been moved by Compact() after
+  // the given move revision.
+  bool IsPageMoved(const int32_t page, const uint32_t move_revision) const {
+    return pages_[page].move_revision_ > move_revision;
+  }
+
   // Getter/Setter of dirty state.
-  bool get_dirty_state() const { return dirty_; };
-  void set_dirty_state(const bool dirty) { dirty_ = dirty; }
+  // The getter returns true if any of the pages is dirty, and the setter
+  // updates the state of all pages.
+  bool get_dirty_state() const {
+    for (auto it = pages_.begin(); it != pages_.end(); ++it) {
+      if (it->dirty_) return true;
+    }
+    return false;
+  }
+  void set_dirty_state(const bool dirty) {
+    for (int32_t i = 0; i < get_num_pages(); ++i) {
+      set_dirty_state(i, dirty);
+    }
+  }
 
-  // Getter of dirty rect.
-  const mathfu::vec4i& get_dirty_rect() const { return dirty_rect_; }
+  // Getter/Setter of dirty state of a page.
+  // Clearing the state also clears dirty rects of the page.
+  bool get_dirty_state(const int32_t page) const { return pages_[page].dirty_; }
+  void set_dirty_state(const int32_t page, const bool dirty) {
+    pages_[page].dirty_ = dirty;
+    if (!dirty) {
+      pages_[page].dirty_rects_.clear();
+    }
+  }
 
-  // Getter of allocated glyph cache buffer.
-  const T* get_buffer() const { return buffer_.get(); }
+  // Getter of dirty rects (x0, y0, x1, y1) of a page.
+  // Rects are disjoint and sorted by y. Glyphs in the same row share a rect,
+  // so that each rect covers only the updated span of rows.
+  const std::vector<mathfu::vec4i>& get_dirty_rects(
+      const int32_t page = 0) const {
+    return pages_[page].dirty_rects_;
+  }
+
+  // Getter of allocated glyph cache buffer of a page.
+  const T* get_buffer(const int32_t page = 0) const {
+    return pages_[page].buffer_.get();
+  }
 
   // Getter of the cache size.
   const mathfu::vec2i& get_size() const { return size_; }
 
+  // Getter of # of allocated pages.
+  int32_t get_num_pages() const { return static_cast<int32_t>(pages_.size()); }
+
+  // Getter of max # of pages.
+  int32_t get_max_pages() const { return max_pages_; }
+
+  // Append serialized image of the cache contents to the buffer.
+  // The image includes page buffers, rows and cached entries.
+  void Serialize(std::vector<uint8_t>* buffer) const {
+    GlyphCacheSerializedHeader header;
+    header.version = kGlyphCacheSerializedVersion;
+    header.bytes_per_pixel = sizeof(T);
+    header.width = size_.x();
+    header.height = size_.y();
+    header.num_pages = get_num_pages();
+    header.num_rows = static_cast<int32_t>(rows_.size() - free_rows_.size());
+    header.num_entries = num_entries_;
+    header.reserved = 0;
+    AppendData(&header, sizeof(header), buffer);
+
+    for (auto it = rows_.begin(); it != rows_.end(); ++it) {
+      if (it->get_page() == kGlyphCachePageInvalid) continue;
+      GlyphCacheSerializedRow row;
+      row.page = it->get_page();
+      row.y_pos = it->get_y_pos();
+      row.height = it->get_size().y();
+      row.num_entries = static_cast<int32_t>(it->get_num_glyphs());
+      AppendData(&row, sizeof(row), buffer);
+    }
+
+    for (auto it = rows_.begin(); it != rows_.end(); ++it) {
+      if (it->get_page() == kGlyphCachePageInvalid) continue;
+      auto& entries = it->get_cached_entries();
+      for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+        auto& value = GetEntry(*entry);
+        auto& key = value.key_;
+        GlyphCacheSerializedEntry e;
+        e.font_id = key.get_font_id();
+        e.code_point = key.get_code_point();
+        e.glyph_size = key.get_glyph_size();
+        e.size[0] = value.get_size().x();
+        e.size[1] = value.get_size().y();
+        e.offset[0] = value.get_offset().x();
+        e.offset[1] = value.get_offset().y();
+        for (int32_t i = 0; i < 4; ++i) {
+          e.uv[i] = value.get_uv()[i];
+        }
+        AppendData(&e, sizeof(e), buffer);
+      }
+    }
+
+    for (auto it = pages_.begin(); it != pages_.end(); ++it) {
+      AppendData(it->buffer_.get(), size_.x() * size_.y() * sizeof(T), buffer);
+    }
+  }
+
+  // Restore the cache contents from a serialized image.
+  // The cache needs to have the same size and enough # of pages with the
+  // serialized one.
+  // Returns the # of bytes read from the image, or 0 if the image is invalid.
+  // Existing entries are flushed when the image is valid.
+  size_t Deserialize(const uint8_t* data, const size_t data_size) {
+    GlyphCacheSerializedHeader header;
+    if (data_size < sizeof(header)) {
+      return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.version != kGlyphCacheSerializedVersion ||
+        header.bytes_per_pixel != sizeof(T) || header.width != size_.x() ||
+        header.height != size_.y() || header.num_pages < 1 ||
+        header.num_pages > max_pages_ || header.num_rows < 0 ||
+        header.num_entries < 0) {
+      return 0;
+    }
+    const size_t page_size = size_.x() * size_.y() * sizeof(T);
+    const size_t total_size =
+        sizeof(header) + header.num_rows * sizeof(GlyphCacheSerializedRow) +
+        header.num_entries * sizeof(GlyphCacheSerializedEntry) +
+        header.num_pages * page_size;
+    if (data_size < total_size) {
+      return 0;
+    }
+
+    // Verify rows before touching current contents.
+    auto rows = data + sizeof(header);
+    auto entries = rows + header.num_rows * sizeof(GlyphCacheSerializedRow);
+    auto pages = entries +
+                 header.num_entries * sizeof(GlyphCacheSerializedEntry);
+    int32_t num_entries = 0;
+    for (int32_t i = 0; i < header.num_rows; ++i) {
+      GlyphCacheSerializedRow row;
+      memcpy(&row, rows + i * sizeof(row), sizeof(row));
+      if (row.page < 0 || row.page >= header.num_pages || row.y_pos < 0 ||
+          row.height <= 0 || row.y_pos + row.height > size_.y() ||
+          row.num_entries < 0) {
+        return 0;
+      }
+      num_entries += row.num_entries;
+    }
+    if (num_entries != header.num_entries) {
+      return 0;
+    }
+
+    // Restore pages.
+    while (get_num_pages() < header.num_pages) {
+      AllocatePage();
+    }
+    Flush();
+    Clear();
+    for (int32_t i = 0; i < get_num_pages(); ++i) {
+      if (i < header.num_pages) {
+        memcpy(pages_[i].buffer_.get(), pages + i * page_size, page_size);
+      }
+      UpdateDirtyRect(i, mathfu::vec4i(mathfu::kZeros2i, size_));
+    }
+
+    // Restore rows and entries.
+    auto entry_data = entries;
+    for (int32_t i = 0; i < header.num_rows; ++i) {
+      GlyphCacheSerializedRow row;
+      memcpy(&row, rows + i * sizeof(row), sizeof(row));
+      auto row_index = AllocateRow(
+          row.y_pos, mathfu::vec2i(size_.x(), row.height), row.page);
+      for (int32_t j = 0; j < row.num_entries; ++j) {
+        GlyphCacheSerializedEntry e;
+        memcpy(&e, entry_data, sizeof(e));
+        entry_data += sizeof(e);
+
+        auto req_size =
+            mathfu::vec2i(e.size[0] + kGlyphCachePaddingX, row.height);
+        if (!rows_[row_index].DoesFit(req_size) ||
+            e.code_point >= kGlyphKeyCodePointInvalid ||
+            e.glyph_size >= (1U << kGlyphKeyGlyphSizeBits)) {
+          // Broken image. Discard restored contents.
+          Flush();
+          return 0;
+        }
+        auto key = GlyphKey(e.font_id, e.code_point, e.glyph_size);
+        auto entry_index = AllocateEntry();
+        auto& entry = GetEntry(entry_index);
+        entry = GlyphCacheEntry();
+        entry.set_code_point(e.code_point);
+        entry.set_size(mathfu::vec2i(e.size[0], e.size[1]));
+        entry.set_offset(mathfu::vec2i(e.offset[0], e.offset[1]));
+        entry.set_uv(mathfu::vec4(e.uv[0], e.uv[1], e.uv[2], e.uv[3]));
+        entry.set_page(row.page);
+        entry.key_ = key;
+        entry.row_ = row_index;
+        Insert(key, entry_index);
+        rows_[row_index].Reserve(entry_index, req_size);
+      }
+    }
+
+    // Pages without rows are treated as empty pages.
+    for (int32_t i = header.num_pages; i < get_num_pages(); ++i) {
+      AllocateRow(0, size_, i);
+    }
+
+    // Invalidate entries referenced by existing users.
+    revision_ = counter_;
+    return total_size;
+  }
+
  private:
-  // Insert new row to the row list with a given size.
-  // It tries to merge 2 rows if next row is also empty one.
-  void InsertNewRow(const int32_t y_pos, const mathfu::vec2i& size,
-                    const GlyphCacheEntry::iterator_row pos) {
-    // First, check if we can merge the requested row with next row to free up
-    // more spaces.
-    // New row is always inserted right after valid row entry. So we don't have
-    // to check previous row entry to merge.
-    if (pos != list_row_.end()) {
-      auto next_entry = std::next(pos);
-      if (next_entry->get_num_glyphs() == 0) {
-        // We can merge them.
-        mathfu::vec2i next_size = next_entry->get_size();
-        next_size.y() += size.y();
-        next_entry->set_y_pos(next_entry->get_y_pos() - size.y());
-        next_entry->set_size(next_size);
-        next_entry->set_last_used_counter(counter_);
-        return;
+  // # of entries in an entry block. Entries are allocated per block so that
+  // pointers to entries stay valid while the pool grows.
+  static const int32_t kEntryBlockShift = 8;
+  static const int32_t kEntryBlockSize = 1 << kEntryBlockShift;
+
+  // Initial # of slots in the look-up table. Must be power of 2.
+  static const size_t kInitialTableSize = 256;
+
+  // Max # of dirty rects per page. Closest rects are merged beyond the limit
+  // to bound the # of texture uploads.
+  static const size_t kMaxDirtyRects = 16;
+
+  // Rows using at most 1/kSparseRowDivisor of the width are compacted.
+  static const int32_t kSparseRowDivisor = 2;
+
+  // A page of the cache. Each page has own buffer and a dirty state, and
+  // corresponds to an atlas texture.
+  struct GlyphCachePage {
+    GlyphCachePage() : dirty_(false), move_revision_(0) {}
+    GlyphCachePage(GlyphCachePage&& other)
+        : buffer_(std::move(other.buffer_)),
+          dirty_(other.dirty_),
+          dirty_rects_(std::move(other.dirty_rects_)),
+          move_revision_(other.move_revision_) {}
+
+    // Cache buffer.
+    std::unique_ptr<T[]> buffer_;
+
+    // Flag indicates if the page is dirty. If it's dirty, corresponding font
+    // atlas texture needs to be uploaded.
+    bool dirty_;
+
+    // Disjoint dirty regions in the buffer sorted by y.
+    std::vector<mathfu::vec4i> dirty_rects_;
+
+    // Move revision of the last Compact() that moved entries of the page.
+    uint32_t move_revision_;
+  };
+
+  // A slot of the look-up table.
+  // entry_ is kGlyphCacheIndexInvalid when the slot is empty.
+  struct GlyphCacheSlot {
+    GlyphCacheSlot() : key_(0), entry_(kGlyphCacheIndexInvalid) {}
+    uint64_t key_;
+    int32_t entry_;
+  };
+
+  // An element of the sorted row heights.
+  // Rows with a same height are sorted in the order of insertion.
+  struct RowHeight {
+    RowHeight(const int32_t height, const uint32_t order, const int32_t row)
+        : height_(height), order_(order), row_(row) {}
+    bool operator<(const RowHeight& other) const {
+      return height_ < other.height_ ||
+             (height_ == other.height_ && order_ < other.order_);
+    }
+    int32_t height_;
+    uint32_t order_;
+    int32_t row_;
+  };
+
+  // Allocate new page if the cache hasn't reached the max # of pages.
+  // Returns true if a page has been allocated.
+  bool AllocatePage() {
+    if (get_num_pages() >= max_pages_) {
+      return false;
+    }
+    GlyphCachePage page;
+
+    // Allocate the glyph cache buffer.
+    // A buffer format can be 8/32 bpp (32 bpp is mostly used for Emoji).
+    page.buffer_.reset(new T[size_.x() * size_.y()]);
+
+    // Clearing allocated buffer.
+    const int32_t kCacheClearValue = 0x0;
+    memset(page.buffer_.get(), kCacheClearValue,
+           size_.x() * size_.y() * sizeof(T));
+    pages_.push_back(std::move(page));
+
+    // Create first (empty) row entry in the page.
+    AllocateRow(0, size_, get_num_pages() - 1);
+    return true;
+  }
+
+  // Find a page that is least recently used and not used in current cycle.
+  // Returns kGlyphCachePageInvalid if all pages are in use.
+  int32_t FindLRUPage() {
+    std::vector<uint32_t> page_counters(pages_.size(), 0);
+    for (auto it = rows_.begin(); it != rows_.end(); ++it) {
+      if (it->get_page() == kGlyphCachePageInvalid) continue;
+      auto& counter = page_counters[it->get_page()];
+      counter = std::max(counter, it->get_last_used_counter());
+    }
+
+    auto lru_page = kGlyphCachePageInvalid;
+    for (size_t i = 0; i < page_counters.size(); ++i) {
+      if (page_counters[i] == counter_) {
+        // The page is being used in current rendering cycle.
+        continue;
+      }
+      if (lru_page == kGlyphCachePageInvalid ||
+          page_counters[i] < page_counters[lru_page]) {
+        lru_page = static_cast<int32_t>(i);
       }
     }
+    return lru_page;
+  }
 
-    // Insert new row.
-    auto it = list_row_.insert(pos, GlyphCacheRow(y_pos, size));
-    auto it_lru_row = lru_row_.insert(lru_row_.end(), it);
-    auto it_map = map_row_.insert(
-        std::pair<int32_t, GlyphCacheEntry::iterator_row>(size.y(), it));
+  // Flush all rows in a page and make the page one empty row.
+  void FlushPage(const int32_t page) {
+    for (size_t i = 0; i < rows_.size(); ++i) {
+      if (rows_[i].get_page() != page) continue;
+      FlushRow(static_cast<int32_t>(i));
+      ReleaseRow(static_cast<int32_t>(i));
+    }
+    AllocateRow(0, size_, page);
 
-    // Update a link.
-    it->set_it_lru_row(it_lru_row);
-    it->set_it_row_height_map(it_map);
+#ifdef GLYPH_CACHE_STATS
+    stats_page_flush_++;
+#endif
   }
 
-  void FlushRow(const GlyphCacheEntry::iterator_row row) {
-    // Erase cached glyphs from look-up map.
-    auto& entries = row->get_cached_entries();
-    for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
-      map_entries_.erase(*entry);
+  // Remove all rows and entries without touching pages.
+  void Clear() {
+    std::fill(table_.begin(), table_.end(), GlyphCacheSlot());
+    num_entries_ = 0;
+    free_entries_.clear();
+    auto num_entries =
+        static_cast<int32_t>(entry_blocks_.size()) * kEntryBlockSize;
+    for (int32_t i = num_entries - 1; i >= 0; --i) {
+      free_entries_.push_back(i);
+    }
+    rows_.clear();
+    free_rows_.clear();
+    row_heights_.clear();
+    row_height_order_ = 0;
+    lru_head_ = lru_tail_ = kGlyphCacheIndexInvalid;
+  }
+
+  // Create new row with a given size and make it most recently used.
+  // Returns an index of the row.
+  int32_t AllocateRow(const int32_t y_pos, const mathfu::vec2i& size,
+                      const int32_t page) {
+    int32_t index;
+    if (free_rows_.empty()) {
+      index = static_cast<int32_t>(rows_.size());
+      rows_.push_back(GlyphCacheRow(y_pos, size, page));
+    } else {
+      index = free_rows_.back();
+      free_rows_.pop_back();
+      rows_[index].Initialize(y_pos, size);
+      rows_[index].set_page(page);
+    }
+    LinkRow(index);
+    InsertRowHeight(index);
+    return index;
+  }
+
+  // Release a row to the free list. Entries in the row need to be flushed
+  // beforehand.
+  void ReleaseRow(const int32_t index) {
+    UnlinkRow(index);
+    EraseRowHeight(index);
+    rows_[index].set_page(kGlyphCachePageInvalid);
+    rows_[index].Initialize(0, mathfu::vec2i(0, 0));
+    free_rows_.push_back(index);
+  }
+
+  // Update the height of the row while keeping row heights sorted.
+  void SetRowHeight(const int32_t index, const int32_t height) {
+    EraseRowHeight(index);
+    rows_[index].set_size(mathfu::vec2i(size_.x(), height));
+    InsertRowHeight(index);
+  }
+
+  void InsertRowHeight(const int32_t index) {
+    rows_[index].height_order_ = row_height_order_++;
+    auto height = RowHeight(rows_[index].get_size().y(),
+                            rows_[index].height_order_, index);
+    row_heights_.insert(
+        std::lower_bound(row_heights_.begin(), row_heights_.end(), height),
+        height);
+  }
+
+  void EraseRowHeight(const int32_t index) {
+    auto height = RowHeight(rows_[index].get_size().y(),
+                            rows_[index].height_order_, index);
+    auto it =
+        std::lower_bound(row_heights_.begin(), row_heights_.end(), height);
+    assert(it != row_heights_.end() && it->row_ == index);
+    row_heights_.erase(it);
+  }
+
+  // Link the row at the tail (most recently used end) of the LRU list.
+  void LinkRow(const int32_t index) {
+    auto& row = rows_[index];
+    row.lru_prev_ = lru_tail_;
+    row.lru_next_ = kGlyphCacheIndexInvalid;
+    if (lru_tail_ != kGlyphCacheIndexInvalid) {
+      rows_[lru_tail_].lru_next_ = index;
+    } else {
+      lru_head_ = index;
     }
+    lru_tail_ = index;
+  }
+
+  // Remove the row from the LRU list.
+  void UnlinkRow(const int32_t index) {
+    auto& row = rows_[index];
+    if (row.lru_prev_ != kGlyphCacheIndexInvalid) {
+      rows_[row.lru_prev_].lru_next_ = row.lru_next_;
+    } else {
+      lru_head_ = row.lru_next_;
+    }
+    if (row.lru_next_ != kGlyphCacheIndexInvalid) {
+      rows_[row.lru_next_].lru_prev_ = row.lru_prev_;
+    } else {
+      lru_tail_ = row.lru_prev_;
+    }
+    row.lru_prev_ = row.lru_next_ = kGlyphCacheIndexInvalid;
+  }
+
+  // Make the row most recently used.
+  void TouchRow(const int32_t index) {
+    if (index != lru_tail_) {
+      UnlinkRow(index);
+      LinkRow(index);
+    }
+  }
+
+  void FlushRow(const int32_t index) {
+    // Erase cached glyphs from look-up table.
+    auto& entries = rows_[index].get_cached_entries();
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+      auto& entry = GetEntry(*it);
+      Erase(entry.key_);
+      entry.row_ = kGlyphCacheIndexInvalid;
+      free_entries_.push_back(*it);
+    }
+    entries.clear();
 
     // Update cache revision.
     // It's setting revision equal to the current counter value so that it just
@@ -581,29 +1248,303 @@ class GlyphCache {
 #endif
   }
 
+  // Position of a row in pages.
+  struct RowPosition {
+    RowPosition(const int32_t page, const int32_t y_pos, const int32_t row)
+        : page_(page), y_pos_(y_pos), row_(row) {}
+    bool operator<(const RowPosition& other) const {
+      return page_ < other.page_ ||
+             (page_ == other.page_ && y_pos_ < other.y_pos_);
+    }
+    int32_t page_;
+    int32_t y_pos_;
+    int32_t row_;
+  };
+
+  // Returns rows sorted by the page and the position in the page.
+  std::vector<RowPosition> GetSortedRows() const {
+    std::vector<RowPosition> sorted_rows;
+    for (size_t i = 0; i < rows_.size(); ++i) {
+      auto& row = rows_[i];
+      if (row.get_page() == kGlyphCachePageInvalid) continue;
+      sorted_rows.push_back(RowPosition(row.get_page(), row.get_y_pos(),
+                                        static_cast<int32_t>(i)));
+    }
+    std::sort(sorted_rows.begin(), sorted_rows.end());
+    return sorted_rows;
+  }
+
+  // Returns the width used by entries of the row.
+  int32_t GetUsedWidth(const int32_t index) const {
+    return rows_[index].get_size().x() - rows_[index].remaining_width_;
+  }
+
+  // Returns true if at most 1/kSparseRowDivisor of the row is used.
+  bool IsSparseRow(const int32_t index) const {
+    auto& row = rows_[index];
+    return row.get_page() != kGlyphCachePageInvalid && row.get_num_glyphs() &&
+           GetUsedWidth(index) * kSparseRowDivisor <= row.get_size().x();
+  }
+
+  // Find a destination row for each entry of the row, among denser rows with
+  // the same height.
+  // Returns false if any of the entries doesn't fit.
+  bool FindDestinations(const int32_t source,
+                        std::vector<int32_t>* destinations) {
+    auto height = rows_[source].get_size().y();
+    auto used_width = GetUsedWidth(source);
+    std::vector<std::pair<int32_t, int32_t>> candidates;
+    for (auto it = std::lower_bound(
+             row_heights_.begin(), row_heights_.end(),
+             RowHeight(height, 0, kGlyphCacheIndexInvalid));
+         it != row_heights_.end() && it->height_ == height; ++it) {
+      if (it->row_ != source && rows_[it->row_].get_num_glyphs() &&
+          GetUsedWidth(it->row_) > used_width) {
+        candidates.push_back(
+            std::make_pair(it->row_, rows_[it->row_].remaining_width_));
+      }
+    }
+
+    destinations->clear();
+    auto& entries = rows_[source].get_cached_entries();
+    for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+      auto width = GetEntry(*entry).get_size().x() + kGlyphCachePaddingX;
+      auto it = candidates.begin();
+      while (it != candidates.end() && it->second < width) ++it;
+      if (it == candidates.end()) return false;
+      it->second -= width;
+      destinations->push_back(it->first);
+    }
+    return true;
+  }
+
+  // Move an entry and its image into a row. The entry needs to be removed
+  // from its original row by the caller.
+  void MoveEntry(const int32_t entry_index, const int32_t row_index) {
+    auto& entry = GetEntry(entry_index);
+    auto& row = rows_[row_index];
+    auto size = entry.get_size();
+    auto src_pos =
+        mathfu::vec2i(entry.get_uv().xy() * mathfu::vec2(size_) + 0.5f);
+    auto pos = mathfu::vec2i(
+        row.Reserve(entry_index, mathfu::vec2i(size.x() + kGlyphCachePaddingX,
+                                               row.get_size().y())),
+        row.get_y_pos());
+
+    auto src = pages_[entry.get_page()].buffer_.get();
+    auto dst = pages_[row.get_page()].buffer_.get();
+    for (int32_t y = 0; y < size.y(); ++y) {
+      memcpy(dst + pos.x() + (pos.y() + y) * size_.x(),
+             src + src_pos.x() + (src_pos.y() + y) * size_.x(),
+             size.x() * sizeof(T));
+    }
+    UpdateDirtyRect(row.get_page(), mathfu::vec4i(pos, pos + size));
+    pages_[entry.get_page()].move_revision_ = move_revision_;
+
+    entry.set_page(row.get_page());
+    entry.row_ = row_index;
+    SetEntryPosition(&entry, pos);
+  }
+
+  // Move a row up to a position in the page with its entries.
+  void MoveRow(const int32_t index, const int32_t y_pos) {
+    auto& row = rows_[index];
+    assert(y_pos < static_cast<int32_t>(row.get_y_pos()));
+    auto buffer = pages_[row.get_page()].buffer_.get();
+    auto width = GetUsedWidth(index);
+    // Lines are copied from the top, since the regions may overlap.
+    for (int32_t y = 0; y < row.get_size().y(); ++y) {
+      memmove(buffer + (y_pos + y) * size_.x(),
+              buffer + (row.get_y_pos() + y) * size_.x(), width * sizeof(T));
+    }
+    UpdateDirtyRect(row.get_page(),
+                    mathfu::vec4i(0, y_pos, width, y_pos + row.get_size().y()));
+    pages_[row.get_page()].move_revision_ = move_revision_;
+    row.set_y_pos(y_pos);
+
+    auto& entries = row.get_cached_entries();
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+      auto& entry = GetEntry(*it);
+      auto pos = mathfu::vec2i(
+          entry.get_uv().xy() * mathfu::vec2(size_) + 0.5f);
+      SetEntryPosition(&entry, mathfu::vec2i(pos.x(), y_pos));
+    }
+  }
+
+  // Update UV of an entry placed at a position.
+  void SetEntryPosition(GlyphCacheEntry* entry, const mathfu::vec2i& pos) {
+    entry->set_uv(mathfu::vec4(
+        mathfu::vec2(pos) / mathfu::vec2(size_),
+        mathfu::vec2(pos + entry->get_size()) / mathfu::vec2(size_)));
+  }
+
+  // Getter of an entry in the entry pool.
+  GlyphCacheEntry& GetEntry(const int32_t index) {
+    return entry_blocks_[index >> kEntryBlockShift]
+                        [index & (kEntryBlockSize - 1)];
+  }
+  const GlyphCacheEntry& GetEntry(const int32_t index) const {
+    return entry_blocks_[index >> kEntryBlockShift]
+                        [index & (kEntryBlockSize - 1)];
+  }
+
+  // Take an entry from the free list. The pool grows by a block when the
+  // free list is empty.
+  int32_t AllocateEntry() {
+    if (free_entries_.empty()) {
+      auto base = static_cast<int32_t>(entry_blocks_.size()) * kEntryBlockSize;
+      entry_blocks_.push_back(std::unique_ptr<GlyphCacheEntry[]>(
+          new GlyphCacheEntry[kEntryBlockSize]));
+      for (int32_t i = kEntryBlockSize - 1; i >= 0; --i) {
+        free_entries_.push_back(base + i);
+      }
+    }
+    auto index = free_entries_.back();
+    free_entries_.pop_back();
+    return index;
+  }
+
+  // Look up an entry index in the table.
+  // Returns kGlyphCacheIndexInvalid if the key is not in the table.
+  int32_t LookUp(const GlyphKey& key) const {
+    auto packed_key = key.get_packed_key();
+    auto mask = table_.size() - 1;
+    for (auto i = static_cast<size_t>(key.get_hash()) & mask;;
+         i = (i + 1) & mask) {
+      auto& slot = table_[i];
+      if (slot.entry_ == kGlyphCacheIndexInvalid) {
+        return kGlyphCacheIndexInvalid;
+      }
+      if (slot.key_ == packed_key) {
+        return slot.entry_;
+      }
+    }
+  }
+
+  // Insert a key to the table. The key must not be in the table.
+  // The table is kept at most half full to keep probe sequences short.
+  void Insert(const GlyphKey& key, const int32_t entry) {
+    if (static_cast<size_t>(num_entries_ + 1) * 2 > table_.size()) {
+      Rehash(table_.size() * 2);
+    }
+    InsertSlot(key.get_packed_key(), key.get_hash(), entry);
+    num_entries_++;
+  }
+
+  void InsertSlot(const uint64_t packed_key, const uint64_t hash,
+                  const int32_t entry) {
+    auto mask = table_.size() - 1;
+    auto i = static_cast<size_t>(hash) & mask;
+    while (table_[i].entry_ != kGlyphCacheIndexInvalid) {
+      i = (i + 1) & mask;
+    }
+    table_[i].key_ = packed_key;
+    table_[i].entry_ = entry;
+  }
+
+  // Erase a key from the table.
+  // Following slots in the probe sequence are shifted backward instead of
+  // leaving tombstones.
+  void Erase(const GlyphKey& key) {
+    auto packed_key = key.get_packed_key();
+    auto mask = table_.size() - 1;
+    auto i = static_cast<size_t>(key.get_hash()) & mask;
+    while (table_[i].key_ != packed_key ||
+           table_[i].entry_ == kGlyphCacheIndexInvalid) {
+      assert(table_[i].entry_ != kGlyphCacheIndexInvalid);
+      i = (i + 1) & mask;
+    }
+    for (auto j = (i + 1) & mask; table_[j].entry_ != kGlyphCacheIndexInvalid;
+         j = (j + 1) & mask) {
+      // Move the slot if its home position is not in (i, j].
+      auto home = static_cast<size_t>(GlyphKey::Hash(table_[j].key_)) & mask;
+      if (((j - home) & mask) >= ((j - i) & mask)) {
+        table_[i] = table_[j];
+        i = j;
+      }
+    }
+    table_[i] = GlyphCacheSlot();
+    num_entries_--;
+  }
+
+  // Resize the table and re-insert all keys.
+  void Rehash(const size_t size) {
+    std::vector<GlyphCacheSlot> table(size);
+    table_.swap(table);
+    for (auto it = table.begin(); it != table.end(); ++it) {
+      if (it->entry_ != kGlyphCacheIndexInvalid) {
+        InsertSlot(it->key_, GlyphKey::Hash(it->key_), it->entry_);
+      }
+    }
+  }
+
   // Copy glyph image into the buffer.
   void CopyImage(const mathfu::vec2i& pos, const T* const image,
                  const GlyphCacheEntry* entry) {
-    auto buffer = buffer_.get();
+    auto buffer = pages_[entry->get_page()].buffer_.get();
     auto size = entry->get_size().x() * sizeof(T);
     for (int32_t y = 0; y < entry->get_size().y(); ++y) {
       memcpy(buffer + pos.x() + (pos.y() + y) * size_.x(),
              image + y * entry->get_size().x(), size);
     }
-    UpdateDirtyRect(mathfu::vec4i(pos, pos + entry->get_size()));
+    UpdateDirtyRect(entry->get_page(),
+                    mathfu::vec4i(pos, pos + entry->get_size()));
   }
 
-  // Update dirty rect.
-  void UpdateDirtyRect(const mathfu::vec4i& rect) {
-    if (!dirty_) {
-      // Initialize dirty rect.
-      dirty_rect_ = mathfu::vec4i(size_, mathfu::kZeros2i);
-    }
+  // Append raw data to the buffer.
+  static void AppendData(const void* data, const size_t size,
+                         std::vector<uint8_t>* buffer) {
+    auto p = static_cast<const uint8_t*>(data);
+    buffer->insert(buffer->end(), p, p + size);
+  }
 
-    dirty_ = true;
-    dirty_rect_ =
-        mathfu::vec4i(mathfu::vec2i::Min(dirty_rect_.xy(), rect.xy()),
-                      mathfu::vec2i::Max(dirty_rect_.zw(), rect.zw()));
+  // Returns a bounding rect of two rects.
+  static mathfu::vec4i UnionRect(const mathfu::vec4i& a,
+                                 const mathfu::vec4i& b) {
+    return mathfu::vec4i(mathfu::vec2i::Min(a.xy(), b.xy()),
+                         mathfu::vec2i::Max(a.zw(), b.zw()));
+  }
+
+  // Add a rect to dirty rects of a page.
+  // Rects overlapping the new rect vertically are merged into it. Since rows
+  // never overlap vertically, glyphs of a row are tracked with a rect.
+  void UpdateDirtyRect(const int32_t page, const mathfu::vec4i& rect) {
+    auto& p = pages_[page];
+    auto& rects = p.dirty_rects_;
+    p.dirty_ = true;
+
+    auto merged = rect;
+    auto it = rects.begin();
+    while (it != rects.end()) {
+      if (it->y() < merged.w() && merged.y() < it->w()) {
+        merged = UnionRect(merged, *it);
+        rects.erase(it);
+        // The merged rect may overlap rects skipped so far.
+        it = rects.begin();
+      } else {
+        ++it;
+      }
+    }
+    it = std::lower_bound(rects.begin(), rects.end(), merged,
+                          [](const mathfu::vec4i& lhs,
+                             const mathfu::vec4i& rhs) {
+      return lhs.y() < rhs.y();
+    });
+    rects.insert(it, merged);
+
+    if (rects.size() > kMaxDirtyRects) {
+      // Merge two vertically adjacent rects with the smallest gap. No other
+      // rect lies between them, so rects stay disjoint.
+      size_t closest = 0;
+      for (size_t i = 1; i + 1 < rects.size(); ++i) {
+        if (rects[i + 1].y() - rects[i].w() <
+            rects[closest + 1].y() - rects[closest].w()) {
+          closest = i;
+        }
+      }
+      rects[closest] = UnionRect(rects[closest], rects[closest + 1]);
+      rects.erase(rects.begin() + closest + 1);
+    }
   }
 
 #ifdef GLYPH_CACHE_STATS
@@ -612,7 +1553,9 @@ class GlyphCache {
     stats_hit_ = 0;
     stats_lookup_ = 0;
     stats_row_flush_ = 0;
+    stats_page_flush_ = 0;
     stats_set_fail_ = 0;
+    stats_compaction_bytes_ = 0;
   }
 #endif
 
@@ -625,30 +1568,39 @@ class GlyphCache {
   // Size of the glyph cache. Rounded to power of 2.
   mathfu::vec2i size_;
 
-  // Cache buffer;
-  std::unique_ptr<T> buffer_;
+  // Pages of the cache. Each page has a buffer with the size of size_.
+  std::vector<GlyphCachePage> pages_;
 
-  // Hash map to the cache entries
-  // This map is the primary place to look up the cache entries.
-  // Key: a structure that contains glyph parameters such as a code point, font
-  // id, glyph size etc.
+  // Open addressing hash table to the cache entries.
+  // This table is the primary place to look up the cache entries.
+  // Key: a packed GlyphKey that contains glyph parameters such as a code
+  // point, font id, glyph size etc.
   // Note that the code point is an index in the
   // font file and not a Unicode value.
-  std::unordered_map<GlyphKey, std::unique_ptr<GlyphCacheEntry>, GlyphKey>
-      map_entries_;
+  std::vector<GlyphCacheSlot> table_;
+
+  // Pool of cache entries allocated in blocks, and indices of free entries.
+  std::vector<std::unique_ptr<GlyphCacheEntry[]>> entry_blocks_;
+  std::vector<int32_t> free_entries_;
+
+  // Rows in the cache, and indices of released rows.
+  std::vector<GlyphCacheRow> rows_;
+  std::vector<int32_t> free_rows_;
+
+  // Head (least recently used) and tail (most recently used) of the row LRU
+  // list linked through rows_.
+  int32_t lru_head_;
+  int32_t lru_tail_;
 
-  // list of rows in the cache.
-  std::list<GlyphCacheRow> list_row_;
+  // Sorted row heights to have O(log N) access to a row entry with a given
+  // height.
+  std::vector<RowHeight> row_heights_;
 
-  // LRU entries of the row. Tracks iterator to list_row_.
-  std::list<GlyphCacheEntry::iterator_row> lru_row_;
+  // Insertion order given to the next element of row_heights_.
+  uint32_t row_height_order_;
 
-  // Map to row entries to have O(log N) access to a row entry.
-  // Tracks iterator to list_row_.
-  // Using multimap because multiple rows can have same row height.
-  // Key: height of the row. With the map, an API can have quick access to a row
-  // with a given height.
-  std::multimap<int32_t, GlyphCacheEntry::iterator_row> map_row_;
+  // # of entries in the look-up table.
+  int32_t num_entries_;
 
   // Revision of the buffer.
   // Each time one or more cache entry is evicted, a revision of the cache is
@@ -659,19 +1611,21 @@ class GlyphCache {
   // because existing entries are still valid in that case.
   uint32_t revision_;
 
-  // Flag indicates if the cache is dirty. If it's dirty, corresponding font
-  // atlas texture needs to be uploaded.
-  bool dirty_;
+  // Revision of entry moves. Compact() increments it and marks the pages
+  // whose entries it moved, so that only users of those pages update UVs.
+  uint32_t move_revision_;
 
-  // Dirty region in the buffer.
-  mathfu::vec4i dirty_rect_;
+  // Max # of pages the cache can allocate.
+  int32_t max_pages_;
 
 #ifdef GLYPH_CACHE_STATS
   // Variables to track usage stats.
   int32_t stats_lookup_;
   int32_t stats_hit_;
   int32_t stats_row_flush_;
+  int32_t stats_page_flush_;
   int32_t stats_set_fail_;
+  size_t stats_compaction_bytes_;
 #endif
 };
 /// @endcond
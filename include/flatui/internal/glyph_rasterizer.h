@@ -0,0 +1,172 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GLYPH_RASTERIZER_H
+#define GLYPH_RASTERIZER_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "flatui/internal/distance_field.h"
+#include "flatui/internal/glyph_cache.h"
+#include "flatui/internal/flatui_util.h"
+
+/// @cond FLATUI_INTERNAL
+// Forward decls for FreeType.
+typedef struct FT_LibraryRec_ *FT_Library;
+typedef struct FT_FaceRec_ *FT_Face;
+
+namespace flatui {
+
+// Rasterization request for a glyph.
+struct GlyphRasterizeRequest {
+  // Key of the glyph. Includes a font id, a code point and a glyph size.
+  GlyphKey key;
+
+  // Font file data the glyph is rasterized from. The data needs to be kept
+  // alive until the request finishes.
+  const char *font_data;
+  size_t font_data_size;
+
+  // Padding of the signed distance field. The glyph is rasterized as a
+  // bitmap when the value is 0.
+  int32_t sdf_padding;
+};
+
+// Result of a rasterization request.
+struct GlyphRasterizeResult {
+  // Key of the glyph.
+  GlyphKey key;
+
+  // Glyph cache entry that includes a glyph size and offset.
+  GlyphCacheEntry entry;
+
+  // Rasterized glyph image of entry.get_size().
+  std::vector<uint8_t> image;
+
+  // Flag indicating if the rasterization succeeded.
+  bool succeeded;
+};
+
+// GlyphRasterizer is a pool of worker threads that rasterize glyphs in
+// parallel.
+// Each worker thread has own FreeType library and own FT_Face instances
+// created from the font data given by requests, so FontManager's FT_Face is
+// never touched by workers.
+// Rasterized glyphs are retrieved by the caller (typically between frames) and
+// stored to the glyph cache from the thread that owns the glyph cache.
+class GlyphRasterizer {
+ public:
+  GlyphRasterizer() : in_flight_(0), terminate_(false) {}
+  ~GlyphRasterizer() { Stop(); }
+
+  // Start worker threads.
+  // Returns false if the rasterizer is already running or num_threads is
+  // invalid.
+  bool Start(const int32_t num_threads);
+
+  // Stop worker threads. Pending requests are discarded.
+  void Stop();
+
+  // Returns true if worker threads are running.
+  bool IsRunning() const { return !workers_.empty(); }
+
+  // Queue a rasterization request.
+  // Returns false if the glyph has already been requested and not retrieved
+  // yet.
+  bool Request(const GlyphRasterizeRequest &request);
+
+  // Move finished results to the given vector. The call doesn't block.
+  void Retrieve(std::vector<GlyphRasterizeResult> *results);
+
+  // Block until all queued requests are finished.
+  void Wait();
+
+  // Release FT_Face instances of the given font in all worker threads.
+  // Call the API before a font data used in requests is released.
+  void ReleaseFace(const HashedId font_id);
+
+  // Returns true if the glyph has been requested and its result has not been
+  // retrieved yet.
+  bool IsPending(const GlyphKey &key);
+
+  // Returns # of requests that are queued or being processed.
+  size_t get_num_pending();
+
+ private:
+  // Per thread state of a worker.
+  struct Worker {
+    Worker() : library(nullptr) {}
+
+    // Worker thread.
+    std::thread thread;
+
+    // FreeType library instance only used in the worker thread.
+    FT_Library library;
+
+    // Distance field generator used in the worker thread.
+    DistanceFieldGenerator sdf_generator;
+
+    // Faces created in the worker thread.
+    // Key: font id, Value: FT_Face created from the font data.
+    std::vector<std::pair<HashedId, FT_Face>> faces;
+  };
+
+  // Thread entry of workers.
+  void WorkerMain(Worker *worker);
+
+  // Rasterize a glyph with the worker's face.
+  void Rasterize(Worker *worker, const GlyphRasterizeRequest &request,
+                 GlyphRasterizeResult *result);
+
+  // Look up or create FT_Face for a request in the worker.
+  FT_Face GetFace(Worker *worker, const GlyphRasterizeRequest &request);
+
+  // Worker threads.
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  // Queued requests.
+  std::deque<GlyphRasterizeRequest> requests_;
+
+  // Finished results that are not retrieved yet.
+  std::vector<GlyphRasterizeResult> results_;
+
+  // Keys of requested glyphs used to avoid duplicated requests.
+  std::unordered_set<GlyphKey, GlyphKey> pending_keys_;
+
+  // # of requests being processed by workers.
+  int32_t in_flight_;
+
+  // Flag to terminate worker threads.
+  bool terminate_;
+
+  // Mutex that guards all members above.
+  std::mutex mutex_;
+
+  // Condition variable to notify new requests to workers.
+  std::condition_variable request_cv_;
+
+  // Condition variable to notify finished requests.
+  std::condition_variable finish_cv_;
+};
+
+}  // namespace flatui
+/// @endcond
+
+#endif  // GLYPH_RASTERIZER_H
@@ -0,0 +1,134 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef IMAGE_ATLAS_H
+#define IMAGE_ATLAS_H
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "fplbase/renderer.h"
+#include "mathfu/constants.h"
+
+/// @cond FLATUI_INTERNAL
+namespace flatui {
+
+// ImageAtlas is a runtime texture atlas for small UI images, so that quads of
+// different images can be rendered in a draw call.
+// Images are copied into the atlas on the GPU on their first use, by
+// rendering them into the atlas texture attached to a framebuffer object.
+// Images are packed with a shelf allocator: each shelf is a row with the
+// height of the first image placed in it. Once the atlas is full, images are
+// no longer packed and the caller needs to render them with their own
+// textures, until Update() clears the atlas so that images used afterwards
+// are packed again.
+// The atlas also keeps a white block, so that solid color quads can be
+// batched with images using the atlas texture.
+// Images are identified by texture ids and sizes. Invalidate() an image when
+// its texture is updated or released.
+class ImageAtlas {
+ public:
+  ImageAtlas();
+  ~ImageAtlas();
+
+  // Enable or disable packing images. Either resets the atlas.
+  void SetPacking(bool enable);
+  bool get_packing() const { return packing_; }
+
+  // Look up an image in the atlas, copying the image into the atlas if it's
+  // not packed yet.
+  // renderer, shader: used to copy the image. shader needs to render a
+  // texture as is with the renderer's color.
+  // Returns false if the image is not in the atlas. Otherwise uv is set to
+  // the rect (u0, v0, u1, v1) of the image in the atlas texture.
+  bool Find(fplbase::Renderer &renderer, fplbase::Shader *shader,
+            const fplbase::Texture &texture, mathfu::vec4 *uv);
+
+  // Forget the packed copy of a texture, so that the texture is copied again
+  // on its next use.
+  void Invalidate(const fplbase::Texture &texture);
+
+  // Start a new frame. If the atlas filled up, packed images are cleared so
+  // that images used from now on can be packed. Call this before any Find()
+  // in a frame, since UVs returned earlier are not valid after clearing.
+  void Update();
+
+  // Retrieve the atlas texture, creating it if necessary.
+  const fplbase::Texture *GetTexture();
+
+  // Getter of the UV of the white block in the atlas texture.
+  // Sampling the UV gives an opaque white texel.
+  mathfu::vec2 get_white_uv() const { return white_uv_; }
+
+  // Release the atlas texture and forget packed images.
+  void Reset();
+
+  // Forget packed images, keeping the atlas texture and the white block.
+  void Clear();
+
+  // Images larger than this in either dimension are not packed.
+  static const int32_t kMaxImageSize = 256;
+
+ private:
+  // Returns the key of a texture in images_.
+  static uint64_t GetKey(const fplbase::Texture &texture);
+
+  // Allocate a rect in the atlas. Returns false if the atlas is full.
+  bool Allocate(const mathfu::vec2i &size, mathfu::vec2i *pos);
+
+  // Render a texture into a rect of the atlas texture.
+  // Returns false if the atlas texture can't be rendered to. In that case,
+  // packing is disabled.
+  bool Copy(fplbase::Renderer &renderer, fplbase::Shader *shader,
+            const fplbase::Texture &texture, const mathfu::vec2i &pos,
+            const mathfu::vec2i &size);
+
+  // A row of images. Images are placed from left to right.
+  struct Shelf {
+    int32_t y;
+    int32_t height;
+    int32_t x;
+  };
+
+  // Atlas texture and its size.
+  std::unique_ptr<fplbase::Texture> texture_;
+  mathfu::vec2i size_;
+
+  // Framebuffer object used to render images into the atlas texture.
+  uint32_t framebuffer_;
+
+  // Shelves from the bottom to the top of the atlas.
+  std::vector<Shelf> shelves_;
+
+  // UV rects of packed images keyed by texture ids and sizes.
+  std::unordered_map<uint64_t, mathfu::vec4> images_;
+
+  // Set when an image didn't fit into the atlas.
+  bool full_;
+
+  // # of Update() calls since packed images were cleared.
+  int32_t frames_since_clear_;
+
+  // UV of the white block.
+  mathfu::vec2 white_uv_;
+
+  // Set to pack images.
+  bool packing_;
+};
+
+}  // namespace flatui
+/// @endcond
+
+#endif  // IMAGE_ATLAS_H
@@ -0,0 +1,158 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LAYOUT_CONTEXT_H
+#define LAYOUT_CONTEXT_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "flatui/internal/distance_field.h"
+#include "flatui/internal/flatui_util.h"
+#include "flatui/internal/font_data.h"
+#include "flatui/internal/shaping_cache.h"
+
+/// @cond FLATUI_INTERNAL
+// Forward decls for FreeType & Harfbuzz.
+typedef struct FT_LibraryRec_ *FT_Library;
+typedef struct FT_FaceRec_ *FT_Face;
+struct hb_font_t;
+struct hb_buffer_t;
+
+namespace flatui {
+
+class FaceData;
+
+// A paragraph of a multi line text shaped at once, and the run of a word
+// sliced from it. Words are sliced in the order of the text.
+struct ParagraphRun {
+  ParagraphRun() : start(0), end(0), cursor(0) {}
+
+  // Byte range of the paragraph in the text.
+  size_t start;
+  size_t end;
+
+  // Glyphs of the paragraph, and their faces when fallback fonts are used.
+  // Clusters are byte offsets in the paragraph.
+  ShapedRun run;
+  std::vector<const FaceData *> faces;
+
+  // Sums of x advances of the glyphs before each glyph, followed by the sum
+  // of all glyphs.
+  std::vector<uint32_t> advances;
+
+  // Glyphs of the paragraph before this index in the logical order belong to
+  // words already sliced.
+  size_t cursor;
+
+  // Run of the current word and faces of its glyphs.
+  ShapedRun word;
+  std::vector<const FaceData *> word_faces;
+};
+
+// Mutable state used while FontManager lays out a text.
+// The context points to the FreeType face, the HarfBuzz font and buffer, and
+// the scratch buffers the layout uses, so that texts can be laid out in
+// parallel with a context per thread.
+// The main thread context points to FontManager's own instances. Contexts of
+// other threads are provided by LayoutWorker.
+struct LayoutContext {
+  LayoutContext()
+      : face_data(nullptr),
+        face(nullptr),
+        harfbuzz_font(nullptr),
+        harfbuzz_buf(nullptr),
+        wordbreak_info(nullptr),
+        sdf_generator(nullptr),
+        sdf_image(nullptr),
+        shaping_cache(nullptr),
+        paragraph_run(nullptr),
+        mutex(nullptr) {}
+
+  // FaceData of the font the context lays out with, and the face created
+  // from it with its pixel size state.
+  const FaceData *face_data;
+  FT_Face face;
+  hb_font_t *harfbuzz_font;
+
+  // Buffer for HarfBuzz shaping.
+  hb_buffer_t *harfbuzz_buf;
+
+  // Line break info buffer used in libunibreak.
+  std::vector<char> *wordbreak_info;
+
+  // Distance field generator and its output buffer used in the SDF mode.
+  DistanceFieldGenerator *sdf_generator;
+  std::vector<uint8_t> *sdf_image;
+
+  // Cache of shaped runs. Only used by the thread of the context.
+  ShapingCache *shaping_cache;
+
+  // Paragraph being laid out with TextLayoutStrategyParagraph.
+  ParagraphRun *paragraph_run;
+
+  // Mutex guarding the glyph cache and the FontBuffer cache while texts are
+  // laid out in parallel. nullptr when the layout runs on a single thread.
+  std::mutex *mutex;
+};
+
+// LayoutWorker owns FreeType and HarfBuzz instances for a layout thread.
+// Faces are created from the font data shared with FontManager, so that
+// FontManager's FT_Face is never touched by other threads.
+class LayoutWorker {
+ public:
+  LayoutWorker();
+  ~LayoutWorker();
+
+  // Initialize the FreeType library and the HarfBuzz buffer.
+  // Returns false if the library can't be initialized.
+  bool Initialize();
+
+  // Set up a context laying out texts with the given font.
+  // font_data needs to be kept alive while the face is used.
+  // Returns false if the face can't be created.
+  bool GetContext(const HashedId font_id, const FontData &font_data,
+                  std::mutex *mutex, LayoutContext *context);
+
+  // Release the face of the given font.
+  void ReleaseFace(const HashedId font_id);
+
+ private:
+  // A face created in the worker.
+  struct WorkerFace {
+    HashedId font_id;
+    FT_Face face;
+    hb_font_t *harfbuzz_font;
+  };
+
+  FT_Library library_;
+  hb_buffer_t *harfbuzz_buf_;
+  std::vector<WorkerFace> faces_;
+  std::vector<char> wordbreak_info_;
+  DistanceFieldGenerator sdf_generator_;
+  std::vector<uint8_t> sdf_image_;
+  ShapingCache shaping_cache_;
+  ParagraphRun paragraph_run_;
+
+  // Disable copy constructor.
+  LayoutWorker(const LayoutWorker &);
+  LayoutWorker &operator=(const LayoutWorker &);
+};
+
+}  // namespace flatui
+/// @endcond
+
+#endif  // LAYOUT_CONTEXT_H
@@ -0,0 +1,182 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/// @cond FLATUI_INTERNAL
+namespace flatui {
+
+// LruCache owns values keyed by K within a byte budget.
+// Each value is given its size in bytes when inserted. When an insertion
+// exceeds the budget, least recently used values are evicted.
+// Like GlyphCache, the cache has a cycle counter incremented by Update() for
+// each rendering cycle, and values used in the current cycle are never
+// evicted, so that pointers returned in a cycle stay valid until the next
+// Update(). The cache may exceed the budget when values used in the current
+// cycle don't fit.
+// While deferred release is enabled, evicted and erased values are kept in a
+// pending list instead of being destroyed, so that a thread that doesn't own
+// the resources of values (e.g. GL buffers) can modify the cache. The owning
+// thread destroys them with ReleasePending().
+template <typename K, typename V, typename Hash>
+class LruCache {
+ public:
+  explicit LruCache(size_t max_size)
+      : size_(0),
+        max_size_(max_size),
+        counter_(0),
+        num_evictions_(0),
+        defer_release_(false) {}
+  ~LruCache() {}
+
+  // An entry of the cache.
+  struct Entry {
+    std::unique_ptr<V> value;
+    size_t size;
+    uint32_t last_used_counter;
+    typename std::list<K>::iterator lru_it;
+  };
+  typedef typename std::unordered_map<K, Entry, Hash>::const_iterator
+      const_iterator;
+
+  // Look up a value and mark it used in the current cycle.
+  // Returns nullptr if the key is not in the cache.
+  V *Find(const K &key) {
+    auto it = map_.find(key);
+    if (it == map_.end()) return nullptr;
+    Touch(&it->second);
+    return it->second.value.get();
+  }
+
+  // Insert a value of the given size replacing the existing value of the key.
+  // Least recently used values are evicted to make a room for it.
+  V *Insert(const K &key, std::unique_ptr<V> value, size_t size) {
+    Erase(key);
+    Evict(size);
+    lru_.push_front(key);
+    Entry &entry = map_[key];
+    entry.value = std::move(value);
+    entry.size = size;
+    entry.last_used_counter = counter_;
+    entry.lru_it = lru_.begin();
+    size_ += size;
+    return entry.value.get();
+  }
+
+  // Remove a value. Returns false if the key is not in the cache.
+  bool Erase(const K &key) {
+    auto it = map_.find(key);
+    if (it == map_.end()) return false;
+    size_ -= it->second.size;
+    lru_.erase(it->second.lru_it);
+    Release(&it->second);
+    map_.erase(it);
+    return true;
+  }
+
+  // Remove all values, including values pending release.
+  void Clear() {
+    map_.clear();
+    lru_.clear();
+    pending_release_.clear();
+    size_ = 0;
+  }
+
+  // Enable or disable deferred release of evicted and erased values.
+  void set_defer_release(bool defer) { defer_release_ = defer; }
+
+  // Destroy values evicted or erased while deferred release was enabled.
+  // Invoke this API on the thread owning resources of values.
+  void ReleasePending() { pending_release_.clear(); }
+
+  // Increment the cycle counter. Invoke this API for each rendering cycle.
+  void Update() { counter_++; }
+
+  // Iterators of entries in an unspecified order.
+  const_iterator begin() const { return map_.begin(); }
+  const_iterator end() const { return map_.end(); }
+
+  // Getter of total size of values in bytes.
+  size_t get_size() const { return size_; }
+
+  // Getter/Setter of the byte budget.
+  // Setting a smaller budget evicts values not used in the current cycle.
+  size_t get_max_size() const { return max_size_; }
+  void set_max_size(size_t max_size) {
+    max_size_ = max_size;
+    Evict(0);
+  }
+
+  // Getter of # of values in the cache.
+  size_t get_num_entries() const { return map_.size(); }
+
+  // Getter of # of values evicted since the construction.
+  uint32_t get_num_evictions() const { return num_evictions_; }
+
+ private:
+  // Move the entry to the head of the LRU list.
+  void Touch(Entry *entry) {
+    entry->last_used_counter = counter_;
+    lru_.splice(lru_.begin(), lru_, entry->lru_it);
+  }
+
+  // Move the value of the entry to the pending list if deferred release is
+  // enabled. Otherwise the value is destroyed with the entry.
+  void Release(Entry *entry) {
+    if (defer_release_) {
+      pending_release_.push_back(std::move(entry->value));
+    }
+  }
+
+  // Evict least recently used values until the size fits into the budget.
+  void Evict(size_t size) {
+    while (!lru_.empty() && size_ + size > max_size_) {
+      auto it = map_.find(lru_.back());
+      if (it->second.last_used_counter == counter_) {
+        // The rest of values are used in the current cycle.
+        break;
+      }
+      size_ -= it->second.size;
+      Release(&it->second);
+      map_.erase(it);
+      lru_.pop_back();
+      num_evictions_++;
+    }
+  }
+
+  std::unordered_map<K, Entry, Hash> map_;
+
+  // Keys in the most recently used order.
+  std::list<K> lru_;
+
+  size_t size_;
+  size_t max_size_;
+  uint32_t counter_;
+  uint32_t num_evictions_;
+
+  // Values evicted or erased while deferred release is enabled.
+  std::vector<std::unique_ptr<V>> pending_release_;
+  bool defer_release_;
+};
+
+}  // namespace flatui
+/// @endcond
+
+#endif  // LRU_CACHE_H
@@ -117,6 +117,7 @@ class MicroEdit {
   void Reset() {
     initial_string_.clear();
     wordbreak_info_.clear();
+    character_offsets_.clear();
     editing_text_.clear();
     input_text_selection_start_ = 0;
     input_text_selection_length_ = 0;
@@ -136,11 +137,18 @@ class MicroEdit {
   }
 
   // Helper to count a number of characters in a text.
-  int32_t GetNumCharacters(const std::string &text);
+  // A character is a code point, same as a character in the word break info.
+  int32_t GetNumCharacters(const char *text, size_t length);
 
   // Update a character index information in the UTF8 buffer.
   void UpdateWordBreakInfo();
 
+  // Update the character index information of the paragraph edited at the
+  // byte offset start, where removed bytes were replaced with inserted bytes.
+  // Line breaks in other paragraphs don't depend on the edit, so they are
+  // kept as they are.
+  void UpdateWordBreakInfo(size_t start, size_t removed, size_t inserted);
+
   // Update an index in the wordbreak info buffer to corresponding caret
   // position.
   void UpdateWordBreakIndex();
@@ -159,7 +167,7 @@ class MicroEdit {
   bool MoveCaretToWordBoundary(bool forward);
 
   // Insert a text before the caret position and update caret position.
-  void InsertText(const std::string &text);
+  void InsertText(const char *text, size_t length);
 
   // Remove the specified number of text after the caret position.
   void RemoveText(int32_t num_remove);
@@ -168,9 +176,13 @@ class MicroEdit {
   int32_t PickColumn(const mathfu::vec2i &pointer_position,
                      std::vector<mathfu::vec2i>::const_iterator start_it,
                      std::vector<mathfu::vec2i>::const_iterator end_it);
-  void PickRow(const mathfu::vec2i &pointer_position,
-               std::vector<mathfu::vec2i>::const_iterator *start_it,
-               std::vector<mathfu::vec2i>::const_iterator *end_it);
+  // Returns the first row at or below the pointer position, or # of rows if
+  // the pointer is below the text.
+  int32_t PickRow(const mathfu::vec2i &pointer_position);
+  // Retrieve the first and the last caret positions of the row.
+  void GetRow(int32_t row,
+              std::vector<mathfu::vec2i>::const_iterator *start_it,
+              std::vector<mathfu::vec2i>::const_iterator *end_it);
 
   int32_t caret_pos_;
   int32_t wordbreak_index_;
@@ -191,6 +203,13 @@ class MicroEdit {
   // Word breaking info retrieved by libUnibreak.
   std::vector<char> wordbreak_info_;
 
+  // Byte offsets of each character in the text, followed by the length of the
+  // text. Maps a caret position to an index in the word break info.
+  std::vector<int32_t> character_offsets_;
+
+  // Scratch buffer of paragraph word break info reused across edits.
+  std::vector<char> linebreak_scratch_;
+
   // Editing text in IME.
   bool in_text_input_;
   std::string input_text_;
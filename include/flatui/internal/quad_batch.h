@@ -0,0 +1,112 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef QUAD_BATCH_H
+#define QUAD_BATCH_H
+
+#include <vector>
+
+#include "fplbase/renderer.h"
+#include "mathfu/constants.h"
+
+/// @cond FLATUI_INTERNAL
+namespace flatui {
+
+// QuadBatch accumulates quads of images, backgrounds and nine-patches into a
+// vertex buffer, so that consecutive quads with the same texture are rendered
+// in a draw call. A color and UVs are baked into each vertex.
+// Solid color quads are rendered with a white texel of a texture, so that
+// they can be batched with images in the same texture.
+// The owner needs to flush the batch before changing a render state that
+// affects the batch, or rendering anything that needs to be on top of the
+// quads.
+class QuadBatch {
+ public:
+  QuadBatch() : shader_(nullptr), texture_(nullptr), num_draw_calls_(0) {}
+  ~QuadBatch() {}
+
+  // Append a quad to the batch.
+  // renderer: used to flush the batch when the shader or the texture needs
+  // to be switched.
+  // shader: shader to render the batch.
+  // texture: texture of the quad.
+  // rect: rect (x0, y0, x1, y1) of the quad on the screen.
+  // uv: UVs (u0, v0, u1, v1) at (x0, y0) and (x1, y1).
+  // color: color multiplied to the texture.
+  void Add(fplbase::Renderer &renderer, fplbase::Shader *shader,
+           const fplbase::Texture *texture, const mathfu::vec4 &rect,
+           const mathfu::vec4 &uv, const mathfu::vec4 &color);
+
+  // Append 9 quads of a nine-patch in the same geometry as
+  // Mesh::RenderAAQuadAlongXNinePatch().
+  // image_size: size of the image in pixels.
+  // patch_info: the nine-patch borders (left, top, right, bottom) in the
+  // image UV.
+  // Other arguments are the same as Add(). uv is the rect of the image in
+  // the texture.
+  void AddNinePatch(fplbase::Renderer &renderer, fplbase::Shader *shader,
+                    const fplbase::Texture *texture, const mathfu::vec4 &rect,
+                    const mathfu::vec4 &uv, const mathfu::vec2i &image_size,
+                    const mathfu::vec4 &patch_info,
+                    const mathfu::vec4 &color);
+
+  // Render all quads in the batch and clear the batch.
+  void Flush(fplbase::Renderer &renderer);
+
+  // Discard all quads in the batch without rendering them.
+  void Clear() { vertices_.clear(); }
+
+  // Returns true if the batch has no quads.
+  bool IsEmpty() const { return vertices_.empty(); }
+
+  // Getter of # of draw calls issued since the last ResetDrawCallCount().
+  int32_t get_num_draw_calls() const { return num_draw_calls_; }
+  void ResetDrawCallCount() { num_draw_calls_ = 0; }
+
+ private:
+  // Flush the batch if the shader or the texture changes, and set the color
+  // of following quads.
+  void Prepare(fplbase::Renderer &renderer, fplbase::Shader *shader,
+               const fplbase::Texture *texture, const mathfu::vec4 &color);
+
+  // Append a quad with the current color.
+  void AddQuad(const mathfu::vec2 &p0, const mathfu::vec2 &p1,
+               const mathfu::vec2 &uv0, const mathfu::vec2 &uv1);
+
+  // Vertex of the batch. The layout needs to match kQuadBatchFormat.
+  struct QuadBatchVertex {
+    mathfu::vec3_packed position_;
+    mathfu::vec2_packed uv_;
+    uint8_t color_[4];
+  };
+
+  // Shader and texture used to render the current batch.
+  fplbase::Shader *shader_;
+  const fplbase::Texture *texture_;
+
+  // Vertices of all quads in the batch. Quads are rendered with the quad
+  // indices shared with FontBuffers.
+  std::vector<QuadBatchVertex> vertices_;
+
+  // Color of quads being added.
+  uint8_t color_[4];
+
+  // # of draw calls issued by Flush().
+  int32_t num_draw_calls_;
+};
+
+}  // namespace flatui
+/// @endcond
+
+#endif  // QUAD_BATCH_H
@@ -0,0 +1,86 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RENDER_LAYER_H
+#define RENDER_LAYER_H
+
+#include <memory>
+
+#include "fplbase/renderer.h"
+#include "mathfu/constants.h"
+
+/// @cond FLATUI_INTERNAL
+namespace flatui {
+
+// RenderLayer is an offscreen texture that caches the rendering of a group,
+// so that a static group is composited as a single quad.
+// Contents are rendered into the texture attached to a framebuffer object
+// with premultiplied alpha, so that translucent contents keep their coverage
+// when the layer is composited.
+class RenderLayer {
+ public:
+  RenderLayer();
+  ~RenderLayer();
+
+  // Start rendering into the layer texture. The texture is cleared, and
+  // re-created if the size is changed.
+  // The caller needs to set a projection mapping the rect of the layer on
+  // the screen to the texture.
+  // Returns false if the texture can't be rendered to.
+  bool Begin(fplbase::Renderer &renderer, const mathfu::vec2i &size);
+
+  // Finish rendering into the layer texture, restoring the framebuffer, the
+  // viewport and the scissor test of the screen.
+  void End(fplbase::Renderer &renderer);
+
+  // Set the blend mode to render contents into a layer. Needs to be called
+  // again when something else changed the blend mode while rendering into
+  // the layer.
+  static void SetLayerBlendMode(fplbase::Renderer &renderer);
+
+  // Set the blend mode to composite a layer texture, which has premultiplied
+  // alpha. Set the blend mode back to kBlendModeAlpha once the layer is
+  // rendered.
+  static void SetCompositeBlendMode(fplbase::Renderer &renderer);
+
+  // Getter of the layer texture. Returns nullptr if the layer hasn't been
+  // rendered yet.
+  const fplbase::Texture *get_texture() const { return texture_.get(); }
+
+  // Getter of the size of the layer texture.
+  const mathfu::vec2i &get_size() const { return size_; }
+
+  // UV rect (u0, v0, u1, v1) of the layer at the top-left and the
+  // bottom-right corners on the screen.
+  static mathfu::vec4 GetUV() { return mathfu::vec4(0.0f, 1.0f, 1.0f, 0.0f); }
+
+ private:
+  std::unique_ptr<fplbase::Texture> texture_;
+  mathfu::vec2i size_;
+  uint32_t framebuffer_;
+
+  // Screen states saved by Begin().
+  int32_t previous_framebuffer_;
+  int32_t viewport_[4];
+  bool scissor_;
+
+  // Disable copy constructor.
+  RenderLayer(const RenderLayer &);
+  RenderLayer &operator=(const RenderLayer &);
+};
+
+}  // namespace flatui
+/// @endcond
+
+#endif  // RENDER_LAYER_H
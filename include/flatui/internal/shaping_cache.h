@@ -0,0 +1,120 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SHAPING_CACHE_H
+#define SHAPING_CACHE_H
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <hb.h>
+
+#include "flatui/internal/flatui_util.h"
+
+/// @cond FLATUI_INTERNAL
+namespace flatui {
+
+// Parameters a shaped run depends on besides its text.
+struct ShapedRunKey {
+  ShapedRunKey() : font_id(kNullHash), glyph_size(0), script(0), rtl(false) {}
+  ShapedRunKey(HashedId _font_id, int32_t _glyph_size, uint32_t _script,
+               bool _rtl)
+      : font_id(_font_id),
+        glyph_size(_glyph_size),
+        script(_script),
+        rtl(_rtl) {}
+  bool operator==(const ShapedRunKey &other) const {
+    return font_id == other.font_id && glyph_size == other.glyph_size &&
+           script == other.script && rtl == other.rtl;
+  }
+
+  HashedId font_id;
+  // Pixel size of the face. HarfBuzz positions are hinted for the size.
+  int32_t glyph_size;
+  uint32_t script;
+  bool rtl;
+};
+
+// Output of HarfBuzz shaping for a run of text.
+struct ShapedRun {
+  std::vector<hb_glyph_info_t> glyph_info;
+  std::vector<hb_glyph_position_t> glyph_pos;
+  // Sum of x advances in FreeType unit.
+  uint32_t width;
+};
+
+// ShapingCache keeps shaped runs (typically words) so that laying out the
+// same text again with a different wrap width or label size doesn't re-run
+// HarfBuzz.
+// Memory used by runs is bounded, and least recently used runs are evicted
+// when the cache exceeds the bound.
+class ShapingCache {
+ public:
+  explicit ShapingCache(size_t max_size) : size_(0), max_size_(max_size) {}
+  ~ShapingCache() {}
+
+  // Look up a shaped run. Returns nullptr if the run is not cached.
+  const ShapedRun *Find(const ShapedRunKey &key, const char *text,
+                        size_t length);
+
+  // Store the contents of a shaped HarfBuzz buffer as a run of the text.
+  // Returns the stored run, which stays valid until the next Set() or Clear().
+  const ShapedRun *Set(const ShapedRunKey &key, const char *text,
+                       size_t length, hb_buffer_t *buffer);
+
+  // Release all runs.
+  void Clear();
+
+  // Getter of total # of bytes used by runs.
+  size_t get_size() const { return size_; }
+
+  // Getter/Setter of the max # of bytes used by runs.
+  size_t get_max_size() const { return max_size_; }
+  void set_max_size(size_t max_size) {
+    max_size_ = max_size;
+    Evict(0);
+  }
+
+ private:
+  struct Entry {
+    ShapedRunKey key;
+    std::string text;
+    size_t hash;
+    size_t size;
+    ShapedRun run;
+  };
+  typedef std::list<Entry> EntryList;
+
+  static size_t Hash(const ShapedRunKey &key, const char *text,
+                     size_t length);
+
+  // Evict least recently used runs until the given # of bytes fits.
+  void Evict(size_t size);
+
+  // Runs in the most recently used order.
+  EntryList entries_;
+
+  // Look up table keyed on the hash of a key and a text.
+  std::unordered_multimap<size_t, EntryList::iterator> map_;
+
+  size_t size_;
+  size_t max_size_;
+};
+
+}  // namespace flatui
+/// @endcond
+
+#endif  // SHAPING_CACHE_H
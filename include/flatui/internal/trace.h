@@ -0,0 +1,93 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+
+namespace flatui {
+
+/// @brief A function called when FlatUI enters a traced scope.
+///
+/// @param[in] name A C-string naming the scope, such as "FlatUI::Layout". The
+/// string is a literal that stays valid after the call.
+typedef void (*TraceBeginFunction)(const char *name);
+
+/// @brief A function called when FlatUI leaves the innermost traced scope.
+typedef void (*TraceEndFunction)();
+
+/// @brief Set functions receiving scoped trace events of FlatUI and
+/// FontManager, e.g. to forward them to systrace or Perfetto.
+///
+/// Scopes are properly nested on a thread. Pass `nullptr` to disable tracing.
+/// Trace events are not emitted from the layout workers of
+/// `FontManager::GetBuffers()`.
+///
+/// @param[in] begin A function invoked at the beginning of a scope.
+/// @param[in] end A function invoked at the end of the scope.
+void SetTraceFunctions(TraceBeginFunction begin, TraceEndFunction end);
+
+/// @cond FLATUI_INTERNAL
+// ScopedTrace emits trace events for the lifetime of the instance.
+// The cost is a branch when no trace function is set. A scope with a null
+// name doesn't emit events.
+class ScopedTrace {
+ public:
+  explicit ScopedTrace(const char *name)
+      : active_(begin_ != nullptr && name != nullptr) {
+    if (active_) begin_(name);
+  }
+  ~ScopedTrace() {
+    if (active_ && end_ != nullptr) end_();
+  }
+
+  static void SetFunctions(TraceBeginFunction begin, TraceEndFunction end) {
+    begin_ = begin;
+    end_ = end;
+  }
+
+ private:
+  static TraceBeginFunction begin_;
+  static TraceEndFunction end_;
+  bool active_;
+
+  // Disable copy constructor.
+  ScopedTrace(const ScopedTrace &);
+  ScopedTrace &operator=(const ScopedTrace &);
+};
+
+// ScopedTimer adds the elapsed time of its lifetime to a counter in seconds.
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(double *seconds)
+      : seconds_(seconds), start_(std::chrono::steady_clock::now()) {}
+  ~ScopedTimer() {
+    *seconds_ += std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start_).count();
+  }
+
+ private:
+  double *seconds_;
+  std::chrono::steady_clock::time_point start_;
+
+  // Disable copy constructor.
+  ScopedTimer(const ScopedTimer &);
+  ScopedTimer &operator=(const ScopedTimer &);
+};
+/// @endcond
+
+}  // namespace flatui
+
+#endif  // TRACE_H
@@ -43,11 +43,23 @@ LOCAL_C_INCLUDES := \
 LOCAL_CPPFLAGS := -std=c++11
 
 LOCAL_SRC_FILES := \
+  src/atlas_uploader.cpp \
+  src/distance_field.cpp \
   src/flatui.cpp \
   src/flatui_common.cpp \
+  src/font_batch.cpp \
+  src/font_data.cpp \
   src/font_manager.cpp \
+  src/font_vertex_buffer.cpp \
+  src/glyph_rasterizer.cpp \
+  src/image_atlas.cpp \
+  src/layout_context.cpp \
   src/micro_edit.cpp \
+  src/quad_batch.cpp \
+  src/render_layer.cpp \
   src/script_table.cpp \
+  src/shaping_cache.cpp \
+  src/trace.cpp \
   src/version.cpp
 
 LOCAL_STATIC_LIBRARIES := \
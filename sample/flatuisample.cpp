@@ -52,8 +52,8 @@ extern "C" int FPL_main(int /*argc*/, char **argv) {
 
   // While an initialization of flatui, it implicitly loads shaders used in the
   // API below using AssetManager.
-  // shaders/color.glslv & .glslf, shaders/font.glslv & .glslf
-  // shaders/textured.glslv & .glslf
+  // shaders/font_batch.glslv & .glslf, shaders/font_batch_sdf.glslv & .glslf
+  // shaders/quad_batch.glslv & .glslf, shaders/textured.glslv & .glslf
 
   // Wait for everything to finish loading...
   while (assetman.TryFinalize() == false) {
@@ -95,5 +95,7 @@ extern "C" int FPL_main(int /*argc*/, char **argv) {
     });
   }
 
+  // Release GL resources of the GUI while the renderer is still alive.
+  flatui::ReleaseGuiContext(flatui::GetCurrentGuiContext());
   return 0;
 }
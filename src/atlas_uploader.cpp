@@ -0,0 +1,137 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "flatui/internal/atlas_uploader.h"
+#ifdef FLATUI_PIXEL_BUFFER_UPLOAD
+#include "fplbase/glplatform.h"
+#endif
+
+using fplbase::Texture;
+using mathfu::vec2i;
+using mathfu::vec4i;
+
+namespace flatui {
+
+// Alignment of packed rows in pixels.
+static const int32_t kPackAlignment = 4;
+
+AtlasUploader::AtlasUploader() : uploaded_bytes_(0) {
+#ifdef FLATUI_PIXEL_BUFFER_UPLOAD
+  for (int32_t i = 0; i < kNumPixelBuffers; ++i) {
+    pixel_buffers_[i] = 0;
+  }
+  current_pixel_buffer_ = 0;
+#endif
+}
+
+AtlasUploader::~AtlasUploader() {
+#ifdef FLATUI_PIXEL_BUFFER_UPLOAD
+  if (pixel_buffers_[0]) {
+    GL_CALL(glDeleteBuffers(kNumPixelBuffers, pixel_buffers_));
+  }
+#endif
+}
+
+vec4i AtlasUploader::AlignRect(const vec4i &rect, const vec2i &image_size) {
+  auto x0 = rect.x() & ~(kPackAlignment - 1);
+  auto x1 = (rect.z() + kPackAlignment - 1) & ~(kPackAlignment - 1);
+  return vec4i(x0, rect.y(), std::min(x1, image_size.x()), rect.w());
+}
+
+void AtlasUploader::PackRects(const uint8_t *image, const vec2i &image_size,
+                              const std::vector<vec4i> &rects, uint8_t *dest) {
+  for (auto it = rects.begin(); it != rects.end(); ++it) {
+    auto width = it->z() - it->x();
+    for (int32_t y = it->y(); y < it->w(); ++y) {
+      memcpy(dest, image + y * image_size.x() + it->x(), width);
+      dest += width;
+    }
+  }
+}
+
+void AtlasUploader::UploadPackedRects(const std::vector<vec4i> &rects,
+                                      const uint8_t *data) {
+  for (auto it = rects.begin(); it != rects.end(); ++it) {
+    auto size = it->zw() - it->xy();
+    Texture::UpdateTexture(fplbase::kFormatLuminance, it->x(), it->y(),
+                           size.x(), size.y(), data);
+    data += size.x() * size.y();
+  }
+}
+
+void AtlasUploader::Upload(Texture *texture, const uint8_t *image,
+                           const vec2i &image_size,
+                           const std::vector<vec4i> &rects) {
+  aligned_rects_.clear();
+  size_t size = 0;
+  for (auto it = rects.begin(); it != rects.end(); ++it) {
+    auto rect = AlignRect(*it, image_size);
+    if (rect.x() >= rect.z() || rect.y() >= rect.w()) continue;
+    aligned_rects_.push_back(rect);
+    size += (rect.z() - rect.x()) * (rect.w() - rect.y());
+  }
+  uploaded_bytes_ = size;
+  if (!size) return;
+
+  texture->Set(0);
+#ifdef FLATUI_PIXEL_BUFFER_UPLOAD
+  if (UploadWithPixelBuffer(image, image_size, size)) return;
+#endif
+
+  if (aligned_rects_.size() == 1 && aligned_rects_[0].x() == 0 &&
+      aligned_rects_[0].z() == image_size.x()) {
+    // Full rows are contiguous in the image, no need to pack them.
+    auto &rect = aligned_rects_[0];
+    UploadPackedRects(aligned_rects_, image + rect.y() * image_size.x());
+    return;
+  }
+  staging_.resize(size);
+  PackRects(image, image_size, aligned_rects_, staging_.data());
+  UploadPackedRects(aligned_rects_, staging_.data());
+}
+
+#ifdef FLATUI_PIXEL_BUFFER_UPLOAD
+bool AtlasUploader::UploadWithPixelBuffer(const uint8_t *image,
+                                          const vec2i &image_size,
+                                          size_t size) {
+  if (!pixel_buffers_[0]) {
+    GL_CALL(glGenBuffers(kNumPixelBuffers, pixel_buffers_));
+  }
+  auto buffer = pixel_buffers_[current_pixel_buffer_];
+  current_pixel_buffer_ = (current_pixel_buffer_ + 1) % kNumPixelBuffers;
+
+  // Orphan the previous storage of the buffer so that mapping it doesn't
+  // wait for a pending upload.
+  GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer));
+  GL_CALL(glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr,
+                       GL_STREAM_DRAW));
+  auto dest = static_cast<uint8_t *>(
+      glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                       GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+  if (dest == nullptr) {
+    GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+    return false;
+  }
+  PackRects(image, image_size, aligned_rects_, dest);
+  GL_CALL(glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER));
+
+  // Data pointers are offsets in the bound pixel buffer.
+  UploadPackedRects(aligned_rects_, nullptr);
+  GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+  return true;
+}
+#endif
+
+}  // namespace flatui
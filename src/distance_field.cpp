@@ -0,0 +1,131 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "flatui/internal/distance_field.h"
+
+namespace flatui {
+
+// A large value used as an infinite distance.
+static const float kDistanceInfinity = 1e20f;
+
+void DistanceFieldGenerator::Generate(const uint8_t *bitmap,
+                                      const int32_t width,
+                                      const int32_t height,
+                                      const int32_t pitch,
+                                      const int32_t padding,
+                                      std::vector<uint8_t> *output) {
+  const int32_t out_width = width + padding * 2;
+  const int32_t out_height = height + padding * 2;
+  const size_t size = out_width * out_height;
+  grid_outer_.assign(size, kDistanceInfinity);
+  grid_inner_.assign(size, 0.0f);
+
+  // Initialize grids with coverage values.
+  // Partially covered pixels are treated as the edge is at the distance of
+  // (coverage - 0.5) pixels.
+  for (int32_t y = 0; y < height; ++y) {
+    for (int32_t x = 0; x < width; ++x) {
+      auto a = bitmap[y * pitch + x] / 255.0f;
+      auto index = (y + padding) * out_width + x + padding;
+      if (a == 1.0f) {
+        grid_outer_[index] = 0.0f;
+        grid_inner_[index] = kDistanceInfinity;
+      } else if (a > 0.0f) {
+        auto outer = std::max(0.0f, 0.5f - a);
+        auto inner = std::max(0.0f, a - 0.5f);
+        grid_outer_[index] = outer * outer;
+        grid_inner_[index] = inner * inner;
+      }
+    }
+  }
+  for (int32_t i = 0; i < static_cast<int32_t>(size); ++i) {
+    if (grid_outer_[i] == kDistanceInfinity) {
+      grid_inner_[i] = 0.0f;
+    }
+  }
+
+  auto max_length = static_cast<size_t>(std::max(out_width, out_height));
+  f_.resize(max_length);
+  d_.resize(max_length);
+  v_.resize(max_length);
+  z_.resize(max_length + 1);
+
+  Transform2D(&grid_outer_, out_width, out_height);
+  Transform2D(&grid_inner_, out_width, out_height);
+
+  // Encode signed distances to 8 bit values.
+  output->resize(size);
+  const float radius = static_cast<float>(std::max(padding, 1));
+  for (size_t i = 0; i < size; ++i) {
+    auto distance = sqrtf(grid_outer_[i]) - sqrtf(grid_inner_[i]);
+    auto value =
+        255.0f - 255.0f * (distance / radius + 1.0f - kDistanceFieldEdge);
+    (*output)[i] =
+        static_cast<uint8_t>(mathfu::Clamp(value + 0.5f, 0.0f, 255.0f));
+  }
+}
+
+void DistanceFieldGenerator::Transform2D(std::vector<float> *grid,
+                                         const int32_t width,
+                                         const int32_t height) {
+  auto &g = *grid;
+  for (int32_t x = 0; x < width; ++x) {
+    for (int32_t y = 0; y < height; ++y) {
+      f_[y] = g[y * width + x];
+    }
+    Transform1D(height);
+    for (int32_t y = 0; y < height; ++y) {
+      g[y * width + x] = d_[y];
+    }
+  }
+  for (int32_t y = 0; y < height; ++y) {
+    for (int32_t x = 0; x < width; ++x) {
+      f_[x] = g[y * width + x];
+    }
+    Transform1D(width);
+    for (int32_t x = 0; x < width; ++x) {
+      g[y * width + x] = d_[x];
+    }
+  }
+}
+
+void DistanceFieldGenerator::Transform1D(const int32_t length) {
+  // Lower envelope of parabolas rooted at each sample.
+  int32_t k = 0;
+  v_[0] = 0;
+  z_[0] = -kDistanceInfinity;
+  z_[1] = kDistanceInfinity;
+  for (int32_t q = 1; q < length; ++q) {
+    auto r = v_[k];
+    auto s = ((f_[q] + q * q) - (f_[r] + r * r)) / (2.0f * (q - r));
+    while (s <= z_[k]) {
+      k--;
+      r = v_[k];
+      s = ((f_[q] + q * q) - (f_[r] + r * r)) / (2.0f * (q - r));
+    }
+    k++;
+    v_[k] = q;
+    z_[k] = s;
+    z_[k + 1] = kDistanceInfinity;
+  }
+  k = 0;
+  for (int32_t q = 0; q < length; ++q) {
+    while (z_[k + 1] < q) k++;
+    auto r = v_[k];
+    d_[q] = (q - r) * (q - r) + f_[r];
+  }
+}
+
+}  // namespace flatui
@@ -13,21 +13,24 @@
 // limitations under the License.
 
 #include <cstring>
+#include <unordered_map>
 #include "flatui/flatui.h"
 #include "flatui/internal/flatui_util.h"
+#include "flatui/internal/font_batch.h"
+#include "flatui/internal/image_atlas.h"
 #include "flatui/internal/micro_edit.h"
+#include "flatui/internal/quad_batch.h"
+#include "flatui/internal/render_layer.h"
 #include "fplbase/utilities.h"
 
 using fplbase::Button;
 using fplbase::InputSystem;
 using fplbase::LogError;
 using fplbase::LogInfo;
-using fplbase::Mesh;
 using fplbase::Shader;
 using fplbase::Texture;
 using mathfu::vec2;
 using mathfu::vec2i;
-using mathfu::vec3;
 using mathfu::vec3i;
 using mathfu::vec4;
 using mathfu::vec4i;
@@ -45,10 +48,19 @@ Alignment GetAlignment(Layout layout) {
 static const float kScrollSpeedDragDefault = 2.0f;
 static const float kScrollSpeedWheelDefault = 16.0f;
 static const float kScrollSpeedGamepadDefault = 0.1f;
+
+// # of items laid out beyond each edge of the viewport in ScrollList().
+static const int32_t kScrollListOverscan = 2;
+
+// Id of placeholder elements standing in for items outside of the viewport.
+static const HashedId kScrollListSpacerHashedId = HashId("__list_spacer__");
 static const int32_t kDragStartThresholdDefault = 8;
 static const int32_t kPointerIndexInvalid = -1;
 static const int32_t kElementIndexInvalid = -1;
 static const vec2i kDragStartPoisitionInvalid = vec2i(-1, -1);
+// Offset basis and prime of the FNV hash used for layout signatures.
+static const uint32_t kSignatureOffsetBasis = 0x811c9dc5;
+static const uint32_t kSignaturePrime = 0x01000193;
 #if !defined(NDEBUG)
 static const uint32_t kDefaultGroupHashedId = HashId(kDefaultGroupID);
 #endif
@@ -97,10 +109,16 @@ class Group {
 
 // This holds transient state used while a GUI is being laid out / rendered.
 // It is intentionally hidden from the interface.
-// It is implemented as a singleton that the GUI element functions can access.
+// Each thread has at most one instance running, which the GUI element
+// functions can access. The state kept across frames is owned by the
+// GuiContext being run.
 
 class InternalState;
-InternalState *state = nullptr;
+thread_local InternalState *state = nullptr;
+
+// The GuiContext used by the calling thread, or nullptr for the default
+// context.
+thread_local GuiContext *current_context = nullptr;
 
 class InternalState : public Group {
  public:
@@ -118,10 +136,18 @@ class InternalState : public Group {
     bool interactive;  // Wants to respond to user input.
   };
 
-  InternalState(fplbase::AssetManager &assetman, FontManager &fontman,
-                fplbase::InputSystem &input)
+  // Forward decl.
+  struct PersistentState;
+
+  InternalState(PersistentState &persistent, fplbase::AssetManager &assetman,
+                FontManager &fontman, fplbase::InputSystem &input)
       : Group(kDirVertical, kAlignLeft, 0, 0),
         layout_pass_(true),
+        retained_pass_(false),
+        retained_committed_(false),
+        retained_abandoned_(false),
+        signature_(kSignatureOffsetBasis),
+        layout_signature_(kSignatureOffsetBasis),
         canvas_size_(assetman.renderer().window_size()),
         default_projection_(true),
         virtual_resolution_(FLATUI_DEFAULT_VIRTUAL_RESOLUTION),
@@ -129,6 +155,13 @@ class InternalState : public Group {
         renderer_(assetman.renderer()),
         input_(input),
         fontman_(fontman),
+        font_batch_(persistent.arena_.font_batch),
+        quad_batch_(persistent.arena_.quad_batch),
+        image_atlas_(persistent.arena_.image_atlas),
+        layer_(nullptr),
+        layer_cached_(false),
+        layer_rendering_(false),
+        layer_signature_(kSignatureOffsetBasis),
         clip_position_(mathfu::kZeros2i),
         clip_size_(mathfu::kZeros2i),
         clip_inside_(false),
@@ -138,7 +171,24 @@ class InternalState : public Group {
         gamepad_event(kEventHover),
         latest_event_(kEventNone),
         latest_event_element_idx_(0),
+        persistent_(persistent),
+        frame_stats_(persistent.frame_stats_),
         version_(&Version()) {
+    // Reuse the storage of previous frames, so that a steady-state frame
+    // doesn't allocate.
+    auto &arena = persistent_.arena_;
+    elements_.swap(arena.elements);
+    group_stack_.swap(arena.group_stack);
+    elements_.clear();
+    group_stack_.clear();
+    arena.num_allocations = 0;
+
+    frame_stats_ = FrameStats();
+    font_batch_.ResetDrawCallCount();
+    quad_batch_.ResetDrawCallCount();
+    image_atlas_.Update();
+    fontman_.ResetStats();
+
     SetScale();
 
     bool flush_pointer_capture = true;
@@ -166,7 +216,8 @@ class InternalState : public Group {
       }
     }
 
-    // If this assert hits, you likely are trying to created nested GUIs.
+    // If this assert hits, you likely are trying to created nested GUIs on
+    // the same thread.
     assert(!state);
 
     state = this;
@@ -174,12 +225,12 @@ class InternalState : public Group {
     // Load shaders ahead.
     image_shader_ = matman_.LoadShader("shaders/textured");
     assert(image_shader_);
-    font_shader_ = matman_.LoadShader("shaders/font");
-    assert(font_shader_);
-    font_clipping_shader_ = matman_.LoadShader("shaders/font_clipping");
-    assert(font_clipping_shader_);
-    color_shader_ = matman_.LoadShader("shaders/color");
-    assert(color_shader_);
+    font_batch_shader_ = matman_.LoadShader("shaders/font_batch");
+    assert(font_batch_shader_);
+    font_batch_sdf_shader_ = matman_.LoadShader("shaders/font_batch_sdf");
+    assert(font_batch_sdf_shader_);
+    quad_batch_shader_ = matman_.LoadShader("shaders/quad_batch");
+    assert(quad_batch_shader_);
 
     text_color_ = mathfu::kOnes4f;
 
@@ -193,7 +244,38 @@ class InternalState : public Group {
     fontman_.StartLayoutPass();
   }
 
-  ~InternalState() { state = nullptr; }
+  ~InternalState() {
+    auto &arena = persistent_.arena_;
+#if !defined(NDEBUG)
+    // If you hit this assert, a frame with the same layout as the previous
+    // frame needed more storage than the previous frame.
+    assert(!arena.num_allocations || signature_ != arena.signature);
+#endif
+    arena.signature = signature_;
+
+    frame_stats_.retained_layout = retained_pass_;
+    frame_stats_.num_draw_calls += font_batch_.get_num_draw_calls() +
+                                   quad_batch_.get_num_draw_calls();
+    frame_stats_.font_stats = fontman_.GetStats();
+
+    // Give the storage back to the arena for the next frame.
+    elements_.swap(arena.elements);
+    group_stack_.swap(arena.group_stack);
+    state = nullptr;
+  }
+
+  // Returns the persistent state owned by a GUI context.
+  static PersistentState &GetPersistentState(GuiContext &context);
+
+  // Returns # of times the frame arena grew in the last frame.
+  static int32_t GetFrameAllocationCount(PersistentState &persistent) {
+    return persistent.arena_.num_allocations;
+  }
+
+  // Statistics of the current frame, or the last frame outside of Run().
+  static FrameStats &GetFrameStats(PersistentState &persistent) {
+    return persistent.frame_stats_;
+  }
 
   template <int D>
   mathfu::Vector<int, D> VirtualToPhysical(const mathfu::Vector<float, D> &v) {
@@ -277,9 +359,15 @@ class InternalState : public Group {
     // Do nothing if there is no elements.
     if (elements_.size() == 0) return;
 
-    // Put in a sentinel element. We'll use this element to point to
-    // when a group didn't exist during layout but it does during rendering.
-    NewElement(mathfu::kZeros2i, kNullHash);
+    if (!retained_pass_) {
+      // Keep the signature of the layout to validate it in the render pass.
+      layout_signature_ = signature_;
+
+      // Put in a sentinel element. We'll use this element to point to
+      // when a group didn't exist during layout but it does during rendering.
+      NewElement(mathfu::kZeros2i, kNullHash);
+    }
+    signature_ = kSignatureOffsetBasis;
 
     // Update font manager if they need to upload font atlas texture.
     fontman_.StartRenderPass();
@@ -295,10 +383,181 @@ class InternalState : public Group {
     if (default_projection_) SetOrtho();
   }
 
+  // Start the render pass with the layout retained from the previous frame
+  // instead of the layout pass.
+  // Returns false if the retained layout can't be used in the frame, so that
+  // the caller needs to run the layout pass.
+  bool StartRetainedRenderPass() {
+    auto &retained = persistent_.retained_;
+    auto invalidated = retained.invalidated;
+    retained.invalidated = false;
+    if (!retained.enabled || !retained.valid || invalidated ||
+        retained.elements.empty()) {
+      return false;
+    }
+    if (retained.default_projection && retained.canvas_size != canvas_size_) {
+      // The window has been resized.
+      return false;
+    }
+
+    // Restore states set in the layout pass of the retained frame.
+    elements_.swap(retained.elements);
+    canvas_size_ = retained.canvas_size;
+    default_projection_ = retained.default_projection;
+    virtual_resolution_ = retained.virtual_resolution;
+    SetScale();
+    layout_signature_ = retained.signature;
+    retained_pass_ = true;
+
+    StartRenderPass();
+    return true;
+  }
+
+  // Finish the render pass. Labels batched in the pass are rendered.
+  // In the retained layout mode, the layout is kept for the next frame.
+  void EndRenderPass() {
+    if (layout_pass_) return;
+    auto &retained = persistent_.retained_;
+    if (retained_abandoned_) {
+      // Give the retained layout back. It's not valid anymore.
+      retained.elements.swap(elements_);
+      retained.valid = false;
+      return;
+    }
+    FlushBatches();
+
+    // Release layers that didn't show up in the frame.
+    auto &layers = persistent_.layers_;
+    for (auto it = layers.begin(); it != layers.end();) {
+      if (it->second->used) {
+        it->second->used = false;
+        ++it;
+      } else {
+        it = layers.erase(it);
+      }
+    }
+
+    if (!retained.enabled) return;
+
+    // The layout can be reused only when the render pass saw the same
+    // elements as the layout pass.
+    retained.valid = signature_ == layout_signature_;
+    if (retained_pass_) {
+      // Give the retained layout back.
+      retained.elements.swap(elements_);
+    } else {
+      // Copy the layout rather than swapping it, so that both containers keep
+      // the capacity they grew to.
+      CountArenaGrowth(retained.elements, elements_.size());
+      retained.elements.assign(elements_.begin(), elements_.end());
+      retained.signature = layout_signature_;
+      retained.canvas_size = canvas_size_;
+      retained.default_projection = default_projection_;
+      retained.virtual_resolution = virtual_resolution_;
+    }
+  }
+
+  // Returns true if the retained pass was abandoned, so that the frame needs
+  // to be run again with the layout pass.
+  bool RetainedPassAbandoned() const { return retained_abandoned_; }
+
+  // (retained render pass): returns true if the pass has drawn or delivered
+  // something that would be repeated if the frame was run again.
+  bool RetainedPassCommitted() const {
+    return retained_committed_ || font_batch_.get_num_draw_calls() ||
+           quad_batch_.get_num_draw_calls();
+  }
+
+  // (retained render pass): abandon the retained layout. Glyphs and quads not
+  // rendered yet are discarded, and the rest of the pass doesn't render or
+  // deliver events.
+  void AbandonRetainedPass() {
+    retained_abandoned_ = true;
+    font_batch_.Clear();
+    quad_batch_.Clear();
+  }
+
+  // Enable or disable the retained layout mode.
+  static void SetRetainedLayout(PersistentState &persistent, bool enable) {
+    auto &retained = persistent.retained_;
+    retained.enabled = enable;
+    retained.valid = false;
+    // The retained layout storage may grow in the next frame.
+    persistent.arena_.signature = kSignatureOffsetBasis;
+    if (!enable) {
+      // Release the retained layout.
+      std::vector<Element>().swap(retained.elements);
+    }
+  }
+
+  static void SetImageAtlas(PersistentState &persistent, bool enable) {
+    persistent.arena_.image_atlas.SetPacking(enable);
+  }
+
+  static void InvalidateImage(PersistentState &persistent,
+                              const Texture &texture) {
+    persistent.arena_.image_atlas.Invalidate(texture);
+  }
+
+  // Release GL resources of the context. They are created again when used in
+  // the next frame.
+  static void ReleaseResources(PersistentState &persistent) {
+    persistent.arena_.image_atlas.Reset();
+    persistent.layers_.clear();
+    // The retained layout may refer to the released atlas and layers.
+    persistent.retained_.valid = false;
+  }
+
+  // Let the next frame run the layout pass in the retained layout mode.
+  static void InvalidateLayout(PersistentState &persistent) {
+    persistent.retained_.invalidated = true;
+  }
+
+  // Let the next frame render the layer again.
+  static void InvalidateLayer(PersistentState &persistent, HashedId hash) {
+    auto &layers = persistent.layers_;
+    auto it = layers.find(hash);
+    if (it != layers.end()) it->second->invalidated = true;
+  }
+
+  // Fold a value into the layout signature of the current pass, and into the
+  // signature of the current layer.
+  void Sign(uint32_t value) {
+    signature_ = (signature_ ^ value) * kSignaturePrime;
+    if (layer_) layer_signature_ = (layer_signature_ ^ value) * kSignaturePrime;
+  }
+
+  void Sign(HashedId hash, const vec2i &size) {
+    Sign(hash);
+    Sign(static_cast<uint32_t>(size.x()));
+    Sign(static_cast<uint32_t>(size.y()));
+  }
+
+  // Count a heap allocation of the frame arena if the container needs to grow
+  // to hold the given # of items.
+  template <typename T>
+  void CountArenaGrowth(const std::vector<T> &container, size_t size) {
+    if (size > container.capacity()) persistent_.arena_.num_allocations++;
+  }
+
+  // (render pass): render quads and labels in the batches. Call this before
+  // any draw call or render state change so that they are drawn in order.
+  // Quads are always rendered before labels. A quad that needs to cover a
+  // batched label flushes the batches before it's added (see RenderQuad()).
+  void FlushBatches() {
+    quad_batch_.Flush(renderer_);
+    font_batch_.Flush(renderer_, fontman_);
+  }
+
   // (render pass): retrieve the next corresponding cached element we
   // created in the layout pass. This is slightly more tricky than a straight
   // lookup because event handlers may insert/remove elements.
-  Element *NextElement(HashedId hash) {
+  // The size is the one the element passed to NewElement() in the layout
+  // pass, which is used to validate the layout.
+  Element *NextElement(HashedId hash, const vec2i &size) {
+    Sign(hash, size);
+    frame_stats_.num_elements++;
+    if (retained_abandoned_) return nullptr;
     auto backup = element_it_;
     while (element_it_ != elements_.end()) {
       // This loop usually returns on the first iteration, the only time it
@@ -313,8 +572,35 @@ class InternalState : public Group {
     return nullptr;
   }
 
+  // (render pass): retrieve the element of a label. In the retained pass, a
+  // label whose text changed misses its element by the text hash. The label
+  // is rendered in place of the element at its slot when it has the same
+  // size. Otherwise the retained pass is abandoned, unless it has already
+  // drawn or delivered something, so that the frame is laid out again rather
+  // than rendered with an outdated layout.
+  Element *NextLabelElement(HashedId hash, const vec2i &size) {
+    if (!retained_pass_ || retained_abandoned_ ||
+        element_it_ == elements_.end() || EqualId(element_it_->hash, hash)) {
+      return NextElement(hash, size);
+    }
+    auto &element = *element_it_;
+    if (element.size == size) {
+      // Sign the retained ID, so that the layout stays valid.
+      Sign(element.hash, size);
+      frame_stats_.num_elements++;
+      ++element_it_;
+      return &element;
+    }
+    if (!RetainedPassCommitted()) {
+      AbandonRetainedPass();
+    }
+    return NextElement(hash, size);
+  }
+
   // (layout pass): create a new element.
   void NewElement(const vec2i &size, HashedId hash) {
+    Sign(hash, size);
+    CountArenaGrowth(elements_, elements_.size() + 1);
     elements_.push_back(Element(size, hash));
   }
 
@@ -354,37 +640,65 @@ class InternalState : public Group {
     return pos;
   }
 
-  void RenderQuad(Shader *sh, const vec4 &color, const vec2i &pos,
+  // Flush the batches if a quad covers a label in the font batch, since the
+  // label would be rendered after the quad otherwise.
+  void FlushBatchesUnder(const vec4 &rect) {
+    if (font_batch_.Overlaps(rect)) FlushBatches();
+  }
+
+  void RenderQuad(const Texture *tex, const vec4 &color, const vec2i &pos,
                   const vec2i &size, const vec4 &uv) {
-    renderer_.set_color(color);
-    sh->Set(renderer_);
-    Mesh::RenderAAQuadAlongX(vec3(vec2(pos), 0), vec3(vec2(pos + size), 0),
-                             uv.xy(), uv.zw());
+    if (layer_cached_ || retained_abandoned_) return;
+    auto rect = vec4(vec2(pos), vec2(pos + size));
+    FlushBatchesUnder(rect);
+    quad_batch_.Add(renderer_, quad_batch_shader_, tex, rect, uv, color);
+  }
+
+  // Render a solid color quad with the white block of the image atlas.
+  void RenderColorQuad(const vec4 &color, const vec2i &pos,
+                       const vec2i &size) {
+    auto white_uv = image_atlas_.get_white_uv();
+    auto atlas = image_atlas_.GetTexture();
+    RenderQuad(atlas, color, pos, size, vec4(white_uv, white_uv));
+  }
+
+  // Render a texture, from the image atlas if the texture is packed.
+  void RenderImageQuad(const Texture &tex, const vec4 &color,
+                       const vec2i &pos, const vec2i &size) {
+    if (layer_cached_ || retained_abandoned_) return;
+    vec4 uv;
+    auto texture = FindImage(tex, &uv);
+    RenderQuad(texture, color, pos, size, uv);
   }
 
-  void RenderQuad(Shader *sh, const vec4 &color, const vec2i &pos,
-                  const vec2i &size) {
-    RenderQuad(sh, color, pos, size, vec4(0, 0, 1, 1));
+  // Look up a texture in the image atlas. Returns the texture to render the
+  // image with, and its UV rect in the texture.
+  const Texture *FindImage(const Texture &tex, vec4 *uv) {
+    auto found = image_atlas_.Find(renderer_, image_shader_, tex, uv);
+    // Copying an image into the atlas resets the blend mode.
+    if (layer_rendering_) RenderLayer::SetLayerBlendMode(renderer_);
+    if (found) return image_atlas_.GetTexture();
+    *uv = vec4(0, 0, 1, 1);
+    return &tex;
   }
 
   // An image element.
   void Image(const Texture &texture, float ysize) {
     auto hash = HashPointer(&texture);
+    auto virtual_image_size = vec2(
+        texture.original_size().x() * ysize / texture.original_size().y(),
+        ysize);
+    // Map the size to real screen pixels, rounding to the nearest int
+    // for pixel-aligned rendering.
+    auto size = VirtualToPhysical(virtual_image_size);
     if (layout_pass_) {
-      auto virtual_image_size = vec2(
-          texture.original_size().x() * ysize / texture.original_size().y(),
-          ysize);
-      // Map the size to real screen pixels, rounding to the nearest int
-      // for pixel-aligned rendering.
-      auto size = VirtualToPhysical(virtual_image_size);
       NewElement(size, hash);
       Extend(size);
     } else {
-      auto element = NextElement(hash);
+      auto element = NextElement(hash, size);
       if (element) {
-        texture.Set(0);
-        RenderQuad(image_shader_, mathfu::kOnes4f, Position(*element),
-                   element->size);
+        RenderImageQuad(texture, mathfu::kOnes4f, Position(*element),
+                        element->size);
         Advance(element->size);
       }
     }
@@ -421,7 +735,7 @@ class InternalState : public Group {
       ui_text = persistent_.text_edit_.GetEditingText();
     }
     auto parameter = FontBufferParameters(
-        fontman_.GetCurrentFace()->font_id_, HashId(ui_text->c_str()),
+        fontman_.GetCurrentFontId(), HashId(ui_text->c_str()),
         static_cast<float>(size.y()), physical_label_size, true);
     auto buffer =
         fontman_.GetBuffer(ui_text->c_str(), ui_text->length(), parameter);
@@ -523,10 +837,18 @@ class InternalState : public Group {
           RenderCaret(caret_pos, caret_size);
         }
 
+        // Text input may change the layout of the next frame.
+        InvalidateLayout(persistent_);
+
         // Handle text input events only after the rendering for the pass is
         // finished.
-        auto finished_input = persistent_.text_edit_.HandleInputEvents(
-            input_.GetTextInputEvents());
+        bool finished_input;
+        {
+          ScopedTrace trace("FlatUI::EditInput");
+          ScopedTimer timer(&frame_stats_.edit_input_time);
+          finished_input = persistent_.text_edit_.HandleInputEvents(
+              input_.GetTextInputEvents());
+        }
         input_.ClearTextInputEvents();
         if (finished_input) {
           CaptureInput(kNullHash, true);
@@ -547,7 +869,7 @@ class InternalState : public Group {
     startpos.y() += static_cast<int>(font_size * kUnderlineOffsetFactor);
     size.y() += static_cast<int>(line_width);
 
-    RenderQuad(color_shader_, mathfu::kOnes4f, pos + startpos, size);
+    RenderColorQuad(mathfu::kOnes4f, pos + startpos, size);
   }
 
   // Helper for Edit widget to render a caret.
@@ -560,7 +882,7 @@ class InternalState : public Group {
     const double kCareteBlinkDuration = 10.0;
     auto t = input_.Time();
     if (sin(t * kCareteBlinkDuration) > 0.0) {
-      RenderQuad(color_shader_, mathfu::kOnes4f, caret_pos, caret_size);
+      RenderColorQuad(mathfu::kOnes4f, caret_pos, caret_size);
     }
   }
 
@@ -578,19 +900,23 @@ class InternalState : public Group {
     auto physical_label_size = VirtualToPhysical(label_size);
     auto size = VirtualToPhysical(vec2(0, ysize));
     auto parameter = FontBufferParameters(
-        fontman_.GetCurrentFace()->font_id_, HashId(text),
+        fontman_.GetCurrentFontId(), HashId(text),
         static_cast<float>(size.y()), physical_label_size, false);
-    auto buffer = fontman_.GetBuffer(text, strlen(text), parameter);
+    // The layout pass only measures the text. Glyphs are built in the render
+    // pass when the label is drawn.
+    auto buffer = fontman_.MeasureText(text, strlen(text), parameter);
     assert(buffer);
-    Label(*buffer, parameter, vec4i(vec2i(0, 0), buffer->get_size()));
+    Label(*buffer, parameter, vec4i(vec2i(0, 0), buffer->get_size()), text);
   }
 
+  // A label of a FontBuffer. When the text is given, the buffer may have been
+  // measured only, and the glyphs are retrieved in the render pass.
   vec2i Label(const FontBuffer &buffer, const FontBufferParameters &parameter,
-              const vec4i &window) {
+              const vec4i &window, const char *text = nullptr) {
     vec2i pos = mathfu::kZeros2i;
     auto hash = parameter.get_text_id();
+    auto size = window.zw();
     if (layout_pass_) {
-      auto size = window.zw();
       NewElement(size, hash);
       Extend(size);
     } else {
@@ -599,10 +925,8 @@ class InternalState : public Group {
         fontman_.StartRenderPass();
       }
 
-      auto element = NextElement(hash);
+      auto element = NextLabelElement(hash, size);
       if (element) {
-        fontman_.GetAtlasTexture()->Set(0);
-
         pos = Position(*element);
 
         bool clipping = false;
@@ -611,50 +935,90 @@ class InternalState : public Group {
                      (buffer.get_size().x() > window.z()) ||
                      (buffer.get_size().y() > window.w());
         }
+        auto clipping_rect = vec4(-kFontBatchNoClipping, -kFontBatchNoClipping,
+                                  kFontBatchNoClipping, kFontBatchNoClipping);
         if (clipping) {
+          // Set a window to show a part of the label.
           pos -= window.xy();
+          clipping_rect = vec4(vec2(position_), vec2(position_ + window.zw()));
+        }
 
-          // Set a window to show a part of the label.
-          font_clipping_shader_->Set(renderer_);
-          font_clipping_shader_->SetUniform(
-              "pos_offset", vec3(static_cast<float>(pos.x()),
-                                 static_cast<float>(pos.y()), 0.0f));
-          auto start = vec2(position_ - pos);
-          auto end = start + vec2(window.zw());
-          font_clipping_shader_->SetUniform("clipping", vec4(start, end));
-        } else {
-          font_shader_->Set(renderer_);
-          font_shader_->SetUniform("pos_offset",
-                                   vec3(static_cast<float>(pos.x()),
-                                        static_cast<float>(pos.y()), 0.0f));
+        // Glyphs in the SDF mode are rendered with the SDF shader variant.
+        auto sdf = fontman_.GetSDFMode();
+        auto smoothing = 0.0f;
+        if (sdf) {
+          // Smoothing width of the glyph edge in the distance field unit,
+          // corresponding to 1 pixel at the rendering scale.
+          auto scale = parameter.get_font_size() /
+                       static_cast<float>(kGlyphSDFReferenceSize);
+          smoothing = 0.5f / (kGlyphSDFPadding * std::max(scale, 0.01f));
         }
 
-        const fplbase::Attribute kFormat[] = {
-            fplbase::kPosition3f, fplbase::kTexCoord2f, fplbase::kEND};
-        Mesh::RenderArray(
-            Mesh::kTriangles, static_cast<int>(buffer.get_indices()->size()),
-            kFormat, sizeof(FontVertex),
-            reinterpret_cast<const char *>(buffer.get_vertices()->data()),
-            buffer.get_indices()->data());
+        // Labels are merged into the font batch and rendered with a single
+        // draw call when the batch is flushed. A label rendered right away
+        // needs to be on top of the batched quads.
+        const FontBuffer *label = nullptr;
+        if (!layer_cached_ && !IsClipped(Position(*element), element->size)) {
+          label = text ? RetrieveLabel(text, buffer, parameter) : &buffer;
+        }
+        if (label) {
+          if (FontBatch::RendersDirectly(*label)) quad_batch_.Flush(renderer_);
+          font_batch_.Add(renderer_, fontman_,
+                          sdf ? font_batch_sdf_shader_ : font_batch_shader_,
+                          *label, vec2(pos), clipping_rect, text_color_,
+                          smoothing);
+        }
         Advance(element->size);
       }
     }
     return pos;
   }
 
+  // (render pass): retrieve the glyphs of a label laid out with
+  // MeasureText(). The measured buffer is released when the glyphs are built.
+  const FontBuffer *RetrieveLabel(const char *text, const FontBuffer &measured,
+                                  const FontBufferParameters &parameter) {
+    auto length = strlen(text);
+    if (!measured.get_measured_state()) {
+      return fontman_.GetBuffer(text, length, parameter);
+    }
+    // Render the batches first, since the new glyphs may be rasterized into
+    // atlas rows used by batched labels.
+    FlushBatches();
+    auto buffer = fontman_.GetBuffer(text, length, parameter);
+    // Upload the new glyphs to the atlas textures.
+    fontman_.StartRenderPass();
+    return buffer;
+  }
+
+  // (render pass): returns true if a rect is out of the scrolling area being
+  // rendered, so that an expensive element can skip rendering.
+  bool IsClipped(const vec2i &pos, const vec2i &size) const {
+    if (!clip_inside_) return false;
+    auto clip_end = clip_position_ + clip_size_;
+    return pos.x() >= clip_end.x() || pos.y() >= clip_end.y() ||
+           pos.x() + size.x() <= clip_position_.x() ||
+           pos.y() + size.y() <= clip_position_.y();
+  }
+
   // Custom element with user supplied renderer.
   void CustomElement(
       const vec2 &virtual_size, const char *id,
-      const std::function<void(const vec2i &pos, const vec2i &size)> renderer) {
+      const std::function<void(const vec2i &pos, const vec2i &size)>
+          &renderer) {
     auto hash = HashId(id);
+    auto size = VirtualToPhysical(virtual_size);
     if (layout_pass_) {
-      auto size = VirtualToPhysical(virtual_size);
       NewElement(size, hash);
       Extend(size);
     } else {
-      auto element = NextElement(hash);
+      auto element = NextElement(hash, size);
       if (element) {
-        renderer(Position(*element), element->size);
+        if (!layer_cached_) {
+          FlushBatches();
+          renderer(Position(*element), element->size);
+          retained_committed_ = true;
+        }
         Advance(element->size);
       }
     }
@@ -669,20 +1033,19 @@ class InternalState : public Group {
   void RenderTexture(const Texture &tex, const vec2i &pos, const vec2i &size,
                      const vec4 &color) {
     if (!layout_pass_) {
-      tex.Set(0);
-      RenderQuad(image_shader_, color, pos, size);
+      RenderImageQuad(tex, color, pos, size);
     }
   }
 
   void RenderTextureNinePatch(const Texture &tex, const vec4 &patch_info,
                               const vec2i &pos, const vec2i &size) {
-    if (!layout_pass_) {
-      tex.Set(0);
-      renderer_.set_color(mathfu::kOnes4f);
-      image_shader_->Set(renderer_);
-      Mesh::RenderAAQuadAlongXNinePatch(vec3(vec2(pos), 0),
-                                        vec3(vec2(pos + size), 0), tex.size(),
-                                        patch_info);
+    if (!layout_pass_ && !layer_cached_ && !retained_abandoned_) {
+      auto rect = vec4(vec2(pos), vec2(pos + size));
+      FlushBatchesUnder(rect);
+      vec4 uv;
+      auto texture = FindImage(tex, &uv);
+      quad_batch_.AddNinePatch(renderer_, quad_batch_shader_, texture, rect,
+                               uv, tex.size(), patch_info, mathfu::kOnes4f);
     }
   }
 
@@ -691,11 +1054,15 @@ class InternalState : public Group {
   void StartGroup(Direction direction, Alignment align, float spacing,
                   HashedId hash) {
     Group layout(direction, align, static_cast<int>(spacing), elements_.size());
+    CountArenaGrowth(group_stack_, group_stack_.size() + 1);
     group_stack_.push_back(*this);
+    Sign(static_cast<uint32_t>(direction | align));
+    Sign(static_cast<uint32_t>(layout.spacing_));
     if (layout_pass_) {
       NewElement(mathfu::kZeros2i, hash);
     } else {
-      auto element = NextElement(hash);
+      frame_stats_.num_groups++;
+      auto element = NextElement(hash, mathfu::kZeros2i);
       if (element) {
         layout.position_ = Position(*element);
         layout.size_ = element->size;
@@ -733,6 +1100,85 @@ class InternalState : public Group {
     }
   }
 
+  // A group rendered through a cached render-to-texture layer. The contents
+  // are rendered into the layer texture only when their signature or size
+  // changed, or the layer has been invalidated. Otherwise, the render pass
+  // walks the contents without drawing them, and composites the texture.
+  void StartLayer(Direction direction, Alignment align, float spacing,
+                  HashedId hash) {
+    // If you hit this assert, you are nesting layers, which is not supported.
+    assert(!layer_);
+    StartGroup(direction, align, spacing, hash);
+    auto &layer = persistent_.layers_[hash];
+    if (!layer) layer.reset(new Layer());
+    layer_ = layer.get();
+    layer_signature_ = kSignatureOffsetBasis;
+    if (layout_pass_) return;
+
+    layer_->used = true;
+    layer_position_ = position_;
+    auto size = GroupSize();
+    layer_cached_ = layer_->valid && !layer_->invalidated &&
+                    layer_->contents_signature == layer_->layout_signature &&
+                    layer_->target.get_size() == size;
+    if (layer_cached_ || !size.x() || !size.y() || retained_abandoned_) {
+      return;
+    }
+
+    FlushBatches();
+    retained_committed_ = true;
+    if (!layer_->target.Begin(renderer_, size)) {
+      // Render the contents to the screen as a regular group.
+      layer_->valid = false;
+      return;
+    }
+    layer_rendering_ = true;
+    layer_projection_ = renderer_.model_view_projection();
+    auto p0 = vec2(position_);
+    auto p1 = vec2(position_ + size);
+    renderer_.set_model_view_projection(mathfu::OrthoHelper<float>(
+        p0.x(), p1.x(), p1.y(), p0.y(), -1.0f, 1.0f));
+    layer_->contents_signature = layer_->layout_signature;
+    layer_->invalidated = false;
+  }
+
+  void EndLayer() {
+    // If you hit this assert, you have EndLayer() without StartLayer().
+    assert(layer_);
+    auto &layer = *layer_;
+    auto size = GroupSize();
+    EndGroup();
+    layer_ = nullptr;
+    if (layout_pass_) {
+      layer.layout_signature = layer_signature_;
+      return;
+    }
+
+    if (layer_rendering_) {
+      FlushBatches();
+      layer.target.End(renderer_);
+      renderer_.set_model_view_projection(layer_projection_);
+      layer.valid = true;
+      layer_rendering_ = false;
+    }
+    layer_cached_ = false;
+    // Contents that didn't match the layout pass, such as elements added by
+    // an event handler, are rendered again in the next frame.
+    if (layer_signature_ != layer.layout_signature) layer.invalidated = true;
+    if (!layer.valid || !layer.target.get_texture() || retained_abandoned_) {
+      return;
+    }
+
+    // Composite the layer.
+    FlushBatches();
+    RenderLayer::SetCompositeBlendMode(renderer_);
+    quad_batch_.Add(renderer_, quad_batch_shader_, layer.target.get_texture(),
+                    vec4(vec2(layer_position_), vec2(layer_position_ + size)),
+                    RenderLayer::GetUV(), mathfu::kOnes4f);
+    quad_batch_.Flush(renderer_);
+    renderer_.SetBlendMode(fplbase::kBlendModeAlpha);
+  }
+
   void ModalGroup() {
     if (group_stack_.back().direction_ == kDirOverlay) {
       // Simply mark all elements before this last group as non-interactive.
@@ -743,11 +1189,16 @@ class InternalState : public Group {
 
   void SetMargin(const Margin &margin) {
     margin_ = VirtualToPhysical(margin.borders);
+    for (int i = 0; i < 4; ++i) Sign(static_cast<uint32_t>(margin_[i]));
   }
 
   void StartScroll(const vec2 &size, vec2 *virtual_offset) {
     auto psize = VirtualToPhysical(size);
     auto offset = VirtualToPhysical(*virtual_offset);
+    Sign(kNullHash, psize);
+    // If you hit this assert, you are scrolling inside a layer, which is not
+    // supported.
+    assert(!layer_);
 
     if (layout_pass_) {
       // If you hit this assert, you are nesting scrolling areas, which is
@@ -765,6 +1216,7 @@ class InternalState : public Group {
       // placement use another technique alltogether (render to texture,
       // glClipPlane, or stencil buffer).
       assert(default_projection_);
+      FlushBatches();
       renderer_.ScissorOn(
           vec2i(position_.x(), canvas_size_.y() - position_.y() - psize.y()),
           psize);
@@ -840,8 +1292,8 @@ class InternalState : public Group {
         }
       }
       // Store size/position, so expensive rendering commands can choose to
-      // clip against the viewport.
-      // TODO: add culling code where appropriate.
+      // clip against the viewport (see IsClipped()).
+      clip_inside_ = true;
       clip_size_ = psize;
       clip_position_ = position_;
       // Start the rendering of this group at the offset before the start of
@@ -863,10 +1315,61 @@ class InternalState : public Group {
       for (int i = 0; i <= pointer_max_active_index_; i++) {
         clip_mouse_inside_[i] = true;
       }
+      clip_inside_ = false;
+      FlushBatches();
       renderer_.ScissorOff();
     }
   }
 
+  // A scrolling list of item_count items that only lays out the items
+  // around the viewport. Items outside of it are replaced by two spacers, so
+  // that the scrolling range still reflects the whole list.
+  void ScrollList(const vec2 &size, int32_t item_count, float item_height,
+                  vec2 *virtual_offset,
+                  const std::function<void(int32_t index)> &item_renderer) {
+    assert(item_height > 0.0f);
+    auto axis = direction_ == kDirHorizontal ? 0 : 1;
+    auto pitch = std::max(
+        VirtualToPhysical(vec2(item_height, item_height))[axis] + spacing_, 1);
+    auto view_size = VirtualToPhysical(size)[axis];
+
+    // Determine the range from the offset before StartScroll() updates it in
+    // the render pass, so that both passes visit the same items.
+    auto offset = std::max(VirtualToPhysical(*virtual_offset)[axis], 0);
+    auto first = std::max(offset / pitch - kScrollListOverscan, 0);
+    auto last = std::min((offset + view_size) / pitch + 1 + kScrollListOverscan,
+                         item_count);
+    first = std::min(first, last);
+
+    StartScroll(size, virtual_offset);
+    // Spacers don't include the spacing the group adds before each element.
+    if (first > 0) {
+      ScrollListSpacer(axis, first * pitch - spacing_);
+    }
+    for (auto i = first; i < last; ++i) {
+      item_renderer(i);
+    }
+    if (last < item_count) {
+      ScrollListSpacer(axis, (item_count - last) * pitch - spacing_);
+    }
+    EndScroll();
+  }
+
+  // An empty element occupying the given length along the axis.
+  void ScrollListSpacer(int axis, int32_t length) {
+    auto size = mathfu::kZeros2i;
+    size[axis] = std::max(length, 0);
+    if (layout_pass_) {
+      NewElement(size, kScrollListSpacerHashedId);
+      Extend(size);
+    } else {
+      auto element = NextElement(kScrollListSpacerHashedId, size);
+      if (element) {
+        Advance(element->size);
+      }
+    }
+  }
+
   void StartSlider(Direction direction, float scroll_margin, float *value) {
     auto event = CheckEvent(false);
     if (!layout_pass_) {
@@ -1007,7 +1510,19 @@ class InternalState : public Group {
     return EqualId(hash, persistent_.pointer_element[i]);
   }
 
+  // Check the event of the current element. An element in a layer showing an
+  // event is likely to change its looks, so the layer is rendered again in
+  // the next frame.
   Event CheckEvent(bool check_dragevent_only) {
+    if (retained_abandoned_) return kEventNone;
+    auto event = DetectEvent(check_dragevent_only);
+    if (layer_ && event != kEventNone) layer_->invalidated = true;
+    // The event would be delivered again if the frame was run again.
+    if (event != kEventNone && event != kEventHover) retained_committed_ = true;
+    return event;
+  }
+
+  Event DetectEvent(bool check_dragevent_only) {
     if (latest_event_element_idx_ == element_idx_) return latest_event_;
 
     auto &element = elements_[element_idx_];
@@ -1111,6 +1626,9 @@ class InternalState : public Group {
             // We only report an event for the first finger to touch an element.
             // This is intentional.
 
+            // Events may change the layout of the next frame.
+            if (event != kEventHover) InvalidateLayout(persistent_);
+
             latest_event_ = static_cast<Event>(event);
             latest_event_element_idx_ = element_idx_;
             return static_cast<Event>(event);
@@ -1121,6 +1639,7 @@ class InternalState : public Group {
         if (!persistent_.is_last_event_pointer_type &&
             EqualId(persistent_.input_focus_, hash)) {
           gamepad_has_focus_element = true;
+          if (gamepad_event != kEventHover) InvalidateLayout(persistent_);
           latest_event_ = gamepad_event;
           latest_event_element_idx_ = element_idx_;
           return gamepad_event;
@@ -1254,14 +1773,13 @@ class InternalState : public Group {
 
   void ColorBackground(const vec4 &color) {
     if (!layout_pass_) {
-      RenderQuad(color_shader_, color, position_, GroupSize());
+      RenderColorQuad(color, position_, GroupSize());
     }
   }
 
   void ImageBackground(const Texture &tex) {
     if (!layout_pass_) {
-      tex.Set(0);
-      RenderQuad(image_shader_, mathfu::kOnes4f, position_, GroupSize());
+      RenderImageQuad(tex, mathfu::kOnes4f, position_, GroupSize());
     }
   }
 
@@ -1274,11 +1792,15 @@ class InternalState : public Group {
 
   // Set Label's font.
   void SetTextFont(const char *font_name) { fontman_.SelectFont(font_name); }
+  void SetTextFont(const char *font_names[], int32_t count) {
+    fontman_.SelectFont(font_names, count);
+  }
 
   // Set a locale used for the text rendering.
   void SetTextLocale(const char *locale) {
     fontman_.SetLocale(locale);
   }
+  void SetTextLocale(const LocaleInfo &locale) { fontman_.SetLocale(locale); }
 
   // Override text layout direction that is set by SetTextLanguage() API.
   void SetTextDirection(TextLayoutDirection direction) {
@@ -1294,6 +1816,20 @@ class InternalState : public Group {
   vec2i GetPointerPosition() { return input_.get_pointers()[0].mousepos; }
 
   bool layout_pass_;
+
+  // Flag indicating the render pass uses the layout of the previous frame.
+  bool retained_pass_;
+
+  // Flags indicating the retained pass delivered an event or drew something
+  // that can't be undone, and that the retained pass has been abandoned.
+  bool retained_committed_;
+  bool retained_abandoned_;
+
+  // Layout signature of the current pass, and the one of the layout pass.
+  // The signature folds element IDs, sizes and group parameters.
+  uint32_t signature_;
+  uint32_t layout_signature_;
+
   std::vector<Element> elements_;
   std::vector<Element>::iterator element_it_;
   std::vector<Group> group_stack_;
@@ -1307,9 +1843,47 @@ class InternalState : public Group {
   InputSystem &input_;
   FontManager &fontman_;
   Shader *image_shader_;
-  Shader *font_shader_;
-  Shader *font_clipping_shader_;
-  Shader *color_shader_;
+  Shader *font_batch_shader_;
+  Shader *font_batch_sdf_shader_;
+  Shader *quad_batch_shader_;
+
+  // Batch of labels rendered in the render pass. Owned by the frame arena.
+  FontBatch &font_batch_;
+
+  // Batch of images, backgrounds and solid color quads rendered in the render
+  // pass, and the atlas of small images. Owned by the frame arena.
+  QuadBatch &quad_batch_;
+  ImageAtlas &image_atlas_;
+
+  // Cached render-to-texture layer of StartLayer() and its states.
+  struct Layer {
+    Layer()
+        : layout_signature(kSignatureOffsetBasis),
+          contents_signature(kSignatureOffsetBasis),
+          valid(false),
+          invalidated(false),
+          used(false) {}
+    RenderLayer target;
+    // Signature of the contents in the last layout pass.
+    uint32_t layout_signature;
+    // Signature of the layout the texture has been rendered with.
+    uint32_t contents_signature;
+    // The texture has contents to composite.
+    bool valid;
+    // The contents need to be rendered again.
+    bool invalidated;
+    // The layer showed up in the current frame.
+    bool used;
+  };
+
+  // The layer being laid out or rendered, and its states in the render pass.
+  // While a cached layer is rendered, the contents are not drawn.
+  Layer *layer_;
+  bool layer_cached_;
+  bool layer_rendering_;
+  uint32_t layer_signature_;
+  vec2i layer_position_;
+  mathfu::mat4 layer_projection_;
 
   // Expensive rendering commands can check if they're inside this rect to
   // cull themselves inside a scrolling group.
@@ -1340,11 +1914,12 @@ class InternalState : public Group {
   Event latest_event_;
   size_t latest_event_element_idx_;
 
-  // Intra-frame persistent state.
-  static struct PersistentState {
+ public:
+  // Intra-frame persistent state, owned by a GuiContext.
+  struct PersistentState {
     PersistentState() : is_last_event_pointer_type(true) {
-      // This is effectively a global, so no memory allocation or other
-      // complex initialization here.
+      // This is created with a GuiContext, which may be a global, so no
+      // memory allocation or other complex initialization here.
       for (int i = 0; i < InputSystem::kMaxSimultanuousPointers; i++) {
         pointer_element[i] = kNullHash;
       }
@@ -1352,6 +1927,47 @@ class InternalState : public Group {
       dragging_pointer_ = kPointerIndexInvalid;
     }
 
+    // Layout kept for the retained layout mode.
+    struct RetainedLayout {
+      RetainedLayout()
+          : enabled(false),
+            valid(false),
+            invalidated(false),
+            signature(kSignatureOffsetBasis),
+            canvas_size(mathfu::kZeros2i),
+            default_projection(true),
+            virtual_resolution(FLATUI_DEFAULT_VIRTUAL_RESOLUTION) {}
+      bool enabled;
+      // The elements below can be used in the next frame.
+      bool valid;
+      // Something changed in the frame that may affect the next layout.
+      bool invalidated;
+      std::vector<Element> elements;
+      uint32_t signature;
+      vec2i canvas_size;
+      bool default_projection;
+      float virtual_resolution;
+    } retained_;
+
+    // Storage of InternalState reused across frames. Containers keep their
+    // capacity, so that a frame only allocates when it needs more elements,
+    // nested groups or batched glyphs than any previous frame.
+    struct FrameArena {
+      FrameArena() : num_allocations(0), signature(kSignatureOffsetBasis) {}
+      std::vector<Element> elements;
+      std::vector<Group> group_stack;
+      FontBatch font_batch;
+      QuadBatch quad_batch;
+      ImageAtlas image_atlas;
+      // # of times the containers grew in the last frame.
+      int32_t num_allocations;
+      // Layout signature of the last frame.
+      uint32_t signature;
+    } arena_;
+
+    // Render-to-texture layers by group ID.
+    std::unordered_map<HashedId, std::unique_ptr<Layer>> layers_;
+
     // For each pointer, the element id that last received a down event.
     HashedId pointer_element[InputSystem::kMaxSimultanuousPointers];
     // The element the gamepad is currently "over", simulates the mouse
@@ -1375,7 +1991,17 @@ class InternalState : public Group {
 
     // If yes, then touch/mouse, else gamepad/keyboard.
     bool is_last_event_pointer_type;
-  } persistent_;
+
+    // Statistics of the current or the last frame.
+    FrameStats frame_stats_;
+  };
+
+ private:
+  // The persistent state of the GuiContext being run.
+  PersistentState &persistent_;
+
+  // Statistics of the frame, stored in the persistent state.
+  FrameStats &frame_stats_;
 
   const FlatUiVersion *version_;
 
@@ -1384,28 +2010,112 @@ class InternalState : public Group {
   InternalState &operator=(const InternalState &);
 };
 
-InternalState::PersistentState InternalState::persistent_;
+struct GuiContext::Impl {
+  InternalState::PersistentState persistent;
+};
 
-void Run(fplbase::AssetManager &assetman, FontManager &fontman,
-         fplbase::InputSystem &input,
+GuiContext::GuiContext() : impl_(new Impl()) {}
+
+GuiContext::~GuiContext() {
+  // Fall back to the default context if this context is current in the
+  // calling thread.
+  if (current_context == this) current_context = nullptr;
+}
+
+InternalState::PersistentState &InternalState::GetPersistentState(
+    GuiContext &context) {
+  return context.impl_->persistent;
+}
+
+void SetCurrentGuiContext(GuiContext *context) {
+  // If this assert hits, you likely are trying to switch contexts in Run().
+  assert(!state);
+  current_context = context;
+}
+
+GuiContext &GetCurrentGuiContext() {
+  if (current_context != nullptr) return *current_context;
+  // The default context is shared by threads not setting their own context.
+  static GuiContext default_context;
+  return default_context;
+}
+
+void ReleaseGuiContext(GuiContext &context) {
+  // If this assert hits, you likely are trying to release a context in Run().
+  assert(!state);
+  InternalState::ReleaseResources(InternalState::GetPersistentState(context));
+}
+
+// Makes a context current in the calling thread for the scope and restores the
+// previous one, so that the context doesn't stay current after Run().
+class ScopedGuiContext {
+ public:
+  explicit ScopedGuiContext(GuiContext *context) : previous_(current_context) {
+    current_context = context;
+  }
+  ~ScopedGuiContext() { current_context = previous_; }
+
+ private:
+  GuiContext *previous_;
+};
+
+// Returns the persistent state of the current context of the calling thread.
+static InternalState::PersistentState &CurrentState() {
+  return InternalState::GetPersistentState(GetCurrentGuiContext());
+}
+
+void Run(GuiContext &context, fplbase::AssetManager &assetman,
+         FontManager &fontman, fplbase::InputSystem &input,
          const std::function<void()> &gui_definition) {
-  // Create our new temporary state.
-  InternalState internal_state(assetman, fontman, input);
+  ScopedTrace trace("FlatUI::Run");
+  // If this assert hits, you likely are trying to call Run() in Run().
+  assert(!state);
+  ScopedGuiContext scoped_context(&context);
+  auto &persistent = InternalState::GetPersistentState(context);
+  auto &stats = InternalState::GetFrameStats(persistent);
+
+  // A retained pass abandoned because the layout changed runs the frame again
+  // with the layout pass.
+  for (;;) {
+    // Create our new temporary state.
+    InternalState internal_state(persistent, assetman, fontman, input);
+
+    // Run two passes, one for layout, one for rendering.
+    // The layout pass is skipped when the retained layout can be reused.
+    if (!internal_state.StartRetainedRenderPass()) {
+      // First pass:
+      {
+        ScopedTrace layout_trace("FlatUI::LayoutPass");
+        ScopedTimer layout_timer(&stats.layout_pass_time);
+        gui_definition();
+      }
 
-  // Run two passes, one for layout, one for rendering.
-  // First pass:
-  gui_definition();
+      // Second pass:
+      internal_state.StartRenderPass();
+    }
 
-  // Second pass:
-  internal_state.StartRenderPass();
+    ScopedTrace render_trace("FlatUI::RenderPass");
+    ScopedTimer render_timer(&stats.render_pass_time);
+    auto &renderer = assetman.renderer();
+    renderer.SetBlendMode(fplbase::kBlendModeAlpha);
+    renderer.DepthTest(false);
 
-  auto &renderer = assetman.renderer();
-  renderer.SetBlendMode(fplbase::kBlendModeAlpha);
-  renderer.DepthTest(false);
+    gui_definition();
 
-  gui_definition();
+    if (internal_state.RetainedPassAbandoned()) {
+      internal_state.EndRenderPass();
+      continue;
+    }
+    internal_state.CheckGamePadFocus();
+    internal_state.EndRenderPass();
+    break;
+  }
+}
 
-  internal_state.CheckGamePadFocus();
+void Run(fplbase::AssetManager &assetman, FontManager &fontman,
+         fplbase::InputSystem &input,
+         const std::function<void()> &gui_definition) {
+  Run(GetCurrentGuiContext(), assetman, fontman, input, gui_definition);
 }
 
 InternalState *Gui() {
@@ -1413,6 +2123,28 @@ InternalState *Gui() {
   return state;
 }
 
+void SetRetainedLayout(bool enable) {
+  InternalState::SetRetainedLayout(CurrentState(), enable);
+}
+
+void SetImageAtlas(bool enable) {
+  InternalState::SetImageAtlas(CurrentState(), enable);
+}
+
+void InvalidateImage(const fplbase::Texture &texture) {
+  InternalState::InvalidateImage(CurrentState(), texture);
+}
+
+void InvalidateLayout() { InternalState::InvalidateLayout(CurrentState()); }
+
+int32_t GetFrameAllocationCount() {
+  return InternalState::GetFrameAllocationCount(CurrentState());
+}
+
+const FrameStats &GetFrameStats() {
+  return InternalState::GetFrameStats(CurrentState());
+}
+
 void Image(const Texture &texture, float size) { Gui()->Image(texture, size); }
 
 void Label(const char *text, float font_size) { Gui()->Label(text, font_size); }
@@ -1433,6 +2165,17 @@ void StartGroup(Layout layout, float spacing, const char *id) {
 
 void EndGroup() { Gui()->EndGroup(); }
 
+void StartLayer(Layout layout, float spacing, const char *id) {
+  Gui()->StartLayer(GetDirection(layout), GetAlignment(layout), spacing,
+                    HashId(id));
+}
+
+void EndLayer() { Gui()->EndLayer(); }
+
+void InvalidateLayer(const char *id) {
+  InternalState::InvalidateLayer(CurrentState(), HashId(id));
+}
+
 void SetMargin(const Margin &margin) { Gui()->SetMargin(margin); }
 
 void StartScroll(const vec2 &size, vec2 *offset) {
@@ -1441,6 +2184,12 @@ void StartScroll(const vec2 &size, vec2 *offset) {
 
 void EndScroll() { Gui()->EndScroll(); }
 
+void ScrollList(const vec2 &size, int32_t item_count, float item_height,
+                vec2 *offset,
+                const std::function<void(int32_t index)> &item_renderer) {
+  Gui()->ScrollList(size, item_count, item_height, offset, item_renderer);
+}
+
 void StartSlider(Direction direction, float scroll_margin, float *value) {
   Gui()->StartSlider(direction, scroll_margin, value);
 }
@@ -1470,9 +2219,13 @@ void RenderTextureNinePatch(const Texture &tex, const vec4 &patch_info,
 void SetTextColor(const mathfu::vec4 &color) { Gui()->SetTextColor(color); }
 
 void SetTextFont(const char *font_name) { Gui()->SetTextFont(font_name); }
+void SetTextFont(const char *font_names[], int32_t count) {
+  Gui()->SetTextFont(font_names, count);
+}
 void SetTextLocale(const char *locale) {
   Gui()->SetTextLocale(locale);
 }
+void SetTextLocale(const LocaleInfo &locale) { Gui()->SetTextLocale(locale); }
 void SetTextDirection(const TextLayoutDirection direction) {
   Gui()->SetTextDirection(direction);
 }
@@ -0,0 +1,184 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "flatui/internal/font_batch.h"
+#include "flatui/internal/font_vertex_buffer.h"
+#include "fplbase/glplatform.h"
+
+using fplbase::Mesh;
+using mathfu::mat4;
+using mathfu::vec2;
+using mathfu::vec3;
+using mathfu::vec4;
+
+namespace flatui {
+
+// Vertex format of FontBatch::FontBatchVertex.
+// The clipping rect is passed as a tangent and the smoothing width as an
+// alternative texture coordinate since FPLBase has no generic attributes.
+static const fplbase::Attribute kFontBatchFormat[] = {
+    fplbase::kPosition3f, fplbase::kTexCoord2f, fplbase::kTexCoordAlt2f,
+    fplbase::kTangent4f,  fplbase::kColor4ub,   fplbase::kEND};
+
+// Max # of vertices in a draw call addressable with the shared quad indices.
+static const size_t kFontBatchMaxVertices =
+    FontBuffer::kMaxGlyphsPerDraw * FontBuffer::kVerticesPerCodePoint;
+
+// Labels with at least this many glyphs are rendered from the vertex buffer
+// objects of their FontBuffers instead of being copied into the batch.
+// Copying long texts every frame costs more than their own draw calls.
+static const size_t kFontBatchMinDirectGlyphs = 256;
+
+void FontBatch::Add(fplbase::Renderer &renderer, FontManager &fontman,
+                    fplbase::Shader *shader, const FontBuffer &buffer,
+                    const vec2 &offset, const vec4 &clipping, const vec4 &color,
+                    float smoothing) {
+  auto &vertices = *buffer.get_vertices();
+  if (vertices.empty()) return;
+
+  if (RendersDirectly(buffer)) {
+    // Keep the rendering order with labels already in the batch.
+    Flush(renderer, fontman);
+    RenderDirect(renderer, fontman, shader, buffer, offset, clipping, color,
+                 smoothing);
+    return;
+  }
+
+  // Flush the batch if the shader changes.
+  if (shader != shader_) {
+    Flush(renderer, fontman);
+    shader_ = shader;
+  }
+
+  // Bake label parameters into vertices, and sort them into the pages of the
+  // glyphs.
+  FontBatchVertex v;
+  v.smoothing_ = vec2(smoothing, 0.0f);
+  v.clipping_ = clipping;
+  for (int32_t i = 0; i < 4; ++i) {
+    v.color_[i] = static_cast<uint8_t>(
+        mathfu::Clamp(color[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+  }
+  auto &glyph_pages = buffer.get_glyph_pages();
+  auto it = vertices.begin();
+  for (size_t i = 0; i < glyph_pages.size(); ++i) {
+    auto page = static_cast<size_t>(glyph_pages[i]);
+    if (vertices_.size() <= page) {
+      vertices_.resize(page + 1);
+    }
+    auto &page_vertices = vertices_[page];
+    for (int32_t j = 0; j < FontBuffer::kVerticesPerCodePoint; ++j, ++it) {
+      v.position_ = vec3(it->position() + offset, 0.0f);
+      v.uv_ = it->uv();
+      page_vertices.push_back(v);
+    }
+  }
+  auto rect = vec4(offset, offset + vec2(buffer.get_size()));
+  rects_.push_back(vec4(vec2::Max(rect.xy(), clipping.xy()),
+                        vec2::Min(rect.zw(), clipping.zw())));
+  num_labels_++;
+}
+
+void FontBatch::Clear() {
+  for (auto it = vertices_.begin(); it != vertices_.end(); ++it) {
+    it->clear();
+  }
+  rects_.clear();
+  num_labels_ = 0;
+}
+
+bool FontBatch::Overlaps(const vec4 &rect) const {
+  for (auto it = rects_.begin(); it != rects_.end(); ++it) {
+    if (rect.x() < it->z() && it->x() < rect.z() && rect.y() < it->w() &&
+        it->y() < rect.w()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool FontBatch::RendersDirectly(const FontBuffer &buffer) {
+  return buffer.get_vertices()->size() >=
+         kFontBatchMinDirectGlyphs * FontBuffer::kVerticesPerCodePoint;
+}
+
+void FontBatch::RenderDirect(fplbase::Renderer &renderer,
+                             FontManager &fontman, fplbase::Shader *shader,
+                             const FontBuffer &buffer, const vec2 &offset,
+                             const vec4 &clipping, const vec4 &color,
+                             float smoothing) {
+  auto vertex_buffer = buffer.GetVertexBuffer();
+
+  // The vertices are relative to the label, so the label position is applied
+  // with the transform.
+  auto mvp = renderer.model_view_projection();
+  renderer.set_model_view_projection(
+      mvp * mat4::FromTranslationVector(vec3(offset, 0.0f)));
+  shader->Set(renderer);
+  renderer.set_model_view_projection(mvp);
+
+  // Label parameters are passed as constant vertex attributes, so that the
+  // batch shaders are used as is.
+  vertex_buffer->Bind(fontman.GetQuadIndexBuffer());
+  auto rect = clipping - vec4(offset, offset);
+  GL_CALL(glVertexAttrib4f(Mesh::kAttributeTangent, rect.x(), rect.y(),
+                           rect.z(), rect.w()));
+  GL_CALL(glVertexAttrib2f(Mesh::kAttributeTexCoordAlt, smoothing, 0.0f));
+  auto c = vec4::Max(vec4::Min(color, mathfu::kOnes4f), mathfu::kZeros4f);
+  GL_CALL(
+      glVertexAttrib4f(Mesh::kAttributeColor, c.x(), c.y(), c.z(), c.w()));
+
+  // Render runs of glyphs in the same page.
+  auto &glyph_pages = buffer.get_glyph_pages();
+  for (size_t start = 0; start < glyph_pages.size();) {
+    auto page = glyph_pages[start];
+    auto end = start + 1;
+    while (end < glyph_pages.size() && glyph_pages[end] == page) ++end;
+    fontman.GetAtlasTexture(page)->Set(0);
+    num_draw_calls_ += vertex_buffer->Render(static_cast<int32_t>(start),
+                                             static_cast<int32_t>(end - start));
+    start = end;
+  }
+  FontVertexBuffer::Unbind();
+}
+
+void FontBatch::Flush(fplbase::Renderer &renderer, FontManager &fontman) {
+  if (IsEmpty()) return;
+
+  shader_->Set(renderer);
+  auto &indices = FontBuffer::GetQuadIndices();
+  for (size_t page = 0; page < vertices_.size(); ++page) {
+    auto &vertices = vertices_[page];
+    if (vertices.empty()) continue;
+    fontman.GetAtlasTexture(static_cast<int32_t>(page))->Set(0);
+    // Render the page in chunks addressable with the shared quad indices.
+    for (size_t start = 0; start < vertices.size();
+         start += kFontBatchMaxVertices) {
+      auto count = std::min(vertices.size() - start, kFontBatchMaxVertices);
+      auto num_indices = count / FontBuffer::kVerticesPerCodePoint *
+                         FontBuffer::kIndiciesPerCodePoint;
+      Mesh::RenderArray(Mesh::kTriangles, static_cast<int>(num_indices),
+                        kFontBatchFormat, sizeof(FontBatchVertex),
+                        reinterpret_cast<const char *>(&vertices[start]),
+                        indices.data());
+      num_draw_calls_++;
+    }
+    vertices.clear();
+  }
+  rects_.clear();
+  num_labels_ = 0;
+}
+
+}  // namespace flatui
@@ -0,0 +1,142 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+
+#include <mutex>
+#include <unordered_map>
+
+#if defined(__ANDROID__)
+#include <android/asset_manager.h>
+#elif !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "flatui/internal/font_data.h"
+#include "fplbase/utilities.h"
+
+using fplbase::LogInfo;
+
+namespace flatui {
+
+FontData::FontData()
+    : data_(nullptr),
+      size_(0)
+#if defined(__ANDROID__)
+      ,
+      asset_(nullptr)
+#endif
+{
+}
+
+FontData::~FontData() { Unmap(); }
+
+std::shared_ptr<FontData> FontData::Open(const char *file_name) {
+  // Instances shared by file names. Entries are kept while any FontManager
+  // references them.
+  static std::mutex mutex;
+  static std::unordered_map<std::string, std::weak_ptr<FontData>> files;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &file = files[file_name];
+  auto font_data = file.lock();
+  if (font_data != nullptr) {
+    return font_data;
+  }
+
+  font_data.reset(new FontData());
+  if (!font_data->Map(file_name)) {
+    // Fall back to load the file to the heap.
+    if (!fplbase::LoadFile(file_name, &font_data->heap_data_) ||
+        font_data->heap_data_.empty()) {
+      files.erase(file_name);
+      return nullptr;
+    }
+    font_data->data_ =
+        reinterpret_cast<const unsigned char *>(font_data->heap_data_.data());
+    font_data->size_ = font_data->heap_data_.size();
+  }
+  file = font_data;
+  return font_data;
+}
+
+bool FontData::Map(const char *file_name) {
+#if defined(__ANDROID__)
+  auto manager = fplbase::GetAAssetManager();
+  if (manager == nullptr) {
+    return false;
+  }
+  asset_ = AAssetManager_open(manager, file_name, AASSET_MODE_BUFFER);
+  if (asset_ == nullptr) {
+    return false;
+  }
+  // The buffer is mapped from the APK if the asset is not compressed.
+  data_ = static_cast<const unsigned char *>(AAsset_getBuffer(asset_));
+  size_ = static_cast<size_t>(AAsset_getLength(asset_));
+  if (data_ == nullptr || !size_) {
+    Unmap();
+    return false;
+  }
+  return true;
+#elif !defined(_WIN32)
+  auto fd = open(file_name, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return false;
+  }
+  auto mapped = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                     MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after the file is closed.
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    LogInfo("Can't map a font file: %s\n", file_name);
+    return false;
+  }
+  data_ = static_cast<const unsigned char *>(mapped);
+  size_ = static_cast<size_t>(st.st_size);
+  return true;
+#else
+  (void)file_name;
+  return false;
+#endif
+}
+
+void FontData::Unmap() {
+  if (!heap_data_.empty()) {
+    heap_data_.clear();
+  } else if (data_ != nullptr) {
+#if defined(__ANDROID__)
+    // The buffer is owned by the asset.
+#elif !defined(_WIN32)
+    munmap(const_cast<unsigned char *>(data_), size_);
+#endif
+  }
+#if defined(__ANDROID__)
+  if (asset_ != nullptr) {
+    AAsset_close(asset_);
+    asset_ = nullptr;
+  }
+#endif
+  data_ = nullptr;
+  size_ = 0;
+}
+
+}  // namespace flatui
@@ -14,9 +14,13 @@
 
 #include "precompiled.h"
 
+#include <atomic>
+#include <thread>
+
 // Freetype2 header
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include FT_TRUETYPE_TABLES_H
 
 // Harfbuzz header
 #include <hb.h>
@@ -24,6 +28,12 @@
 #include <hb-ot.h>
 
 #include "font_manager.h"
+#include "flatui/internal/atlas_uploader.h"
+#include "flatui/internal/distance_field.h"
+#include "flatui/internal/glyph_rasterizer.h"
+#include "flatui/internal/layout_context.h"
+#include "flatui/internal/shaping_cache.h"
+#include "flatui/internal/trace.h"
 #include "fplbase/fpl_common.h"
 #include "fplbase/utilities.h"
 
@@ -43,9 +53,118 @@ namespace flatui {
 // The default script used for a layout.
 const hb_script_t kDefaultScript = HB_SCRIPT_LATIN;
 
-// Singleton object of FreeType&Harfbuzz.
+// Persistent cache file format.
+// A cache file consists of a header, font records, a serialized glyph cache
+// image and FontBuffer records in the order. All records are POD with 4 bytes
+// aligned fields so that the file can be used from a memory mapped region.
+// Increment kCacheFileVersion when any of the records (including FontVertex
+// and the glyph cache image) is changed.
+const char kCacheFileIdentifier[] = "FUIC";
+const uint32_t kCacheFileVersion = 4;
+
+struct CacheFileHeader {
+  char identifier[4];
+  uint32_t version;
+  uint32_t num_fonts;
+  uint32_t num_buffers;
+  uint32_t glyph_cache_size;
+  uint32_t script;
+  HashedId language;
+  int32_t layout_direction;
+  float line_height;
+  uint32_t sdf;
+  uint32_t layout_strategy;
+};
+
+struct CacheFileFont {
+  HashedId font_id;
+  HashedId font_hash;
+};
+
+// A FontBuffer record is followed by FontVertex[num_glyphs * 4],
+// uint32_t code_points[num_glyphs], int32_t glyph_pages[num_glyphs] and
+// int32_t caret_positions[num_carets * 2].
+struct CacheFileBuffer {
+  HashedId font_id;
+  HashedId text_id;
+  float font_size;
+  int32_t size[2];
+  uint32_t caret_info;
+  int32_t string_size[2];
+  int32_t metrics[5];
+  uint32_t num_glyphs;
+  uint32_t num_carets;
+};
+
+// Append raw data to a buffer.
+static void AppendData(const void *data, const size_t size,
+                       std::vector<uint8_t> *buffer) {
+  auto p = static_cast<const uint8_t *>(data);
+  buffer->insert(buffer->end(), p, p + size);
+}
+
+// Returns the key of a text image in the image cache. The font id and the text
+// hash are mixed with FNV-1a, and the upper bits of the text hash fill the
+// code point field, so that different pairs of ids don't share a key.
+static GlyphKey GetTextImageKey(const HashedId font_id, const HashedId text_id,
+                                const int32_t ysize) {
+  const HashedId ids[] = {font_id, text_id};
+  auto bytes = reinterpret_cast<const uint8_t *>(ids);
+  uint32_t hash = 0x811c9dc5;
+  for (size_t i = 0; i < sizeof(ids); ++i) {
+    hash = (hash ^ bytes[i]) * 0x01000193;
+  }
+  uint32_t code_point = (text_id >> kGlyphKeyGlyphSizeBits) %
+                        kGlyphKeyCodePointInvalid;
+  return GlyphKey(hash, code_point, ysize);
+}
+
+// Read raw data from a buffer and advance the read position.
+// Returns false if the buffer doesn't have enough data.
+static bool ReadData(const uint8_t **p, const uint8_t *end, const size_t size,
+                     void *data) {
+  if (static_cast<size_t>(end - *p) < size) {
+    return false;
+  }
+  memcpy(data, *p, size);
+  *p += size;
+  return true;
+}
+
+// Calculate a hash of a font file.
+// For OpenType/TrueType fonts, it uses the checksum adjustment in the head
+// table that covers entire file, so that it doesn't need to scan the file.
+static HashedId HashFontData(const FT_Face face, const FontData &data) {
+  HashedId hash = 0x84222325;
+  auto mix = [&hash](uint32_t value) {
+    for (int32_t i = 0; i < 4; ++i) {
+      hash = (hash ^ ((value >> (i * 8)) & 0xff)) * 0x000001b3;
+    }
+  };
+  mix(static_cast<uint32_t>(data.size()));
+  auto head = static_cast<TT_Header *>(FT_Get_Sfnt_Table(face, FT_SFNT_HEAD));
+  if (head != nullptr) {
+    mix(static_cast<uint32_t>(head->CheckSum_Adjust));
+    mix(static_cast<uint32_t>(face->num_glyphs));
+  } else {
+    for (size_t i = 0; i < data.size(); ++i) {
+      hash = (hash ^ data.data()[i]) * 0x000001b3;
+    }
+  }
+  if (hash == kNullHash) {
+    hash++;
+  }
+  return hash;
+}
+
+// Lock the mutex of a layout context if the layout runs in parallel.
+static std::unique_lock<std::mutex> LockContext(const LayoutContext &context) {
+  return context.mutex != nullptr ? std::unique_lock<std::mutex>(*context.mutex)
+                                  : std::unique_lock<std::mutex>();
+}
+
+// Singleton object of FreeType.
 FT_Library *FontManager::ft_;
-hb_buffer_t *FontManager::harfbuzz_buf_;
 
 // Enumerate words in a specified buffer using line break information generated
 // by libunibreak.
@@ -129,24 +248,45 @@ class WordEnumerator {
   bool single_line_;
 };
 
-FontManager::FontManager() {
+FontManager::FontManager()
+    : map_textures_(kFontTextureCacheSize),
+      map_buffers_(kFontBufferCacheSize),
+      map_images_(kFontTextureCacheSize) {
   // Initialize variables and libraries.
   Initialize();
 
   // Initialize glyph cache.
   glyph_cache_.reset(new GlyphCache<uint8_t>(
-      mathfu::vec2i(kGlyphCacheWidth, kGlyphCacheHeight)));
+      mathfu::vec2i(kGlyphCacheWidth, kGlyphCacheHeight),
+      kGlyphCacheMaxPages));
+}
+
+FontManager::FontManager(const mathfu::vec2i &cache_size)
+    : map_textures_(kFontTextureCacheSize),
+      map_buffers_(kFontBufferCacheSize),
+      map_images_(kFontTextureCacheSize) {
+  // Initialize variables and libraries.
+  Initialize();
+
+  // Initialize glyph cache.
+  glyph_cache_.reset(new GlyphCache<uint8_t>(cache_size, kGlyphCacheMaxPages));
 }
 
-FontManager::FontManager(const mathfu::vec2i &cache_size) {
+FontManager::FontManager(const mathfu::vec2i &cache_size,
+                         const int32_t max_pages)
+    : map_textures_(kFontTextureCacheSize),
+      map_buffers_(kFontBufferCacheSize),
+      map_images_(kFontTextureCacheSize) {
   // Initialize variables and libraries.
   Initialize();
 
   // Initialize glyph cache.
-  glyph_cache_.reset(new GlyphCache<uint8_t>(cache_size));
+  glyph_cache_.reset(new GlyphCache<uint8_t>(cache_size, max_pages));
 }
 
-FontManager::~FontManager() {}
+FontManager::~FontManager() {
+  hb_buffer_destroy(harfbuzz_buf_);
+}
 
 void FontManager::Initialize() {
   // Initialize variables.
@@ -154,10 +294,19 @@ void FontManager::Initialize() {
   face_initialized_ = false;
   current_atlas_revision_ = 0;
   current_pass_ = 0;
+  current_face_ = nullptr;
+  current_font_id_ = kNullHash;
+  fallback_run_.reset(new ShapedRun());
+  paragraph_run_.reset(new ParagraphRun());
   script_ = kDefaultScript;
   language_ = kDefaultLanguage;
+  locale_ = nullptr;
   layout_direction_ = TextLayoutDirectionLTR;
+  layout_strategy_ = TextLayoutStrategyWord;
   line_height_ = kLineHeightDefault;
+  sdf_ = false;
+  atlas_uploader_.reset(new AtlasUploader());
+  shaping_cache_.reset(new ShapingCache(kShapingCacheSize));
 
   if (ft_ == nullptr) {
     ft_ = new FT_Library;
@@ -169,10 +318,8 @@ void FontManager::Initialize() {
     }
   }
 
-  if (harfbuzz_buf_ == nullptr) {
-    // Create a buffer for harfbuzz.
-    harfbuzz_buf_ = hb_buffer_create();
-  }
+  // Create a buffer for harfbuzz.
+  harfbuzz_buf_ = hb_buffer_create();
 
 #ifdef FLATUI_USE_LIBUNIBREAK
   // Initialize libunibreak
@@ -184,9 +331,6 @@ void FontManager::Initialize() {
 
 void FontManager::Terminate() {
   assert(ft_ != nullptr);
-  hb_buffer_destroy(harfbuzz_buf_);
-  harfbuzz_buf_ = nullptr;
-
   FT_Done_FreeType(*ft_);
   ft_ = nullptr;
 }
@@ -194,22 +338,81 @@ void FontManager::Terminate() {
 void FontManager::SetRenderer(fplbase::Renderer &renderer) {
   renderer_ = &renderer;
 
-  // Initialize the font atlas texture.
-  atlas_texture_.reset(new Texture(nullptr, fplbase::kFormatLuminance, false));
-  atlas_texture_.get()->LoadFromMemory(glyph_cache_->get_buffer(),
-                                       glyph_cache_->get_size(), false);
-  atlas_texture_.get()->Set(0);
+  // Initialize the font atlas textures.
+  atlas_textures_.clear();
+  CreatePageTextures(glyph_cache_.get(), &atlas_textures_);
+
+  // Text image textures are re-created on the next GetImage() call.
+  image_textures_.clear();
+  if (image_cache_) {
+    image_cache_->Flush();
+  }
+  map_images_.Clear();
+}
+
+void FontManager::CreatePageTextures(
+    GlyphCache<uint8_t> *cache,
+    std::vector<std::unique_ptr<fplbase::Texture>> *textures) {
+  // Create textures for newly allocated cache pages.
+  while (static_cast<int32_t>(textures->size()) < cache->get_num_pages()) {
+    auto page = static_cast<int32_t>(textures->size());
+    std::unique_ptr<Texture> texture(
+        new Texture(nullptr, fplbase::kFormatLuminance, false));
+    texture->LoadFromMemory(cache->get_buffer(page), cache->get_size(), false);
+    texture->Set(0);
+    stats_.uploaded_atlas_bytes +=
+        cache->get_size().x() * cache->get_size().y();
+    textures->push_back(std::move(texture));
+
+    // The texture is initialized with the latest contents of the page.
+    cache->set_dirty_state(page, false);
+  }
+}
+
+void FontManager::UploadPages(
+    GlyphCache<uint8_t> *cache,
+    std::vector<std::unique_ptr<fplbase::Texture>> *textures) {
+  CreatePageTextures(cache, textures);
+
+  // Upload dirty regions of each page.
+  for (int32_t page = 0; page < cache->get_num_pages(); ++page) {
+    if (!cache->get_dirty_state(page)) {
+      continue;
+    }
+    atlas_uploader_->Upload((*textures)[page].get(), cache->get_buffer(page),
+                            cache->get_size(), cache->get_dirty_rects(page));
+    stats_.uploaded_atlas_bytes += atlas_uploader_->get_uploaded_bytes();
+  }
+  cache->set_dirty_state(false);
 }
 
 FontBuffer *FontManager::GetBuffer(const char *text, const size_t length,
                                    const FontBufferParameters &parameter) {
-  auto buffer = CreateBuffer(text, length, parameter);
+  return GetBuffer(text, length, parameter, GlyphRasterizeModeBlock);
+}
+
+FontBuffer *FontManager::GetBuffer(const char *text, const size_t length,
+                                   const FontBufferParameters &parameter,
+                                   const GlyphRasterizeMode mode) {
+  LayoutContext context;
+  GetMainContext(&context);
+  auto async = IsAsyncRasterizationEnabled();
+  auto buffer = CreateBuffer(&context, text, length, parameter, async, false);
+  if (buffer != nullptr && !buffer->get_ready_state() &&
+      mode == GlyphRasterizeModeBlock) {
+    // Wait for worker threads and re-create the buffer with rasterized
+    // glyphs.
+    rasterizer_->Wait();
+    UpdateRasterizedGlyphs();
+    map_buffers_.Erase(parameter);
+    buffer = CreateBuffer(&context, text, length, parameter, false, false);
+  }
   if (buffer == nullptr) {
     // Flush glyph cache & Upload a texture
     FlushAndUpdate();
 
     // Try to create buffer again.
-    buffer = CreateBuffer(text, length, parameter);
+    buffer = CreateBuffer(&context, text, length, parameter, false, false);
     if (buffer == nullptr) {
       LogError("The given text '%s' with ",
                "size:%d does not fit a glyph cache. Try to "
@@ -220,60 +423,308 @@ FontBuffer *FontManager::GetBuffer(const char *text, const size_t length,
   return buffer;
 }
 
-FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
-                                      const FontBufferParameters &parameters) {
+const FontBuffer *FontManager::MeasureText(
+    const char *text, const size_t length,
+    const FontBufferParameters &parameters) {
+  if (parameters.get_caret_info_flag()) {
+    return GetBuffer(text, length, parameters);
+  }
+  LayoutContext context;
+  GetMainContext(&context);
+  return CreateBuffer(&context, text, static_cast<uint32_t>(length),
+                      parameters, false, true);
+}
+
+void FontManager::GetBuffers(const std::vector<FontBufferRequest> &requests,
+                             const int32_t num_threads,
+                             std::vector<FontBuffer *> *buffers) {
+  // Fallback fonts are only used in the calling thread.
+  if (num_threads > 1 && requests.size() > 1 && current_face_ != nullptr &&
+      fallback_faces_.empty()) {
+    // Lay out texts in parallel and prewarm the FontBuffer cache.
+    LayoutBuffersInParallel(requests, num_threads);
+  }
+
+  // Retrieve buffers in the calling thread. Buffers laid out by workers are
+  // found in the cache and only their UVs are updated here. Buffers failed in
+  // workers (e.g. the glyph cache is full) are laid out again with a flush.
+  buffers->resize(requests.size());
+  for (size_t i = 0; i < requests.size(); ++i) {
+    auto &request = requests[i];
+    (*buffers)[i] = GetBuffer(request.text, request.length, request.parameters,
+                              GlyphRasterizeModeBlock);
+  }
+}
+
+void FontManager::LayoutBuffersInParallel(
+    const std::vector<FontBufferRequest> &requests,
+    const int32_t num_threads) {
+  // The calling thread uses the first worker. Workers are kept so that their
+  // faces and shaping caches are reused in later calls.
+  auto num_workers = std::min(static_cast<size_t>(num_threads),
+                              requests.size());
+  while (layout_workers_.size() < num_workers) {
+    std::unique_ptr<LayoutWorker> worker(new LayoutWorker());
+    if (!worker->Initialize()) {
+      break;
+    }
+    layout_workers_.push_back(std::move(worker));
+  }
+  num_workers = std::min(num_workers, layout_workers_.size());
+
+  // Requests are handed out to workers one by one.
+  std::atomic<size_t> next_request(0);
+  auto layout = [this, &requests, &next_request](LayoutWorker *worker) {
+    LayoutContext context;
+    if (!worker->GetContext(current_face_->font_id_,
+                            *current_face_->font_data_, &layout_mutex_,
+                            &context)) {
+      return;
+    }
+    context.face_data = current_face_;
+    for (;;) {
+      auto index = next_request++;
+      if (index >= requests.size()) {
+        break;
+      }
+      auto &request = requests[index];
+      CreateBuffer(&context, request.text,
+                   static_cast<uint32_t>(request.length), request.parameters,
+                   false, false);
+    }
+  };
+
+  // Workers may evict or replace FontBuffers, whose vertex buffers can only be
+  // deleted on the GL thread. They are released in StartLayoutPass().
+  map_buffers_.set_defer_release(true);
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_workers; ++i) {
+    threads.push_back(std::thread(layout, layout_workers_[i].get()));
+  }
+  if (num_workers) {
+    layout(layout_workers_[0].get());
+  }
+  for (auto it = threads.begin(); it != threads.end(); ++it) {
+    it->join();
+  }
+  map_buffers_.set_defer_release(false);
+}
+
+void FontManager::GetMainContext(LayoutContext *context) {
+  context->face_data = current_face_;
+  context->face = current_face_ != nullptr ? current_face_->face_ : nullptr;
+  context->harfbuzz_font =
+      current_face_ != nullptr ? current_face_->harfbuzz_font_ : nullptr;
+  context->harfbuzz_buf = harfbuzz_buf_;
+  context->wordbreak_info = &wordbreak_info_;
+  if (sdf_ && sdf_generator_ == nullptr) {
+    sdf_generator_.reset(new DistanceFieldGenerator());
+  }
+  context->sdf_generator = sdf_generator_.get();
+  context->sdf_image = &sdf_image_;
+  context->shaping_cache = shaping_cache_.get();
+  context->paragraph_run = paragraph_run_.get();
+  context->mutex = nullptr;
+}
+
+bool FontManager::EnableAsyncRasterization(const int32_t num_threads) {
+  if (rasterizer_ == nullptr) {
+    rasterizer_.reset(new GlyphRasterizer());
+  }
+  return rasterizer_->Start(num_threads);
+}
+
+void FontManager::DisableAsyncRasterization() {
+  if (rasterizer_ != nullptr) {
+    rasterizer_->Stop();
+  }
+}
+
+bool FontManager::IsAsyncRasterizationEnabled() const {
+  return rasterizer_ != nullptr && rasterizer_->IsRunning();
+}
+
+void FontManager::RequestGlyph(const FaceData *face, const uint32_t code_point,
+                               const int32_t ysize) {
+  GlyphRasterizeRequest request;
+  request.key = GlyphKey(face->font_id_, code_point, ysize);
+  request.font_data = reinterpret_cast<const char *>(face->font_data_->data());
+  request.font_data_size = face->font_data_->size();
+  request.sdf_padding = sdf_ ? kGlyphSDFPadding : 0;
+  rasterizer_->Request(request);
+}
+
+void FontManager::UpdateRasterizedGlyphs() {
+  if (!IsAsyncRasterizationEnabled()) {
+    return;
+  }
+  std::vector<GlyphRasterizeResult> results;
+  rasterizer_->Retrieve(&results);
+  for (auto it = results.begin(); it != results.end(); ++it) {
+    if (!it->succeeded) {
+      // Remember the glyph so that it's laid out without a quad instead of
+      // being requested again in each layout.
+      LogInfo("Can't rasterize glyph %u.\n", it->key.get_code_point());
+      failed_glyphs_.insert(it->key);
+      continue;
+    }
+    stats_.num_glyph_rasterizations++;
+    if (glyph_cache_->Set(it->image.data(), it->key, it->entry) == nullptr) {
+      // The glyph is requested again when it's used next time.
+      LogInfo("Glyph cache is full. Discarding a rasterized glyph.\n");
+    }
+  }
+}
+
+FontBuffer *FontManager::CreateBuffer(LayoutContext *context,
+                                      const char *text, const uint32_t length,
+                                      const FontBufferParameters &parameters,
+                                      const bool async, const bool measure) {
   // Adjust y size if the size selector is set.
   auto ysize = static_cast<int32_t>(parameters.get_font_size());
   auto size = parameters.get_size();
   auto caret_info = parameters.get_caret_info_flag();
-  int32_t converted_ysize = ConvertSize(ysize);
-  float scale = ysize / static_cast<float>(converted_ysize);
+  // In the SDF mode, glyphs are always rasterized at the reference size.
+  int32_t converted_ysize =
+      sdf_ ? kGlyphSDFReferenceSize : ConvertSize(ysize);
   bool multi_line = size.y() == 0 || size.y() > ysize;
 
   // Check cache if we already have a FontBuffer generated.
-  auto it = map_buffers_.find(parameters);
-  if (it != map_buffers_.end()) {
+  auto lock = LockContext(*context);
+  auto cached_buffer = map_buffers_.Find(parameters);
+  if (cached_buffer != nullptr && !measure &&
+      (cached_buffer->get_measured_state() ||
+       (!cached_buffer->get_ready_state() &&
+        (current_pass_ != kRenderPass || !async)))) {
+    // The buffer has only been measured, or some glyphs in the buffer were
+    // pending and may be available now. Re-create the buffer with glyphs.
+    map_buffers_.Erase(parameters);
+    cached_buffer = nullptr;
+  }
+  if (cached_buffer != nullptr) {
+    stats_.num_buffer_hits++;
+  } else {
+    stats_.num_buffer_misses++;
+  }
+  if (cached_buffer != nullptr && context->mutex != nullptr) {
+    // Laid out by another worker. UV is updated in the calling thread.
+    return cached_buffer;
+  }
+  if (lock.owns_lock()) {
+    lock.unlock();
+  }
+  if (cached_buffer != nullptr) {
     // Update current pass.
     if (current_pass_ != kRenderPass) {
-      it->second->set_pass(current_pass_);
+      cached_buffer->set_pass(current_pass_);
     }
 
+    // A measurement doesn't look up glyphs.
+    if (measure) return cached_buffer;
+
     // Update UV of the buffer
-    auto ret = UpdateUV(converted_ysize, it->second.get());
+    auto ret = UpdateUV(context, converted_ysize, cached_buffer);
     return ret;
   }
 
-  // Otherwise, create new FontBuffer.
+  // Multi line buffers with caret info (edit boxes) are composed of buffers of
+  // each paragraph, so that an edit only lays out the edited paragraph.
+  if (caret_info && multi_line && context->mutex == nullptr && length > 1 &&
+      memchr(text, '\n', length - 1) != nullptr) {
+    return CreateBufferByParagraphs(context, text, length, parameters, async);
+  }
 
-  // Set freetype settings.
-  FT_Set_Pixel_Sizes(current_face_->face_, 0, converted_ysize);
+  // Otherwise, create new FontBuffer.
+  ScopedTrace trace(context->mutex == nullptr ? "FontManager::CreateBuffer"
+                                              : nullptr);
 
   // Create FontBuffer with derived string length.
   std::unique_ptr<FontBuffer> buffer(new FontBuffer(length, caret_info));
 
+  // Pick a layout variant specialized for the parameters.
+  // TextLayoutDirectionTTB isn't supported yet and is laid out as LTR.
+  typedef bool (FontManager::*LayoutFunction)(
+      LayoutContext *, const char *, const uint32_t,
+      const FontBufferParameters &, const int32_t, const bool, const bool,
+      FontBuffer *);
+  static const LayoutFunction kLayoutFunctions[] = {
+      &FontManager::LayoutBuffer<false, false, false>,
+      &FontManager::LayoutBuffer<false, false, true>,
+      &FontManager::LayoutBuffer<false, true, false>,
+      &FontManager::LayoutBuffer<false, true, true>,
+      &FontManager::LayoutBuffer<true, false, false>,
+      &FontManager::LayoutBuffer<true, false, true>,
+      &FontManager::LayoutBuffer<true, true, false>,
+      &FontManager::LayoutBuffer<true, true, true>};
+  auto rtl = layout_direction_ == TextLayoutDirectionRTL;
+  auto layout = kLayoutFunctions[rtl * 4 + multi_line * 2 + caret_info];
+  if (!(this->*layout)(context, text, length, parameters, converted_ysize,
+                       async, measure, buffer.get())) {
+    return nullptr;
+  }
+  buffer->set_measured_state(measure);
+  if (measure) stats_.num_measurements++;
+
+  // Set current pass.
+  if (current_pass_ != kRenderPass) {
+    buffer->set_pass(current_pass_);
+  }
+
+  // Verify the buffer.
+  assert(buffer->Verify());
+
+  // Insert the created entry to the cache.
+  auto buffer_size = GetBufferSize(*buffer);
+  lock = LockContext(*context);
+  return map_buffers_.Insert(parameters, std::move(buffer), buffer_size);
+}
+
+template <bool kRightToLeft, bool kMultiLine, bool kCaretInfo>
+bool FontManager::LayoutBuffer(LayoutContext *context, const char *text,
+                               const uint32_t length,
+                               const FontBufferParameters &parameters,
+                               const int32_t converted_ysize, const bool async,
+                               const bool measure, FontBuffer *buffer) {
+  // Placeholder entry used for glyphs being rasterized in worker threads.
+  static const GlyphCacheEntry kPendingEntry;
+  // Padding of glyph images in the glyph cache, excluded from the metrics.
+  const int32_t padding = sdf_ ? kGlyphSDFPadding : 0;
+
+  auto ysize = static_cast<int32_t>(parameters.get_font_size());
+  auto size = parameters.get_size();
+  float scale = ysize / static_cast<float>(converted_ysize);
+  bool ready = true;
+
+  // Set freetype settings.
+  FT_Set_Pixel_Sizes(context->face, 0, converted_ysize);
+
   // Retrieve word breaking information using libunibreak.
+  auto &wordbreak_info = *context->wordbreak_info;
   if (length) {
-    wordbreak_info_.resize(length);
+    wordbreak_info.resize(length);
     set_linebreaks_utf8(reinterpret_cast<const utf8_t *>(text), length,
-                        language_.c_str(), &wordbreak_info_[0]);
+                        language_, &wordbreak_info[0]);
   }
-  WordEnumerator word_enum(wordbreak_info_, !multi_line);
+  WordEnumerator word_enum(wordbreak_info, !kMultiLine);
 
   // Initialize font metrics parameters.
-  int32_t base_line = ysize * current_face_->face_->ascender /
-                      current_face_->face_->units_per_EM;
+  int32_t base_line =
+      ysize * context->face->ascender / context->face->units_per_EM;
   if (base_line > ysize) {
     base_line = ysize;
   }
   FontMetrics initial_metrics(base_line, 0, base_line, base_line - ysize, 0);
+  float scaled_base_line = base_line * scale;
 
-  float pos_start = 0;
-  if (layout_direction_ == TextLayoutDirectionRTL) {
-    // In RTL layout, the glyph position start from right.
-    pos_start = static_cast<float>(size.x());
-  }
+  // In RTL layout, the glyph position start from right.
+  float pos_start = kRightToLeft ? static_cast<float>(size.x()) : 0.0f;
   mathfu::vec2 pos(pos_start, 0);
-  FT_GlyphSlot glyph = current_face_->face_->glyph;
+  const int32_t idx_advance = kRightToLeft ? -1 : 1;
+
+  // Faces of glyphs in the current run when fallback fonts are used.
+  auto primary_face = context->face_data;
+  const std::vector<const FaceData *> *run_faces = nullptr;
+  const FaceData *last_run_face = nullptr;
 
   uint32_t line_width = 0;
   uint32_t max_line_width = 0;
@@ -285,11 +736,14 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
 
   // Find words and layout them.
   while (word_enum.Advance()) {
-    if (!multi_line) {
+    const ShapedRun *run = nullptr;
+    if (!kMultiLine) {
       // Single line text.
       // In this mode, it layouts all string into single line.
-      max_line_width = static_cast<uint32_t>(LayoutText(text, length) * scale);
-      if (layout_direction_ == TextLayoutDirectionRTL && size.x() == 0) {
+      run = ShapeTextWithFallback(context, text, length, converted_ysize,
+                                  &run_faces);
+      max_line_width = static_cast<uint32_t>(run->width * scale);
+      if (kRightToLeft && size.x() == 0) {
         pos.x() = static_cast<float>(max_line_width / kFreeTypeUnit);
       }
     } else {
@@ -298,10 +752,9 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
       // performs a line break if either current word exceeds the max line
       // width or indicated a line break must happen due to a line break
       // character etc.
-      uint32_t word_width = static_cast<uint32_t>(
-          LayoutText(text + word_enum.GetCurrentWordIndex(),
-                     word_enum.GetCurrentWordLength()) *
-          scale);
+      run = ShapeWord(context, text, length, word_enum, converted_ysize,
+                      &run_faces);
+      uint32_t word_width = static_cast<uint32_t>(run->width * scale);
       if (lastline_must_break || (line_width + word_width) / kFreeTypeUnit >
                                      static_cast<uint32_t>(size.x())) {
         // Line break.
@@ -309,12 +762,9 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
         total_height += static_cast<int32_t>(line_height);
         first_character = lastline_must_break;
         if (size.y() && total_height > static_cast<uint32_t>(size.y()) &&
-            !caret_info) {
+            !kCaretInfo) {
           // The text size exceeds given size.
           // For now, we just don't render the rest of strings.
-
-          // Cleanup buffer contents.
-          hb_buffer_clear_contents(harfbuzz_buf_);
           break;
         }
 
@@ -334,35 +784,62 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
       lastline_must_break = word_enum.CurrentWordMustBreak();
     }
 
+    // A measurement only needs the size of the text.
+    if (measure) continue;
+
     // Update the first caret position.
-    if (caret_info && first_character) {
-      buffer->AddCaretPosition(pos + vec2(0, base_line * scale));
+    if (kCaretInfo && first_character) {
+      buffer->AddCaretPosition(pos + vec2(0, scaled_base_line));
       first_character = false;
     }
 
     // Retrieve layout info.
-    uint32_t glyph_count;
-    auto glyph_info = hb_buffer_get_glyph_infos(harfbuzz_buf_, &glyph_count);
-    auto glyph_pos = hb_buffer_get_glyph_positions(harfbuzz_buf_, &glyph_count);
+    auto glyph_count = static_cast<uint32_t>(run->glyph_info.size());
+    auto glyph_info = run->glyph_info.data();
+    auto glyph_pos = run->glyph_pos.data();
 
-    auto idx = 0;
-    auto idx_advance = 1;
-    if (layout_direction_ == TextLayoutDirectionRTL) {
-      idx = glyph_count - 1;
-      idx_advance = -1;
-    }
+    // Reserve the outputs of the run, which may have more glyphs than bytes
+    // when characters are decomposed.
+    buffer->Reserve(static_cast<size_t>(total_glyph_count + glyph_count));
 
+    int32_t idx = kRightToLeft ? static_cast<int32_t>(glyph_count) - 1 : 0;
     for (size_t i = 0; i < glyph_count; ++i, idx += idx_advance) {
       auto code_point = glyph_info[idx].codepoint;
       if (!code_point) {
         total_glyph_count--;
         continue;
       }
-      auto cache = GetCachedEntry(code_point, converted_ysize);
-      if (cache == nullptr) {
-        // Cleanup buffer contents.
-        hb_buffer_clear_contents(harfbuzz_buf_);
-        return nullptr;
+
+      // Switch to the face of a glyph shaped with a fallback font.
+      auto glyph_face = run_faces != nullptr ? (*run_faces)[idx] : primary_face;
+      if (glyph_face != context->face_data) {
+        SetContextFace(context, glyph_face, converted_ysize);
+      }
+
+      GlyphCacheEntry cache;
+      if (async) {
+        GlyphKey key(context->face_data->font_id_, code_point,
+                     converted_ysize);
+        auto entry = glyph_cache_->Find(key);
+        if (entry != nullptr) {
+          cache = *entry;
+        } else if (!key.is_valid() || failed_glyphs_.count(key)) {
+          // The glyph failed to rasterize or can't be cached. Lay it out
+          // without a quad.
+          cache = kPendingEntry;
+        } else {
+          // Request the glyph to worker threads and layout the glyph without
+          // a quad for now.
+          RequestGlyph(context->face_data, code_point, converted_ysize);
+          cache = kPendingEntry;
+          ready = false;
+        }
+      } else if (!GetCachedEntry(context, code_point, converted_ysize,
+                                 &cache)) {
+        if (context->face_data != primary_face) {
+          SetContextFace(context, primary_face, converted_ysize);
+        }
+        return false;
       }
 
       auto pos_advance =
@@ -370,64 +847,66 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
                        static_cast<float>(-glyph_pos[idx].y_advance)) *
           scale / static_cast<float>(kFreeTypeUnit);
       // Advance positions before rendering in RTL.
-      if (layout_direction_ == TextLayoutDirectionRTL) {
+      if (kRightToLeft) {
         pos -= pos_advance;
       }
 
       // Register vertices only when the glyph has a size.
-      if (cache->get_size().x() && cache->get_size().y()) {
+      if (cache.get_size().x() && cache.get_size().y()) {
         // Add the code point to the buffer. This information is used when
         // re-fetching UV information when the texture atlas is updated.
         buffer->get_code_points()->push_back(code_point);
 
-        // Calculate internal/external leading value and expand a buffer if
-        // necessary.
+        // Record the face of the glyph if it's changed from the last glyph.
+        auto run_face = glyph_face != primary_face ? glyph_face : nullptr;
+        if (run_face != last_run_face) {
+          buffer->face_runs_.push_back(std::make_pair(
+              static_cast<int32_t>(total_glyph_count + i), run_face));
+          last_run_face = run_face;
+        }
+
+        // Calculate internal/external leading value from the cache entry,
+        // which is valid even if the glyph wasn't rasterized in this call.
         FontMetrics new_metrics;
-        if (UpdateMetrics(glyph, initial_metrics, &new_metrics)) {
+        if (UpdateMetrics(cache.get_offset().y() - padding,
+                          cache.get_size().y() - padding * 2,
+                          initial_metrics, &new_metrics)) {
           initial_metrics = new_metrics;
         }
 
-        // Construct indices array.
-        const uint16_t kIndices[] = {0, 1, 2, 1, 3, 2};
-        for (size_t j = 0; j < FPL_ARRAYSIZE(kIndices); ++j) {
-          auto index = kIndices[j];
-          buffer->get_indices()->push_back(
-              static_cast<unsigned short>(index + (total_glyph_count + i) * 4));
-        }
+        // Record the glyph's cache page.
+        buffer->AddPage(cache.get_page());
 
         // Construct intermediate vertices array.
         // The vertices array is update in the render pass with correct
         // glyph size & glyph cache entry information.
 
         // Update vertices.
-        buffer->AddVertices(pos, base_line, scale, *cache);
+        buffer->AddVertices(pos, base_line, scale, cache);
 
         // Update UV.
         buffer->UpdateUV(static_cast<int32_t>(total_glyph_count + i),
-                         cache->get_uv());
+                         cache.get_uv());
       } else {
         total_glyph_count--;
       }
 
       // Advance positions after rendering in LTR.
-      if (layout_direction_ == TextLayoutDirectionLTR) {
+      if (!kRightToLeft) {
         pos += pos_advance;
       }
 
       // Update caret information if it has been requested.
-      bool end_of_line = lastline_must_break == true && i == glyph_count - 1;
-      if (caret_info && end_of_line == false) {
+      if (kCaretInfo && !(lastline_must_break && i == glyph_count - 1)) {
         // Is the current glyph a ligature?
         // We are not using hb_ot_layout_get_ligature_carets() as the API barely
         // work with existing fonts.
         // https://bugs.freedesktop.org/show_bug.cgi?id=90962 tracks a request
         // for the issue.
         auto carets = GetCaretPosCount(word_enum, glyph_info,
-                                       static_cast<int32_t>(glyph_count),
-                                       static_cast<int32_t>(idx));
+                                       static_cast<int32_t>(glyph_count), idx);
 
-        auto scaled_offset = cache->get_offset().x() * scale;
-        float scaled_base_line = base_line * scale;
+        auto scaled_offset = cache.get_offset().x() * scale;
         // Add caret points
         for (auto caret = 1; caret <= carets; ++caret) {
           buffer->AddCaretPosition(
@@ -438,19 +917,25 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
       }
     }
 
+    if (context->face_data != primary_face) {
+      SetContextFace(context, primary_face, converted_ysize);
+    }
+
     // Set buffer revision using glyph cache revision.
+    auto lock = LockContext(*context);
     buffer->set_revision(glyph_cache_->get_revision());
+    buffer->set_move_revision(glyph_cache_->get_move_revision());
+    if (lock.owns_lock()) {
+      lock.unlock();
+    }
 
     // Update total number of glyphs.
     total_glyph_count += glyph_count;
-
-    // Cleanup buffer contents.
-    hb_buffer_clear_contents(harfbuzz_buf_);
   }
 
   // Add the last caret.
-  if (caret_info) {
-    buffer->AddCaretPosition(pos + vec2(0, base_line * scale));
+  if (kCaretInfo) {
+    buffer->AddCaretPosition(pos + vec2(0, scaled_base_line));
   }
 
   // Setup size.
@@ -458,20 +943,88 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
 
   // Setup font metrics.
   buffer->set_metrics(initial_metrics);
+  buffer->set_ready_state(ready && !measure);
+  return true;
+}
 
-  // Set current pass.
+FontBuffer *FontManager::CreateBufferByParagraphs(
+    LayoutContext *context, const char *text, const uint32_t length,
+    const FontBufferParameters &parameters, const bool async) {
+  auto ysize = static_cast<int32_t>(parameters.get_font_size());
+  auto line_height = ysize * line_height_;
+  auto line_step = std::max(static_cast<int32_t>(line_height), 1);
+  std::unique_ptr<FontBuffer> buffer(new FontBuffer(length, true));
+  vec2 offset = mathfu::kZeros2f;
+  int32_t width = 0;
+  int32_t num_lines = 0;
+  bool ready = true;
+
+  // A paragraph ends with a line feed, where the layout always breaks a line.
+  uint32_t start = 0;
+  while (start < length) {
+    auto end = length;
+    auto line_feed = static_cast<const char *>(
+        memchr(text + start, '\n', length - start));
+    if (line_feed != nullptr) {
+      end = static_cast<uint32_t>(line_feed - text) + 1;
+    }
+    FontBufferParameters paragraph_parameters(
+        parameters.get_font_id(), HashId(text + start, end - start),
+        parameters.get_font_size(), vec2i(parameters.get_size().x(), 0),
+        true);
+    auto paragraph = CreateBuffer(context, text + start, end - start,
+                                  paragraph_parameters, async, false);
+    if (paragraph == nullptr) {
+      return nullptr;
+    }
+
+    // The last caret of a paragraph is the first caret of the next one.
+    buffer->Append(*paragraph, offset, end == length);
+    if (start == 0) {
+      buffer->set_metrics(paragraph->metrics());
+    } else {
+      // Expand leadings to include glyphs of the paragraph.
+      auto metrics = buffer->metrics();
+      auto &paragraph_metrics = paragraph->metrics();
+      metrics.set_internal_leading(std::max(
+          metrics.internal_leading(), paragraph_metrics.internal_leading()));
+      metrics.set_external_leading(std::min(
+          metrics.external_leading(), paragraph_metrics.external_leading()));
+      metrics.set_base_line(metrics.internal_leading() + metrics.ascender());
+      buffer->set_metrics(metrics);
+    }
+    width = std::max(width, paragraph->get_size().x());
+    ready &= paragraph->get_ready_state();
+
+    auto paragraph_lines = (paragraph->get_size().y() - ysize) / line_step + 1;
+    num_lines += paragraph_lines;
+    offset.y() += paragraph_lines * line_height;
+    start = end;
+  }
+
+  buffer->set_size(vec2i(width, ysize + (num_lines - 1) * line_step));
+  buffer->set_ready_state(ready);
+  buffer->set_revision(glyph_cache_->get_revision());
+  buffer->set_move_revision(glyph_cache_->get_move_revision());
   if (current_pass_ != kRenderPass) {
     buffer->set_pass(current_pass_);
   }
-
-  // Verify the buffer.
   assert(buffer->Verify());
 
-  // Insert the created entry to the hash map.
-  auto insert = map_buffers_.insert(
-      std::pair<FontBufferParameters, std::unique_ptr<FontBuffer>>(
-          parameters, std::move(buffer)));
-  return insert.first->second.get();
+  auto buffer_size = GetBufferSize(*buffer);
+  return map_buffers_.Insert(parameters, std::move(buffer), buffer_size);
+}
+
+size_t FontManager::GetBufferSize(const FontBuffer &buffer) {
+  auto size = sizeof(FontBuffer) +
+              buffer.vertices_.capacity() * sizeof(FontVertex) +
+              buffer.code_points_.capacity() * sizeof(uint32_t) +
+              buffer.glyph_pages_.capacity() * sizeof(int32_t) +
+              buffer.caret_positions_.capacity() * sizeof(mathfu::vec2i) +
+              buffer.line_starts_.capacity() * sizeof(int32_t) +
+              buffer.face_runs_.capacity() *
+                  sizeof(std::pair<int32_t, const FaceData *>);
+  return size;
 }
 
 int32_t FontManager::GetCaretPosCount(const WordEnumerator &word_enum,
@@ -502,30 +1055,72 @@ int32_t FontManager::GetCaretPosCount(const WordEnumerator &word_enum,
   return num_characters;
 }
 
-FontBuffer *FontManager::UpdateUV(const int32_t ysize, FontBuffer *buffer) {
-  if (buffer->get_revision() != current_atlas_revision_) {
-    // Cache revision has been updated.
+bool FontManager::HasMovedGlyphs(const FontBuffer &buffer) const {
+  auto move_revision = buffer.get_move_revision();
+  if (move_revision == glyph_cache_->get_move_revision()) return false;
+  auto &pages = buffer.get_glyph_pages();
+  auto page = kGlyphCachePageInvalid;
+  for (auto it = pages.begin(); it != pages.end(); ++it) {
+    if (*it == page) continue;
+    page = *it;
+    if (glyph_cache_->IsPageMoved(page, move_revision)) return true;
+  }
+  return false;
+}
+
+FontBuffer *FontManager::UpdateUV(LayoutContext *context, const int32_t ysize,
+                                  FontBuffer *buffer) {
+  auto moved = HasMovedGlyphs(*buffer);
+  if (!moved) {
+    // The pages of the buffer have no moved glyphs up to now.
+    buffer->set_move_revision(glyph_cache_->get_move_revision());
+  }
+  if (buffer->get_revision() != current_atlas_revision_ || moved) {
+    // Cache revision has been updated, or glyphs of the buffer have been
+    // moved by a compaction.
     // Some referencing glyph cache entries might have been evicted.
     // So we need to check glyph cache entries again while we can still use
     // layout information.
 
     // Set freetype settings.
-    FT_Set_Pixel_Sizes(current_face_->face_, 0, ysize);
+    FT_Set_Pixel_Sizes(context->face, 0, ysize);
 
     auto code_points = buffer->get_code_points();
+    auto primary_face = context->face_data;
+    auto face_run = buffer->face_runs_.begin();
     for (size_t i = 0; i < code_points->size(); ++i) {
+      // Look up glyphs laid out with fallback fonts in their faces.
+      while (face_run != buffer->face_runs_.end() &&
+             face_run->first <= static_cast<int32_t>(i)) {
+        SetContextFace(context,
+                       face_run->second ? face_run->second : primary_face,
+                       ysize);
+        ++face_run;
+      }
+
       auto code_point = code_points->at(i);
-      auto cache = GetCachedEntry(code_point, ysize);
-      if (cache == nullptr) {
+      GlyphCacheEntry cache;
+      if (!GetCachedEntry(context, code_point, ysize, &cache)) {
+        if (context->face_data != primary_face) {
+          SetContextFace(context, primary_face, ysize);
+        }
         return nullptr;
       }
 
       // Update UV.
-      buffer->UpdateUV(static_cast<int32_t>(i), cache->get_uv());
+      buffer->UpdateUV(static_cast<int32_t>(i), cache.get_uv());
+
+      // Update the page since the glyph may have been moved to other page.
+      buffer->UpdatePage(static_cast<int32_t>(i), cache.get_page());
 
       // Update revision.
       buffer->set_revision(glyph_cache_->get_revision());
     }
+    buffer->set_move_revision(glyph_cache_->get_move_revision());
+
+    if (context->face_data != primary_face) {
+      SetContextFace(context, primary_face, ysize);
+    }
   }
   return buffer;
 }
@@ -540,30 +1135,113 @@ FontTexture *FontManager::GetTexture(const char *text, const uint32_t length,
                            static_cast<float>(ysize), mathfu::kZeros2i, false);
 
   // Check cache if we already have a texture.
-  auto it = map_textures_.find(parameter);
-  if (it != map_textures_.end()) {
-    return it->second.get();
+  auto cached_texture = map_textures_.Find(parameter);
+  if (cached_texture != nullptr) {
+    return cached_texture;
   }
 
   // Otherwise, create new texture.
+  std::vector<uint8_t> image;
+  vec2i size;
+  FontMetrics metrics;
+  if (!ComposeTextImage(text, length, ysize, true, &image, &size, &metrics)) {
+    return nullptr;
+  }
+  std::unique_ptr<FontTexture> tex(new FontTexture());
+  tex->LoadFromMemory(image.data(), size, false);
 
+  // Setup font metrics.
+  tex->set_metrics(metrics);
+
+  // Put to the cache. The texture size is the size of the luminance image.
+  return map_textures_.Insert(parameter, std::move(tex), size.x() * size.y());
+}
+
+const FontImage *FontManager::GetImage(const char *text, const uint32_t length,
+                                       const float original_ysize) {
+  // Round up y size if the size selector is set.
+  int32_t ysize = ConvertSize(static_cast<int32_t>(original_ysize));
+
+  auto font_id = GetCurrentFace()->font_id_;
+  auto text_id = HashId(text, length);
+  auto parameter = FontBufferParameters(
+      font_id, text_id, static_cast<float>(ysize), mathfu::kZeros2i, false);
+  auto key = GetTextImageKey(font_id, text_id, ysize);
+
+  if (!image_cache_) {
+    image_cache_.reset(new GlyphCache<uint8_t>(
+        mathfu::vec2i(kGlyphCacheWidth, kGlyphCacheHeight),
+        kGlyphCacheMaxPages));
+  }
+
+  // Check cache if we already have the image. The location of the image may
+  // have changed since the last lookup.
+  auto cached_image = map_images_.Find(parameter);
+  if (cached_image != nullptr) {
+    auto entry = image_cache_->Find(key);
+    if (entry != nullptr && entry->get_code_point() == text_id) {
+      cached_image->texture_ = image_textures_[entry->get_page()].get();
+      cached_image->uv_ = entry->get_uv();
+      return cached_image;
+    }
+    // The image has been evicted from the shared textures. Compose it again.
+  }
+
+  std::vector<uint8_t> pixels;
+  vec2i size;
+  FontMetrics metrics;
+  if (!ComposeTextImage(text, length, ysize, false, &pixels, &size,
+                        &metrics)) {
+    return nullptr;
+  }
+
+  // Store the image to the shared textures. GlyphCache rounds up the height of
+  // the image and adds paddings.
+  auto cache_size = image_cache_->get_size();
+  if (size.x() + kGlyphCachePaddingX > cache_size.x() ||
+      size.y() + kGlyphCachePaddingY + kGlyphCacheHeightRound >
+          cache_size.y()) {
+    LogInfo("The text image is too large for a shared texture: %dx%d\n",
+            size.x(), size.y());
+    return nullptr;
+  }
+  // The text hash is kept in the entry to detect a key shared with another
+  // text.
+  auto entry = image_cache_->Find(key);
+  if (entry != nullptr && entry->get_code_point() != text_id) {
+    LogInfo("The text image key collides with another text.\n");
+    return nullptr;
+  }
+  GlyphCacheEntry new_entry;
+  new_entry.set_code_point(text_id);
+  new_entry.set_size(size);
+  entry = image_cache_->Set(pixels.data(), key, new_entry);
+  if (entry == nullptr) {
+    LogInfo("Text image textures are full. Need to increase the size.\n");
+    return nullptr;
+  }
+  UploadPages(image_cache_.get(), &image_textures_);
+
+  std::unique_ptr<FontImage> image(new FontImage());
+  image->texture_ = image_textures_[entry->get_page()].get();
+  image->uv_ = entry->get_uv();
+  image->size_ = size;
+  image->metrics_ = metrics;
+  return map_images_.Insert(parameter, std::move(image), sizeof(FontImage));
+}
+
+bool FontManager::ComposeTextImage(const char *text, const uint32_t length,
+                                   const int32_t ysize,
+                                   const bool power_of_two,
+                                   std::vector<uint8_t> *image, vec2i *size,
+                                   FontMetrics *metrics) {
   // Set freetype settings.
   FT_Set_Pixel_Sizes(current_face_->face_, 0, ysize);
 
   // Layout text.
-  auto string_width = LayoutText(text, length) / kFreeTypeUnit;
-
-  // Retrieve layout info.
-  uint32_t glyph_count;
-  hb_glyph_info_t *glyph_info =
-      hb_buffer_get_glyph_infos(harfbuzz_buf_, &glyph_count);
-  hb_glyph_position_t *glyph_pos =
-      hb_buffer_get_glyph_positions(harfbuzz_buf_, &glyph_count);
-
-  // Calculate texture size. The texture may be expanded later depending on
-  // glyph sizes.
-  int32_t width = RoundUpToPowerOf2(string_width);
-  int32_t height = RoundUpToPowerOf2(ysize);
+  LayoutContext context;
+  GetMainContext(&context);
+  auto run = ShapeText(&context, text, length, ysize);
 
   // Initialize font metrics parameters.
   int32_t base_line = ysize * current_face_->face_->ascender /
@@ -571,128 +1249,117 @@ FontTexture *FontManager::GetTexture(const char *text, const uint32_t length,
   if (base_line > ysize) {
     base_line = ysize;
   }
-  FontMetrics initial_metrics(base_line, 0, base_line, base_line - ysize, 0);
-
-  // rasterized image format in FreeType is 8 bit gray scale format.
-  std::unique_ptr<uint8_t[]> image(new uint8_t[width * height]);
-  memset(image.get(), 0, width * height);
-
+  *metrics = FontMetrics(base_line, 0, base_line, base_line - ysize, 0);
+
+  // A glyph placed in the image. The bitmap is either in a glyph cache page,
+  // or in a temporary buffer when rasterized on its own.
+  struct PlacedGlyph {
+    int32_t x;
+    int32_t top;
+    vec2i size;
+    int32_t page;
+    vec2i pos;
+    size_t bitmap;
+  };
+  std::vector<PlacedGlyph> glyphs;
+  std::vector<uint8_t> bitmaps;
+  glyphs.reserve(run->glyph_info.size());
+
+  // Place glyphs and calculate the image size.
   // TODO: make padding values configurable.
-  float kGlyphPadding = 0.0f;
-  mathfu::vec2 pos(kGlyphPadding, kGlyphPadding);
-  FT_GlyphSlot glyph = current_face_->face_->glyph;
-
-  for (size_t i = 0; i < glyph_count; ++i) {
-    auto code_point = glyph_info[i].codepoint;
+  float pos = 0.0f;
+  int32_t width = 0;
+  auto cache_size = vec2(glyph_cache_->get_size());
+  for (size_t i = 0; i < run->glyph_info.size(); ++i) {
+    auto code_point = run->glyph_info[i].codepoint;
     if (!code_point) continue;
-    FT_Error err =
-        FT_Load_Glyph(current_face_->face_, code_point, FT_LOAD_RENDER);
 
-    // Load glyph using harfbuzz layout information.
-    // Note that harfbuzz takes care of ligatures.
-    if (err) {
-      // Error. This could happen typically the loaded font does not support
-      // particular glyph.
-      LogInfo("Can't load glyph %c FT_Error:%d\n", text[i], err);
-      return nullptr;
+    // SDF glyphs in the glyph cache can't be used as is.
+    PlacedGlyph glyph;
+    vec2i offset;
+    GlyphCacheEntry entry;
+    if (!sdf_ && GetCachedEntry(&context, code_point, ysize, &entry)) {
+      offset = entry.get_offset();
+      glyph.size = entry.get_size();
+      glyph.page = entry.get_page();
+      glyph.pos = vec2i(entry.get_uv().xy() * cache_size + 0.5f);
+      glyph.bitmap = 0;
+    } else {
+      FT_Error err = FT_Load_Glyph(context.face, code_point, FT_LOAD_RENDER);
+      stats_.num_glyph_rasterizations++;
+      if (err) {
+        // Error. This could happen typically the loaded font does not support
+        // particular glyph.
+        LogInfo("Can't load glyph %c FT_Error:%d\n", code_point, err);
+        return false;
+      }
+      FT_GlyphSlot g = context.face->glyph;
+      offset = vec2i(g->bitmap_left, g->bitmap_top);
+      glyph.size = vec2i(g->bitmap.width, g->bitmap.rows);
+      glyph.page = kGlyphCachePageInvalid;
+      glyph.bitmap = bitmaps.size();
+      for (int32_t y = 0; y < glyph.size.y(); ++y) {
+        auto row = g->bitmap.buffer + y * g->bitmap.pitch;
+        bitmaps.insert(bitmaps.end(), row, row + glyph.size.x());
+      }
     }
 
-    // Calculate internal/external leading value and expand a buffer if
-    // necessary.
+    // Calculate internal/external leading value.
     FontMetrics new_metrics;
-    if (UpdateMetrics(glyph, initial_metrics, &new_metrics)) {
-      if (new_metrics.total() != initial_metrics.total()) {
-        // Expand buffer and update height if necessary.
-        if (ExpandBuffer(width, height, initial_metrics, new_metrics, &image)) {
-          height = RoundUpToPowerOf2(new_metrics.total());
-        }
-      }
-      initial_metrics = new_metrics;
+    if (UpdateMetrics(offset.y(), glyph.size.y(), *metrics, &new_metrics)) {
+      *metrics = new_metrics;
     }
 
-    if (i == 0 && glyph->bitmap_left < 0) {
+    if (glyphs.empty() && offset.x() < 0) {
       // Slightly shift all text to right.
-      pos.x() = static_cast<float>(-glyph->bitmap_left);
-    }
-
-    // Copy the texture
-    uint32_t y_offset = initial_metrics.base_line() - glyph->bitmap_top;
-    for (uint32_t y = 0; y < glyph->bitmap.rows; ++y) {
-      memcpy(&image[(static_cast<size_t>(pos.y()) + y + y_offset) * width +
-                    static_cast<size_t>(pos.x()) + glyph->bitmap_left],
-             &glyph->bitmap.buffer[y * glyph->bitmap.pitch],
-             glyph->bitmap.width);
+      pos = static_cast<float>(-offset.x());
     }
+    glyph.x = static_cast<int32_t>(pos) + offset.x();
+    glyph.top = offset.y();
+    width = std::max(width, glyph.x + glyph.size.x());
+    glyphs.push_back(glyph);
 
     // Advance positions.
-    pos += mathfu::vec2(static_cast<float>(glyph_pos[i].x_advance),
-                        static_cast<float>(-glyph_pos[i].y_advance)) /
+    pos += static_cast<float>(run->glyph_pos[i].x_advance) /
            static_cast<float>(kFreeTypeUnit);
   }
-
-  // Create new texture.
-  FontTexture *tex = new FontTexture();
-  tex->LoadFromMemory(image.get(), vec2i(width, height), false);
-
-  // Setup font metrics.
-  tex->set_metrics(initial_metrics);
-
-  // Cleanup buffer contents.
-  hb_buffer_clear_contents(harfbuzz_buf_);
-
-  // Put to the dic.
-  map_textures_[parameter].reset(tex);
-
-  return tex;
-}
-
-bool FontManager::ExpandBuffer(const int32_t width, const int32_t height,
-                               const FontMetrics &original_metrics,
-                               const FontMetrics &new_metrics,
-                               std::unique_ptr<uint8_t[]> *image) {
-  // Returns immediately if the size has not been changed.
-  if (original_metrics.total() == new_metrics.total()) {
-    return false;
+  width = std::max(std::max(width, static_cast<int32_t>(pos)), 1);
+  int32_t height = std::max(metrics->total(), 1);
+  if (power_of_two) {
+    width = RoundUpToPowerOf2(width);
+    height = RoundUpToPowerOf2(height);
   }
 
-  int32_t new_height = RoundUpToPowerOf2(new_metrics.total());
-  int32_t internal_leading_change =
-      new_metrics.internal_leading() - original_metrics.internal_leading();
-  // Internal leading tracks max value of it in rendering glyphs, so we can
-  // assume internal_leading_change >= 0.
-  assert(internal_leading_change >= 0);
-
-  if (height != new_height) {
-    // Reallocate buffer.
-    std::unique_ptr<uint8_t[]> old_image = std::move(*image);
-    image->reset(new uint8_t[width * new_height]);
-
-    // Copy existing contents.
-    memcpy(&(*image)[width * internal_leading_change], old_image.get(),
-           width * original_metrics.total());
-
-    // Clear top.
-    memset(image->get(), 0, width * internal_leading_change);
-
-    // Clear bottom.
-    int32_t clear_offset = original_metrics.total() + internal_leading_change;
-    memset(&(*image)[width * clear_offset], 0,
-           width * (new_height - clear_offset));
-    return true;
-  } else {
-    if (internal_leading_change > 0) {
-      // Move existing contents down and make a space for additional internal
-      // leading.
-      memcpy(&(*image)[width * internal_leading_change], image->get(),
-             width * original_metrics.total());
-
-      // Clear the top
-      memset(image->get(), 0, width * internal_leading_change);
+  // Blend glyph bitmaps into the image, so that overlapping glyphs such as
+  // kerned pairs don't clip each other.
+  // rasterized image format in FreeType is 8 bit gray scale format.
+  image->assign(static_cast<size_t>(width) * height, 0);
+  for (auto it = glyphs.begin(); it != glyphs.end(); ++it) {
+    const uint8_t *src;
+    int32_t pitch;
+    if (it->page != kGlyphCachePageInvalid) {
+      pitch = glyph_cache_->get_size().x();
+      src = glyph_cache_->get_buffer(it->page) + it->pos.y() * pitch +
+            it->pos.x();
+    } else {
+      pitch = it->size.x();
+      src = bitmaps.data() + it->bitmap;
+    }
+    auto y0 = metrics->base_line() - it->top;
+    auto x_begin = std::max(it->x, 0);
+    auto x_end = std::min(it->x + it->size.x(), width);
+    auto y_begin = std::max(y0, 0);
+    auto y_end = std::min(y0 + it->size.y(), height);
+    for (int32_t y = y_begin; y < y_end; ++y) {
+      auto d = image->data() + static_cast<size_t>(y) * width;
+      auto s = src + (y - y0) * pitch - it->x;
+      for (int32_t x = x_begin; x < x_end; ++x) {
+        d[x] = std::max(d[x], s[x]);
+      }
     }
-    // Bottom doesn't have to be cleared since the part is already clean.
   }
-
-  return false;
+  *size = vec2i(width, height);
+  return true;
 }
 
 bool FontManager::Open(const char *font_name) {
@@ -708,16 +1375,18 @@ bool FontManager::Open(const char *font_name) {
           font_name, std::unique_ptr<FaceData>(new FaceData)));
   auto face = insert.first->second.get();
 
-  // Load the font file of assets.
-  if (!fplbase::LoadFile(font_name, &face->font_data_)) {
+  // Map the font file of assets, or share the file opened by other
+  // FontManagers.
+  face->font_data_ = FontData::Open(font_name);
+  if (face->font_data_ == nullptr) {
     LogInfo("Can't load font reource: %s\n", font_name);
     return false;
   }
 
   // Open the font.
   FT_Error err = FT_New_Memory_Face(
-      *ft_, reinterpret_cast<const unsigned char *>(&face->font_data_[0]),
-      static_cast<FT_Long>(face->font_data_.size()), 0, &face->face_);
+      *ft_, face->font_data_->data(),
+      static_cast<FT_Long>(face->font_data_->size()), 0, &face->face_);
   if (err) {
     // Failed to open font.
     LogInfo("Failed to initialize font:%s FT_Error:%d\n", font_name, err);
@@ -729,16 +1398,26 @@ bool FontManager::Open(const char *font_name) {
   if (!face->harfbuzz_font_) {
     // Failed to open font.
     LogInfo("Failed to initialize harfbuzz layout information:%s\n", font_name);
-    face->font_data_.clear();
+    face->font_data_.reset();
     FT_Done_Face(face->face_);
     return false;
   }
 
   face->font_id_ = HashId(font_name);
+  face->font_hash_ = HashFontData(face->face_, *face->font_data_);
+
+  // Build the coverage of the font from the cmap.
+  FT_UInt glyph_index;
+  for (auto code_point = FT_Get_First_Char(face->face_, &glyph_index);
+       glyph_index != 0;
+       code_point = FT_Get_Next_Char(face->face_, code_point, &glyph_index)) {
+    face->coverage_.Add(static_cast<uint32_t>(code_point));
+  }
 
   // Set first opened font as a default font.
   if (!face_initialized_) {
     current_face_ = face;
+    UpdateCurrentFontId();
   }
 
   face_initialized_ = true;
@@ -751,11 +1430,40 @@ bool FontManager::Close(const char *font_name) {
     return false;
   }
 
+  // Release faces in worker threads before closing the font data.
+  if (rasterizer_ != nullptr) {
+    rasterizer_->ReleaseFace(it->second->font_id_);
+  }
+  for (auto worker = layout_workers_.begin(); worker != layout_workers_.end();
+       ++worker) {
+    (*worker)->ReleaseFace(it->second->font_id_);
+  }
+
+  // Forget glyphs of the font failed to rasterize.
+  for (auto key = failed_glyphs_.begin(); key != failed_glyphs_.end();) {
+    if (key->get_font_id() == it->second->font_id_) {
+      key = failed_glyphs_.erase(key);
+    } else {
+      ++key;
+    }
+  }
+
+  // Remove the face from the current fallback chain.
+  auto face = it->second.get();
+  fallback_faces_.erase(
+      std::remove(fallback_faces_.begin(), fallback_faces_.end(), face),
+      fallback_faces_.end());
+  if (current_face_ == face) {
+    current_face_ = nullptr;
+  }
+  UpdateCurrentFontId();
+
   // Clean up face instance data.
   it->second->Close();
 
-  map_textures_.clear();
-  map_buffers_.clear();
+  map_textures_.Clear();
+  map_buffers_.Clear();
+  map_images_.Clear();
 
   map_faces_.erase(it);
 
@@ -772,28 +1480,328 @@ bool FontManager::SelectFont(const char *font_name) {
     return false;
   }
   current_face_ = it->second.get();
+  fallback_faces_.clear();
+  UpdateCurrentFontId();
+  return true;
+}
+
+bool FontManager::SelectFont(const char *font_names[], int32_t count) {
+  std::vector<FaceData *> faces;
+  for (int32_t i = 0; i < count; ++i) {
+    auto it = map_faces_.find(font_names[i]);
+    if (it == map_faces_.end()) {
+      LogError("The font %s is not opened.\n", font_names[i]);
+      return false;
+    }
+    faces.push_back(it->second.get());
+  }
+  if (faces.empty()) {
+    return false;
+  }
+  current_face_ = faces[0];
+  fallback_faces_.assign(faces.begin() + 1, faces.end());
+  UpdateCurrentFontId();
+  return true;
+}
+
+void FontManager::UpdateCurrentFontId() {
+  if (current_face_ == nullptr) {
+    current_font_id_ = kNullHash;
+    return;
+  }
+  if (fallback_faces_.empty()) {
+    current_font_id_ = current_face_->font_id_;
+    return;
+  }
+  std::vector<HashedId> ids(1, current_face_->font_id_);
+  for (auto it = fallback_faces_.begin(); it != fallback_faces_.end(); ++it) {
+    ids.push_back((*it)->font_id_);
+  }
+  current_font_id_ = HashId(reinterpret_cast<const char *>(ids.data()),
+                            ids.size() * sizeof(HashedId));
+}
+
+bool FontManager::SaveCache(const char *file_name) {
+  std::vector<uint8_t> data;
+
+  CacheFileHeader header;
+  memcpy(header.identifier, kCacheFileIdentifier, sizeof(header.identifier));
+  header.version = kCacheFileVersion;
+  header.num_fonts = static_cast<uint32_t>(map_faces_.size());
+  header.num_buffers = 0;
+  header.glyph_cache_size = 0;
+  header.script = script_;
+  header.language = HashId(language_);
+  header.layout_direction = layout_direction_;
+  header.line_height = line_height_;
+  header.sdf = sdf_;
+  header.layout_strategy = layout_strategy_;
+  AppendData(&header, sizeof(header), &data);
+
+  for (auto it = map_faces_.begin(); it != map_faces_.end(); ++it) {
+    CacheFileFont font;
+    font.font_id = it->second->font_id_;
+    font.font_hash = it->second->font_hash_;
+    AppendData(&font, sizeof(font), &data);
+  }
+
+  auto glyph_cache_offset = data.size();
+  glyph_cache_->Serialize(&data);
+  header.glyph_cache_size =
+      static_cast<uint32_t>(data.size() - glyph_cache_offset);
+
+  for (auto it = map_buffers_.begin(); it != map_buffers_.end(); ++it) {
+    auto &buffer = *it->second.value;
+    // Buffers referencing evicted glyphs can not be restored as is.
+    // Buffers with fallback fonts are not saved since records don't keep
+    // faces of glyphs.
+    if (!buffer.get_ready_state() ||
+        buffer.get_revision() != glyph_cache_->get_revision() ||
+        HasMovedGlyphs(buffer) || !buffer.face_runs_.empty()) {
+      continue;
+    }
+    auto &parameters = it->first;
+    CacheFileBuffer record;
+    record.font_id = parameters.get_font_id();
+    record.text_id = parameters.get_text_id();
+    record.font_size = parameters.get_font_size();
+    record.size[0] = parameters.get_size().x();
+    record.size[1] = parameters.get_size().y();
+    record.caret_info = parameters.get_caret_info_flag();
+    record.string_size[0] = buffer.size_.x();
+    record.string_size[1] = buffer.size_.y();
+    record.metrics[0] = buffer.metrics_.base_line();
+    record.metrics[1] = buffer.metrics_.internal_leading();
+    record.metrics[2] = buffer.metrics_.ascender();
+    record.metrics[3] = buffer.metrics_.descender();
+    record.metrics[4] = buffer.metrics_.external_leading();
+    record.num_glyphs = static_cast<uint32_t>(buffer.code_points_.size());
+    record.num_carets = static_cast<uint32_t>(buffer.caret_positions_.size());
+    AppendData(&record, sizeof(record), &data);
+    AppendData(buffer.vertices_.data(),
+               buffer.vertices_.size() * sizeof(FontVertex), &data);
+    AppendData(buffer.code_points_.data(),
+               buffer.code_points_.size() * sizeof(uint32_t), &data);
+    AppendData(buffer.glyph_pages_.data(),
+               buffer.glyph_pages_.size() * sizeof(int32_t), &data);
+    for (auto caret = buffer.caret_positions_.begin();
+         caret != buffer.caret_positions_.end(); ++caret) {
+      int32_t pos[] = {caret->x(), caret->y()};
+      AppendData(pos, sizeof(pos), &data);
+    }
+    header.num_buffers++;
+  }
+
+  // Update the header with counts.
+  memcpy(&data[0], &header, sizeof(header));
+
+  FILE *fp = fopen(file_name, "wb");
+  if (fp == nullptr) {
+    LogError("Can't open a cache file: %s\n", file_name);
+    return false;
+  }
+  auto written = fwrite(data.data(), 1, data.size(), fp);
+  fclose(fp);
+  if (written != data.size()) {
+    LogError("Failed to write a cache file: %s\n", file_name);
+    return false;
+  }
+  return true;
+}
+
+bool FontManager::LoadCache(const char *file_name) {
+  std::string data;
+  if (!fplbase::LoadFile(file_name, &data)) {
+    LogInfo("Can't load a cache file: %s\n", file_name);
+    return false;
+  }
+  return LoadCache(data.data(), data.size());
+}
+
+bool FontManager::LoadCache(const void *data, const size_t size) {
+  auto p = static_cast<const uint8_t *>(data);
+  auto end = p + size;
+
+  CacheFileHeader header;
+  if (!ReadData(&p, end, sizeof(header), &header) ||
+      memcmp(header.identifier, kCacheFileIdentifier,
+             sizeof(header.identifier)) ||
+      header.version != kCacheFileVersion) {
+    LogInfo("Invalid cache file format.\n");
+    return false;
+  }
+
+  // Verify fonts used in the cache.
+  for (uint32_t i = 0; i < header.num_fonts; ++i) {
+    CacheFileFont font;
+    if (!ReadData(&p, end, sizeof(font), &font)) {
+      return false;
+    }
+    bool found = false;
+    for (auto it = map_faces_.begin(); it != map_faces_.end(); ++it) {
+      if (it->second->font_id_ == font.font_id) {
+        found = it->second->font_hash_ == font.font_hash;
+        break;
+      }
+    }
+    if (!found) {
+      LogInfo("A font in the cache file is not opened or has been changed.\n");
+      return false;
+    }
+  }
+
+  // Glyph images are not compatible between the bitmap and SDF modes.
+  if (header.sdf != static_cast<uint32_t>(sdf_)) {
+    LogInfo("The glyph mode of the cache file doesn't match.\n");
+    return false;
+  }
+
+  // Restore the glyph cache.
+  if (static_cast<size_t>(end - p) < header.glyph_cache_size ||
+      glyph_cache_->Deserialize(p, header.glyph_cache_size) !=
+          header.glyph_cache_size) {
+    LogInfo("The glyph cache in the cache file doesn't match.\n");
+    return false;
+  }
+  p += header.glyph_cache_size;
+  current_atlas_revision_ = glyph_cache_->get_revision();
+  map_buffers_.Clear();
+
+  // FontBuffers are valid only with the same layout settings.
+  if (header.script != script_ ||
+      header.language != HashId(language_) ||
+      header.layout_direction != layout_direction_ ||
+      header.line_height != line_height_ ||
+      header.layout_strategy != static_cast<uint32_t>(layout_strategy_)) {
+    return true;
+  }
+
+  // Restore FontBuffers.
+  for (uint32_t i = 0; i < header.num_buffers; ++i) {
+    CacheFileBuffer record;
+    if (!ReadData(&p, end, sizeof(record), &record)) {
+      break;
+    }
+    // Check the record against the rest of the file before allocating, so
+    // that a broken file can't request huge buffers.
+    const size_t kGlyphRecordSize =
+        FontBuffer::kVerticesPerCodePoint * sizeof(FontVertex) +
+        sizeof(uint32_t) + sizeof(int32_t);
+    const size_t kCaretRecordSize = sizeof(int32_t) * 2;
+    const size_t num_glyphs = record.num_glyphs;
+    const size_t num_carets = record.num_carets;
+    const size_t remaining = static_cast<size_t>(end - p);
+    if (num_glyphs > remaining / kGlyphRecordSize ||
+        num_carets > (remaining - num_glyphs * kGlyphRecordSize) /
+                         kCaretRecordSize) {
+      LogInfo("A buffer in the cache file is truncated.\n");
+      break;
+    }
+    std::unique_ptr<FontBuffer> buffer(
+        new FontBuffer(record.num_glyphs, record.caret_info != 0));
+    buffer->vertices_.resize(num_glyphs * FontBuffer::kVerticesPerCodePoint,
+                             FontVertex(0.0f, 0.0f, 0.0f, 0.0f));
+    buffer->code_points_.resize(record.num_glyphs);
+    buffer->glyph_pages_.resize(record.num_glyphs);
+    if (!ReadData(&p, end, buffer->vertices_.size() * sizeof(FontVertex),
+                  buffer->vertices_.data()) ||
+        !ReadData(&p, end, num_glyphs * sizeof(uint32_t),
+                  buffer->code_points_.data()) ||
+        !ReadData(&p, end, num_glyphs * sizeof(int32_t),
+                  buffer->glyph_pages_.data())) {
+      break;
+    }
+    bool valid = true;
+    for (uint32_t j = 0; j < record.num_carets && valid; ++j) {
+      int32_t pos[2];
+      if (!(valid = ReadData(&p, end, sizeof(pos), pos))) {
+        break;
+      }
+      buffer->AddCaretPosition(pos[0], pos[1]);
+    }
+    for (uint32_t j = 0; j < record.num_glyphs && valid; ++j) {
+      valid = buffer->glyph_pages_[j] >= 0 &&
+              buffer->glyph_pages_[j] < glyph_cache_->get_num_pages();
+    }
+    valid = valid && record.metrics[1] >= 0 && record.metrics[2] >= 0 &&
+            record.metrics[3] <= 0 && record.metrics[4] <= 0;
+    if (!valid) {
+      break;
+    }
+
+    buffer->set_size(vec2i(record.string_size[0], record.string_size[1]));
+    buffer->set_metrics(FontMetrics(record.metrics[0], record.metrics[1],
+                                    record.metrics[2], record.metrics[3],
+                                    record.metrics[4]));
+    buffer->set_revision(glyph_cache_->get_revision());
+    buffer->set_move_revision(glyph_cache_->get_move_revision());
+    buffer->set_pass(0);
+    assert(buffer->Verify());
+
+    FontBufferParameters parameters(
+        record.font_id, record.text_id, record.font_size,
+        vec2i(record.size[0], record.size[1]), record.caret_info != 0);
+    auto buffer_size = GetBufferSize(*buffer);
+    map_buffers_.Insert(parameters, std::move(buffer), buffer_size);
+  }
   return true;
 }
 
+void FontManager::SetSDFMode(const bool sdf) {
+  if (sdf == sdf_) {
+    return;
+  }
+  sdf_ = sdf;
+
+  // Glyph images and layouts in the caches are not usable in the new mode.
+  if (rasterizer_ != nullptr) {
+    rasterizer_->Wait();
+    std::vector<GlyphRasterizeResult> results;
+    rasterizer_->Retrieve(&results);
+  }
+  glyph_cache_->Flush();
+  current_atlas_revision_ = glyph_cache_->get_revision();
+  FlushLayout();
+}
+
+void FontManager::SetShapingCacheSize(const size_t size) {
+  shaping_cache_->set_max_size(size);
+}
+
 void FontManager::StartLayoutPass() {
   // Reset pass.
   current_pass_ = 0;
+
+  // Start a new cycle of the FontBuffer, FontTexture and FontImage caches.
+  // Entries not used since then can be evicted.
+  map_buffers_.Update();
+  map_buffers_.ReleasePending();
+  map_textures_.Update();
+  map_images_.Update();
+  if (image_cache_) {
+    image_cache_->Update();
+  }
+
+  // Store glyphs rasterized in worker threads since the last frame.
+  UpdateRasterizedGlyphs();
+}
+
+size_t FontManager::CompactGlyphCache(const size_t max_bytes) {
+  ScopedTrace trace("FontManager::CompactGlyphCache");
+  auto bytes = glyph_cache_->Compact(max_bytes);
+  stats_.compacted_atlas_bytes += bytes;
+  return bytes;
 }
 
 void FontManager::UpdatePass(const bool start_subpass) {
+  ScopedTrace trace("FontManager::UpdatePass");
+
   // Increment a cycle counter in glyph cache.
   glyph_cache_->Update();
 
   if (glyph_cache_->get_dirty_state() && current_pass_ <= 0) {
-    auto rect = glyph_cache_->get_dirty_rect();
-    atlas_texture_.get()->Set(0);
-    Texture::UpdateTexture(fplbase::kFormatLuminance, 0, rect.y(),
-                           glyph_cache_.get()->get_size().x(),
-                           rect.w() - rect.y(),
-                           glyph_cache_.get()->get_buffer() +
-                               glyph_cache_.get()->get_size().x() * rect.y());
+    UploadPages(glyph_cache_.get(), &atlas_textures_);
     current_atlas_revision_ = glyph_cache_->get_revision();
-    glyph_cache_->set_dirty_state(false);
   }
 
   if (start_subpass) {
@@ -807,26 +1815,29 @@ void FontManager::UpdatePass(const bool start_subpass) {
     glyph_cache_->Flush();
     current_atlas_revision_ = glyph_cache_->get_revision();
     current_pass_++;
+    stats_.num_flushes++;
   } else {
     // Reset pass.
     current_pass_ = kRenderPass;
   }
 }
 
-uint32_t FontManager::LayoutText(const char *text, const size_t length) {
-  SetLanguageSettings();
+uint32_t FontManager::LayoutText(LayoutContext *context, const char *text,
+                                 const size_t length) {
+  auto harfbuzz_buf = context->harfbuzz_buf;
+  SetLanguageSettings(context);
   hb_buffer_set_language(
-      harfbuzz_buf_, hb_language_from_string(text, static_cast<int>(length)));
+      harfbuzz_buf, hb_language_from_string(text, static_cast<int>(length)));
 
   // Layout the text.
-  hb_buffer_add_utf8(harfbuzz_buf_, text, static_cast<unsigned int>(length), 0,
+  hb_buffer_add_utf8(harfbuzz_buf, text, static_cast<unsigned int>(length), 0,
                      static_cast<int>(length));
-  hb_shape(current_face_->harfbuzz_font_, harfbuzz_buf_, nullptr, 0);
+  hb_shape(context->harfbuzz_font, harfbuzz_buf, nullptr, 0);
 
   // Retrieve layout info.
   uint32_t glyph_count;
   hb_glyph_position_t *glyph_pos =
-      hb_buffer_get_glyph_positions(harfbuzz_buf_, &glyph_count);
+      hb_buffer_get_glyph_positions(harfbuzz_buf, &glyph_count);
 
   // Retrieve a width of the string.
   uint32_t string_width = 0;
@@ -836,22 +1847,226 @@ uint32_t FontManager::LayoutText(const char *text, const size_t length) {
   return string_width;
 }
 
-bool FontManager::UpdateMetrics(const FT_GlyphSlot g,
+const ShapedRun *FontManager::ShapeText(LayoutContext *context,
+                                        const char *text, const size_t length,
+                                        const int32_t ysize) {
+  ShapedRunKey key(context->face_data->font_id_, ysize, script_,
+                   layout_direction_ == TextLayoutDirectionRTL);
+  auto run = context->shaping_cache->Find(key, text, length);
+  if (run == nullptr) {
+    {
+      auto lock = LockContext(*context);
+      stats_.num_shaping_calls++;
+    }
+    LayoutText(context, text, length);
+    run = context->shaping_cache->Set(key, text, length,
+                                      context->harfbuzz_buf);
+    hb_buffer_clear_contents(context->harfbuzz_buf);
+  }
+  return run;
+}
+
+const ShapedRun *FontManager::ShapeWord(
+    LayoutContext *context, const char *text, const size_t length,
+    const WordEnumerator &word_enum, const int32_t ysize,
+    const std::vector<const FaceData *> **faces) {
+  auto word_start = word_enum.GetCurrentWordIndex();
+  auto word_length = word_enum.GetCurrentWordLength();
+  if (layout_strategy_ != TextLayoutStrategyParagraph) {
+    return ShapeTextWithFallback(context, text + word_start, word_length,
+                                 ysize, faces);
+  }
+
+  // Shape the paragraph up to the next mandatory break on its first word.
+  auto &paragraph = *context->paragraph_run;
+  if (word_start == 0 || word_start >= paragraph.end) {
+    auto &wordbreak_info = *word_enum.GetBuffer();
+    auto end = word_start;
+    while (end < length && wordbreak_info[end] != LINEBREAK_MUSTBREAK) {
+      end++;
+    }
+    ShapeParagraph(context, text, word_start, std::min(end + 1, length),
+                   ysize);
+  }
+
+  // Find glyphs of the word. Clusters increase in the logical order, which
+  // is the reverse of the glyph order in RTL.
+  auto &info = paragraph.run.glyph_info;
+  auto glyph_count = info.size();
+  auto rtl = layout_direction_ == TextLayoutDirectionRTL;
+  auto cluster = [&info, glyph_count, rtl](size_t i) {
+    return info[rtl ? glyph_count - 1 - i : i].cluster;
+  };
+  auto start = static_cast<uint32_t>(word_start - paragraph.start);
+  auto end = static_cast<uint32_t>(start + word_length);
+  auto &cursor = paragraph.cursor;
+  while (cursor < glyph_count && cluster(cursor) < start) cursor++;
+  auto first = cursor;
+  while (cursor < glyph_count && cluster(cursor) < end) cursor++;
+
+  // A cluster over the boundary of the word, such as a ligature, can't be
+  // split. Shape the word on its own instead.
+  if ((first < glyph_count && cluster(first) != start) ||
+      (cursor < glyph_count && cluster(cursor) != end)) {
+    return ShapeTextWithFallback(context, text + word_start, word_length,
+                                 ysize, faces);
+  }
+
+  // Slice the word with clusters relative to the word.
+  auto begin_glyph = rtl ? glyph_count - cursor : first;
+  auto end_glyph = rtl ? glyph_count - first : cursor;
+  auto &word = paragraph.word;
+  word.glyph_info.assign(info.begin() + begin_glyph, info.begin() + end_glyph);
+  for (auto it = word.glyph_info.begin(); it != word.glyph_info.end(); ++it) {
+    it->cluster -= start;
+  }
+  auto &pos = paragraph.run.glyph_pos;
+  word.glyph_pos.assign(pos.begin() + begin_glyph, pos.begin() + end_glyph);
+  word.width = paragraph.advances[end_glyph] - paragraph.advances[begin_glyph];
+  *faces = nullptr;
+  if (!paragraph.faces.empty()) {
+    paragraph.word_faces.assign(paragraph.faces.begin() + begin_glyph,
+                                paragraph.faces.begin() + end_glyph);
+    *faces = &paragraph.word_faces;
+  }
+  return &word;
+}
+
+void FontManager::ShapeParagraph(LayoutContext *context, const char *text,
+                                 const size_t start, const size_t end,
+                                 const int32_t ysize) {
+  auto &paragraph = *context->paragraph_run;
+  const std::vector<const FaceData *> *faces;
+  auto run =
+      ShapeTextWithFallback(context, text + start, end - start, ysize, &faces);
+
+  // Copy the run, since words shaped on their own overwrite it.
+  paragraph.start = start;
+  paragraph.end = end;
+  paragraph.run = *run;
+  paragraph.faces.clear();
+  if (faces != nullptr) paragraph.faces = *faces;
+  paragraph.cursor = 0;
+
+  auto glyph_count = run->glyph_pos.size();
+  paragraph.advances.resize(glyph_count + 1);
+  paragraph.advances[0] = 0;
+  for (size_t i = 0; i < glyph_count; ++i) {
+    paragraph.advances[i + 1] =
+        paragraph.advances[i] + run->glyph_pos[i].x_advance;
+  }
+}
+
+// Decode a UTF-8 character at the index and advance the index.
+static uint32_t DecodeUtf8(const char *text, const size_t length,
+                           size_t *index) {
+  auto p = reinterpret_cast<const uint8_t *>(text);
+  auto i = *index;
+  uint32_t c = p[i++];
+  auto trailing = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0;
+  if (trailing) c &= 0x3f >> trailing;
+  for (; trailing && i < length && (p[i] & 0xc0) == 0x80; --trailing) {
+    c = (c << 6) | (p[i++] & 0x3f);
+  }
+  *index = i;
+  return c;
+}
+
+const ShapedRun *FontManager::ShapeTextWithFallback(
+    LayoutContext *context, const char *text, const size_t length,
+    const int32_t ysize, const std::vector<const FaceData *> **faces) {
+  *faces = nullptr;
+  if (fallback_faces_.empty() || context->mutex != nullptr) {
+    return ShapeText(context, text, length, ysize);
+  }
+
+  // Pick a face of a character from the coverages. Characters no face has
+  // glyphs for are laid out with the primary face.
+  auto primary_face = context->face_data;
+  auto next_face = [this, text, length, primary_face](size_t *index) {
+    auto code_point = DecodeUtf8(text, length, index);
+    if (primary_face->coverage_.Contains(code_point)) {
+      return primary_face;
+    }
+    for (auto it = fallback_faces_.begin(); it != fallback_faces_.end();
+         ++it) {
+      if ((*it)->coverage_.Contains(code_point)) {
+        return static_cast<const FaceData *>(*it);
+      }
+    }
+    return primary_face;
+  };
+
+  // Most texts are covered by the primary face.
+  size_t index = 0;
+  while (index < length && next_face(&index) == primary_face) {
+  }
+  if (index == length) {
+    return ShapeText(context, text, length, ysize);
+  }
+
+  // Shape each run of a face and merge them into one run. Glyphs of a RTL
+  // run are in the visual order, so later runs are prepended.
+  auto &run = *fallback_run_;
+  run.glyph_info.clear();
+  run.glyph_pos.clear();
+  run.width = 0;
+  fallback_run_faces_.clear();
+  auto rtl = layout_direction_ == TextLayoutDirectionRTL;
+  size_t start = 0;
+  while (start < length) {
+    size_t end = start;
+    auto face = next_face(&end);
+    while (end < length) {
+      auto next = end;
+      if (next_face(&next) != face) break;
+      end = next;
+    }
+
+    SetContextFace(context, face, ysize);
+    auto shaped = ShapeText(context, text + start, end - start, ysize);
+    auto offset = rtl ? 0 : run.glyph_info.size();
+    auto info = run.glyph_info.insert(run.glyph_info.begin() + offset,
+                                      shaped->glyph_info.begin(),
+                                      shaped->glyph_info.end());
+    for (size_t i = 0; i < shaped->glyph_info.size(); ++i) {
+      // Clusters are byte offsets in the shaped text.
+      info[i].cluster += static_cast<uint32_t>(start);
+    }
+    run.glyph_pos.insert(run.glyph_pos.begin() + offset,
+                         shaped->glyph_pos.begin(), shaped->glyph_pos.end());
+    fallback_run_faces_.insert(fallback_run_faces_.begin() + offset,
+                               shaped->glyph_info.size(), face);
+    run.width += shaped->width;
+    start = end;
+  }
+  SetContextFace(context, primary_face, ysize);
+  *faces = &fallback_run_faces_;
+  return &run;
+}
+
+void FontManager::SetContextFace(LayoutContext *context, const FaceData *face,
+                                 const int32_t ysize) {
+  assert(context->mutex == nullptr);
+  context->face_data = face;
+  context->face = face->face_;
+  context->harfbuzz_font = face->harfbuzz_font_;
+  FT_Set_Pixel_Sizes(face->face_, 0, ysize);
+}
+
+bool FontManager::UpdateMetrics(const int32_t top, const int32_t height,
                                 const FontMetrics &current_metrics,
                                 FontMetrics *new_metrics) {
   // Calculate internal/external leading value and expand a buffer if
   // necessary.
-  if (g->bitmap_top > current_metrics.ascender() ||
-      static_cast<int32_t>(g->bitmap_top - g->bitmap.rows) <
-          current_metrics.descender()) {
+  if (top > current_metrics.ascender() ||
+      top - height < current_metrics.descender()) {
     *new_metrics = current_metrics;
-    new_metrics->set_internal_leading(
-        std::max(current_metrics.internal_leading(),
-                 g->bitmap_top - current_metrics.ascender()));
+    new_metrics->set_internal_leading(std::max(
+        current_metrics.internal_leading(), top - current_metrics.ascender()));
     new_metrics->set_external_leading(
         std::min(current_metrics.external_leading(),
-                 static_cast<int32_t>(g->bitmap_top - g->bitmap.rows -
-                                      current_metrics.descender())));
+                 top - height - current_metrics.descender()));
     new_metrics->set_base_line(new_metrics->internal_leading() +
                                new_metrics->ascender());
 
@@ -860,85 +2075,152 @@ bool FontManager::UpdateMetrics(const FT_GlyphSlot g,
   return false;
 }
 
+// Convert ISO 15924 script code to a HarfBuzz script tag.
+static uint32_t ConvertScript(const char *script) {
+  uint32_t s = *reinterpret_cast<const uint32_t *>(script);
+  return s >> 24 | (s & 0xff0000) >> 8 | (s & 0xff00) << 8 | s << 24;
+}
+
 void FontManager::SetLocale(const char *locale) {
-  if (locale_ == locale) {
+  auto info = GetLocaleInfo(locale);
+  if (info != nullptr) {
+    SetLocale(*info);
+  }
+}
+
+void FontManager::SetLocale(const LocaleInfo &locale) {
+  if (locale_ == &locale) {
     return;
   }
-  // Retrieve the language in the locale string.
-  std::string language = locale;
-  language = language.substr(0, language.find("-"));
   // Set the linebreak language.
-  if (IsLanguageSupported(language.c_str())) {
-    language_ = language;
-  } else {
-    language_ = kDefaultLanguage;
-  }
+  language_ = locale.language;
 
   // Set the script and the layout direction.
-  auto layout_info = FindLocale(locale);
-  if (layout_info == nullptr) {
-    // Lookup with the language.
-    layout_info = FindLocale(language.c_str());
+  if (locale.script_info != nullptr) {
+    SetLayoutDirection(locale.script_info->direction);
+    script_ = locale.script;
   }
-  if (layout_info != nullptr) {
-    SetLayoutDirection(layout_info->direction);
-    SetScript(layout_info->script);
+  locale_ = &locale;
+}
+
+const LocaleInfo *FontManager::GetLocaleInfo(const char *locale) {
+  if (locale == nullptr) {
+    return nullptr;
+  }
+  // Locales longer than packed tags only share a tag with locales of the same
+  // language, which resolve to the same settings.
+  auto length = strlen(locale);
+  auto tag = PackLocaleTag(locale, length);
+  auto it = locales_.find(tag);
+  if (it != locales_.end()) {
+    return &it->second;
   }
-  locale_ = locale;
+
+  // Retrieve the language in the locale string.
+  auto language_tag = PackLocaleTag(locale, strcspn(locale, "-"));
+  LocaleInfo info;
+  info.language = FindLanguage(language_tag);
+  if (info.language == nullptr) {
+    info.language = kDefaultLanguage;
+  }
+
+  // Look up the script and the layout direction.
+  info.script_info = length <= sizeof(tag) ? FindLocale(tag) : nullptr;
+  if (info.script_info == nullptr) {
+    // Lookup with the language.
+    info.script_info = FindLocale(language_tag);
+  }
+  info.script = info.script_info != nullptr
+                    ? ConvertScript(info.script_info->script)
+                    : static_cast<uint32_t>(kDefaultScript);
+  return &locales_.insert(std::make_pair(tag, info)).first->second;
 }
 
 void FontManager::SetScript(const char *script) {
-  uint32_t s = *reinterpret_cast<const uint32_t *>(script);
-  script_ = static_cast<hb_script_t>(s >> 24 | (s & 0xff0000) >> 8 |
-                                     (s & 0xff00) << 8 | s << 24);
+  script_ = ConvertScript(script);
 }
 
-void FontManager::SetLanguageSettings() {
-  assert(harfbuzz_buf_);
+void FontManager::SetLanguageSettings(LayoutContext *context) {
+  auto harfbuzz_buf = context->harfbuzz_buf;
+  assert(harfbuzz_buf);
   // Set harfbuzz settings.
   if (layout_direction_ == TextLayoutDirectionRTL) {
-    hb_buffer_set_direction(harfbuzz_buf_, HB_DIRECTION_RTL);
+    hb_buffer_set_direction(harfbuzz_buf, HB_DIRECTION_RTL);
   } else {
-    hb_buffer_set_direction(harfbuzz_buf_, HB_DIRECTION_LTR);
+    hb_buffer_set_direction(harfbuzz_buf, HB_DIRECTION_LTR);
   }
-  hb_buffer_set_script(harfbuzz_buf_, static_cast<hb_script_t>(script_));
+  hb_buffer_set_script(harfbuzz_buf, static_cast<hb_script_t>(script_));
 }
 
-const GlyphCacheEntry *FontManager::GetCachedEntry(const uint32_t code_point,
-                                                   const int32_t ysize) {
-  GlyphKey key(current_face_->font_id_, code_point, ysize);
+bool FontManager::GetCachedEntry(LayoutContext *context,
+                                 const uint32_t code_point,
+                                 const int32_t ysize, GlyphCacheEntry *entry) {
+  GlyphKey key(context->face_data->font_id_, code_point, ysize);
+  if (!key.is_valid()) {
+    // The glyph can't be cached. Lay it out without a quad instead of flushing
+    // the cache for a retry.
+    LogInfo("Glyph %u at size %d doesn't fit a glyph key.\n", code_point,
+            ysize);
+    *entry = GlyphCacheEntry();
+    return true;
+  }
+  auto lock = LockContext(*context);
   auto cache = glyph_cache_->Find(key);
+  if (lock.owns_lock()) {
+    lock.unlock();
+  }
 
   if (cache == nullptr) {
     // Load glyph using harfbuzz layout information.
     // Note that harfbuzz takes care of ligatures.
-    FT_Error err =
-        FT_Load_Glyph(current_face_->face_, code_point, FT_LOAD_RENDER);
+    FT_Error err = FT_Load_Glyph(context->face, code_point, FT_LOAD_RENDER);
     if (err) {
       // Error. This could happen typically the loaded font does not support
       // particular glyph.
       LogInfo("Can't load glyph %c FT_Error:%d\n", code_point, err);
-      return nullptr;
+      return false;
     }
 
     // Store the glyph to cache.
-    FT_GlyphSlot g = current_face_->face_->glyph;
-    GlyphCacheEntry entry;
-    entry.set_code_point(code_point);
-    entry.set_size(vec2i(g->bitmap.width, g->bitmap.rows));
-    entry.set_offset(vec2i(g->bitmap_left, g->bitmap_top));
+    FT_GlyphSlot g = context->face->glyph;
+    GlyphCacheEntry new_entry;
+    new_entry.set_code_point(code_point);
+    new_entry.set_size(vec2i(g->bitmap.width, g->bitmap.rows));
+    new_entry.set_offset(vec2i(g->bitmap_left, g->bitmap_top));
+    const uint8_t *image = g->bitmap.buffer;
+
+    if (sdf_) {
+      // Convert the glyph image to a distance field with paddings.
+      auto &sdf_image = *context->sdf_image;
+      context->sdf_generator->Generate(g->bitmap.buffer, g->bitmap.width,
+                                       g->bitmap.rows, g->bitmap.pitch,
+                                       kGlyphSDFPadding, &sdf_image);
+      new_entry.set_size(new_entry.get_size() +
+                         vec2i(kGlyphSDFPadding * 2, kGlyphSDFPadding * 2));
+      new_entry.set_offset(new_entry.get_offset() +
+                           vec2i(-kGlyphSDFPadding, kGlyphSDFPadding));
+      image = sdf_image.data();
+    }
 
-    GlyphKey new_key(current_face_->font_id_, entry.get_code_point(), ysize);
-    cache = glyph_cache_->Set(g->bitmap.buffer, new_key, entry);
+    GlyphKey new_key(context->face_data->font_id_, new_entry.get_code_point(),
+                     ysize);
+    lock = LockContext(*context);
+    // Another layout worker may have stored the glyph in the meantime.
+    cache = glyph_cache_->Find(new_key);
+    if (cache == nullptr) {
+      cache = glyph_cache_->Set(image, new_key, new_entry);
+      stats_.num_glyph_rasterizations++;
+    }
 
     if (cache == nullptr) {
       // Glyph cache need to be flushed.
-      // Returning nullptr here for a retry.
+      // Returning false here for a retry.
       LogInfo("Glyph cache is full. Need to flush and re-create.\n");
-      return nullptr;
+      return false;
     }
   }
-  return cache;
+  *entry = *cache;
+  return true;
 }
 
 int32_t FontManager::ConvertSize(const int32_t original_ysize) {
@@ -958,21 +2240,82 @@ void FontBuffer::AddVertices(const vec2 &pos, const int32_t base_line,
 
   auto x = rounded_pos.x() + scaled_offset.x();
   auto y = rounded_pos.y() + scaled_base_line - scaled_offset.y();
-  vertices_.push_back(FontVertex(x, y, 0.0f, 0.0f, 0.0f));
+  vertices_.push_back(FontVertex(x, y, 0.0f, 0.0f));
 
-  vertices_.push_back(FontVertex(x, y + scaled_size.y(), 0.0f, 0.0f, 0.0f));
+  vertices_.push_back(FontVertex(x, y + scaled_size.y(), 0.0f, 0.0f));
 
-  vertices_.push_back(FontVertex(x + scaled_size.x(), y, 0.0f, 0.0f, 0.0f));
+  vertices_.push_back(FontVertex(x + scaled_size.x(), y, 0.0f, 0.0f));
 
   vertices_.push_back(
-      FontVertex(x + scaled_size.x(), y + scaled_size.y(), 0.0f, 0.0f, 0.0f));
+      FontVertex(x + scaled_size.x(), y + scaled_size.y(), 0.0f, 0.0f));
 }
 
 void FontBuffer::UpdateUV(const int32_t index, const vec4 &uv) {
-  vertices_[index * 4].uv_ = uv.xy();
-  vertices_[index * 4 + 1].uv_ = mathfu::vec2(uv.x(), uv.w());
-  vertices_[index * 4 + 2].uv_ = mathfu::vec2(uv.z(), uv.y());
-  vertices_[index * 4 + 3].uv_ = uv.zw();
+  uv_version_++;
+  vertices_[index * 4].set_uv(uv.xy());
+  vertices_[index * 4 + 1].set_uv(mathfu::vec2(uv.x(), uv.w()));
+  vertices_[index * 4 + 2].set_uv(mathfu::vec2(uv.z(), uv.y()));
+  vertices_[index * 4 + 3].set_uv(uv.zw());
+}
+
+FontVertexBuffer *FontBuffer::GetVertexBuffer() const {
+  if (!vertex_buffer_) {
+    vertex_buffer_.reset(new FontVertexBuffer());
+  }
+  vertex_buffer_->Update(vertices_.data(), vertices_.size(), uv_version_);
+  return vertex_buffer_.get();
+}
+
+const std::vector<uint16_t> &FontBuffer::GetQuadIndices() {
+  static const std::vector<uint16_t> quad_indices = []() {
+    const uint16_t kIndices[] = {0, 1, 2, 1, 3, 2};
+    std::vector<uint16_t> indices;
+    indices.reserve(kMaxGlyphsPerDraw * FPL_ARRAYSIZE(kIndices));
+    for (int32_t i = 0; i < kMaxGlyphsPerDraw; ++i) {
+      for (size_t j = 0; j < FPL_ARRAYSIZE(kIndices); ++j) {
+        indices.push_back(
+            static_cast<uint16_t>(kIndices[j] + i * kVerticesPerCodePoint));
+      }
+    }
+    return indices;
+  }();
+  return quad_indices;
+}
+
+void FontBuffer::Append(const FontBuffer &buffer, const vec2 &offset,
+                        const bool last_caret) {
+  auto base = static_cast<int32_t>(code_points_.size());
+  for (auto it = buffer.vertices_.begin(); it != buffer.vertices_.end();
+       ++it) {
+    FontVertex vertex = *it;
+    vertex.position_ = it->position() + offset;
+    vertices_.push_back(vertex);
+  }
+  code_points_.insert(code_points_.end(), buffer.code_points_.begin(),
+                      buffer.code_points_.end());
+  glyph_pages_.insert(glyph_pages_.end(), buffer.glyph_pages_.begin(),
+                      buffer.glyph_pages_.end());
+  if (!face_runs_.empty() || !buffer.face_runs_.empty()) {
+    // Glyphs before the first run of the appended buffer use the face of the
+    // buffer.
+    if (buffer.face_runs_.empty() || buffer.face_runs_[0].first != 0) {
+      face_runs_.push_back(std::make_pair(base, nullptr));
+    }
+    for (auto it = buffer.face_runs_.begin(); it != buffer.face_runs_.end();
+         ++it) {
+      face_runs_.push_back(std::make_pair(base + it->first, it->second));
+    }
+  }
+
+  auto num_carets = buffer.caret_positions_.size();
+  if (!last_caret && num_carets) {
+    num_carets--;
+  }
+  auto caret_offset = vec2i(offset);
+  for (size_t i = 0; i < num_carets; ++i) {
+    auto caret = buffer.caret_positions_[i] + caret_offset;
+    AddCaretPosition(caret.x(), caret.y());
+  }
 }
 
 void FontBuffer::AddCaretPosition(const vec2 &pos) {
@@ -982,13 +2325,29 @@ void FontBuffer::AddCaretPosition(const vec2 &pos) {
 
 void FontBuffer::AddCaretPosition(int32_t x, int32_t y) {
   assert(caret_positions_.capacity());
+  if (caret_positions_.empty() || caret_positions_.back().y() != y) {
+    line_starts_.push_back(static_cast<int32_t>(caret_positions_.size()));
+  }
   caret_positions_.push_back(mathfu::vec2i(x, y));
 }
 
+int32_t FontBuffer::GetCaretLine(size_t index) const {
+  auto it = std::upper_bound(line_starts_.begin(), line_starts_.end(),
+                             static_cast<int32_t>(index));
+  if (it == line_starts_.begin()) return 0;
+  return static_cast<int32_t>(std::distance(line_starts_.begin(), it)) - 1;
+}
+
 void FaceData::Close() {
-  hb_font_destroy(harfbuzz_font_);
-  FT_Done_Face(face_);
-  font_data_.clear();
+  if (harfbuzz_font_ != nullptr) {
+    hb_font_destroy(harfbuzz_font_);
+    harfbuzz_font_ = nullptr;
+  }
+  if (face_ != nullptr) {
+    FT_Done_Face(face_);
+    face_ = nullptr;
+  }
+  font_data_.reset();
 }
 
 }  // namespace flatui
@@ -0,0 +1,131 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "flatui/internal/font_vertex_buffer.h"
+#include "flatui/font_manager.h"
+#include "fplbase/glplatform.h"
+
+using fplbase::Mesh;
+
+namespace flatui {
+
+QuadIndexBuffer::QuadIndexBuffer() : index_buffer_(0) {}
+
+QuadIndexBuffer::~QuadIndexBuffer() {
+  if (index_buffer_) {
+    GL_CALL(glDeleteBuffers(1, &index_buffer_));
+  }
+}
+
+void QuadIndexBuffer::Bind() {
+  if (!index_buffer_) {
+    auto &indices = FontBuffer::GetQuadIndices();
+    GL_CALL(glGenBuffers(1, &index_buffer_));
+    GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_));
+    GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                         indices.size() * sizeof(uint16_t), indices.data(),
+                         GL_STATIC_DRAW));
+    return;
+  }
+  GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_));
+}
+
+FontVertexBuffer::FontVertexBuffer()
+    : vertex_buffer_(0), num_vertices_(0), uv_version_(0) {}
+
+FontVertexBuffer::~FontVertexBuffer() {
+  if (vertex_buffer_) {
+    GL_CALL(glDeleteBuffers(1, &vertex_buffer_));
+  }
+}
+
+size_t FontVertexBuffer::Update(const FontVertex *vertices,
+                                size_t num_vertices, uint32_t uv_version) {
+  if (vertex_buffer_ && num_vertices == num_vertices_ &&
+      uv_version == uv_version_) {
+    return 0;
+  }
+  auto size = num_vertices * sizeof(FontVertex);
+  auto reuse_storage = vertex_buffer_ && num_vertices == num_vertices_;
+  if (!vertex_buffer_) {
+    GL_CALL(glGenBuffers(1, &vertex_buffer_));
+  }
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_));
+  if (reuse_storage) {
+    // Only UVs are changed. Keep the storage.
+    GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, 0, size, vertices));
+  } else {
+    GL_CALL(glBufferData(GL_ARRAY_BUFFER, size, vertices, GL_STATIC_DRAW));
+  }
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  num_vertices_ = num_vertices;
+  uv_version_ = uv_version;
+  return size;
+}
+
+void FontVertexBuffer::Bind(QuadIndexBuffer *index_buffer) const {
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_));
+  index_buffer->Bind();
+  GL_CALL(glEnableVertexAttribArray(Mesh::kAttributePosition));
+  GL_CALL(glEnableVertexAttribArray(Mesh::kAttributeTexCoord));
+}
+
+void FontVertexBuffer::Unbind() {
+  GL_CALL(glDisableVertexAttribArray(Mesh::kAttributePosition));
+  GL_CALL(glDisableVertexAttribArray(Mesh::kAttributeTexCoord));
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+}
+
+void FontVertexBuffer::SetAttributes(size_t first_vertex) {
+  auto offset = first_vertex * sizeof(FontVertex);
+  GL_CALL(glVertexAttribPointer(
+      Mesh::kAttributePosition, 2, GL_FLOAT, GL_FALSE, sizeof(FontVertex),
+      reinterpret_cast<const void *>(offset + offsetof(FontVertex,
+                                                       position_))));
+  // UVs are unorm16, normalized to [0, 1] by the GPU.
+  GL_CALL(glVertexAttribPointer(
+      Mesh::kAttributeTexCoord, 2, GL_UNSIGNED_SHORT, GL_TRUE,
+      sizeof(FontVertex),
+      reinterpret_cast<const void *>(offset + offsetof(FontVertex, uv_))));
+}
+
+int32_t FontVertexBuffer::Render(int32_t first_glyph,
+                                 int32_t num_glyphs) const {
+  int32_t num_draw_calls = 0;
+  while (num_glyphs > 0) {
+    // Point the attributes to the chunk of the first glyph, so that the
+    // glyphs are addressed with the shared indices.
+    auto chunk = first_glyph / FontBuffer::kMaxGlyphsPerDraw;
+    auto chunk_start = chunk * FontBuffer::kMaxGlyphsPerDraw;
+    auto count = std::min(num_glyphs, chunk_start +
+                                          FontBuffer::kMaxGlyphsPerDraw -
+                                          first_glyph);
+    SetAttributes(static_cast<size_t>(chunk_start) *
+                  FontBuffer::kVerticesPerCodePoint);
+    auto first_index = static_cast<size_t>(first_glyph - chunk_start) *
+                       FontBuffer::kIndiciesPerCodePoint;
+    GL_CALL(glDrawElements(
+        GL_TRIANGLES, count * FontBuffer::kIndiciesPerCodePoint,
+        GL_UNSIGNED_SHORT,
+        reinterpret_cast<const void *>(first_index * sizeof(uint16_t))));
+    num_draw_calls++;
+    first_glyph += count;
+    num_glyphs -= count;
+  }
+  return num_draw_calls;
+}
+
+}  // namespace flatui
@@ -0,0 +1,230 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+
+// Freetype2 header
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "flatui/internal/glyph_rasterizer.h"
+#include "fplbase/utilities.h"
+
+using fplbase::LogInfo;
+using fplbase::LogError;
+using mathfu::vec2i;
+
+namespace flatui {
+
+bool GlyphRasterizer::Start(const int32_t num_threads) {
+  if (IsRunning() || num_threads <= 0) {
+    return false;
+  }
+  terminate_ = false;
+  for (int32_t i = 0; i < num_threads; ++i) {
+    std::unique_ptr<Worker> worker(new Worker());
+    FT_Error err = FT_Init_FreeType(&worker->library);
+    if (err) {
+      LogError("Can't initialize freetype for a worker. FT_Error:%d\n", err);
+      break;
+    }
+    worker->thread = std::thread(&GlyphRasterizer::WorkerMain, this,
+                                 worker.get());
+    workers_.push_back(std::move(worker));
+  }
+  return IsRunning();
+}
+
+void GlyphRasterizer::Stop() {
+  if (!IsRunning()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    terminate_ = true;
+    requests_.clear();
+  }
+  request_cv_.notify_all();
+
+  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+    auto &worker = *it;
+    worker->thread.join();
+    for (auto face = worker->faces.begin(); face != worker->faces.end();
+         ++face) {
+      FT_Done_Face(face->second);
+    }
+    FT_Done_FreeType(worker->library);
+  }
+  workers_.clear();
+  results_.clear();
+  pending_keys_.clear();
+  in_flight_ = 0;
+}
+
+bool GlyphRasterizer::Request(const GlyphRasterizeRequest &request) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!pending_keys_.insert(request.key).second) {
+      // The glyph has already been requested.
+      return false;
+    }
+    requests_.push_back(request);
+  }
+  request_cv_.notify_one();
+  return true;
+}
+
+void GlyphRasterizer::Retrieve(std::vector<GlyphRasterizeResult> *results) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = results_.begin(); it != results_.end(); ++it) {
+    pending_keys_.erase(it->key);
+    results->push_back(std::move(*it));
+  }
+  results_.clear();
+}
+
+void GlyphRasterizer::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  finish_cv_.wait(lock, [this] { return requests_.empty() && !in_flight_; });
+}
+
+void GlyphRasterizer::ReleaseFace(const HashedId font_id) {
+  // Workers are idle once all requests are finished, so that it's safe to
+  // release their faces here.
+  std::unique_lock<std::mutex> lock(mutex_);
+  finish_cv_.wait(lock, [this] { return requests_.empty() && !in_flight_; });
+  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+    auto &faces = (*it)->faces;
+    for (auto face = faces.begin(); face != faces.end();) {
+      if (face->first == font_id) {
+        FT_Done_Face(face->second);
+        face = faces.erase(face);
+      } else {
+        ++face;
+      }
+    }
+  }
+
+  // Discard results of the font since the font is not available anymore.
+  for (auto it = results_.begin(); it != results_.end();) {
+    if (it->key.get_font_id() == font_id) {
+      pending_keys_.erase(it->key);
+      it = results_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool GlyphRasterizer::IsPending(const GlyphKey &key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pending_keys_.find(key) != pending_keys_.end();
+}
+
+size_t GlyphRasterizer::get_num_pending() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return requests_.size() + in_flight_;
+}
+
+void GlyphRasterizer::WorkerMain(Worker *worker) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    request_cv_.wait(lock, [this] { return terminate_ || !requests_.empty(); });
+    if (terminate_) {
+      break;
+    }
+    auto request = requests_.front();
+    requests_.pop_front();
+    in_flight_++;
+
+    // Rasterize the glyph without holding the lock.
+    lock.unlock();
+    GlyphRasterizeResult result;
+    Rasterize(worker, request, &result);
+    lock.lock();
+
+    results_.push_back(std::move(result));
+    in_flight_--;
+    finish_cv_.notify_all();
+  }
+}
+
+FT_Face GlyphRasterizer::GetFace(Worker *worker,
+                                 const GlyphRasterizeRequest &request) {
+  auto font_id = request.key.get_font_id();
+  for (auto it = worker->faces.begin(); it != worker->faces.end(); ++it) {
+    if (it->first == font_id) {
+      return it->second;
+    }
+  }
+
+  // Create a clone of the face for the worker from the shared font data.
+  FT_Face face;
+  FT_Error err = FT_New_Memory_Face(
+      worker->library, reinterpret_cast<const FT_Byte *>(request.font_data),
+      static_cast<FT_Long>(request.font_data_size), 0, &face);
+  if (err) {
+    LogError("Can't load a font face in a worker. FT_Error:%d\n", err);
+    return nullptr;
+  }
+  worker->faces.push_back(std::make_pair(font_id, face));
+  return face;
+}
+
+void GlyphRasterizer::Rasterize(Worker *worker,
+                                const GlyphRasterizeRequest &request,
+                                GlyphRasterizeResult *result) {
+  result->key = request.key;
+  result->succeeded = false;
+
+  auto face = GetFace(worker, request);
+  if (face == nullptr) {
+    return;
+  }
+
+  auto code_point = request.key.get_code_point();
+  FT_Set_Pixel_Sizes(face, 0, request.key.get_glyph_size());
+  FT_Error err = FT_Load_Glyph(face, code_point, FT_LOAD_RENDER);
+  if (err) {
+    LogInfo("Can't load glyph %c FT_Error:%d\n", code_point, err);
+    return;
+  }
+
+  FT_GlyphSlot g = face->glyph;
+  result->entry.set_code_point(code_point);
+  result->entry.set_size(vec2i(g->bitmap.width, g->bitmap.rows));
+  result->entry.set_offset(vec2i(g->bitmap_left, g->bitmap_top));
+
+  auto padding = request.sdf_padding;
+  if (padding > 0) {
+    // Convert the glyph image to a distance field with paddings.
+    worker->sdf_generator.Generate(g->bitmap.buffer, g->bitmap.width,
+                                   g->bitmap.rows, g->bitmap.pitch, padding,
+                                   &result->image);
+    result->entry.set_size(result->entry.get_size() +
+                           vec2i(padding * 2, padding * 2));
+    result->entry.set_offset(result->entry.get_offset() +
+                             vec2i(-padding, padding));
+  } else {
+    // Copy the glyph image. Each row of the bitmap may be padded.
+    result->image.resize(g->bitmap.width * g->bitmap.rows);
+    for (uint32_t y = 0; y < g->bitmap.rows; ++y) {
+      memcpy(&result->image[y * g->bitmap.width],
+             &g->bitmap.buffer[y * g->bitmap.pitch], g->bitmap.width);
+    }
+  }
+  result->succeeded = true;
+}
+
+}  // namespace flatui
@@ -0,0 +1,231 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "flatui/internal/image_atlas.h"
+#include "fplbase/glplatform.h"
+#include "fplbase/utilities.h"
+
+using fplbase::LogError;
+using fplbase::Mesh;
+using fplbase::Texture;
+using mathfu::vec2;
+using mathfu::vec2i;
+using mathfu::vec3;
+using mathfu::vec4;
+
+namespace flatui {
+
+// Size of the atlas texture when images are packed.
+static const int32_t kImageAtlasSize = 1024;
+
+// Size of the white block at the origin of the atlas. Bilinear sampling at
+// its center only reads white texels.
+static const int32_t kImageAtlasWhiteSize = 4;
+
+// Padding around each image, filled with the edges of the image so that
+// bilinear filtering at the edges doesn't read neighbor images.
+static const int32_t kImageAtlasPadding = 1;
+
+// UV rect of an image that can't be packed.
+static const vec4 kImageNotPacked(-1.0f, -1.0f, -1.0f, -1.0f);
+
+// Min # of frames between clearing a full atlas, so that a working set of
+// images larger than the atlas isn't copied again every frame.
+static const int32_t kImageAtlasMinClearInterval = 60;
+
+ImageAtlas::ImageAtlas()
+    : size_(mathfu::kZeros2i),
+      framebuffer_(0),
+      full_(false),
+      frames_since_clear_(0),
+      white_uv_(mathfu::kZeros2f),
+      packing_(false) {}
+
+ImageAtlas::~ImageAtlas() { Reset(); }
+
+void ImageAtlas::SetPacking(bool enable) {
+  if (enable == packing_) return;
+  Reset();
+  packing_ = enable;
+}
+
+void ImageAtlas::Reset() {
+  if (framebuffer_) {
+    GL_CALL(glDeleteFramebuffers(1, &framebuffer_));
+    framebuffer_ = 0;
+  }
+  texture_.reset();
+  size_ = mathfu::kZeros2i;
+  Clear();
+}
+
+void ImageAtlas::Clear() {
+  shelves_.clear();
+  images_.clear();
+  full_ = false;
+  frames_since_clear_ = 0;
+}
+
+void ImageAtlas::Update() {
+  frames_since_clear_++;
+  if (full_ && frames_since_clear_ >= kImageAtlasMinClearInterval) {
+    // Images are copied again on their next use. The atlas texture keeps the
+    // white block.
+    Clear();
+  }
+}
+
+void ImageAtlas::Invalidate(const Texture &texture) {
+  images_.erase(GetKey(texture));
+}
+
+uint64_t ImageAtlas::GetKey(const Texture &texture) {
+  // A texture id may be reused after the texture is released, so the size is
+  // part of the key too.
+  auto size = texture.size();
+  return (static_cast<uint64_t>(texture.id()) << 32) |
+         (static_cast<uint64_t>(size.x() & 0xffff) << 16) |
+         static_cast<uint64_t>(size.y() & 0xffff);
+}
+
+const Texture *ImageAtlas::GetTexture() {
+  if (texture_) return texture_.get();
+
+  // Without packing, the texture only holds the white block.
+  auto size = packing_ ? kImageAtlasSize : kImageAtlasWhiteSize;
+  size_ = vec2i(size, size);
+  std::vector<uint8_t> image(size * size * 4, 0);
+  for (int32_t y = 0; y < kImageAtlasWhiteSize; ++y) {
+    memset(&image[y * size * 4], 0xff, kImageAtlasWhiteSize * 4);
+  }
+  texture_.reset(new Texture());
+  texture_->LoadFromMemory(image.data(), size_, fplbase::kFormat8888, false);
+  white_uv_ = vec2(kImageAtlasWhiteSize * 0.5f) / vec2(size_);
+  return texture_.get();
+}
+
+bool ImageAtlas::Find(fplbase::Renderer &renderer, fplbase::Shader *shader,
+                      const Texture &texture, vec4 *uv) {
+  if (!packing_) return false;
+  auto key = GetKey(texture);
+  auto it = images_.find(key);
+  if (it != images_.end()) {
+    if (it->second.x() < 0.0f) return false;
+    *uv = it->second;
+    return true;
+  }
+
+  // Images that can't be packed are recorded too, so that they're not tried
+  // again every frame.
+  auto entry = kImageNotPacked;
+  auto size = texture.size();
+  vec2i pos;
+  if (size.x() <= kMaxImageSize && size.y() <= kMaxImageSize &&
+      GetTexture() != nullptr) {
+    if (!Allocate(size + vec2i(kImageAtlasPadding * 2), &pos)) {
+      full_ = true;
+    } else {
+      pos += vec2i(kImageAtlasPadding);
+      if (Copy(renderer, shader, texture, pos, size)) {
+        auto atlas_size = vec4(vec2(size_), vec2(size_));
+        entry = vec4(vec2(pos), vec2(pos + size)) / atlas_size;
+      }
+    }
+  }
+  images_[key] = entry;
+  if (entry.x() < 0.0f) return false;
+  *uv = entry;
+  return true;
+}
+
+bool ImageAtlas::Allocate(const vec2i &size, vec2i *pos) {
+  // Use the lowest shelf that has a room for the image.
+  Shelf *best = nullptr;
+  for (auto it = shelves_.begin(); it != shelves_.end(); ++it) {
+    if (size.y() <= it->height && it->x + size.x() <= size_.x() &&
+        (best == nullptr || it->height < best->height)) {
+      best = &*it;
+    }
+  }
+  if (best == nullptr) {
+    // Open a new shelf on top of the last one.
+    auto y = shelves_.empty() ? kImageAtlasWhiteSize
+                              : shelves_.back().y + shelves_.back().height;
+    if (y + size.y() > size_.y() || size.x() > size_.x()) return false;
+    Shelf shelf = {y, size.y(), 0};
+    shelves_.push_back(shelf);
+    best = &shelves_.back();
+  }
+  *pos = vec2i(best->x, best->y);
+  best->x += size.x();
+  return true;
+}
+
+bool ImageAtlas::Copy(fplbase::Renderer &renderer, fplbase::Shader *shader,
+                      const Texture &texture, const vec2i &pos,
+                      const vec2i &size) {
+  GLint previous_framebuffer = 0;
+  GLint viewport[4];
+  GL_CALL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous_framebuffer));
+  GL_CALL(glGetIntegerv(GL_VIEWPORT, viewport));
+  auto scissor = glIsEnabled(GL_SCISSOR_TEST);
+
+  auto attach = !framebuffer_;
+  if (attach) {
+    GL_CALL(glGenFramebuffers(1, &framebuffer_));
+  }
+  GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_));
+  if (attach) {
+    GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                   GL_TEXTURE_2D, texture_->id(), 0));
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      LogError("Can't render to the image atlas. Packing is disabled.\n");
+      GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer));
+      packing_ = false;
+      return false;
+    }
+  }
+
+  // Atlas pixels are addressed from the bottom-left corner, and image UVs
+  // map linearly to the rect so that (0, 0) lands on pos.
+  GL_CALL(glViewport(0, 0, size_.x(), size_.y()));
+  if (scissor) GL_CALL(glDisable(GL_SCISSOR_TEST));
+  auto mvp = renderer.model_view_projection();
+  renderer.set_model_view_projection(mathfu::OrthoHelper<float>(
+      0.0f, static_cast<float>(size_.x()), 0.0f,
+      static_cast<float>(size_.y()), -1.0f, 1.0f));
+  renderer.set_color(mathfu::kOnes4f);
+  renderer.SetBlendMode(fplbase::kBlendModeOff);
+  shader->Set(renderer);
+  texture.Set(0);
+
+  // Stretch the image over the padding first, then render it in place.
+  auto p0 = vec2(pos);
+  auto p1 = vec2(pos + size);
+  auto padding = vec2(static_cast<float>(kImageAtlasPadding));
+  Mesh::RenderAAQuadAlongX(vec3(p0 - padding, 0.0f), vec3(p1 + padding, 0.0f),
+                           mathfu::kZeros2f, mathfu::kOnes2f);
+  Mesh::RenderAAQuadAlongX(vec3(p0, 0.0f), vec3(p1, 0.0f), mathfu::kZeros2f,
+                           mathfu::kOnes2f);
+
+  renderer.SetBlendMode(fplbase::kBlendModeAlpha);
+  renderer.set_model_view_projection(mvp);
+  GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer));
+  GL_CALL(glViewport(viewport[0], viewport[1], viewport[2], viewport[3]));
+  if (scissor) GL_CALL(glEnable(GL_SCISSOR_TEST));
+  return true;
+}
+
+}  // namespace flatui
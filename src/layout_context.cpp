@@ -0,0 +1,123 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+
+// Freetype2 header
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+// Harfbuzz header
+#include <hb.h>
+#include <hb-ft.h>
+
+#include "font_manager.h"
+#include "flatui/internal/layout_context.h"
+#include "fplbase/utilities.h"
+
+using fplbase::LogError;
+
+namespace flatui {
+
+LayoutWorker::LayoutWorker()
+    : library_(nullptr),
+      harfbuzz_buf_(nullptr),
+      shaping_cache_(kShapingCacheSize) {}
+
+LayoutWorker::~LayoutWorker() {
+  for (auto it = faces_.begin(); it != faces_.end(); ++it) {
+    hb_font_destroy(it->harfbuzz_font);
+    FT_Done_Face(it->face);
+  }
+  if (harfbuzz_buf_ != nullptr) {
+    hb_buffer_destroy(harfbuzz_buf_);
+  }
+  if (library_ != nullptr) {
+    FT_Done_FreeType(library_);
+  }
+}
+
+bool LayoutWorker::Initialize() {
+  if (library_ != nullptr) {
+    return true;
+  }
+  FT_Error err = FT_Init_FreeType(&library_);
+  if (err) {
+    LogError("Can't initialize freetype for a layout worker. FT_Error:%d\n",
+             err);
+    library_ = nullptr;
+    return false;
+  }
+  harfbuzz_buf_ = hb_buffer_create();
+  return true;
+}
+
+bool LayoutWorker::GetContext(const HashedId font_id,
+                              const FontData &font_data, std::mutex *mutex,
+                              LayoutContext *context) {
+  const WorkerFace *face = nullptr;
+  for (auto it = faces_.begin(); it != faces_.end(); ++it) {
+    if (it->font_id == font_id) {
+      face = &*it;
+      break;
+    }
+  }
+  if (face == nullptr) {
+    // Create a clone of the face for the worker from the shared font data.
+    WorkerFace new_face;
+    new_face.font_id = font_id;
+    FT_Error err =
+        FT_New_Memory_Face(library_, font_data.data(),
+                           static_cast<FT_Long>(font_data.size()), 0,
+                           &new_face.face);
+    if (err) {
+      LogError("Can't load a font face in a layout worker. FT_Error:%d\n",
+               err);
+      return false;
+    }
+    new_face.harfbuzz_font = hb_ft_font_create(new_face.face, NULL);
+    if (!new_face.harfbuzz_font) {
+      LogError("Can't create a harfbuzz font in a layout worker.\n");
+      FT_Done_Face(new_face.face);
+      return false;
+    }
+    faces_.push_back(new_face);
+    face = &faces_.back();
+  }
+
+  context->face = face->face;
+  context->harfbuzz_font = face->harfbuzz_font;
+  context->harfbuzz_buf = harfbuzz_buf_;
+  context->wordbreak_info = &wordbreak_info_;
+  context->sdf_generator = &sdf_generator_;
+  context->sdf_image = &sdf_image_;
+  context->shaping_cache = &shaping_cache_;
+  context->paragraph_run = &paragraph_run_;
+  context->mutex = mutex;
+  return true;
+}
+
+void LayoutWorker::ReleaseFace(const HashedId font_id) {
+  for (auto it = faces_.begin(); it != faces_.end();) {
+    if (it->font_id == font_id) {
+      hb_font_destroy(it->harfbuzz_font);
+      FT_Done_Face(it->face);
+      it = faces_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+}  // namespace flatui
@@ -39,7 +39,10 @@ void MicroEdit::Initialize(std::string *text, EditorMode mode) {
 }
 
 void MicroEdit::UpdateWordBreakInfo() {
+  character_offsets_.clear();
   if (!text_->length()) {
+    wordbreak_info_.clear();
+    character_offsets_.push_back(0);
     num_characters_ = 0;
     wordbreak_index_ = 0;
     return;
@@ -49,38 +52,93 @@ void MicroEdit::UpdateWordBreakInfo() {
   set_linebreaks_utf8(reinterpret_cast<const utf8_t *>(text_->c_str()),
                       text_->length(), language_.c_str(), &wordbreak_info_[0]);
 
-  // Count number of characters.
-  auto num_characters = 1;
-  for (size_t i = 1; i < wordbreak_info_.size(); ++i) {
-    if (wordbreak_info_[i - 1] != LINEBREAK_INSIDEACHAR) {
-      num_characters++;
+  // Build character offsets.
+  character_offsets_.push_back(0);
+  for (size_t i = 0; i < wordbreak_info_.size(); ++i) {
+    if (wordbreak_info_[i] != LINEBREAK_INSIDEACHAR) {
+      character_offsets_.push_back(static_cast<int32_t>(i + 1));
     }
   }
-  num_characters_ = num_characters;
+  if (character_offsets_.back() != static_cast<int32_t>(text_->length())) {
+    character_offsets_.push_back(static_cast<int32_t>(text_->length()));
+  }
+  num_characters_ = static_cast<int32_t>(character_offsets_.size()) - 1;
 
   UpdateWordBreakIndex();
 }
 
-void MicroEdit::UpdateWordBreakIndex() {
-  // TODO: Update for a better look up rather than a linear search.
-  // Check for the last caret position.
-  if (caret_pos_ == num_characters_) {
-    wordbreak_index_ = static_cast<int32_t>(wordbreak_info_.size());
+void MicroEdit::UpdateWordBreakInfo(size_t start, size_t removed,
+                                    size_t inserted) {
+  if (!text_->length()) {
+    wordbreak_info_.clear();
+    character_offsets_.assign(1, 0);
+    num_characters_ = 0;
+    wordbreak_index_ = 0;
     return;
   }
 
-  wordbreak_index_ = 0;
-  auto current_pos = 1;
-  for (size_t i = 1; i < wordbreak_info_.size(); ++i) {
-    if (wordbreak_info_[i - 1] != LINEBREAK_INSIDEACHAR) {
-      if (caret_pos_ == current_pos) {
-        // Update an index of wordbreak info for the current caret position.
-        wordbreak_index_ = static_cast<int32_t>(i);
-        break;
-      }
-      current_pos++;
-    }
+  // Find the paragraph including the edit. A paragraph ends after a line
+  // feed, where a line always breaks.
+  auto &text = *text_;
+  size_t begin = 0;
+  if (start) {
+    auto line_feed = text.rfind('\n', start - 1);
+    if (line_feed != std::string::npos) begin = line_feed + 1;
+  }
+  auto end = text.find('\n', start + inserted);
+  end = end == std::string::npos ? text.length() : end + 1;
+  auto old_end = end + removed - inserted;
+
+  // Retrieve word breaking information of the paragraph and replace the old
+  // one.
+  linebreak_scratch_.resize(end - begin);
+  if (end > begin) {
+    set_linebreaks_utf8(reinterpret_cast<const utf8_t *>(text.c_str() + begin),
+                        end - begin, language_.c_str(),
+                        &linebreak_scratch_[0]);
+  }
+  wordbreak_info_.erase(wordbreak_info_.begin() + begin,
+                        wordbreak_info_.begin() + old_end);
+  wordbreak_info_.insert(wordbreak_info_.begin() + begin,
+                         linebreak_scratch_.begin(), linebreak_scratch_.end());
+
+  // Replace character offsets in the paragraph and shift following ones.
+  // The paragraph begins with a character, and the last offset is the text
+  // length.
+  auto last = character_offsets_.end() - 1;
+  auto first_removed = std::lower_bound(character_offsets_.begin(), last,
+                                        static_cast<int32_t>(begin));
+  auto last_removed =
+      std::lower_bound(first_removed, last, static_cast<int32_t>(old_end));
+  auto shift = static_cast<int32_t>(inserted) - static_cast<int32_t>(removed);
+  for (auto it = last_removed; it != character_offsets_.end(); ++it) {
+    *it += shift;
+  }
+  auto is_character = [this, begin](size_t i) {
+    return i == begin ||
+           linebreak_scratch_[i - begin - 1] != LINEBREAK_INSIDEACHAR;
+  };
+  size_t num_inserted = 0;
+  for (size_t i = begin; i < end; ++i) {
+    if (is_character(i)) num_inserted++;
+  }
+  auto index = character_offsets_.erase(first_removed, last_removed);
+  index = character_offsets_.insert(index, num_inserted, 0);
+  for (size_t i = begin; i < end; ++i) {
+    if (is_character(i)) *index++ = static_cast<int32_t>(i);
+  }
+  num_characters_ = static_cast<int32_t>(character_offsets_.size()) - 1;
+
+  UpdateWordBreakIndex();
+}
+
+void MicroEdit::UpdateWordBreakIndex() {
+  if (caret_pos_ < 0 ||
+      caret_pos_ >= static_cast<int32_t>(character_offsets_.size())) {
+    wordbreak_index_ = 0;
+    return;
   }
+  wordbreak_index_ = character_offsets_[caret_pos_];
 }
 
 bool MicroEdit::MoveCaretVertical(int32_t offset) {
@@ -102,10 +160,10 @@ bool MicroEdit::MoveCaretVertical(int32_t offset) {
 
 bool MicroEdit::MoveCaretInLine(CaretPosition position) {
   // Pick current row.
-  auto start_of_line = buffer_->GetCaretPositions().begin();
+  auto start_of_line = buffer_->GetCaretPositions().end();
   auto end_of_line = buffer_->GetCaretPositions().end();
-  auto pos = buffer_->GetCaretPositions()[GetCaretPosition()];
-  PickRow(pos, &start_of_line, &end_of_line);
+  GetRow(buffer_->GetCaretLine(GetCaretPosition()), &start_of_line,
+         &end_of_line);
 
   ptrdiff_t index = 0;
   if (position == kTailOfLine) {
@@ -173,43 +231,41 @@ bool MicroEdit::SetCaret(int32_t position) {
   return true;
 }
 
-void MicroEdit::InsertText(const std::string &text) {
-  text_->insert(wordbreak_index_, text);
-  caret_pos_ += GetNumCharacters(text);
+void MicroEdit::InsertText(const char *text, size_t length) {
+  auto start = static_cast<size_t>(wordbreak_index_);
+  auto num_characters = num_characters_;
+  text_->insert(start, text, length);
+  UpdateWordBreakInfo(start, 0, length);
+  caret_pos_ += num_characters_ - num_characters;
   expected_caret_x_position_ = kCaretPosInvalid;
-  UpdateWordBreakInfo();
+  UpdateWordBreakIndex();
 }
 
 void MicroEdit::RemoveText(int32_t num_remove) {
-  for (auto i = 0; i < num_remove; ++i) {
-    // Remove 1 character from the buffer.
-    auto num_to_erase = 1;
-    auto erase_index = wordbreak_index_;
-    while (erase_index < static_cast<int32_t>(text_->size()) &&
+  // Find the bytes of characters to remove and erase them at once.
+  auto start = static_cast<size_t>(wordbreak_index_);
+  auto erase_index = start;
+  for (auto i = 0; i < num_remove && erase_index < text_->size(); ++i) {
+    while (erase_index < text_->size() &&
            wordbreak_info_[erase_index++] == LINEBREAK_INSIDEACHAR) {
-      num_to_erase++;
-    };
-    text_->erase(wordbreak_index_, num_to_erase);
-    wordbreak_info_.erase(
-        wordbreak_info_.begin() + wordbreak_index_,
-        wordbreak_info_.begin() + wordbreak_index_ + num_to_erase);
+    }
   }
-  UpdateWordBreakInfo();
+  if (erase_index == start) return;
+  text_->erase(start, erase_index - start);
+  UpdateWordBreakInfo(start, erase_index - start, 0);
 }
 
-int32_t MicroEdit::GetNumCharacters(const std::string &text) {
+int32_t MicroEdit::GetNumCharacters(const char *text, size_t length) {
   // Retrieve # of characters in the text.
-  if (!text.length()) {
+  if (!length) {
     return 0;
   }
 
-  std::vector<char> v(text.length());
-  set_linebreaks_utf8(reinterpret_cast<const utf8_t *>(text.c_str()),
-                      text.length(), language_.c_str(), &v[0]);
+  // Count bytes other than UTF8 continuation bytes, which are the bytes
+  // libunibreak marks as LINEBREAK_INSIDEACHAR.
   auto characters = 0;
-  for (auto it = v.begin(); it != v.end(); ++it) {
-    auto i = *it;
-    if (i != LINEBREAK_INSIDEACHAR) {
+  for (size_t i = 0; i < length; ++i) {
+    if ((static_cast<uint8_t>(text[i]) & 0xc0) != 0x80) {
       characters++;
     }
   }
@@ -230,8 +286,8 @@ void MicroEdit::UpdateEditingText(const std::string &input) {
     return;
   }
   in_text_input_ = true;
-  input_text_ = std::move(input);
-  input_text_characters_ = GetNumCharacters(input);
+  input_text_ = input;
+  input_text_characters_ = GetNumCharacters(input.c_str(), input.length());
   editing_text_ = *text_;
   editing_text_.insert(wordbreak_index_, input_text_.c_str());
 }
@@ -318,42 +374,57 @@ int32_t MicroEdit::Pick(const vec2i &pointer_position, float offset) {
   }
 
   // Pick a row first.
-  auto start_it = buffer_->GetCaretPositions().begin();
-  auto end_it = buffer_->GetCaretPositions().end();
-  auto buffer_begin = start_it;
-  auto buffer_end = end_it;
-  PickRow(pointer_position, &start_it, &end_it);
+  auto row = PickRow(pointer_position);
+  auto num_rows = static_cast<int32_t>(buffer_->GetLineStarts().size());
 
   // Pick previous/next row based on the offset value.
   if (offset < 0) {
-    if (start_it == buffer_begin) {
+    if (row == 0) {
       return kCaretPosInvalid;
     }
-    end_it = start_it - 1;
-    start_it = buffer_begin;
-    PickRow(*end_it, &start_it, &end_it);
+    row--;
   } else if (offset > 0) {
-    if (end_it == buffer_end - 1) {
+    if (row >= num_rows - 1) {
       return kCaretPosInvalid;
     }
-    start_it = end_it + 1;
-    end_it = buffer_end - 1;
-    PickRow(*start_it, &start_it, &end_it);
+    row++;
+  } else if (row == num_rows) {
+    // The pointer is below the text.
+    return static_cast<int32_t>(buffer_->GetCaretPositions().size()) - 1;
   }
 
   // And pick a column.
+  auto start_it = buffer_->GetCaretPositions().end();
+  auto end_it = buffer_->GetCaretPositions().end();
+  GetRow(row, &start_it, &end_it);
   return PickColumn(pointer_position, start_it, end_it);
 }
 
-void MicroEdit::PickRow(const vec2i &pointer_position,
-                        std::vector<vec2i>::const_iterator *start_it,
-                        std::vector<vec2i>::const_iterator *end_it) {
-  // Perform a binary search in the caret position buffer.
-  auto compare = [](const vec2i &lhs,
-                    const vec2i &rhs) { return lhs.y() < rhs.y(); };
-  *start_it = std::lower_bound(*start_it, *end_it, pointer_position, compare);
-  if (*start_it < *end_it)
-    *end_it = std::upper_bound(*start_it, *end_it, **start_it, compare) - 1;
+int32_t MicroEdit::PickRow(const vec2i &pointer_position) {
+  // Perform a binary search in the first caret positions of rows.
+  auto &carets = buffer_->GetCaretPositions();
+  auto &line_starts = buffer_->GetLineStarts();
+  auto compare = [&carets](const int32_t line_start, const int32_t y) {
+    return carets[line_start].y() < y;
+  };
+  auto it = std::lower_bound(line_starts.begin(), line_starts.end(),
+                             pointer_position.y(), compare);
+  return static_cast<int32_t>(std::distance(line_starts.begin(), it));
+}
+
+void MicroEdit::GetRow(int32_t row,
+                       std::vector<vec2i>::const_iterator *start_it,
+                       std::vector<vec2i>::const_iterator *end_it) {
+  auto &carets = buffer_->GetCaretPositions();
+  auto &line_starts = buffer_->GetLineStarts();
+  if (row < 0 || row >= static_cast<int32_t>(line_starts.size())) {
+    *start_it = *end_it = carets.end();
+    return;
+  }
+  *start_it = carets.begin() + line_starts[row];
+  *end_it = row + 1 < static_cast<int32_t>(line_starts.size())
+                ? carets.begin() + line_starts[row + 1] - 1
+                : carets.end() - 1;
 }
 
 int32_t MicroEdit::PickColumn(const vec2i &pointer_position,
@@ -390,7 +461,7 @@ bool MicroEdit::HandleInputEvents(
           case fplbase::FPLK_RETURN:
           case fplbase::FPLK_RETURN2:
             if (!single_line_ && (event->key.modifier & FPL_KMOD_SHIFT)) {
-              InsertText("\n");
+              InsertText("\n", 1);
             } else {
               // Finish the input session if IME is not active.
               if (!in_text_input_) ret = true;
@@ -479,7 +550,7 @@ bool MicroEdit::HandleInputEvents(
         input_text_selection_length_ = event->edit.length;
         break;
       case fplbase::kTextInputEventTypeText:
-        InsertText(event->text);
+        InsertText(event->text.c_str(), event->text.length());
         ResetEditingText();
         break;
     }
@@ -0,0 +1,129 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "flatui/internal/quad_batch.h"
+#include "flatui/font_manager.h"
+#include "fplbase/fpl_common.h"
+
+using fplbase::Mesh;
+using mathfu::vec2;
+using mathfu::vec3;
+using mathfu::vec4;
+
+namespace flatui {
+
+// Vertex format of QuadBatch::QuadBatchVertex.
+static const fplbase::Attribute kQuadBatchFormat[] = {
+    fplbase::kPosition3f, fplbase::kTexCoord2f, fplbase::kColor4ub,
+    fplbase::kEND};
+
+// Max # of quads in a draw call addressable with the shared quad indices.
+static const size_t kQuadBatchMaxQuads = FontBuffer::kMaxGlyphsPerDraw;
+
+void QuadBatch::Prepare(fplbase::Renderer &renderer, fplbase::Shader *shader,
+                        const fplbase::Texture *texture, const vec4 &color) {
+  if (shader != shader_ || texture != texture_) {
+    Flush(renderer);
+    shader_ = shader;
+    texture_ = texture;
+  }
+  for (int32_t i = 0; i < 4; ++i) {
+    color_[i] = static_cast<uint8_t>(
+        mathfu::Clamp(color[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+  }
+}
+
+void QuadBatch::AddQuad(const vec2 &p0, const vec2 &p1, const vec2 &uv0,
+                        const vec2 &uv1) {
+  // Same vertex order as glyphs in FontBuffer.
+  const vec2 positions[] = {p0, vec2(p0.x(), p1.y()), vec2(p1.x(), p0.y()),
+                            p1};
+  const vec2 uvs[] = {uv0, vec2(uv0.x(), uv1.y()), vec2(uv1.x(), uv0.y()),
+                      uv1};
+  QuadBatchVertex v;
+  memcpy(v.color_, color_, sizeof(color_));
+  for (size_t i = 0; i < FPL_ARRAYSIZE(positions); ++i) {
+    v.position_ = vec3(positions[i], 0.0f);
+    v.uv_ = uvs[i];
+    vertices_.push_back(v);
+  }
+}
+
+void QuadBatch::Add(fplbase::Renderer &renderer, fplbase::Shader *shader,
+                    const fplbase::Texture *texture, const vec4 &rect,
+                    const vec4 &uv, const vec4 &color) {
+  Prepare(renderer, shader, texture, color);
+  AddQuad(rect.xy(), rect.zw(), uv.xy(), uv.zw());
+}
+
+void QuadBatch::AddNinePatch(fplbase::Renderer &renderer,
+                             fplbase::Shader *shader,
+                             const fplbase::Texture *texture, const vec4 &rect,
+                             const vec4 &uv, const mathfu::vec2i &image_size,
+                             const vec4 &patch_info, const vec4 &color) {
+  Prepare(renderer, shader, texture, color);
+
+  auto min = vec2::Min(rect.xy(), rect.zw());
+  auto max = vec2::Max(rect.xy(), rect.zw());
+  auto p0 = vec2(image_size) * patch_info.xy() + min;
+  auto p1 = max - vec2(image_size) * (mathfu::kOnes2f - patch_info.zw());
+
+  // Keep the patch edges from overlapping when the rect is smaller than the
+  // borders.
+  if (p0.x() > p1.x()) {
+    p0.x() = p1.x() = (min.x() + max.x()) / 2;
+  }
+  if (p0.y() > p1.y()) {
+    p0.y() = p1.y() = (min.y() + max.y()) / 2;
+  }
+
+  // Grid of the patches on the screen and in the image UV, mapped into the
+  // rect of the image in the texture.
+  const float xs[] = {min.x(), p0.x(), p1.x(), max.x()};
+  const float ys[] = {min.y(), p0.y(), p1.y(), max.y()};
+  const float us[] = {0.0f, patch_info.x(), patch_info.z(), 1.0f};
+  const float vs[] = {0.0f, patch_info.y(), patch_info.w(), 1.0f};
+  auto uv_size = uv.zw() - uv.xy();
+  for (int32_t y = 0; y < 3; ++y) {
+    for (int32_t x = 0; x < 3; ++x) {
+      AddQuad(vec2(xs[x], ys[y]), vec2(xs[x + 1], ys[y + 1]),
+              uv.xy() + vec2(us[x], vs[y]) * uv_size,
+              uv.xy() + vec2(us[x + 1], vs[y + 1]) * uv_size);
+    }
+  }
+}
+
+void QuadBatch::Flush(fplbase::Renderer &renderer) {
+  if (IsEmpty()) return;
+
+  shader_->Set(renderer);
+  texture_->Set(0);
+  auto &indices = FontBuffer::GetQuadIndices();
+  auto num_quads = vertices_.size() / FontBuffer::kVerticesPerCodePoint;
+  for (size_t start = 0; start < num_quads; start += kQuadBatchMaxQuads) {
+    auto count = std::min(num_quads - start, kQuadBatchMaxQuads);
+    Mesh::RenderArray(
+        Mesh::kTriangles,
+        static_cast<int>(count * FontBuffer::kIndiciesPerCodePoint),
+        kQuadBatchFormat, sizeof(QuadBatchVertex),
+        reinterpret_cast<const char *>(
+            &vertices_[start * FontBuffer::kVerticesPerCodePoint]),
+        indices.data());
+    num_draw_calls_++;
+  }
+  vertices_.clear();
+}
+
+}  // namespace flatui
@@ -0,0 +1,100 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "flatui/internal/render_layer.h"
+#include "fplbase/glplatform.h"
+#include "fplbase/utilities.h"
+
+using fplbase::LogError;
+using fplbase::Texture;
+using mathfu::vec2i;
+
+namespace flatui {
+
+RenderLayer::RenderLayer()
+    : size_(mathfu::kZeros2i),
+      framebuffer_(0),
+      previous_framebuffer_(0),
+      scissor_(false) {
+  for (int32_t i = 0; i < 4; ++i) viewport_[i] = 0;
+}
+
+RenderLayer::~RenderLayer() {
+  if (framebuffer_) {
+    GL_CALL(glDeleteFramebuffers(1, &framebuffer_));
+  }
+}
+
+bool RenderLayer::Begin(fplbase::Renderer &renderer, const vec2i &size) {
+  GLint previous_framebuffer = 0;
+  GL_CALL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous_framebuffer));
+  previous_framebuffer_ = previous_framebuffer;
+  GL_CALL(glGetIntegerv(GL_VIEWPORT, viewport_));
+  scissor_ = glIsEnabled(GL_SCISSOR_TEST) != GL_FALSE;
+
+  if (!framebuffer_) {
+    GL_CALL(glGenFramebuffers(1, &framebuffer_));
+  }
+  GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_));
+  if (!texture_ || size != size_) {
+    // Contents are cleared below, the initial image doesn't matter.
+    std::vector<uint8_t> image(size.x() * size.y() * 4, 0);
+    texture_.reset(new Texture());
+    texture_->LoadFromMemory(image.data(), size, fplbase::kFormat8888, false);
+    size_ = size;
+    GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                   GL_TEXTURE_2D, texture_->id(), 0));
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      LogError("Can't render to a layer texture of %dx%d.\n", size.x(),
+               size.y());
+      GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer_));
+      texture_.reset();
+      size_ = mathfu::kZeros2i;
+      return false;
+    }
+  }
+
+  GL_CALL(glViewport(0, 0, size.x(), size.y()));
+  if (scissor_) GL_CALL(glDisable(GL_SCISSOR_TEST));
+  GL_CALL(glClearColor(0.0f, 0.0f, 0.0f, 0.0f));
+  GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
+  SetLayerBlendMode(renderer);
+  return true;
+}
+
+void RenderLayer::End(fplbase::Renderer &renderer) {
+  renderer.SetBlendMode(fplbase::kBlendModeAlpha);
+  GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer_));
+  GL_CALL(glViewport(viewport_[0], viewport_[1], viewport_[2], viewport_[3]));
+  if (scissor_) GL_CALL(glEnable(GL_SCISSOR_TEST));
+}
+
+void RenderLayer::SetLayerBlendMode(fplbase::Renderer &renderer) {
+  // Let the renderer know the blend state is changed, so that a following
+  // SetBlendMode() call isn't skipped.
+  renderer.SetBlendMode(fplbase::kBlendModeOff);
+  GL_CALL(glEnable(GL_BLEND));
+  // Colors are accumulated premultiplied, and alpha as coverage.
+  GL_CALL(glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE,
+                              GL_ONE_MINUS_SRC_ALPHA));
+}
+
+void RenderLayer::SetCompositeBlendMode(fplbase::Renderer &renderer) {
+  renderer.SetBlendMode(fplbase::kBlendModeOff);
+  GL_CALL(glEnable(GL_BLEND));
+  GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+}
+
+}  // namespace flatui
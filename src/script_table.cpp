@@ -12,7 +12,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#include <cstdlib>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <memory>
 #include "font_manager.h"
 #include "fplbase/fpl_common.h"
 
@@ -624,33 +627,80 @@ const ScriptInfo FontManager::script_table_[] = {
 const char *FontManager::language_table_[] = {"de", "en", "es", "fr",
                                               "ja", "ko", "ru", "zh"};
 
-bool FontManager::IsLanguageSupported(const char *language) {
-  if (language == nullptr) {
-    return false;
+uint64_t FontManager::PackLocaleTag(const char *locale, size_t length) {
+  // Pack characters from the highest byte, so that shorter strings are
+  // ordered first as strcmp() does.
+  uint64_t tag = 0;
+  for (size_t i = 0; i < sizeof(tag); ++i) {
+    auto c = i < length ? static_cast<uint8_t>(locale[i]) : 0;
+    tag = (tag << 8) | c;
   }
-  // Perform binary search.
-  auto p = bsearch(language, language_table_, FPL_ARRAYSIZE(language_table_),
-                   sizeof(const char *),
-                   [](const void * key, const void * elem)->int {
-    return strcmp(reinterpret_cast<const char *>(key),
-                  *static_cast<const char *const *>(elem));
-  });
-
-  return p != nullptr;
+  return tag;
 }
 
-const ScriptInfo *FontManager::FindLocale(const char *locale) {
-  if (locale == nullptr) {
+namespace {
+
+// Open addressing hash table of script_table_ entries keyed by packed tags.
+// The size is a power of 2 that keeps the table at most half full.
+class LocaleIndex {
+ public:
+  static const size_t kSize = 2048;
+
+  explicit LocaleIndex(const ScriptInfo *table) : table_(table) {
+    std::fill(indices_, indices_ + kSize, kEmpty);
+  }
+
+  void Insert(uint64_t tag, size_t index) {
+    auto slot = Hash(tag);
+    while (indices_[slot] != kEmpty) slot = (slot + 1) & (kSize - 1);
+    tags_[slot] = tag;
+    indices_[slot] = static_cast<uint16_t>(index);
+  }
+
+  const ScriptInfo *Find(uint64_t tag) const {
+    for (auto slot = Hash(tag); indices_[slot] != kEmpty;
+         slot = (slot + 1) & (kSize - 1)) {
+      if (tags_[slot] == tag) return &table_[indices_[slot]];
+    }
     return nullptr;
   }
 
-  // Perform binary search.
-  return reinterpret_cast<const ScriptInfo *>(
-      bsearch(locale, script_table_, FPL_ARRAYSIZE(script_table_),
-              sizeof(ScriptInfo), [](const void * key, const void * elem)->int {
-        auto info = reinterpret_cast<const ScriptInfo *>(elem);
-        return strcmp(reinterpret_cast<const char *>(key), info->locale);
-      }));
+ private:
+  static const uint16_t kEmpty = 0xffff;
+
+  static size_t Hash(uint64_t tag) {
+    // Fibonacci hashing.
+    return static_cast<size_t>((tag * 0x9e3779b97f4a7c15ULL) >> 53);
+  }
+
+  const ScriptInfo *table_;
+  uint64_t tags_[kSize];
+  uint16_t indices_[kSize];
+};
+
+}  // namespace
+
+const ScriptInfo *FontManager::FindLocale(uint64_t tag) {
+  // The index is built once on the first look up.
+  static const std::unique_ptr<LocaleIndex> index([]() {
+    auto count = FPL_ARRAYSIZE(script_table_);
+    assert(count * 2 <= LocaleIndex::kSize);
+    auto index = new LocaleIndex(script_table_);
+    for (size_t i = 0; i < count; ++i) {
+      auto locale = script_table_[i].locale;
+      index->Insert(PackLocaleTag(locale, strlen(locale)), i);
+    }
+    return index;
+  }());
+  return index->Find(tag);
+}
+
+const char *FontManager::FindLanguage(uint64_t tag) {
+  for (size_t i = 0; i < FPL_ARRAYSIZE(language_table_); ++i) {
+    auto language = language_table_[i];
+    if (PackLocaleTag(language, strlen(language)) == tag) return language;
+  }
+  return nullptr;
 }
 
 }  // namespace flatui
\ No newline at end of file
@@ -0,0 +1,99 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "flatui/internal/shaping_cache.h"
+
+namespace flatui {
+
+size_t ShapingCache::Hash(const ShapedRunKey &key, const char *text,
+                          size_t length) {
+  // FNV-1a over the key and the text.
+  uint32_t hash = 0x811c9dc5;
+  const uint32_t values[] = {key.font_id, static_cast<uint32_t>(key.glyph_size),
+                             key.script, key.rtl};
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    hash = (hash ^ values[i]) * 0x01000193;
+  }
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ static_cast<uint8_t>(text[i])) * 0x01000193;
+  }
+  return hash;
+}
+
+const ShapedRun *ShapingCache::Find(const ShapedRunKey &key, const char *text,
+                                    size_t length) {
+  auto hash = Hash(key, text, length);
+  auto range = map_.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    auto entry = it->second;
+    if (entry->key == key && entry->text.length() == length &&
+        !entry->text.compare(0, length, text, length)) {
+      // Move the run to the head of the LRU list.
+      entries_.splice(entries_.begin(), entries_, entry);
+      return &entry->run;
+    }
+  }
+  return nullptr;
+}
+
+const ShapedRun *ShapingCache::Set(const ShapedRunKey &key, const char *text,
+                                   size_t length, hb_buffer_t *buffer) {
+  uint32_t glyph_count;
+  auto glyph_info = hb_buffer_get_glyph_infos(buffer, &glyph_count);
+  auto glyph_pos = hb_buffer_get_glyph_positions(buffer, &glyph_count);
+  auto size = sizeof(Entry) + length +
+              glyph_count * (sizeof(hb_glyph_info_t) +
+                             sizeof(hb_glyph_position_t));
+  Evict(size);
+
+  entries_.push_front(Entry());
+  auto &entry = entries_.front();
+  entry.key = key;
+  entry.text.assign(text, length);
+  entry.hash = Hash(key, text, length);
+  entry.size = size;
+  entry.run.glyph_info.assign(glyph_info, glyph_info + glyph_count);
+  entry.run.glyph_pos.assign(glyph_pos, glyph_pos + glyph_count);
+  entry.run.width = 0;
+  for (uint32_t i = 0; i < glyph_count; ++i) {
+    entry.run.width += glyph_pos[i].x_advance;
+  }
+  map_.insert(std::make_pair(entry.hash, entries_.begin()));
+  size_ += size;
+  return &entry.run;
+}
+
+void ShapingCache::Clear() {
+  map_.clear();
+  entries_.clear();
+  size_ = 0;
+}
+
+void ShapingCache::Evict(size_t size) {
+  while (!entries_.empty() && size_ + size > max_size_) {
+    auto entry = std::prev(entries_.end());
+    auto range = map_.equal_range(entry->hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == entry) {
+        map_.erase(it);
+        break;
+      }
+    }
+    size_ -= entry->size;
+    entries_.erase(entry);
+  }
+}
+
+}  // namespace flatui
@@ -0,0 +1,27 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "flatui/internal/trace.h"
+
+namespace flatui {
+
+TraceBeginFunction ScopedTrace::begin_ = nullptr;
+TraceEndFunction ScopedTrace::end_ = nullptr;
+
+void SetTraceFunctions(TraceBeginFunction begin, TraceEndFunction end) {
+  ScopedTrace::SetFunctions(begin, end);
+}
+
+}  // namespace flatui
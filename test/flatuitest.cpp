@@ -177,5 +177,7 @@ extern "C" int FPL_main(int /*argc*/, char **argv) {
     });
   }
 
+  // Release GL resources of the GUI while the renderer is still alive.
+  flatui::ReleaseGuiContext(flatui::GetCurrentGuiContext());
   return 0;
 }